@@ -0,0 +1,73 @@
+#!/usr/bin/env bash
+# Time the workloads the in-process features were written for, with mash and with bash.
+# Give a second mash binary (an older build) to time it as well.
+# BENCH_SCALE multiplies the loop counts and data sizes (default 1).
+#
+#   bench/run.sh [mash binary] [baseline mash binary]
+
+cd "$(dirname "$0")/.." || exit 1
+MASH=${1:-./mash}
+BASE=$2
+SCALE=${BENCH_SCALE:-1}
+if [ ! -x "$MASH" ]; then
+	echo "$MASH: not built (run make)" >&2
+	exit 1
+fi
+MASH=$(cd "$(dirname "$MASH")" && pwd)/$(basename "$MASH")
+[ -n "$BASE" ] && BASE=$(cd "$(dirname "$BASE")" && pwd)/$(basename "$BASE")
+
+scratch=$(mktemp -d) || exit 1
+trap 'rm -rf "$scratch"' EXIT
+export XDG_CACHE_HOME=$scratch/cache
+cd "$scratch" || exit 1
+
+# Data
+lines=$((1000000 * SCALE))
+awk -v n=$lines 'BEGIN { for (i = 0; i < n; i++) printf "%d field%d some more words on the line\n", i, i % 97 }' > lines.txt
+printf 'one\ntwo words\nthree\n' > small.txt
+mkdir tree
+(cd tree && awk -v n=$((100 * SCALE)) 'BEGIN { for (a = 1; a <= n; a++) for (b = 1; b <= 20; b++) print "d" a "/e" b }' | xargs mkdir -p &&
+	find . -type d -name 'e*' | awk '{ for (c = 1; c <= 10; c++) print $0 "/f" c ".o\n" $0 "/f" c ".c" }' | xargs touch)
+
+# Workloads, name and script
+names=()
+bench() {
+	names+=("$1")
+	printf '%s\n' "$2" > "$scratch/${#names[@]}.sh"
+}
+n=$((200000 * SCALE))
+bench "arithmetic: (( )) while loop, $n" "i=0 s=0; while ((i < $n)); do ((s += i * 2)); i=\$((i + 1)); done; echo \$s"
+bench "for i in {1..$((1000000 * SCALE))}" "for i in {1..$((1000000 * SCALE))}; do ((s += i)); done; echo \$s"
+bench "test: [ ] loop, $((100000 * SCALE))" "i=0; while [ \$i -lt $((100000 * SCALE)) ]; do if [ -n \"\$i\" ]; then i=\$((i + 1)); fi; done; echo \$i"
+bench "test: [[ ]] loop, $((100000 * SCALE))" "i=0; while [[ \$i -lt $((100000 * SCALE)) ]]; do if [[ \$i == *5 ]]; then x=\$i; fi; i=\$((i + 1)); done; echo \$x"
+bench "[[ =~ ]], $((200000 * SCALE))" "i=0; while ((i < $((200000 * SCALE)))); do [[ user\$i@example.com =~ ^[a-z0-9.]+@([a-z]+)\\.com\$ ]]; i=\$((i + 1)); done; echo \${BASH_REMATCH[1]}"
+bench "case over 8 arms, $((300000 * SCALE))" "i=0; for w in {1..$((300000 * SCALE))}; do case x\$w in -h|--help) ;; *.c) ;; *.h) ;; -*) ;; x*5) ((i++));; x1*) ;; x2*) ;; *) ;; esac; done; echo \$i"
+bench "glob: echo **/*.o | wc -w" "cd tree; echo **/*.o | wc -w"
+bench "glob: find -name '*.o' (for reference)" "cd tree; find . -name '*.o' | wc -l"
+bench "arrays: a+=(\$i), sum \"\${a[@]}\", $((100000 * SCALE))" "for i in {1..$((100000 * SCALE))}; do a+=(\$i); done; for x in \"\${a[@]}\"; do ((s += x)); done; echo \${#a[@]} \$s"
+bench "read: while read line, $lines lines" "while read -r line; do x=1; done < lines.txt; echo \$line"
+bench "mapfile -t, $lines lines" "mapfile -t l < lines.txt; echo \${#l[@]}"
+bench "\$(< file) and \$(cat file), $((2000 * SCALE))" "for i in {1..$((2000 * SCALE))}; do x=\$(< small.txt); y=\$(cat small.txt); done; echo \$x"
+
+shells=("$MASH" bash)
+header="mash	bash"
+if [ -n "$BASE" ]; then
+	shells+=("$BASE")
+	header+="	baseline"
+fi
+TIMEFORMAT=%R
+printf '%-48s %s\n' workload "$header"
+for i in "${!names[@]}"; do
+	row=
+	for j in "${!shells[@]}"; do
+		shell=${shells[j]}
+		args=("$scratch/$((i + 1)).sh")
+		[ "$shell" = bash ] && args=(-O globstar "${args[@]}")
+		"$shell" "${args[@]}" > "$scratch/$((i + 1)).$j" 2> /dev/null # Warm up (and fill the script cache)
+		t=$( { time "$shell" "${args[@]}" > /dev/null 2>&1; } 2>&1 )
+		row+="${t}s	"
+	done
+	# The timings only mean something if both shells did the same work
+	cmp -s "$scratch/$((i + 1)).0" "$scratch/$((i + 1)).1" || row+="(output differs from bash)"
+	printf '%-48s %s\n' "${names[i]}" "$row"
+done
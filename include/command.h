@@ -2,21 +2,74 @@
 #define COMMAND_H
 
 #include "command_structures.h"
+#include <sys/types.h>
+
+/*
+ * Arenas
+ */
+
+Arena *arenaInit();
+void *arenaAlloc(Arena*, size_t);
+void *arenaGrow(Arena*, void*, size_t, size_t);
+char *arenaStrndup(Arena*, const char*, size_t);
+ArenaMark arenaMark(Arena*);
+void arenaReset(Arena*, ArenaMark);
+void arenaCleanup(Arena*, void (*)(void*), void*);
+void arenaRetain(Arena*);
+void arenaRelease(Arena*);
+void wordAppend(Arena*, WordList*, char*);
 
 /*
  * Arguments
  */
 
-CmdArg argdup(CmdArg);
-void freeArg(CmdArg);
+CmdArg argdup(Arena*, CmdArg);
+
+/*
+ * Arithmetic
+ */
+
+MathProg *mathCompile(Arena*, char*, size_t, Variables*);
+MathProg *mathDup(Arena*, MathProg*);
+
+/*
+ * Patterns
+ */
+
+Pattern *patternCompile(Arena*, char*, size_t);
+Pattern *patternDup(Arena*, Pattern*);
+char *patternQuote(char*);
+_Bool patternMatch(Pattern*, char*, size_t);
+ssize_t patternPrefix(Pattern*, char*, size_t, _Bool);
+ssize_t patternSuffix(Pattern*, char*, size_t, _Bool);
+
+/*
+ * Regular expressions
+ */
+
+#define REGEX_CACHE_SIZE 64 // Compiled expressions kept for patterns with expansions
+
+regex_t *regexCompile(Arena*, char*);
+regex_t *regexCached(char*, size_t);
+char *regexQuote(char*);
+void regexCacheStats(size_t*, size_t*, size_t*);
+void regexCacheFree();
+
+/*
+ * case dispatch
+ */
+
+#define CASE_NO_ARM ((size_t)-1)
+
+CaseTable *caseCompile(Arena*, Command*);
+size_t caseMatch(CaseTable*, char*, size_t);
 
 /*
  * Commands
  */
 
-Command *commandInit();
-int commandParse(Command*, FILE*restrict, FILE*restrict, AliasMap*, char*);
-void commandFree(Command*);
+Command *commandInit(Arena*);
+int commandParse(Command*, CmdInput*restrict, FILE*restrict, AliasMap*, Variables*, char*);
 
 /*
  * Aliases
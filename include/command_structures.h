@@ -2,6 +2,8 @@
 #define COMMAND_DEFS_H
 
 #include "hashTable.h"
+#include <regex.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /*
@@ -14,13 +16,16 @@ enum _arg_type {
 	ARG_BASIC_STRING,
 	ARG_QUOTED_STRING,
 	ARG_VARIABLE,
+	ARG_PARAMETER,
 	ARG_SUBSHELL,
 	ARG_QUOTED_SUBSHELL,
 	ARG_COMPLEX_STRING,
 	ARG_MATH,
-	ARG_MATH_OPERAND_NUMERIC,
-	ARG_MATH_OPERAND_VARIABLE,
-	ARG_MATH_OPERATOR
+	ARG_MATH_WORD,  // $((...)) with expansions in it, compiled once they are expanded
+	ARG_PARAM_EXP,  // ${...} with an operator
+	ARG_COND,       // [[ ... ]] expression
+	ARG_GLOB,       // Word expanded into the path names it matches
+	ARG_READ_FILE   // $(< file) or $(cat file), read without forking
 };
 
 // Commands
@@ -29,22 +34,310 @@ enum _cmd_type {
 	CMD_REGULAR,
 	CMD_WHILE, CMD_DO, CMD_DONE,
 	CMD_IF, CMD_THEN, CMD_ELSE, CMD_FI,
+	CMD_ARITH,     // ((expr))
+	CMD_FOR_ARITH, // for ((init; cond; step))
+	CMD_FOR_IN,    // for name in words
+	CMD_COND,      // [[ expr ]]
+	CMD_GROUP, CMD_GROUP_END, // { ... }
+	CMD_CASE, CMD_CASE_ARM, CMD_ESAC, // case word in pattern) ... ;; esac
+	CMD_FUNCTION,  // name() { ... }
+};
+
+// Special parameters (resolved by the tokenizer, never looked up by name)
+enum _param_type {
+	PARAM_POSITIONAL, // $0, $1, ...
+	PARAM_RANDOM,     // $RANDOM
+	PARAM_STATUS,     // $?
+	PARAM_PID,        // $$
+	PARAM_COUNT       // $#
+};
+
+// Arithmetic program instructions
+enum _math_op {
+	MOP_PUSH,    // Push constant
+	MOP_LOAD,    // Push variable
+	MOP_RANDOM,  // Push $RANDOM
+	MOP_ELEMENT, // Replace the index on top with that element of an array
+	MOP_STORE,   // Assign top of stack to variable (value stays on the stack)
+	MOP_PREINC, MOP_PREDEC, MOP_POSTINC, MOP_POSTDEC,
+	MOP_NEG, MOP_NOT, MOP_BNOT, MOP_BOOL,
+	MOP_POW, MOP_MUL, MOP_DIV, MOP_MOD, MOP_ADD, MOP_SUB, MOP_SHL, MOP_SHR,
+	MOP_LT, MOP_LE, MOP_GT, MOP_GE, MOP_EQ, MOP_NE,
+	MOP_BAND, MOP_BXOR, MOP_BOR,
+	MOP_LAND,    // Jump if top is 0 (keeping it), otherwise pop
+	MOP_LOR,     // Jump if top is not 0 (replacing it with 1), otherwise pop
+	MOP_JZ,      // Pop, and jump if it was 0
+	MOP_JMP,
+	MOP_POP
+};
+
+// Parameter expansion operators
+enum _pexp_op {
+	PEXP_NONE,                                  // ${name}
+	PEXP_LENGTH,                                // ${#name}
+	PEXP_SUBSTRING,                             // ${name:offset:length}
+	PEXP_DEFAULT, PEXP_ASSIGN, PEXP_ALTERNATE, PEXP_ERROR, // ${name:-word} ${name:=word} ${name:+word} ${name:?word}
+	PEXP_PREFIX_SHORT, PEXP_PREFIX_LONG,        // ${name#pattern} ${name##pattern}
+	PEXP_SUFFIX_SHORT, PEXP_SUFFIX_LONG,        // ${name%pattern} ${name%%pattern}
+	PEXP_REPLACE, PEXP_REPLACE_ALL,             // ${name/pattern/string} ${name//pattern/string}
+	PEXP_REPLACE_PREFIX, PEXP_REPLACE_SUFFIX,   // ${name/#pattern/string} ${name/%pattern/string}
+	PEXP_KEYS                                   // ${!name[@]}
+};
+
+// Conditional expression operators (test, [ and [[)
+enum _test_op {
+	TEST_NONE,      // Not an operator
+	TEST_STRING,    // Lone operand, true if not empty
+	// Unary
+	TEST_NONEMPTY, TEST_EMPTY,
+	TEST_EXISTS, TEST_REGULAR, TEST_DIRECTORY, TEST_BLOCK, TEST_CHARACTER, TEST_FIFO, TEST_SYMLINK, TEST_SOCKET,
+	TEST_SETUID, TEST_SETGID, TEST_STICKY, TEST_SIZE, TEST_READ, TEST_WRITE, TEST_EXECUTE,
+	TEST_TERMINAL, TEST_OWNER, TEST_GROUP, TEST_SET,
+	// Binary
+	TEST_STR_EQ, TEST_STR_NE, TEST_STR_LT, TEST_STR_GT,
+	TEST_INT_EQ, TEST_INT_NE, TEST_INT_LT, TEST_INT_LE, TEST_INT_GT, TEST_INT_GE,
+	TEST_NEWER, TEST_OLDER, TEST_SAME_FILE,
+	TEST_REGEX,     // =~, only in [[ ]]
+	// Logical
+	TEST_NOT, TEST_AND, TEST_OR
+};
+
+// Glob pattern nodes
+enum _pattern_type {
+	PAT_LITERAL, // Run of characters
+	PAT_ANY,     // ?
+	PAT_STAR,    // *
+	PAT_CLASS    // [...]
 };
 
 /*
  * Data structures
  */
 
+// Block of arena memory, blocks are only freed with the whole arena (or by arenaReset)
+typedef struct _arena_block ArenaBlock;
+struct _arena_block {
+	ArenaBlock *prev;
+	size_t used, size;
+	char data[];
+};
+
+// Function called when an arena is freed, for what it points to that isn't in the arena itself
+typedef struct _arena_cleanup ArenaCleanup;
+struct _arena_cleanup {
+	void (*fn)(void*);
+	void *data;
+	ArenaCleanup *next;
+};
+
+// Everything allocated by one parse (a line, a sourced file, an alias), freed all at once
+typedef struct _arena Arena;
+struct _arena {
+	ArenaBlock *block; // Block being allocated from, the others are linked behind it
+	void *last;        // Most recent allocation, which can grow in place
+	size_t refs;       // Functions defined by the parse (and the parse cache) keep it alive
+	ArenaCleanup *cleanups;
+};
+
+// Position in an arena, used like a stack by the words a command expands
+typedef struct _arena_mark ArenaMark;
+struct _arena_mark {
+	ArenaBlock *block, *prev; // Block in use, and what was linked behind it
+	size_t used;
+};
+
+// Indexed array elements
+typedef struct _var_array VarArray;
+struct _var_array {
+	size_t count, size; // Dense: one past the highest element set. Sparse: elements. Allocated
+	char **values;      // Dense: NULL for elements that aren't set
+	size_t *indexes;    // Sparse: index of each value, in order (NULL while the array is dense)
+	size_t set;         // Elements that are set
+	Arena *arena;       // Block storage for small values loaded in bulk (mapfile), NULL if there are none
+	_Bool *shared;      // Which values are in arena rather than allocated on their own (parallel to values)
+};
+
+// Associative array elements
+typedef struct _var_assoc VarAssoc;
+struct _var_assoc {
+	unsigned long long buckets;
+	hashTable *map;     // Keys to values
+	size_t count;
+};
+
+// Shell variable (symbol), its address never changes once interned
+typedef struct _variable Variable;
+struct _variable {
+	char *name;
+	char *value;      // NULL if unset (or if numeric and not yet formatted)
+	VarArray *array;  // Elements if it is an indexed array (value isn't used), NULL otherwise
+	VarAssoc *assoc;  // Elements if it is an associative array, NULL otherwise
+	long long number; // Value, when numeric is set
+	_Bool exported;
+	_Bool integer;    // declare -i, assignments are evaluated arithmetically
+	_Bool numeric;    // number is authoritative, value is formatted on demand
+	_Bool formatted;  // value holds number as a string
+};
+
+// Variable made local by a function, and its state before that
+typedef struct _saved_var SavedVar;
+struct _saved_var {
+	Variable *var;
+	Variable old;
+};
+
+// Function call scope, the variables it made local are restored when it returns
+typedef struct _var_scope VarScope;
+struct _var_scope {
+	size_t count, size;
+	SavedVar *saved;
+};
+
+// Variable storage (symbol table)
+typedef struct _shell_var Variables;
+struct _shell_var {
+	unsigned long long buckets;
+	hashTable *map;
+	size_t depth, scope_count; // Scopes in use, scopes allocated (kept for the next call)
+	VarScope *scopes;
+};
+
+// Arithmetic instruction
+typedef struct _math_instr MathInstr;
+struct _math_instr {
+	enum _math_op op;
+	union {
+		long long value; // MOP_PUSH
+		size_t slot;     // Variable index
+		size_t jump;     // Instruction index
+	};
+};
+
+// Compiled arithmetic expression
+typedef struct _math_prog MathProg;
+struct _math_prog {
+	size_t length, depth; // Instruction count, maximum stack depth
+	MathInstr *code;
+	size_t var_count;
+	char **names;
+	Variable **vars;      // NULL entries are bound on first run
+};
+
+// Glob pattern node
+typedef struct _pattern_node PatternNode;
+struct _pattern_node {
+	enum _pattern_type type;
+	size_t length;              // PAT_LITERAL
+	union {
+		char *literal;          // PAT_LITERAL
+		unsigned char *class;   // PAT_CLASS, 256 bit set
+	};
+};
+
+// Compiled glob pattern
+typedef struct _pattern Pattern;
+struct _pattern {
+	size_t count;
+	PatternNode *nodes;
+	size_t min_length; // Shortest string that can match
+	_Bool fixed;       // No stars, so every match is exactly min_length long
+};
+
+typedef struct _param_exp ParamExp;
+typedef struct _cond_expr CondExpr;
+typedef struct _glob Glob;
+typedef struct _file_read FileRead;
+
 // Arguments
 typedef struct _arg CmdArg;
 struct _arg {
 	enum _arg_type type;
+	_Bool quoted; // Expansion was inside double quotes
 	union {
 		char *str;
 		CmdArg *sub;
+		MathProg *math;
+		ParamExp *pexp;
+		CondExpr *cond;
+		Glob *glob;
+		FileRead *read;
+		// ARG_VARIABLE and ARG_PARAMETER (name overlaps str)
+		struct {
+			char *name;
+			union {
+				Variable *var; // NULL if parsed without a symbol table
+				struct {
+					enum _param_type param;
+					unsigned position;
+				};
+			};
+		};
 	};
 };
 
+// Array subscript, which is arithmetic for indexed arrays and a word for associative ones
+typedef struct _subscript Subscript;
+struct _subscript {
+	char type;            // '[' for one element, '@' or '*' for all of them, 0 without a subscript
+	CmdArg key;           // Subscript as a word (ARG_NULL if empty)
+	MathProg *index;      // Subscript as arithmetic (NULL if it isn't valid arithmetic)
+};
+
+// Parameter expansion
+struct _param_exp {
+	enum _pexp_op op;
+	_Bool colon;          // Null values are treated as unset (${name:-word} vs ${name-word})
+	CmdArg param;         // ARG_VARIABLE or ARG_PARAMETER
+	CmdArg word;          // Word, or pattern (ARG_NULL if empty)
+	CmdArg replacement;   // PEXP_REPLACE*
+	MathProg *offset, *length; // PEXP_SUBSTRING (NULL if omitted)
+	Subscript sub;        // ${name[subscript]}
+	Pattern *pattern;     // Compiled at parse time if the pattern is literal
+};
+
+// [[ ... ]] expression node
+struct _cond_expr {
+	enum _test_op op;
+	CmdArg left, right;   // Operands (right is ARG_NULL for unary operators)
+	CondExpr *a, *b;      // TEST_NOT uses a, TEST_AND and TEST_OR use both
+	Pattern *pattern;     // Right side of == and != if it is literal
+	regex_t *regex;       // Right side of =~ if it is literal
+};
+
+// Path name pattern component (between slashes)
+typedef struct _glob_part GlobPart;
+struct _glob_part {
+	char *name;       // Literal component, looked up without reading the directory (NULL for patterns)
+	size_t length;
+	Pattern *pattern;
+	_Bool hidden;     // Pattern starts with a ., so it can match hidden files
+	_Bool recursive;  // **, any number of directories (name and pattern are NULL)
+};
+
+// Path name expansion
+struct _glob {
+	CmdArg word;      // Word it came from, used as is if nothing matches
+	size_t count;     // Components, 0 if the word has expansions (compiled after expanding them)
+	GlobPart *parts;
+	_Bool absolute;   // Starts at /
+	_Bool directory;  // Ends with /, so only directories match
+};
+
+// Command substitution that only outputs a file
+struct _file_read {
+	CmdArg file;      // Word naming the file
+	char *command;    // Text inside $(...), run in a subshell when the file can't be read directly
+	_Bool cat;        // $(cat file), which is only read directly if cat is the system's binary
+	_Bool split;      // File has unquoted expansions, whose result could be more than one word
+};
+
+// Words a command expands to, growing in an arena
+typedef struct _word_list WordList;
+struct _word_list {
+	char **words;     // Terminated by NULL
+	size_t count, size;
+};
+
 // Command IO files
 typedef struct _cmd_io_file CmdIOFile;
 struct _cmd_io_file {
@@ -61,6 +354,37 @@ struct _cmd_io {
 	_Bool in_pipe, out_pipe;
 };
 
+// Where the parser reads lines from
+typedef struct _cmd_input CmdInput;
+struct _cmd_input {
+	FILE *file;      // Read a line at a time (stdin, pipes), NULL to read from text
+	int fd;          // Refills text a block at a time, -1 if text is the whole script
+	char *text;      // Lines are handed out where they are, and terminated in place
+	size_t len, pos, size; // Bytes in text, start of the next line, allocated (fd only)
+};
+
+// Element of a compound array assignment, NAME=(value [subscript]=value ...)
+typedef struct _array_element ArrayElement;
+struct _array_element {
+	Subscript sub;   // No subscript means the element after the last one
+	CmdArg value;    // ARG_NULL if empty
+};
+
+// Variable assignment (NAME=value) at the start of a command
+typedef struct _cmd_assign CmdAssign;
+struct _cmd_assign {
+	char *name;
+	Variable *var;   // NULL if parsed without a symbol table
+	CmdArg value;    // ARG_NULL if empty
+	Subscript sub;   // NAME[subscript]=value
+	_Bool append;    // NAME+=value
+	size_t count;    // Elements of a compound assignment
+	ArrayElement *elements; // NULL if it isn't one
+};
+
+typedef struct _function ShellFunction;
+typedef struct _case_table CaseTable;
+
 // Commands
 typedef struct _command Command;
 struct _command {
@@ -69,12 +393,64 @@ struct _command {
 	enum _cmd_type c_type;
 	int c_argc;
 	CmdArg *c_argv;
+	_Bool c_in_list; // CMD_FOR_IN has "in" (even with no words after it), otherwise it goes through the positional parameters
+	size_t c_assign_count;
+	CmdAssign *c_assign; // Set shell variables if there is no command, otherwise only the command's environment
 	Command *c_next;
 	Command *c_if_true;
 	Command *c_if_false;
 	Command *c_cmds;
 	Command *c_parent;
+	ShellFunction *c_function; // CMD_FUNCTION
+	CaseTable *c_case;         // CMD_CASE
 	CmdIO c_io;
+	Arena *c_arena; // Owns the command and everything it points to
+};
+
+// Parsed file, shared by the parse cache and anything sourcing it
+typedef struct _script Script;
+struct _script {
+	size_t count;
+	Command **cmds; // Command chain of each line, in order
+	size_t refs;
+	Arena *arena;   // Owns the commands
+};
+
+// Shell function, shared by the command that defined it and the function table
+struct _function {
+	char *name;
+	Command *body; // CMD_GROUP
+	Arena *arena;  // Owns the function, a reference is held while it is defined or running
+};
+
+// Literal case pattern, and the first arm that has it
+typedef struct _case_literal CaseLiteral;
+struct _case_literal {
+	char *text; // NULL if the slot is empty
+	size_t length, arm;
+	uint64_t hash;
+};
+
+// case pattern that is tried on its own (a glob the automaton didn't have room for, or one with expansions)
+typedef struct _case_pattern CasePattern;
+struct _case_pattern {
+	size_t arm;
+	Pattern *pattern; // NULL if it has expansions
+	CmdArg word;
+};
+
+// Dispatch of a case command, built once its arms are parsed (or loaded)
+struct _case_table {
+	size_t arm_count;
+	Command **arms;           // CMD_CASE_ARM commands, in order
+	size_t slots;             // Literal patterns, open addressing (a power of 2, or 0 if there are none)
+	CaseLiteral *literals;
+	size_t state_count, class_count; // Glob patterns, as one DFA (state 0 never matches anything, 1 is the start)
+	unsigned char classes[256];      // Bytes that every glob treats the same way share a class
+	uint16_t *next;           // Next state, indexed by state * class_count + class
+	size_t *accept;           // First arm whose pattern matches a word ending in each state
+	size_t pattern_count;     // Everything else, in arm order
+	CasePattern *patterns;
 };
 
 // Alias storage
@@ -82,6 +458,7 @@ typedef struct _alias_map AliasMap;
 struct _alias_map {
 	unsigned long long buckets;
 	hashTable *map;
+	size_t resolved; // Aliases expanded so far, parses that expanded one depend on the aliases at the time
 };
 
 // Single alias
@@ -90,6 +467,7 @@ struct _alias {
 	char *str;
 	int argc;
 	CmdArg *args;
+	Arena *arena; // Owns the args
 };
 
 #endif
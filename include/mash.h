@@ -10,6 +10,8 @@
 #define _VMAJOR 1
 #define _VMINOR 0
 #define TMP_RW_BUFSIZE 4096
+#define SCRIPT_BLOCK_SIZE 65536 // Scripts are read this much at a time
+#define NUMBER_MAX_DEPTH 1024 // Variables naming variables in arithmetic, followed this deep
 
 typedef enum _cmd_signal CmdSignal;
 enum _cmd_signal {
@@ -18,7 +20,8 @@ enum _cmd_signal {
 	CSIG_EXEC,
 	CSIG_CONTINUE,
 	CSIG_BREAK,
-	CSIG_INT
+	CSIG_INT,
+	CSIG_RETURN
 };
 
 typedef struct _cmd_source Source;
@@ -30,10 +33,20 @@ struct _cmd_source {
 	Source *prev, *next;
 };
 
-typedef struct _shell_var Variables;
-struct _shell_var {
-	unsigned long long buckets;
-	hashTable *map;
+#define IFS_VECTOR_CHARS 4 // IFS with at most this many characters is scanned with vector compares
+
+// Classes of IFS characters
+enum {
+	IFS_NONE,
+	IFS_SPACE,
+	IFS_OTHER
+};
+
+typedef struct _ifs Ifs;
+struct _ifs {
+	unsigned char class[256];
+	char chars[IFS_VECTOR_CHARS];
+	size_t count;
 };
 
 /*
@@ -45,8 +58,14 @@ int main(int, char*[]);
  * Command execution
  */
 
+extern _Bool interactive_shell;
 CmdSignal commandExecute(Command*, AliasMap*, Source**, Variables*, FILE**, uint8_t*);
 int expandArgument(char**, CmdArg, Source*, Variables*, uint8_t*);
+int mathRun(MathProg*, Variables*, long long*);
+int evaluateMathString(long long*, char*, Variables*);
+int evaluateCondition(CondExpr*, Source*, Variables*, uint8_t*);
+CmdSignal scriptExecute(Script*, AliasMap*, Source**, Variables*, FILE**, uint8_t*);
+CmdSignal scriptExecuteLines(int, char*, AliasMap*, Source**, Variables*, FILE**, uint8_t*);
 
 /*
  * Mash file utilities
@@ -78,16 +97,75 @@ int sourceShift(Source*, int);
  */
 
 void b_alias(uint8_t*, char**, Source*, AliasMap*);
-void b_cd(uint8_t*, char**, int);
-void b_dot(uint8_t*, char**, int, Source**);
+void b_cd(uint8_t*, char**, int, Variables*);
+void b_declare(uint8_t*, char**, Source*, Variables*);
+CmdSignal b_dot(uint8_t*, char**, int, AliasMap*, Source**, Variables*, FILE**);
+void b_echo(uint8_t*, char**);
 CmdSignal b_exit(uint8_t*, char**, int, Source*);
 void b_export(uint8_t*, char**, int, Source*, Variables*);
 void b_help(uint8_t*);
+void b_let(uint8_t*, char**, Source*, Variables*);
+void b_local(uint8_t*, char**, Source*, Variables*);
+CmdSignal b_mapfile(uint8_t*, FILE*, char**, Source*, Variables*, CmdSignal (*)(char**, void*), void*);
+void b_printf(uint8_t*, char**, Source*, Variables*);
 void b_read(uint8_t*, FILE*, char**, Source*, Variables*);
+CmdSignal b_return(uint8_t*, char**, int, Source*);
 void b_shift(uint8_t*, char**, int, Source*);
+void b_stats(uint8_t*);
+void b_test(uint8_t*, char**, int, Source*, Variables*);
 void b_unalias(uint8_t*, char**, int, AliasMap*);
 void b_unset(uint8_t*, char**, Source*, Variables*);
 
+size_t expandEscapes(char*, char*, _Bool, _Bool*);
+
+/*
+ * Parsed scripts
+ */
+
+char *scriptRead(int, size_t*);
+Script *scriptParse(CmdInput*, AliasMap*, Variables*);
+Script *scriptLoad(char*, AliasMap*, Variables*, _Bool*);
+void scriptRelease(Script*);
+void scriptCacheStats(size_t*, size_t*, size_t*);
+void scriptCacheFree();
+Script *scriptCompiled(FILE*, AliasMap*, Variables*);
+
+/*
+ * Shell output buffer
+ */
+
+void outputWrite(int, char*, size_t);
+void outputFlush();
+
+/*
+ * Shell input buffer
+ */
+
+ssize_t inputPeek(int, char**, _Bool);
+void inputConsume(int, size_t);
+_Bool inputReady(int, int);
+void inputSync();
+void inputDiscard(int);
+
+/*
+ * Shell functions
+ */
+
+void functionDefine(ShellFunction*);
+ShellFunction *functionGet(char*);
+int functionUnset(char*);
+void functionFreeAll();
+
+/*
+ * Conditional expressions
+ */
+
+enum _test_op testUnaryOp(char*);
+enum _test_op testBinaryOp(char*);
+int testUnary(enum _test_op, char*, Variables*);
+int testBinary(enum _test_op, char*, char*);
+int testCompare(enum _test_op, long long, long long);
+
 /*
  * Environment/Shell Variables
  */
@@ -97,10 +175,47 @@ void variableFree(Variables*);
 void variableSet(Variables*, char*, char*);
 char *variableGet(Variables*, char*);
 void variableUnset(Variables*, char*);
+Variable *variableIntern(Variables*, char*);
+char *variableValue(Variable*);
+long long numberValue(Variables*, char*);
+long long variableNumber(Variables*, Variable*);
+int variableSetNumber(Variable*, long long);
+int variableAssign(Variables*, Variable*, char*);
+void variableArrayClear(Variable*);
+void variableArraySet(Variable*, size_t, char*, size_t);
+void variableArrayLoad(Variable*, size_t, char*, size_t);
+size_t variableArrayEnd(Variable*);
+char *variableElement(Variable*, long long, _Bool*);
+_Bool variableElementUnset(Variable*, long long);
+void variableAssocClear(Variable*);
+void variableKeySet(Variable*, char*, char*, size_t);
+char *variableKey(Variable*, char*);
+void variableKeyUnset(Variable*, char*);
+size_t variableCount(Variable*);
+void variableList(Variable*, char**, size_t*, char**);
 int setvar(Variables*, char*, char*, _Bool);
 char *getvar(Variables*, char*);
 int unsetvar(Variables*, char*);
 size_t varNameLength(char*);
+void variablePushScope(Variables*);
+void variablePopScope(Variables*);
+void variableLocal(Variables*, Variable*);
+
+/*
+ * Path name expansion
+ */
+
+Glob *globCompile(Arena*, char*, size_t);
+size_t globExpand(Glob*, Arena*, WordList*, Variables*);
+
+/*
+ * Field splitting
+ */
+
+void ifsInit(Ifs*, char*);
+_Bool ifsField(Ifs*, char*, size_t, size_t*, size_t*, size_t*);
+_Bool ifsDelimiter(Ifs*, char);
+_Bool ifsLeadingSpace(Ifs*, char*, size_t);
 
 /*
  * Prompt utilities
@@ -20,8 +20,10 @@ void b_alias(uint8_t *cmd_exit, char **argv, Source *source, AliasMap *aliases)
 			if (equals == 0)
 				*cmd_exit = 1;
 			else {
-				argv[1][equals] = '\0';
-				if (aliasAdd(aliases, argv[1], &argv[1][equals + 1]) == NULL) {
+				char name[equals + 1];
+				memcpy(name, argv[1], equals);
+				name[equals] = '\0';
+				if (aliasAdd(aliases, name, &argv[1][equals + 1]) == NULL) {
 					fprintf(stderr, "%s: alias: error parsing string\n", source->argv[0]);
 					*cmd_exit = 1;
 				}
@@ -7,11 +7,11 @@
 //#include <string.h>
 #include <unistd.h>
 
-void b_cd(uint8_t *cmd_exit, char **argv, int argc) {
+void b_cd(uint8_t *cmd_exit, char **argv, int argc, Variables *vars) {
 	char *newdir = NULL;
 	switch (argc) {
 		case 1: {
-			char *env_home = getenv("HOME"); // TODO: replace with getvar - I'd do this now, but I think I'll be retiring the builtins soon
+			char *env_home = getvar(vars, "HOME");
 			if (env_home == NULL) {
 				// Step 1
 				fputs("HOME not set.\n", stderr);
@@ -56,7 +56,7 @@ void b_cd(uint8_t *cmd_exit, char **argv, int argc) {
 		return;
 	}
 	char newpath[PATH_MAX];
-	setenv("PWD", getcwd(newpath, PATH_MAX), 1);
+	setvar(vars, "PWD", getcwd(newpath, PATH_MAX), 1);
 
 	*cmd_exit = 0;
 }
@@ -0,0 +1,102 @@
+#include "mash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void b_declare(uint8_t *cmd_exit, char **argv, Source *source, Variables *vars) {
+	*cmd_exit = 0;
+
+	// Parse attribute options (-i/+i integer, -x export, -a indexed array, -A associative array)
+	_Bool set_integer = 0, unset_integer = 0, export = 0;
+	char array = 0;
+	size_t i = 1;
+	for (; argv[i] != NULL && (argv[i][0] == '-' || argv[i][0] == '+') && argv[i][1] != '\0'; ++i) {
+		_Bool add = argv[i][0] == '-';
+		for (size_t c = 1; argv[i][c] != '\0'; ++c) {
+			switch (argv[i][c]) {
+				case 'i':
+					if (add)
+						set_integer = 1;
+					else
+						unset_integer = 1;
+					break;
+				case 'x':
+					export = add;
+					break;
+				case 'a':
+				case 'A':
+					if (add) {
+						array = argv[i][c];
+						break;
+					}
+					fprintf(stderr, "%s: declare: +%c: cannot destroy array variables in this way\n", source->argv[0], argv[i][c]);
+					*cmd_exit = 1;
+					return;
+				default:
+					fprintf(stderr, "%s: declare: %c%c: invalid option\n", source->argv[0], argv[i][0], argv[i][c]);
+					*cmd_exit = 2;
+					return;
+			}
+		}
+	}
+
+	for (; argv[i] != NULL; ++i) {
+		size_t name_len = varNameLength(argv[i]);
+		if (name_len == 0 || (argv[i][name_len] != '\0' && argv[i][name_len] != '=')) {
+			fprintf(stderr, "%s: declare: `%s': not a valid identifier\n", source->argv[0], argv[i]);
+			*cmd_exit = 1;
+			continue;
+		}
+		// Words can point into the parsed command, so the name is copied instead of cut off in place
+		char name[name_len + 1], *value = NULL;
+		memcpy(name, argv[i], name_len);
+		name[name_len] = '\0';
+		if (argv[i][name_len] == '=')
+			value = &argv[i][name_len + 1];
+
+		Variable *var = variableIntern(vars, name);
+		if (unset_integer)
+			var->integer = 0;
+		if (set_integer && !var->integer) {
+			var->integer = 1;
+			// Convert the existing value (if any) so it is numeric from now on
+			if (value == NULL && variableValue(var) != NULL)
+				value = variableValue(var);
+		}
+
+		// The old value becomes element 0
+		char *old = NULL;
+		if (array == 'a' && var->array == NULL) {
+			if (var->assoc != NULL) {
+				fprintf(stderr, "%s: declare: %s: cannot convert associative to indexed array\n", source->argv[0], name);
+				*cmd_exit = 1;
+				continue;
+			}
+			// Detached first, converting frees the scalar value (and value may be it, from -i)
+			old = variableValue(var);
+			var->value = NULL;
+			if (old == NULL)
+				variableArrayClear(var);
+			else
+				variableArraySet(var, 0, old, strlen(old));
+		}
+		if (array == 'A' && var->assoc == NULL) {
+			if (var->array != NULL) {
+				fprintf(stderr, "%s: declare: %s: cannot convert indexed to associative array\n", source->argv[0], name);
+				*cmd_exit = 1;
+				continue;
+			}
+			old = variableValue(var);
+			var->value = NULL;
+			variableAssocClear(var);
+			if (old != NULL)
+				variableKeySet(var, "0", old, strlen(old));
+		}
+
+		if ((value != NULL || export) && setvar(vars, name, value, export) == -1) {
+			fprintf(stderr, "%s: declare: %s: %m\n", source->argv[0], name);
+			*cmd_exit = 1;
+		}
+		free(old);
+	}
+}
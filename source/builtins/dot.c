@@ -1,12 +1,38 @@
+#define _POSIX_C_SOURCE 200809L // O_CLOEXEC
 #include "mash.h"
+#include <fcntl.h>
 #include <stdio.h>
+#include <unistd.h>
 
-void b_dot(uint8_t *cmd_exit, char **argv, int argc, Source **_source) {
-	FILE *script = fopen(argv[1], "r");
-	if (script != NULL)
-		*_source = sourceAdd(*_source, script, argc - 1, &argv[1]);
-	else {
-		fprintf(stderr, "%s: .: %m\n", (*_source)->argv[0]);
+CmdSignal b_dot(uint8_t *cmd_exit, char **argv, int argc, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool) {
+	if (argc < 2) {
+		fprintf(stderr, "%s: .: filename argument required\n", (*_source)->argv[0]);
+		*cmd_exit = 2;
+		return CSIG_DONE;
+	}
+	// Parsed once, and replayed from the cache while the file doesn't change
+	_Bool by_line;
+	Script *script = scriptLoad(argv[1], aliases, vars, &by_line);
+	int fd = by_line ? open(argv[1], O_RDONLY | O_CLOEXEC) : -1;
+	if (script == NULL && fd == -1) {
+		fprintf(stderr, "%s: .: %s: %m\n", (*_source)->argv[0], argv[1]);
 		*cmd_exit = 1;
+		return CSIG_DONE;
+	}
+
+	// Arguments are swapped in as a new source, like they were when the file was read line by line
+	Source *frame = sourceAdd(*_source, NULL, argc - 1, &argv[1]);
+	*_source = frame;
+	*cmd_exit = 0;
+	CmdSignal res;
+	if (script != NULL) {
+		res = scriptExecute(script, aliases, _source, vars, history_pool, cmd_exit);
+		scriptRelease(script);
+	}
+	else {
+		res = scriptExecuteLines(fd, argv[1], aliases, _source, vars, history_pool, cmd_exit);
+		close(fd);
 	}
+	*_source = sourceClose(frame);
+	return res;
 }
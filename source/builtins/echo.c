@@ -0,0 +1,46 @@
+#include "mash.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+void b_echo(uint8_t *cmd_exit, char **argv) {
+	*cmd_exit = 0;
+
+	// Options are only recognized if every character is one (like bash), -e enables escapes
+	_Bool newline = 1, escapes = 0;
+	size_t i = 1;
+	for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0' && strspn(&argv[i][1], "neE") == strlen(&argv[i][1]); ++i) {
+		for (char *c = &argv[i][1]; *c != '\0'; ++c) {
+			switch (*c) {
+				case 'n':
+					newline = 0;
+					break;
+				case 'e':
+					escapes = 1;
+					break;
+				case 'E':
+					escapes = 0;
+					break;
+			}
+		}
+	}
+
+	for (size_t first = i; argv[i] != NULL; ++i) {
+		if (i > first)
+			outputWrite(STDOUT_FILENO, " ", 1);
+		if (!escapes) {
+			outputWrite(STDOUT_FILENO, argv[i], strlen(argv[i]));
+			continue;
+		}
+		// Escapes never make the string longer
+		_Bool stop;
+		char *expanded = malloc(strlen(argv[i]) + 1);
+		size_t len = expandEscapes(expanded, argv[i], 0, &stop);
+		outputWrite(STDOUT_FILENO, expanded, len);
+		free(expanded);
+		if (stop)
+			return;
+	}
+	if (newline)
+		outputWrite(STDOUT_FILENO, "\n", 1);
+}
@@ -1,6 +1,5 @@
 #include "mash.h"
 #include <stdio.h>
-#include <stdlib.h>
 
 CmdSignal b_exit(uint8_t *cmd_exit, char **argv, int argc, Source *source) {
 	if (argc > 1) {
@@ -11,10 +10,8 @@ CmdSignal b_exit(uint8_t *cmd_exit, char **argv, int argc, Source *source) {
 	else
 		*cmd_exit = 0;
 
-	for (size_t v = 0; v < argc; ++v)
-		free(argv[v]);
-
-	if (source->input == stdin)
+	// Interactive, or not reading from a file (-c, or a function)
+	if (source->input == stdin || source->input == NULL)
 		return CSIG_EXIT;
 	else
 		fseek(source->input, 0, SEEK_END);
@@ -0,0 +1,39 @@
+#include "mash.h"
+#include <stdio.h>
+#include <string.h>
+
+void b_let(uint8_t *cmd_exit, char **argv, Source *source, Variables *vars) {
+	if (argv[1] == NULL) {
+		fprintf(stderr, "%s: let: expression expected\n", source->argv[0]);
+		*cmd_exit = 1;
+		return;
+	}
+
+	long long number = 0;
+	for (size_t i = 1; argv[i] != NULL; ++i) {
+		size_t name_len = varNameLength(argv[i]);
+		// Assignment (name=expression), store the number directly
+		if (name_len > 0 && argv[i][name_len] == '=') {
+			char name[name_len + 1];
+			memcpy(name, argv[i], name_len);
+			name[name_len] = '\0';
+			if (evaluateMathString(&number, &argv[i][name_len + 1], vars) == -1) {
+				fprintf(stderr, "%s: let: syntax error in expression `%s'\n", source->argv[0], &argv[i][name_len + 1]);
+				*cmd_exit = 1;
+				return;
+			}
+			if (variableSetNumber(variableIntern(vars, name), number) == -1) {
+				fprintf(stderr, "%s: let: %m\n", source->argv[0]);
+				*cmd_exit = 1;
+				return;
+			}
+		}
+		else if (evaluateMathString(&number, argv[i], vars) == -1) {
+			fprintf(stderr, "%s: let: syntax error in expression `%s'\n", source->argv[0], argv[i]);
+			*cmd_exit = 1;
+			return;
+		}
+	}
+	// Exit status is 1 if the last expression was 0
+	*cmd_exit = number == 0;
+}
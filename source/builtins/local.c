@@ -0,0 +1,26 @@
+#include "mash.h"
+#include <stdio.h>
+#include <string.h>
+
+void b_local(uint8_t *cmd_exit, char **argv, Source *source, Variables *vars) {
+	if (vars->depth == 0) {
+		fprintf(stderr, "%s: local: can only be used in a function\n", source->argv[0]);
+		*cmd_exit = 1;
+		return;
+	}
+
+	// Make the variables local first, then they are declared like usual
+	size_t i = 1;
+	while (argv[i] != NULL && (argv[i][0] == '-' || argv[i][0] == '+') && argv[i][1] != '\0')
+		++i;
+	for (; argv[i] != NULL; ++i) {
+		size_t name_len = varNameLength(argv[i]);
+		if (name_len == 0 || (argv[i][name_len] != '\0' && argv[i][name_len] != '='))
+			continue; // declare will complain about it
+		char name[name_len + 1];
+		memcpy(name, argv[i], name_len);
+		name[name_len] = '\0';
+		variableLocal(vars, variableIntern(vars, name));
+	}
+	b_declare(cmd_exit, argv, source, vars);
+}
@@ -0,0 +1,183 @@
+#define _POSIX_C_SOURCE 200809L // fileno
+#include "mash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAPFILE_QUANTUM 5000 // Lines between calls of the callback, if -c isn't given
+
+static void lineAppend(char **line, size_t *len, size_t *size, char *str, size_t n) {
+	if (*len + n + 1 > *size) {
+		*size = *size == 0 ? 128 : *size;
+		while (*len + n + 1 > *size)
+			*size *= 2;
+		*line = realloc(*line, *size);
+	}
+	memcpy(&(*line)[*len], str, n);
+	*len += n;
+}
+
+// Number given to an option, -1 if it isn't one
+static long long mapfileNumber(char *value) {
+	char *end;
+	long long number = strtoll(value, &end, 10);
+	return value[0] == '\0' || *end != '\0' || number < 0 ? -1 : number;
+}
+
+/*
+ * mapfile [-t] [-d delim] [-n count] [-s skip] [-C callback [-c quantum]] [array]
+ * (also readarray) Loads the lines of filein (stdin if NULL) into an indexed array, MAPFILE if none is named.
+ * The input is split a block at a time with memchr, and short lines are packed into blocks shared by the array
+ * (variableArrayLoad). Every quantum lines, callback is called with the words of the -C option, the index and the
+ * line that is about to be stored; the load stops if it returns anything but CSIG_DONE.
+ */
+CmdSignal b_mapfile(uint8_t *cmd_exit, FILE *filein, char **argv, Source *source, Variables *vars, CmdSignal (*callback)(char**, void*), void *data) {
+	*cmd_exit = 0;
+
+	// Options, the ones with a value take the rest of the word or the next one
+	_Bool trim = 0;
+	char delim = '\n', *command = NULL;
+	long long max = 0, skip = 0, quantum = MAPFILE_QUANTUM;
+	size_t i = 1;
+	for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (!strcmp(argv[i], "--")) {
+			++i;
+			break;
+		}
+		for (size_t c = 1; argv[i][c] != '\0'; ++c) {
+			char option = argv[i][c];
+			if (option == 't') {
+				trim = 1;
+				continue;
+			}
+			if (strchr("dnsCc", option) == NULL) {
+				fprintf(stderr, "%s: %s: -%c: invalid option\n", source->argv[0], argv[0], option);
+				*cmd_exit = 2;
+				return CSIG_DONE;
+			}
+			char *value = argv[i][c + 1] != '\0' ? &argv[i][c + 1] : argv[++i];
+			if (value == NULL) {
+				fprintf(stderr, "%s: %s: -%c: option requires an argument\n", source->argv[0], argv[0], option);
+				*cmd_exit = 2;
+				return CSIG_DONE;
+			}
+			long long number = strchr("nsc", option) == NULL ? 0 : mapfileNumber(value);
+			if (number == -1 || (option == 'c' && number == 0)) {
+				fprintf(stderr, "%s: %s: %s: invalid %s\n", source->argv[0], argv[0], value, option == 'c' ? "callback quantum" : "line count");
+				*cmd_exit = 1;
+				return CSIG_DONE;
+			}
+			switch (option) {
+				case 'd':
+					delim = value[0];
+					break;
+				case 'n':
+					max = number;
+					break;
+				case 's':
+					skip = number;
+					break;
+				case 'C':
+					command = value;
+					break;
+				case 'c':
+					quantum = number;
+					break;
+			}
+			break;
+		}
+		if (argv[i] == NULL)
+			break;
+	}
+
+	char *name = argv[i] == NULL ? "MAPFILE" : argv[i];
+	if (varNameLength(name) != strlen(name)) {
+		fprintf(stderr, "%s: %s: `%s': not a valid identifier\n", source->argv[0], argv[0], name);
+		*cmd_exit = 1;
+		return CSIG_DONE;
+	}
+	Variable *var = variableIntern(vars, name);
+	if (var->assoc != NULL) {
+		fprintf(stderr, "%s: %s: %s: not an indexed array\n", source->argv[0], argv[0], name);
+		*cmd_exit = 1;
+		return CSIG_DONE;
+	}
+	variableArrayClear(var);
+
+	// Lines are stored straight from the input buffer, unless they span blocks or the callback needs them
+	int fd = filein == NULL ? STDIN_FILENO : fileno(filein);
+	char *line = NULL;
+	size_t len = 0, size = 0, index = 0;
+	CmdSignal signal = CSIG_DONE;
+	while (signal == CSIG_DONE && (max == 0 || index < (size_t)max)) {
+		char *input;
+		ssize_t avail = inputPeek(fd, &input, max == 0);
+		if (avail < 1) {
+			if (avail == -1)
+				*cmd_exit = 1;
+			break;
+		}
+
+		size_t used = 0;
+		while (max == 0 || index < (size_t)max) {
+			char *found = memchr(&input[used], delim, avail - used);
+			if (found == NULL) {
+				lineAppend(&line, &len, &size, &input[used], avail - used);
+				used = avail;
+				break;
+			}
+			size_t end = found - input + 1;
+			char *text = &input[used];
+			size_t text_len = end - used;
+			if (len > 0) {
+				lineAppend(&line, &len, &size, text, text_len);
+				text = line;
+				text_len = len;
+			}
+			used = end;
+			len = 0;
+			if (skip > 0) {
+				--skip;
+				continue;
+			}
+			if (trim)
+				--text_len;
+
+			if (command != NULL && (index + 1) % quantum == 0) {
+				// The callback can run anything (even reading this input), so it gets a copy of the line
+				if (text != line) {
+					lineAppend(&line, &len, &size, text, text_len);
+					text = line;
+				}
+				line[text_len] = '\0';
+				len = 0;
+				inputConsume(fd, used);
+				used = 0;
+				char number[24];
+				snprintf(number, sizeof (number), "%zu", index);
+				signal = callback((char*[]){ command, number, line, NULL }, data);
+				if (signal != CSIG_DONE)
+					break;
+			}
+			variableArrayLoad(var, index++, text, text_len);
+			if (used == 0)
+				break;
+		}
+		inputConsume(fd, used);
+	}
+
+	// The last line may not have a delimiter
+	if (len > 0 && signal == CSIG_DONE && (max == 0 || index < (size_t)max) && skip == 0) {
+		if (command != NULL && (index + 1) % quantum == 0) {
+			line[len] = '\0';
+			char number[24];
+			snprintf(number, sizeof (number), "%zu", index);
+			signal = callback((char*[]){ command, number, line, NULL }, data);
+		}
+		if (signal == CSIG_DONE)
+			variableArrayLoad(var, index, line, len);
+	}
+	free(line);
+	return signal;
+}
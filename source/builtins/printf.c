@@ -0,0 +1,371 @@
+#define _POSIX_C_SOURCE 200809L // strndup
+#include "mash.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define PRINTF_MAX_WIDTH 99999999 // Widths and precisions are at most 8 digits
+
+/*
+ * Decode the escape sequence after a backslash into c.
+ * Returns the number of characters used (after the backslash), 0 for \c, and -1 if it isn't an escape.
+ * \0NNN octal escapes are used by echo -e and %b, \NNN by printf formats and %b.
+ */
+static ssize_t escapeChar(char *src, char *c, _Bool zero_octal, _Bool octal) {
+	static const char *const escapes = "a\ab\be\033f\fn\nr\rt\tv\v\\\\";
+	for (const char *e = escapes; *e != '\0'; e += 2) {
+		if (*src == *e) {
+			*c = e[1];
+			return 1;
+		}
+	}
+	switch (*src) {
+		case 'c':
+			return 0;
+		case 'x': {
+			size_t l = 1;
+			int value = 0;
+			for (; l < 3 && src[l] != '\0' && strchr("0123456789abcdefABCDEF", src[l]) != NULL; ++l)
+				value = value * 16 + (src[l] <= '9' ? src[l] - '0' : (src[l] | 0x20) - 'a' + 10);
+			if (l == 1) // No digits, so it is just \x
+				return -1;
+			*c = value;
+			return l;
+		}
+		case '0': case '1': case '2': case '3':
+		case '4': case '5': case '6': case '7': {
+			size_t start;
+			if (zero_octal && *src == '0')
+				start = 1;
+			else if (octal)
+				start = 0;
+			else
+				return -1;
+			size_t l = start;
+			int value = 0;
+			for (; l < start + 3 && src[l] >= '0' && src[l] <= '7'; ++l)
+				value = value * 8 + src[l] - '0';
+			*c = value;
+			return l;
+		}
+	}
+	return -1;
+}
+
+/*
+ * Expand backslash escapes from src into dst (which must be at least as long as src).
+ * Returns the length written, and sets stop if \c was found (nothing else should be output).
+ */
+size_t expandEscapes(char *dst, char *src, _Bool octal, _Bool *stop) {
+	size_t len = 0;
+	*stop = 0;
+	while (*src != '\0') {
+		ssize_t used = *src == '\\' ? escapeChar(&src[1], &dst[len], 1, octal) : -1;
+		if (used == 0) {
+			*stop = 1;
+			break;
+		}
+		// Regular character, or a backslash that doesn't start an escape
+		if (used == -1) {
+			dst[len++] = *src++;
+			continue;
+		}
+		++len;
+		src += used + 1;
+	}
+	dst[len] = '\0';
+	return len;
+}
+
+// Growable output string
+typedef struct _printf_output PrintfOutput;
+struct _printf_output {
+	char *str;
+	size_t len, size;
+};
+
+static void outputAppend(PrintfOutput *out, char *str, size_t len) {
+	if (out->len + len + 1 > out->size) {
+		out->size = (out->len + len + 1) * 2;
+		out->str = realloc(out->str, out->size);
+	}
+	memcpy(&out->str[out->len], str, len);
+	out->len += len;
+	out->str[out->len] = '\0';
+}
+
+static void outputFormat(PrintfOutput *out, char *format, ...) {
+	va_list args, copy;
+	va_start(args, format);
+	va_copy(copy, args);
+	int len = vsnprintf(NULL, 0, format, copy);
+	va_end(copy);
+	if (len > 0) {
+		if (out->len + len + 1 > out->size) {
+			out->size = (out->len + len + 1) * 2;
+			out->str = realloc(out->str, out->size);
+		}
+		vsnprintf(&out->str[out->len], len + 1, format, args);
+		out->len += len;
+	}
+	va_end(args);
+}
+
+// Convert a numeric argument, 'c gives the value of c (like C's char constants)
+static long long printfNumber(char *arg, Source *source, uint8_t *cmd_exit) {
+	if (arg == NULL)
+		return 0;
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+	char *end;
+	errno = 0;
+	long long number = strtoll(arg, &end, 0);
+	if (end == arg || *end != '\0' || errno) {
+		fprintf(stderr, "%s: printf: %s: invalid number\n", source->argv[0], arg);
+		*cmd_exit = 1;
+	}
+	return number;
+}
+
+static double printfFloat(char *arg, Source *source, uint8_t *cmd_exit) {
+	if (arg == NULL)
+		return 0;
+	if (arg[0] == '\'' || arg[0] == '"')
+		return (unsigned char)arg[1];
+	char *end;
+	double number = strtod(arg, &end);
+	if (end == arg || *end != '\0') {
+		fprintf(stderr, "%s: printf: %s: invalid number\n", source->argv[0], arg);
+		*cmd_exit = 1;
+	}
+	return number;
+}
+
+/*
+ * Quote str so the shell would read it back as the same word (%q), in a string allocated for the caller.
+ * Special characters are escaped with backslashes, and strings with unprintable bytes are written as $'...'.
+ */
+static char *printfQuote(char *str) {
+	size_t len = strlen(str);
+	if (len == 0)
+		return strdup("''");
+	_Bool unprintable = 0;
+	for (size_t i = 0; i < len; ++i)
+		unprintable |= (unsigned char)str[i] < ' ' || (unsigned char)str[i] >= 0x7F;
+	char *quoted = malloc(len * 4 + 4), *q = quoted;
+	if (unprintable) {
+		*q++ = '$';
+		*q++ = '\'';
+		static const char escapes[] = "\a\b\033\f\n\r\t\v\\'", letters[] = "abEfnrtv\\'";
+		for (size_t i = 0; i < len; ++i) {
+			unsigned char c = str[i];
+			char *escape = strchr(escapes, c);
+			if (escape != NULL) {
+				*q++ = '\\';
+				*q++ = letters[escape - escapes];
+			}
+			else if (c < ' ' || c >= 0x7F)
+				q += sprintf(q, "\\%03o", c);
+			else
+				*q++ = c;
+		}
+		*q++ = '\'';
+	}
+	else {
+		for (size_t i = 0; i < len; ++i) {
+			// # and ~ only mean something at the start of a word
+			if (strchr(" \"$&'()*,;<>?[\\]^`{|}!", str[i]) != NULL || (i == 0 && (str[i] == '#' || str[i] == '~')))
+				*q++ = '\\';
+			*q++ = str[i];
+		}
+	}
+	*q = '\0';
+	return quoted;
+}
+
+void b_printf(uint8_t *cmd_exit, char **argv, Source *source, Variables *vars) {
+	*cmd_exit = 0;
+
+	// -v var stores the result instead of printing it
+	char *var = NULL;
+	size_t arg = 1;
+	if (argv[arg] != NULL && !strcmp(argv[arg], "-v")) {
+		var = argv[arg + 1];
+		if (var == NULL || varNameLength(var) == 0 || var[varNameLength(var)] != '\0') {
+			fprintf(stderr, "%s: printf: `%s': not a valid identifier\n", source->argv[0], var == NULL ? "" : var);
+			*cmd_exit = 2;
+			return;
+		}
+		arg += 2;
+	}
+	if (argv[arg] != NULL && !strcmp(argv[arg], "--"))
+		++arg;
+	if (argv[arg] == NULL) {
+		fprintf(stderr, "%s: printf: usage: printf [-v var] format [arguments]\n", source->argv[0]);
+		*cmd_exit = 2;
+		return;
+	}
+	char *format = argv[arg++];
+
+	PrintfOutput out = { .str = NULL, .len = 0, .size = 0 };
+	outputAppend(&out, "", 0);
+	_Bool stop = 0;
+	// The format is reused until every argument has been consumed
+	do {
+		size_t first_arg = arg;
+		for (char *f = format; *f != '\0' && !stop;) {
+			if (*f == '\\' && f[1] != '\0') {
+				char c;
+				ssize_t used = escapeChar(&f[1], &c, 0, 1);
+				if (used == 0) {
+					stop = 1;
+					break;
+				}
+				if (used == -1) {
+					outputAppend(&out, f, 1);
+					++f;
+				}
+				else {
+					outputAppend(&out, &c, 1);
+					f += used + 1;
+				}
+				continue;
+			}
+			if (*f != '%') {
+				size_t run = strcspn(f, "\\%");
+				if (run == 0)
+					run = 1;
+				outputAppend(&out, f, run);
+				f += run;
+				continue;
+			}
+			if (f[1] == '%') {
+				outputAppend(&out, "%", 1);
+				f += 2;
+				continue;
+			}
+
+			// Conversion specification, rebuilt for snprintf (with * replaced by the argument)
+			char spec[64] = "%";
+			size_t spec_len = 1;
+			char *start = f++;
+			size_t flags = strspn(f, "-+ #0");
+			if (flags > 8)
+				flags = 8;
+			memcpy(&spec[spec_len], f, flags);
+			spec_len += flags;
+			f += flags;
+			for (int part = 0; part < 2; ++part) {
+				if (part == 1) {
+					if (*f != '.')
+						break;
+					spec[spec_len++] = *f++;
+				}
+				if (*f == '*') {
+					long long number = printfNumber(argv[arg], source, cmd_exit);
+					if (argv[arg] != NULL)
+						++arg;
+					++f;
+					// A negative width left-justifies, a negative precision is the same as none
+					if (number < 0 && part == 1)
+						--spec_len;
+					else {
+						if (number < 0) {
+							spec[spec_len++] = '-';
+							number = number < -PRINTF_MAX_WIDTH ? PRINTF_MAX_WIDTH : -number;
+						}
+						if (number > PRINTF_MAX_WIDTH)
+							number = PRINTF_MAX_WIDTH;
+						spec_len += sprintf(&spec[spec_len], "%d", (int)number);
+					}
+				}
+				else {
+					size_t digits = strspn(f, "0123456789");
+					if (digits > 8) // PRINTF_MAX_WIDTH
+						digits = 8;
+					memcpy(&spec[spec_len], f, digits);
+					spec_len += digits;
+					f += strspn(f, "0123456789");
+				}
+			}
+			f += strspn(f, "hlLjzt"); // Length modifiers are meaningless here
+			char conversion = *f;
+			if (conversion == '\0') {
+				fprintf(stderr, "%s: printf: `%s': missing format character\n", source->argv[0], start);
+				*cmd_exit = 1;
+				stop = 1;
+				break;
+			}
+			++f;
+			char *value = argv[arg];
+			if (value != NULL)
+				++arg;
+
+			switch (conversion) {
+				case 'd':
+				case 'i':
+					strcpy(&spec[spec_len], "lld");
+					outputFormat(&out, spec, printfNumber(value, source, cmd_exit));
+					break;
+				case 'u': case 'o':
+				case 'x': case 'X':
+					sprintf(&spec[spec_len], "ll%c", conversion);
+					outputFormat(&out, spec, (unsigned long long)printfNumber(value, source, cmd_exit));
+					break;
+				case 'f': case 'F':
+				case 'e': case 'E':
+				case 'g': case 'G':
+				case 'a': case 'A':
+					sprintf(&spec[spec_len], "%c", conversion);
+					outputFormat(&out, spec, printfFloat(value, source, cmd_exit));
+					break;
+				case 'c':
+					if (value == NULL || value[0] == '\0')
+						break;
+					strcpy(&spec[spec_len], "c");
+					outputFormat(&out, spec, value[0]);
+					break;
+				case 's':
+					strcpy(&spec[spec_len], "s");
+					outputFormat(&out, spec, value == NULL ? "" : value);
+					break;
+				case 'q': {
+					char *quoted = printfQuote(value == NULL ? "" : value);
+					strcpy(&spec[spec_len], "s");
+					outputFormat(&out, spec, quoted);
+					free(quoted);
+					break;
+				}
+				case 'b': {
+					// Argument with echo -e escapes
+					char *expanded = malloc(value == NULL ? 1 : strlen(value) + 1);
+					expandEscapes(expanded, value == NULL ? "" : value, 1, &stop);
+					strcpy(&spec[spec_len], "s");
+					outputFormat(&out, spec, expanded);
+					free(expanded);
+					break;
+				}
+				default:
+					fprintf(stderr, "%s: printf: `%c': invalid format character\n", source->argv[0], conversion);
+					*cmd_exit = 1;
+					stop = 1;
+			}
+		}
+		// A format without conversions is only printed once
+		if (arg == first_arg)
+			break;
+	} while (!stop && argv[arg] != NULL);
+
+	if (var != NULL) {
+		if (setvar(vars, var, out.str, 0) == -1) {
+			fprintf(stderr, "%s: printf: %s: %m\n", source->argv[0], var);
+			*cmd_exit = 1;
+		}
+	}
+	else
+		outputWrite(STDOUT_FILENO, out.str, out.len);
+	free(out.str);
+}
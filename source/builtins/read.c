@@ -1,36 +1,280 @@
-#define _POSIX_C_SOURCE 200809L // fileno, getline
+#define _POSIX_C_SOURCE 200809L // fileno, clock_gettime
 #include "mash.h"
-#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#define READ_TIMEOUT 142 // Exit status when -t runs out (128 + SIGALRM, like bash)
+
+static void lineAppend(char **line, size_t *len, size_t *size, char *str, size_t n) {
+	if (*len + n + 1 > *size) {
+		*size = *size == 0 ? 128 : *size;
+		while (*len + n + 1 > *size)
+			*size *= 2;
+		*line = realloc(*line, *size);
+	}
+	memcpy(&(*line)[*len], str, n);
+	*len += n;
+}
+
+// Milliseconds until deadline (0 if it has passed)
+static int remaining(struct timespec *deadline) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	long long ms = (deadline->tv_sec - now.tv_sec) * 1000LL + (deadline->tv_nsec - now.tv_nsec) / 1000000;
+	return ms < 0 ? 0 : ms > 0x7FFFFFFF ? 0x7FFFFFFF : ms;
+}
+
+// Whether the character at i is escaped by a backslash (counting back no further than start)
+static _Bool escapedAt(char *line, size_t start, size_t i) {
+	size_t count = 0;
+	while (i > start && line[i - 1] == '\\') {
+		--i;
+		++count;
+	}
+	return count % 2;
+}
+
+// Remove the backslashes that escape the character after them, in place. Returns the new length
+static size_t unescape(char *text, size_t len) {
+	size_t out = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if (text[i] == '\\' && ++i == len)
+			break;
+		text[out++] = text[i];
+	}
+	return out;
+}
+
+/*
+ * Find the next field of line from *pos, like ifsField, except that a character after a backslash is never a
+ * delimiter when escapes is set.
+ */
+static _Bool readField(Ifs *ifs, char *line, size_t len, _Bool escapes, size_t *pos, size_t *start, size_t *field_len) {
+	if (!escapes || ifs->count == 0)
+		return ifsField(ifs, line, len, pos, start, field_len);
+	size_t i = *pos;
+	if (i == 0)
+		while (i < len && ifs->class[(unsigned char)line[i]] == IFS_SPACE)
+			++i;
+	if (i >= len)
+		return 0;
+
+	*start = i;
+	while (i < len && (line[i] == '\\' || ifs->class[(unsigned char)line[i]] == IFS_NONE))
+		i += line[i] == '\\' ? 2 : 1;
+	if (i > len)
+		i = len;
+	*field_len = i - *start;
+	while (i < len && ifs->class[(unsigned char)line[i]] == IFS_SPACE)
+		++i;
+	if (i < len && ifs->class[(unsigned char)line[i]] == IFS_OTHER)
+		++i;
+	while (i < len && ifs->class[(unsigned char)line[i]] == IFS_SPACE)
+		++i;
+	*pos = i;
+	return 1;
+}
+
+static void readAssign(uint8_t *cmd_exit, char *name, char *value, Source *source, Variables *vars) {
+	if (setvar(vars, name, value, 0) == -1) {
+		fprintf(stderr, "%s: read: %s: %m\n", source->argv[0], name);
+		*cmd_exit = 1;
+	}
+}
+
+/*
+ * read [-r] [-d delim] [-n count] [-t timeout] [name ...]
+ * Reads a line (up to delim) from filein (stdin if NULL), and splits it into the names with IFS. The last name gets
+ * the rest of the line, and without names the whole line is put in REPLY.
+ */
 void b_read(uint8_t *cmd_exit, FILE *filein, char **argv, Source *source, Variables *vars) {
 	*cmd_exit = 0;
-	char *value = NULL;
-	size_t size = 0, bytes_read;
-	if (filein == NULL)
-		bytes_read = getline(&value, &size, stdin);
-	else { // Cursed code to keep FILE position and fd offset in sync...
-		off_t offset = lseek(fileno(filein), 0, SEEK_CUR);
-		bytes_read = getline(&value, &size, filein);
-		if (bytes_read > 0)
-			lseek(fileno(filein), offset + bytes_read, SEEK_SET);
-	}
-	if (bytes_read == -1) {
-		if (filein == NULL)
-			clearerr(stdin);
-		*cmd_exit = 1;
+
+	// Options, the ones with a value take the rest of the word or the next one
+	_Bool raw = 0, limited = 0, timed = 0;
+	char delim = '\n';
+	long long max = 0;
+	double timeout = 0;
+	size_t i = 1;
+	for (; argv[i] != NULL && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (!strcmp(argv[i], "--")) {
+			++i;
+			break;
+		}
+		for (size_t c = 1; argv[i][c] != '\0'; ++c) {
+			char option = argv[i][c];
+			if (option == 'r') {
+				raw = 1;
+				continue;
+			}
+			if (strchr("dnt", option) == NULL) {
+				fprintf(stderr, "%s: read: -%c: invalid option\n", source->argv[0], option);
+				*cmd_exit = 2;
+				return;
+			}
+			char *value = argv[i][c + 1] != '\0' ? &argv[i][c + 1] : argv[++i], *end;
+			if (value == NULL) {
+				fprintf(stderr, "%s: read: -%c: option requires an argument\n", source->argv[0], option);
+				*cmd_exit = 2;
+				return;
+			}
+			switch (option) {
+				case 'd':
+					delim = value[0];
+					break;
+				case 'n':
+					max = strtoll(value, &end, 10);
+					if (value[0] == '\0' || *end != '\0' || max < 0) {
+						fprintf(stderr, "%s: read: %s: invalid number\n", source->argv[0], value);
+						*cmd_exit = 1;
+						return;
+					}
+					limited = 1;
+					break;
+				case 't':
+					timeout = strtod(value, &end);
+					if (value[0] == '\0' || *end != '\0' || timeout < 0) {
+						fprintf(stderr, "%s: read: %s: invalid timeout specification\n", source->argv[0], value);
+						*cmd_exit = 1;
+						return;
+					}
+					timed = 1;
+					break;
+			}
+			break;
+		}
+		if (argv[i] == NULL)
+			break;
+	}
+	for (size_t n = i; argv[n] != NULL; ++n) {
+		if (varNameLength(argv[n]) != strlen(argv[n])) {
+			fprintf(stderr, "%s: read: `%s': not a valid identifier\n", source->argv[0], argv[n]);
+			*cmd_exit = 1;
+			return;
+		}
 	}
-	else {
-		if (value[bytes_read - 1] == '\n')
-			value[bytes_read - 1] = '\0';
-		if (argv[1] != NULL) {
-			if (setvar(vars, argv[1], value, 0) == -1) {
-				*cmd_exit = errno;
-				fprintf(stderr, "%s: read: %m\n", source->argv[0]);
+
+	int fd = filein == NULL ? STDIN_FILENO : fileno(filein);
+	// -t 0 only checks for input
+	if (timed && timeout == 0) {
+		*cmd_exit = !inputReady(fd, 0);
+		return;
+	}
+	struct timespec deadline;
+	if (timed) {
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_sec += (time_t)timeout;
+		deadline.tv_nsec += (long)((timeout - (time_t)timeout) * 1e9);
+		if (deadline.tv_nsec >= 1000000000) {
+			++deadline.tv_sec;
+			deadline.tv_nsec -= 1000000000;
+		}
+	}
+
+	// Read up to the delimiter, escaped characters keep their backslash (for splitting) until they are assigned
+	char *line = NULL;
+	size_t len = 0, size = 0;
+	long long count = 0;
+	_Bool escape = 0, done = limited && max == 0;
+	while (!done) {
+		if (timed && !inputReady(fd, remaining(&deadline))) {
+			*cmd_exit = READ_TIMEOUT;
+			break;
+		}
+		char *data;
+		ssize_t avail = inputPeek(fd, &data, 0);
+		if (avail < 1) {
+			*cmd_exit = 1;
+			break;
+		}
+
+		// Most lines have no escapes or limit, and the whole line is found at once
+		if (!limited && !escape) {
+			char *found = memchr(data, delim, avail);
+			size_t chunk = found == NULL ? avail : found - data;
+			if (raw || memchr(data, '\\', chunk) == NULL) {
+				lineAppend(&line, &len, &size, data, chunk);
+				inputConsume(fd, chunk + (found != NULL));
+				done = found != NULL;
+				continue;
 			}
 		}
+
+		size_t used = 0;
+		for (; used < avail && !done; ++used) {
+			char c = data[used];
+			if (escape) {
+				escape = 0;
+				// Escaped newlines continue the line
+				if (c == '\n') {
+					--len;
+					continue;
+				}
+			}
+			else if (c == delim) {
+				done = 1;
+				continue;
+			}
+			else if (c == '\\' && !raw) {
+				escape = 1;
+				lineAppend(&line, &len, &size, &c, 1);
+				continue;
+			}
+			lineAppend(&line, &len, &size, &c, 1);
+			done = limited && ++count >= max;
+		}
+		inputConsume(fd, used);
+	}
+	if (escape) // Backslash at the end of the input
+		--len;
+	lineAppend(&line, &len, &size, "", 1);
+	--len;
+
+	// Without names, the whole line
+	_Bool escapes = !raw && memchr(line, '\\', len) != NULL;
+	if (argv[i] == NULL) {
+		if (escapes)
+			line[unescape(line, len)] = '\0';
+		readAssign(cmd_exit, "REPLY", line, source, vars);
+		free(line);
+		return;
+	}
+
+	Ifs ifs;
+	ifsInit(&ifs, getvar(vars, "IFS"));
+	size_t pos = 0, start, field_len;
+	for (; argv[i + 1] != NULL; ++i) {
+		if (!readField(&ifs, line, len, escapes, &pos, &start, &field_len)) {
+			readAssign(cmd_exit, argv[i], "", source, vars);
+			continue;
+		}
+		if (escapes)
+			field_len = unescape(&line[start], field_len);
+		line[start + field_len] = '\0';
+		readAssign(cmd_exit, argv[i], &line[start], source, vars);
+	}
+
+	// The last name gets the rest, without the IFS whitespace around it (or the delimiter after it if it is one field)
+	size_t end = len;
+	if (pos < len) {
+		while (pos < end && ifs.class[(unsigned char)line[pos]] == IFS_SPACE)
+			++pos;
+		while (end > pos && ifs.class[(unsigned char)line[end - 1]] == IFS_SPACE && !(escapes && escapedAt(line, pos, end - 1)))
+			--end;
+		size_t field_pos = 0;
+		if (readField(&ifs, &line[pos], end - pos, escapes, &field_pos, &start, &field_len) && field_pos == end - pos) {
+			pos += start;
+			end = pos + field_len;
+		}
+		if (escapes)
+			end = pos + unescape(&line[pos], end - pos);
 	}
-	free(value);
+	else
+		pos = end;
+	line[end] = '\0';
+	readAssign(cmd_exit, argv[i], &line[pos], source, vars);
+	free(line);
 }
@@ -0,0 +1,15 @@
+#include "mash.h"
+#include <stdio.h>
+
+CmdSignal b_return(uint8_t *cmd_exit, char **argv, int argc, Source *source) {
+	// Without an argument, the exit status is that of the last command
+	if (argc > 1) {
+		int temp;
+		if (sscanf(argv[1], "%d", &temp) != 1) {
+			fprintf(stderr, "%s: return: %s: numeric argument required\n", source->argv[0], argv[1]);
+			temp = 2;
+		}
+		*cmd_exit = temp & 255;
+	}
+	return CSIG_RETURN;
+}
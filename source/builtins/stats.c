@@ -0,0 +1,16 @@
+#include "command.h"
+#include "mash.h"
+#include <stdio.h>
+#include <unistd.h>
+
+void b_stats(uint8_t *cmd_exit) {
+	*cmd_exit = 0;
+	size_t hits, misses, entries;
+	scriptCacheStats(&hits, &misses, &entries);
+	char line[128];
+	int len = snprintf(line, sizeof (line), "source cache: %zu hits, %zu misses, %zu files\n", hits, misses, entries);
+	outputWrite(STDOUT_FILENO, line, len);
+	regexCacheStats(&hits, &misses, &entries);
+	len = snprintf(line, sizeof (line), "regex cache: %zu hits, %zu misses, %zu patterns\n", hits, misses, entries);
+	outputWrite(STDOUT_FILENO, line, len);
+}
@@ -0,0 +1,335 @@
+#define _XOPEN_SOURCE 700 // faccessat, st_mtim, S_ISVTX
+#include "mash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Conditional expressions, shared by test, [ and [[.
+ * Functions return 0 if the expression is true, 1 if false, and 2 on error.
+ */
+
+static const struct {
+	char *str;
+	enum _test_op op;
+} unary_ops[] = {
+	{ "-n", TEST_NONEMPTY }, { "-z", TEST_EMPTY },
+	{ "-e", TEST_EXISTS }, { "-a", TEST_EXISTS }, { "-f", TEST_REGULAR }, { "-d", TEST_DIRECTORY },
+	{ "-b", TEST_BLOCK }, { "-c", TEST_CHARACTER }, { "-p", TEST_FIFO }, { "-h", TEST_SYMLINK },
+	{ "-L", TEST_SYMLINK }, { "-S", TEST_SOCKET }, { "-u", TEST_SETUID }, { "-g", TEST_SETGID },
+	{ "-k", TEST_STICKY }, { "-s", TEST_SIZE }, { "-r", TEST_READ }, { "-w", TEST_WRITE },
+	{ "-x", TEST_EXECUTE }, { "-t", TEST_TERMINAL }, { "-O", TEST_OWNER }, { "-G", TEST_GROUP },
+	{ "-v", TEST_SET }
+}, binary_ops[] = {
+	{ "=", TEST_STR_EQ }, { "==", TEST_STR_EQ }, { "!=", TEST_STR_NE }, { "<", TEST_STR_LT }, { ">", TEST_STR_GT },
+	{ "-eq", TEST_INT_EQ }, { "-ne", TEST_INT_NE }, { "-lt", TEST_INT_LT }, { "-le", TEST_INT_LE },
+	{ "-gt", TEST_INT_GT }, { "-ge", TEST_INT_GE },
+	{ "-nt", TEST_NEWER }, { "-ot", TEST_OLDER }, { "-ef", TEST_SAME_FILE }
+};
+
+enum _test_op testUnaryOp(char *str) {
+	if (str[0] == '-' && str[1] != '\0' && str[2] == '\0')
+		for (size_t i = 0; i < sizeof (unary_ops) / sizeof (*unary_ops); ++i)
+			if (unary_ops[i].str[1] == str[1])
+				return unary_ops[i].op;
+	return TEST_NONE;
+}
+
+enum _test_op testBinaryOp(char *str) {
+	for (size_t i = 0; i < sizeof (binary_ops) / sizeof (*binary_ops); ++i)
+		if (!strcmp(binary_ops[i].str, str))
+			return binary_ops[i].op;
+	return TEST_NONE;
+}
+
+int testUnary(enum _test_op op, char *str, Variables *vars) {
+	switch (op) {
+		case TEST_STRING:
+		case TEST_NONEMPTY:
+			return str[0] == '\0';
+		case TEST_EMPTY:
+			return str[0] != '\0';
+		case TEST_SET:
+			return getvar(vars, str) == NULL;
+		case TEST_TERMINAL: {
+			char *end;
+			long fd = strtol(str, &end, 10);
+			return *end != '\0' || end == str || !isatty(fd);
+		}
+		// Permissions are checked against the effective ids, like the kernel would
+		case TEST_READ:
+			return faccessat(AT_FDCWD, str, R_OK, AT_EACCESS) == -1;
+		case TEST_WRITE:
+			return faccessat(AT_FDCWD, str, W_OK, AT_EACCESS) == -1;
+		case TEST_EXECUTE:
+			return faccessat(AT_FDCWD, str, X_OK, AT_EACCESS) == -1;
+		default:
+			break;
+	}
+
+	struct stat st;
+	if ((op == TEST_SYMLINK ? lstat(str, &st) : stat(str, &st)) == -1)
+		return 1;
+	switch (op) {
+		case TEST_EXISTS:
+			return 0;
+		case TEST_REGULAR:
+			return !S_ISREG(st.st_mode);
+		case TEST_DIRECTORY:
+			return !S_ISDIR(st.st_mode);
+		case TEST_BLOCK:
+			return !S_ISBLK(st.st_mode);
+		case TEST_CHARACTER:
+			return !S_ISCHR(st.st_mode);
+		case TEST_FIFO:
+			return !S_ISFIFO(st.st_mode);
+		case TEST_SYMLINK:
+			return !S_ISLNK(st.st_mode);
+		case TEST_SOCKET:
+			return !S_ISSOCK(st.st_mode);
+		case TEST_SETUID:
+			return !(st.st_mode & S_ISUID);
+		case TEST_SETGID:
+			return !(st.st_mode & S_ISGID);
+		case TEST_STICKY:
+			return !(st.st_mode & S_ISVTX);
+		case TEST_SIZE:
+			return st.st_size == 0;
+		case TEST_OWNER:
+			return st.st_uid != geteuid();
+		case TEST_GROUP:
+			return st.st_gid != getegid();
+		default:
+			return 2;
+	}
+}
+
+int testCompare(enum _test_op op, long long a, long long b) {
+	switch (op) {
+		case TEST_INT_EQ:
+			return !(a == b);
+		case TEST_INT_NE:
+			return !(a != b);
+		case TEST_INT_LT:
+			return !(a < b);
+		case TEST_INT_LE:
+			return !(a <= b);
+		case TEST_INT_GT:
+			return !(a > b);
+		case TEST_INT_GE:
+			return !(a >= b);
+		default:
+			return 2;
+	}
+}
+
+// Parse an integer operand (surrounding blanks are allowed), returns -1 if it isn't one
+static int testInteger(long long *number, char *str) {
+	char *end;
+	errno = 0;
+	*number = strtoll(str, &end, 10);
+	if (end == str || errno)
+		return -1;
+	end += strspn(end, " \t");
+	return *end == '\0' ? 0 : -1;
+}
+
+// Compare two file modification times
+static int compareTimes(struct stat *a, struct stat *b) {
+	if (a->st_mtim.tv_sec != b->st_mtim.tv_sec)
+		return a->st_mtim.tv_sec < b->st_mtim.tv_sec ? -1 : 1;
+	if (a->st_mtim.tv_nsec != b->st_mtim.tv_nsec)
+		return a->st_mtim.tv_nsec < b->st_mtim.tv_nsec ? -1 : 1;
+	return 0;
+}
+
+int testBinary(enum _test_op op, char *a, char *b) {
+	switch (op) {
+		case TEST_STR_EQ:
+			return strcmp(a, b) != 0;
+		case TEST_STR_NE:
+			return strcmp(a, b) == 0;
+		case TEST_STR_LT:
+			return strcmp(a, b) >= 0;
+		case TEST_STR_GT:
+			return strcmp(a, b) <= 0;
+		case TEST_NEWER:
+		case TEST_OLDER:
+		case TEST_SAME_FILE: {
+			// A file that doesn't exist is older than one that does
+			struct stat st_a, st_b;
+			_Bool has_a = stat(a, &st_a) == 0, has_b = stat(b, &st_b) == 0;
+			if (op == TEST_SAME_FILE)
+				return !(has_a && has_b && st_a.st_dev == st_b.st_dev && st_a.st_ino == st_b.st_ino);
+			if (!has_a || !has_b)
+				return op == TEST_NEWER ? !has_a : !has_b;
+			return op == TEST_NEWER ? compareTimes(&st_a, &st_b) <= 0 : compareTimes(&st_a, &st_b) >= 0;
+		}
+		default: {
+			long long num_a, num_b;
+			if (testInteger(&num_a, a) == -1 || testInteger(&num_b, b) == -1)
+				return 2;
+			return testCompare(op, num_a, num_b);
+		}
+	}
+}
+
+/*
+ * test/[ expression parser.
+ * -a binds tighter than -o, and a binary operator always wins over a unary one
+ * or ! (so `test ! = x' compares two strings, as POSIX requires).
+ */
+typedef struct _test_parser TestParser;
+struct _test_parser {
+	char **argv;
+	int argc, pos;
+	Variables *vars;
+	char *error, *operand; // Operand the error is about (if any)
+};
+
+static int testOr(TestParser*);
+
+static int testPrimary(TestParser *p) {
+	if (p->pos >= p->argc) {
+		p->error = "argument expected";
+		return 2;
+	}
+	char *arg = p->argv[p->pos];
+
+	// Binary operator
+	if (p->pos + 2 < p->argc) {
+		enum _test_op op = testBinaryOp(p->argv[p->pos + 1]);
+		if (op != TEST_NONE) {
+			p->pos += 3;
+			int ret = testBinary(op, arg, p->argv[p->pos - 1]);
+			if (ret == 2) {
+				long long number;
+				p->error = "integer expression expected";
+				p->operand = testInteger(&number, arg) == -1 ? arg : p->argv[p->pos - 1];
+			}
+			return ret;
+		}
+	}
+	if (!strcmp(arg, "!")) {
+		++p->pos;
+		int ret = testPrimary(p);
+		return ret == 2 ? 2 : !ret;
+	}
+	if (!strcmp(arg, "(")) {
+		++p->pos;
+		int ret = testOr(p);
+		if (ret != 2 && (p->pos >= p->argc || strcmp(p->argv[p->pos], ")"))) {
+			p->error = "`)' expected";
+			return 2;
+		}
+		++p->pos;
+		return ret;
+	}
+	enum _test_op op = testUnaryOp(arg);
+	if (op != TEST_NONE && p->pos + 1 < p->argc) {
+		p->pos += 2;
+		return testUnary(op, p->argv[p->pos - 1], p->vars);
+	}
+	++p->pos;
+	return testUnary(TEST_STRING, arg, p->vars);
+}
+
+static int testAnd(TestParser *p) {
+	int ret = testPrimary(p);
+	while (ret != 2 && p->pos < p->argc && !strcmp(p->argv[p->pos], "-a")) {
+		++p->pos;
+		int right = testPrimary(p);
+		ret = right == 2 ? 2 : ret || right;
+	}
+	return ret;
+}
+
+static int testOr(TestParser *p) {
+	int ret = testAnd(p);
+	while (ret != 2 && p->pos < p->argc && !strcmp(p->argv[p->pos], "-o")) {
+		++p->pos;
+		int right = testAnd(p);
+		ret = right == 2 ? 2 : ret && right;
+	}
+	return ret;
+}
+
+/*
+ * POSIX decides expressions of up to 4 arguments by how many there are, before looking at precedence (so `[ ! ]'
+ * is true, it is a single non-empty string). Returns -1 when it is left to the parser.
+ */
+static int testCount(TestParser *p, char **argv, int argc) {
+	int ret;
+	switch (argc) {
+		case 0:
+			return 1;
+		case 1:
+			return argv[0][0] == '\0';
+		case 2:
+			if (!strcmp(argv[0], "!"))
+				return !testCount(p, &argv[1], 1);
+			if (testUnaryOp(argv[0]) != TEST_NONE)
+				return testUnary(testUnaryOp(argv[0]), argv[1], p->vars);
+			return -1;
+		case 3:
+			// Binary operators are left to the parser, which reports their errors
+			if (testBinaryOp(argv[1]) != TEST_NONE)
+				return -1;
+			if (!strcmp(argv[1], "-a") || !strcmp(argv[1], "-o")) {
+				int left = testCount(p, argv, 1), right = testCount(p, &argv[2], 1);
+				return argv[1][1] == 'a' ? left || right : left && right;
+			}
+			if (!strcmp(argv[0], "!")) {
+				ret = testCount(p, &argv[1], 2);
+				return ret == 0 || ret == 1 ? !ret : ret;
+			}
+			if (!strcmp(argv[0], "(") && !strcmp(argv[2], ")"))
+				return testCount(p, &argv[1], 1);
+			return -1;
+		case 4:
+			if (!strcmp(argv[0], "!")) {
+				ret = testCount(p, &argv[1], 3);
+				return ret == 0 || ret == 1 ? !ret : ret;
+			}
+			if (!strcmp(argv[0], "(") && !strcmp(argv[3], ")"))
+				return testCount(p, &argv[1], 2);
+			return -1;
+		default:
+			return -1;
+	}
+}
+
+void b_test(uint8_t *cmd_exit, char **argv, int argc, Source *source, Variables *vars) {
+	char *name = argv[0];
+	if (!strcmp(name, "[")) {
+		if (strcmp(argv[argc - 1], "]")) {
+			fprintf(stderr, "%s: [: missing `]'\n", source->argv[0]);
+			*cmd_exit = 2;
+			return;
+		}
+		--argc;
+	}
+
+	TestParser parser = { .argv = &argv[1], .argc = argc - 1, .pos = 0, .vars = vars, .error = NULL, .operand = NULL };
+	int ret = testCount(&parser, parser.argv, parser.argc);
+	if (ret != -1) {
+		*cmd_exit = ret;
+		return;
+	}
+	ret = testOr(&parser);
+	if (ret != 2 && parser.pos < parser.argc) {
+		parser.error = "too many arguments";
+		ret = 2;
+	}
+	if (ret == 2) {
+		if (parser.operand != NULL)
+			fprintf(stderr, "%s: %s: %s: %s\n", source->argv[0], name, parser.operand, parser.error);
+		else
+			fprintf(stderr, "%s: %s: %s\n", source->argv[0], name, parser.error == NULL ? "syntax error" : parser.error);
+	}
+	*cmd_exit = ret;
+}
@@ -1,9 +1,45 @@
 #include "mash.h"
 #include <stdio.h>
+#include <string.h>
 
 void b_unset(uint8_t *cmd_exit, char **argv, Source *source, Variables *vars) {
-	for (size_t i = 1; argv[i] != NULL; ++i) {
-		if (unsetvar(vars, argv[i]) == -1) {
+	// -f removes functions instead of variables
+	_Bool functions = 0;
+	size_t i = 1;
+	if (argv[i] != NULL && (!strcmp(argv[i], "-f") || !strcmp(argv[i], "-v")))
+		functions = argv[i++][1] == 'f';
+	for (; argv[i] != NULL; ++i) {
+		size_t name_len = varNameLength(argv[i]), len = strlen(argv[i]);
+		if (functions)
+			functionUnset(argv[i]);
+		// name[subscript] removes one element (name[@] and name[*] the whole array)
+		else if (name_len > 0 && argv[i][name_len] == '[' && len > name_len + 2 && argv[i][len - 1] == ']') {
+			// Words can point into the parsed command, so they are copied instead of cut up in place
+			char name[name_len + 1], sub[len - name_len - 1];
+			memcpy(name, argv[i], name_len);
+			name[name_len] = '\0';
+			memcpy(sub, &argv[i][name_len + 1], len - name_len - 2);
+			sub[len - name_len - 2] = '\0';
+			Variable *var = variableIntern(vars, name);
+			long long index;
+			if (!strcmp(sub, "@") || !strcmp(sub, "*")) {
+				if (unsetvar(vars, name) == -1) {
+					fprintf(stderr, "%s: unset: %m\n", source->argv[0]);
+					*cmd_exit = 1;
+				}
+			}
+			else if (var->assoc != NULL)
+				variableKeyUnset(var, sub);
+			else if (evaluateMathString(&index, sub, vars) == -1) {
+				fprintf(stderr, "%s: unset: %s: syntax error in expression\n", source->argv[0], sub);
+				*cmd_exit = 1;
+			}
+			else if (!variableElementUnset(var, index)) {
+				fprintf(stderr, "%s: unset: [%lld]: bad array subscript\n", source->argv[0], index);
+				*cmd_exit = 1;
+			}
+		}
+		else if (unsetvar(vars, argv[i]) == -1) {
 			fprintf(stderr, "%s: unset: %m\n", source->argv[0]);
 			*cmd_exit = 1;
 		}
@@ -1,12 +1,13 @@
 #define _POSIX_C_SOURCE 200809L // strdup
 #include "command.h"
-#include "compatibility.h" // For reallocarray
+#include <stdlib.h>
 #include <string.h>
 
 AliasMap *aliasInit() {
 	AliasMap *info = malloc(sizeof (AliasMap));
 	info->buckets = 16;
 	info->map = createTable(info->buckets);
+	info->resolved = 0;
 	return info;
 }
 
@@ -15,9 +16,7 @@ void aliasFree(AliasMap *info) {
 		for (Node *node = info->map[bucket].next; node != NULL; node = node->next) {
 			Alias *alias = node->entry.data;
 			free(alias->str);
-			for (size_t i = 0; i < alias->argc; ++i)
-				freeArg(alias->args[i]);
-			free(alias->args);
+			arenaRelease(alias->arena);
 			free(alias);
 		}
 		free_nodes(info->map[bucket].next);
@@ -28,7 +27,7 @@ void aliasFree(AliasMap *info) {
 
 void aliasResolve(AliasMap *info, Command *cmd) {
 	// Cannot check for alias from this command
-	if (cmd->c_type != CMD_REGULAR || cmd->c_argv[0].type != ARG_BASIC_STRING)
+	if (cmd->c_type != CMD_REGULAR || cmd->c_argc == 0 || cmd->c_argv[0].type != ARG_BASIC_STRING)
 		return;
 
 	TableEntry *entry = tableSearch(info->map, info->buckets, cmd->c_argv[0].str);
@@ -38,15 +37,15 @@ void aliasResolve(AliasMap *info, Command *cmd) {
 
 	// Update command
 	Alias *alias = entry->data;
+	++info->resolved;
 	int temp_argc = cmd->c_argc;
 	cmd->c_argc += alias->argc - 1;
-	cmd->c_argv = reallocarray(cmd->c_argv, cmd->c_argc, sizeof (CmdArg));
-	// Delete alias arg and shift remaining args
-	freeArg(cmd->c_argv[0]);
+	cmd->c_argv = arenaGrow(cmd->c_arena, cmd->c_argv, temp_argc * sizeof (CmdArg), cmd->c_argc * sizeof (CmdArg));
+	// Replace alias arg and shift remaining args
 	for (size_t i = 0; i < temp_argc - 1; ++i)
 		cmd->c_argv[cmd->c_argc - i - 1] = cmd->c_argv[temp_argc - i - 1];
 	for (size_t i = 0; i < alias->argc; ++i)
-		cmd->c_argv[i] = argdup(alias->args[i]);
+		cmd->c_argv[i] = argdup(cmd->c_arena, alias->args[i]);
 	// Check if new argv[0] is the same as the alias name. If not, run through again.
 	// Shouldn't do this if they are the same, since it's perfectly normal to alias 'ls' to 'ls --color=auto' for example (infinite recursion).
 	if (strcmp(cmd->c_argv[0].str, entry->key))
@@ -61,9 +60,7 @@ Alias *aliasAdd(AliasMap *info, char *name, char *str) {
 	Alias *alias = entry->data;
 	if (alias != NULL) {
 		free(alias->str);
-		for (size_t i = 0; i < alias->argc; ++i)
-			freeArg(alias->args[i]);
-		free(alias->args);
+		arenaRelease(alias->arena);
 	}
 	// Otherwise create a new one
 	else
@@ -73,11 +70,16 @@ Alias *aliasAdd(AliasMap *info, char *name, char *str) {
 	alias->str = strdup(str);
 
 	// Parse string into args (so we don't have to do that every single time the alias is called)
-	Command temp = {};
-	temp.c_size = (temp.c_len = strlen(str)) + 1;
-	temp.c_buf = str;
-	if (commandParse(&temp, NULL, NULL, NULL, NULL) != 0) { // TODO: we should parse this earlier, that way if there's an error, and the alias already existed, we don't delete the old one
-		commandFree(&temp);
+	// Parsing consumes the buffer, and str may belong to someone else
+	size_t len = strlen(str);
+	char buf[len + 1];
+	memcpy(buf, str, len + 1);
+	Command temp = { .c_arena = arenaInit() };
+	temp.c_size = (temp.c_len = len) + 1;
+	temp.c_buf = buf;
+	alias->arena = temp.c_arena;
+	if (commandParse(&temp, NULL, NULL, NULL, NULL, NULL) != 0) { // TODO: we should parse this earlier, that way if there's an error, and the alias already existed, we don't delete the old one
+		arenaRelease(alias->arena);
 		free(alias->str);
 		free(alias);
 		info->map = tableRemove(info->map, &info->buckets, name);
@@ -96,9 +98,7 @@ int aliasRemove(AliasMap *info, char *name) {
 
 	Alias *alias = entry->data;
 	free(alias->str);
-	for (size_t i = 0; i < alias->argc; ++i)
-		freeArg(alias->args[i]);
-	free(alias->args);
+	arenaRelease(alias->arena);
 	free(alias);
 
 	info->map = tableRemove(info->map, &info->buckets, name);
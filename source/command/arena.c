@@ -0,0 +1,133 @@
+#include "command.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Parse arenas.
+ * Everything a parse creates (commands, argument arrays, token strings,
+ * compiled expressions) is bump allocated from blocks owned by one arena,
+ * so nothing is freed on its own, and the whole tree is freed in one call.
+ */
+
+#define ARENA_BLOCK_SIZE 4096   // First block, allocated together with the arena
+#define ARENA_MAX_BLOCK 65536   // Blocks double in size up to this
+#define ARENA_ALIGN 8
+
+// The first block is part of the same allocation as the arena
+#define firstBlock(arena) ((ArenaBlock*)((char*)(arena) + sizeof (Arena)))
+
+Arena *arenaInit() {
+	Arena *arena = malloc(sizeof (Arena) + sizeof (ArenaBlock) + ARENA_BLOCK_SIZE);
+	*arena = (Arena){ .block = firstBlock(arena), .last = NULL, .refs = 1, .cleanups = NULL };
+	*arena->block = (ArenaBlock){ .prev = NULL, .used = 0, .size = ARENA_BLOCK_SIZE };
+	return arena;
+}
+
+static void *arenaBytes(Arena *arena, size_t size, size_t align) {
+	ArenaBlock *block = arena->block;
+	size_t start = (block->used + align - 1) & ~(align - 1);
+	if (start + size > block->size) {
+		size_t block_size = block->size * 2 > ARENA_MAX_BLOCK ? ARENA_MAX_BLOCK : block->size * 2;
+		if (size > block_size / 4) {
+			// Too big to share a block, it gets its own behind the current one
+			ArenaBlock *own = malloc(sizeof (ArenaBlock) + size);
+			*own = (ArenaBlock){ .prev = block->prev, .used = size, .size = size };
+			block->prev = own;
+			return own->data;
+		}
+		block = malloc(sizeof (ArenaBlock) + block_size);
+		*block = (ArenaBlock){ .prev = arena->block, .used = 0, .size = block_size };
+		arena->block = block;
+		start = 0;
+	}
+	block->used = start + size;
+	return arena->last = &block->data[start];
+}
+
+// Uninitialized memory, aligned for any of the parser's structures
+void *arenaAlloc(Arena *arena, size_t size) {
+	return arenaBytes(arena, size, ARENA_ALIGN);
+}
+
+/*
+ * Resize an allocation from the arena (like realloc), the most recent allocation is extended in place if it fits.
+ * The old memory is only reclaimed with the arena.
+ */
+void *arenaGrow(Arena *arena, void *ptr, size_t old_size, size_t size) {
+	ArenaBlock *block = arena->block;
+	if (ptr != NULL && ptr == arena->last && (char*)ptr - block->data + size <= block->size) {
+		block->used = (char*)ptr - block->data + size;
+		return ptr;
+	}
+	void *new_ptr = arenaAlloc(arena, size);
+	if (ptr != NULL)
+		memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+	return new_ptr;
+}
+
+// Copy of len bytes of str and a null terminator, strings are packed without alignment
+char *arenaStrndup(Arena *arena, const char *str, size_t len) {
+	char *copy = arenaBytes(arena, len + 1, 1);
+	memcpy(copy, str, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+// Remember how much of the arena is in use, to release everything allocated after this with arenaReset
+ArenaMark arenaMark(Arena *arena) {
+	return (ArenaMark){ .block = arena->block, .prev = arena->block->prev, .used = arena->block->used };
+}
+
+// Free everything allocated since mark was taken, marks have to be reset in the reverse order they were taken
+void arenaReset(Arena *arena, ArenaMark mark) {
+	// Blocks started since the mark (and oversized ones linked behind them)
+	while (arena->block != mark.block) {
+		ArenaBlock *prev = arena->block->prev;
+		free(arena->block);
+		arena->block = prev;
+	}
+	// Oversized blocks linked behind the marked block
+	while (mark.block->prev != mark.prev) {
+		ArenaBlock *prev = mark.block->prev->prev;
+		free(mark.block->prev);
+		mark.block->prev = prev;
+	}
+	mark.block->used = mark.used;
+	arena->last = NULL;
+}
+
+// Call fn with data when the arena is freed (for memory that has to be freed some other way, like compiled regexes)
+void arenaCleanup(Arena *arena, void (*fn)(void*), void *data) {
+	ArenaCleanup *cleanup = arenaAlloc(arena, sizeof (ArenaCleanup));
+	*cleanup = (ArenaCleanup){ .fn = fn, .data = data, .next = arena->cleanups };
+	arena->cleanups = cleanup;
+}
+
+void arenaRetain(Arena *arena) {
+	++arena->refs;
+}
+
+// Drop a reference, everything allocated from the arena is freed with the last one
+void arenaRelease(Arena *arena) {
+	if (--arena->refs > 0)
+		return;
+	for (ArenaCleanup *cleanup = arena->cleanups; cleanup != NULL; cleanup = cleanup->next)
+		cleanup->fn(cleanup->data);
+	for (ArenaBlock *block = arena->block, *prev; block != NULL; block = prev) {
+		prev = block->prev;
+		if (block != firstBlock(arena))
+			free(block);
+	}
+	free(arena);
+}
+
+// Add a word to a list growing in arena, which is kept terminated by NULL
+void wordAppend(Arena *arena, WordList *list, char *word) {
+	if (list->count + 1 >= list->size) {
+		size_t size = list->size < 8 ? 8 : list->size * 2;
+		list->words = arenaGrow(arena, list->words, list->size * sizeof (char*), size * sizeof (char*));
+		list->size = size;
+	}
+	list->words[list->count++] = word;
+	list->words[list->count] = NULL;
+}
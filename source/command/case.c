@@ -0,0 +1,286 @@
+#include "command.h"
+#include "compatibility.h" // For reallocarray
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * case dispatch.
+ * A case command runs the first arm with a pattern matching its word. Rather
+ * than trying every pattern in turn, literal patterns are looked up in a hash
+ * table, and the glob patterns of every arm are combined into one DFA (built
+ * when the command is parsed) that finds the first arm they match in a single
+ * pass over the word. Patterns with expansions can't be compiled until they
+ * run, so the executor tries those itself, only in arms before the best match.
+ */
+
+#define CASE_DFA_STATES 1024 // Globs needing a bigger automaton than this are matched one at a time
+
+#define classHas(class, c) ((class)[(unsigned char)(c) >> 3] & 1 << ((unsigned char)(c) & 7))
+
+Pattern *literalPattern(Arena*, CmdArg);
+
+// FNV-1a
+static uint64_t caseHash(const char *str, size_t len) {
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < len; ++i)
+		hash = (hash ^ (unsigned char)str[i]) * 0x100000001B3;
+	return hash;
+}
+
+// Position in a glob pattern (NFA state), which steps to the next one on a character
+typedef struct _case_position CasePosition;
+struct _case_position {
+	enum _pattern_type type; // What the step matches, PAT_LITERAL is the single character c
+	unsigned char c;
+	unsigned char *class;
+	_Bool loop;              // After a star, so any character stays here
+	_Bool last;              // End of the pattern, matches arm (there is no step)
+	size_t arm;
+};
+
+static _Bool positionStep(CasePosition *pos, unsigned char c) {
+	if (pos->last)
+		return 0;
+	switch (pos->type) {
+		case PAT_ANY:
+			return 1;
+		case PAT_CLASS:
+			return classHas(pos->class, c);
+		default:
+			return pos->c == c;
+	}
+}
+
+// Glob pattern waiting to be added to the automaton
+typedef struct _case_glob CaseGlob;
+struct _case_glob {
+	Pattern *pattern;
+	size_t arm;
+};
+
+/*
+ * Build the DFA of every glob (subset construction, over classes of bytes that every pattern treats the same).
+ * Returns 0 if it would need more than CASE_DFA_STATES states.
+ */
+static _Bool caseAutomaton(Arena *arena, CaseTable *table, CaseGlob *globs, size_t glob_count) {
+	// One position per character a pattern consumes, plus its end
+	size_t count = 0, capacity = 0;
+	CasePosition *positions = NULL;
+	size_t starts[glob_count];
+	for (size_t g = 0; g < glob_count; ++g) {
+		Pattern *pat = globs[g].pattern;
+		size_t needed = count + pat->min_length + 1;
+		if (needed > capacity) {
+			capacity = needed * 2;
+			positions = reallocarray(positions, capacity, sizeof (CasePosition));
+		}
+		starts[g] = count;
+		CasePosition *pos = &positions[count];
+		*pos = (CasePosition){ .loop = 0, .last = 0 };
+		for (size_t n = 0; n < pat->count; ++n) {
+			PatternNode *node = &pat->nodes[n];
+			if (node->type == PAT_STAR) {
+				pos->loop = 1;
+				continue;
+			}
+			for (size_t c = 0; c < (node->type == PAT_LITERAL ? node->length : 1); ++c) {
+				pos->type = node->type;
+				pos->c = node->type == PAT_LITERAL ? node->literal[c] : 0;
+				pos->class = node->type == PAT_CLASS ? node->class : NULL;
+				pos = &positions[++count];
+				*pos = (CasePosition){ .loop = 0, .last = 0 };
+			}
+		}
+		pos->last = 1;
+		pos->arm = globs[g].arm;
+		++count;
+	}
+
+	// Split bytes into classes, each step either takes a whole class or none of it
+	unsigned char classes[256] = { 0 }, reps[256] = { 0 };
+	size_t class_count = 1;
+	for (size_t p = 0; p < count; ++p) {
+		if (positions[p].last || positions[p].type == PAT_ANY)
+			continue;
+		short remap[512];
+		memset(remap, -1, sizeof (remap));
+		size_t split = 0;
+		for (int b = 0; b < 256; ++b) {
+			size_t key = classes[b] * 2 + positionStep(&positions[p], b);
+			if (remap[key] == -1)
+				remap[key] = split++;
+			classes[b] = remap[key];
+		}
+		class_count = split;
+	}
+	for (int b = 255; b >= 0; --b)
+		reps[classes[b]] = b;
+
+	// States are sets of positions, found again through a hash table of their sets
+	size_t words = (count + 63) / 64, slots = CASE_DFA_STATES * 2, state_count = 0;
+	uint64_t *sets = calloc(CASE_DFA_STATES, words * sizeof (uint64_t));
+	size_t *index = calloc(slots, sizeof (size_t)); // State + 1, 0 if the slot is empty
+	uint16_t *next = malloc(CASE_DFA_STATES * class_count * sizeof (uint16_t));
+	uint64_t set[words];
+	_Bool fits = 1;
+
+	// State 0 is the empty set, 1 is every pattern's start
+	for (size_t s = 0; fits && s < 2; ++s) {
+		memset(set, 0, sizeof (set));
+		for (size_t g = 0; s == 1 && g < glob_count; ++g)
+			set[starts[g] / 64] |= (uint64_t)1 << starts[g] % 64;
+		memcpy(&sets[state_count * words], set, sizeof (set));
+		size_t slot = caseHash((char*)set, sizeof (set)) & (slots - 1);
+		while (index[slot] != 0)
+			slot = (slot + 1) & (slots - 1);
+		index[slot] = ++state_count;
+	}
+	for (size_t c = 0; c < class_count; ++c)
+		next[c] = 0;
+	for (size_t state = 1; fits && state < state_count; ++state) {
+		for (size_t c = 0; c < class_count; ++c) {
+			memset(set, 0, sizeof (set));
+			uint64_t *from = &sets[state * words];
+			for (size_t p = 0; p < count; ++p) {
+				if (!(from[p / 64] >> p % 64 & 1))
+					continue;
+				if (positions[p].loop)
+					set[p / 64] |= (uint64_t)1 << p % 64;
+				if (positionStep(&positions[p], reps[c]))
+					set[(p + 1) / 64] |= (uint64_t)1 << (p + 1) % 64;
+			}
+			size_t slot = caseHash((char*)set, sizeof (set)) & (slots - 1);
+			while (index[slot] != 0 && memcmp(&sets[(index[slot] - 1) * words], set, sizeof (set)))
+				slot = (slot + 1) & (slots - 1);
+			if (index[slot] == 0) {
+				if (state_count == CASE_DFA_STATES) {
+					fits = 0;
+					break;
+				}
+				memcpy(&sets[state_count * words], set, sizeof (set));
+				index[slot] = ++state_count;
+			}
+			next[state * class_count + c] = index[slot] - 1;
+		}
+	}
+
+	if (fits) {
+		table->state_count = state_count;
+		table->class_count = class_count;
+		memcpy(table->classes, classes, sizeof (classes));
+		table->next = arenaAlloc(arena, state_count * class_count * sizeof (uint16_t));
+		memcpy(table->next, next, state_count * class_count * sizeof (uint16_t));
+		table->accept = arenaAlloc(arena, state_count * sizeof (size_t));
+		for (size_t state = 0; state < state_count; ++state) {
+			table->accept[state] = CASE_NO_ARM;
+			for (size_t p = 0; p < count; ++p)
+				if (positions[p].last && sets[state * words + p / 64] >> p % 64 & 1 && positions[p].arm < table->accept[state])
+					table->accept[state] = positions[p].arm;
+		}
+	}
+	free(next);
+	free(index);
+	free(sets);
+	free(positions);
+	return fits;
+}
+
+/*
+ * Build the dispatch of a case command from its arms (the CMD_CASE_ARM commands after c_cmds, whose arguments are the
+ * patterns), allocated from arena.
+ */
+CaseTable *caseCompile(Arena *arena, Command *cmd) {
+	CaseTable *table = arenaAlloc(arena, sizeof (CaseTable));
+	*table = (CaseTable){ .arm_count = 0, .slots = 0, .state_count = 0, .pattern_count = 0 };
+	size_t pattern_total = 0;
+	for (Command *arm = cmd->c_cmds; arm != NULL; arm = arm->c_next) {
+		++table->arm_count;
+		pattern_total += arm->c_argc;
+	}
+	table->arms = arenaAlloc(arena, (table->arm_count + 1) * sizeof (Command*));
+
+	// Sort out the patterns (every list is in arm order)
+	CaseLiteral literals[pattern_total + 1];
+	CaseGlob globs[pattern_total + 1];
+	CasePattern patterns[pattern_total + 1];
+	size_t literal_count = 0, glob_count = 0, pattern_count = 0, arm_index = 0;
+	for (Command *arm = cmd->c_cmds; arm != NULL; arm = arm->c_next, ++arm_index) {
+		table->arms[arm_index] = arm;
+		for (int i = 0; i < arm->c_argc; ++i) {
+			Pattern *pat = literalPattern(NULL, arm->c_argv[i]);
+			if (pat == NULL)
+				patterns[pattern_count++] = (CasePattern){ .arm = arm_index, .pattern = NULL, .word = arm->c_argv[i] };
+			else if (pat->fixed && pat->count <= 1 && (pat->count == 0 || pat->nodes[0].type == PAT_LITERAL)) {
+				size_t length = pat->count == 0 ? 0 : pat->nodes[0].length;
+				char *text = arenaStrndup(arena, pat->count == 0 ? "" : pat->nodes[0].literal, length);
+				literals[literal_count++] = (CaseLiteral){ .text = text, .length = length, .arm = arm_index, .hash = caseHash(text, length) };
+				free(pat);
+			}
+			else {
+				globs[glob_count++] = (CaseGlob){ .pattern = pat, .arm = arm_index };
+				patterns[pattern_count++] = (CasePattern){ .arm = arm_index, .pattern = pat, .word = arm->c_argv[i] };
+			}
+		}
+	}
+
+	// Literals, the first arm with a text keeps it
+	if (literal_count > 0) {
+		table->slots = 4;
+		while (table->slots < literal_count * 2)
+			table->slots *= 2;
+		table->literals = arenaAlloc(arena, table->slots * sizeof (CaseLiteral));
+		for (size_t i = 0; i < table->slots; ++i)
+			table->literals[i].text = NULL;
+		for (size_t i = 0; i < literal_count; ++i) {
+			size_t slot = literals[i].hash & (table->slots - 1);
+			while (table->literals[slot].text != NULL && (table->literals[slot].length != literals[i].length || memcmp(table->literals[slot].text, literals[i].text, literals[i].length)))
+				slot = (slot + 1) & (table->slots - 1);
+			if (table->literals[slot].text == NULL)
+				table->literals[slot] = literals[i];
+		}
+	}
+
+	// Globs go in the automaton if it isn't too big, otherwise they are tried one by one
+	_Bool automaton = glob_count > 0 && caseAutomaton(arena, table, globs, glob_count);
+	table->patterns = arenaAlloc(arena, (pattern_count + 1) * sizeof (CasePattern));
+	for (size_t i = 0; i < pattern_count; ++i) {
+		if (patterns[i].pattern != NULL && automaton)
+			continue;
+		CasePattern *kept = &table->patterns[table->pattern_count++];
+		*kept = patterns[i];
+		if (kept->pattern != NULL)
+			kept->pattern = patternDup(arena, kept->pattern);
+	}
+	for (size_t i = 0; i < glob_count; ++i)
+		free(globs[i].pattern);
+	return table;
+}
+
+/*
+ * Find the first arm with a literal or glob pattern matching word, CASE_NO_ARM if none do.
+ * Patterns with expansions aren't tried, the caller has to check the ones before the arm this returns.
+ */
+size_t caseMatch(CaseTable *table, char *word, size_t len) {
+	size_t best = CASE_NO_ARM;
+	if (table->slots > 0) {
+		uint64_t hash = caseHash(word, len);
+		for (size_t slot = hash & (table->slots - 1); table->literals[slot].text != NULL; slot = (slot + 1) & (table->slots - 1)) {
+			CaseLiteral *literal = &table->literals[slot];
+			if (literal->hash == hash && literal->length == len && !memcmp(literal->text, word, len)) {
+				best = literal->arm;
+				break;
+			}
+		}
+	}
+	if (table->state_count > 0) {
+		size_t state = 1;
+		for (size_t i = 0; state != 0 && i < len; ++i)
+			state = table->next[state * table->class_count + table->classes[(unsigned char)word[i]]];
+		if (table->accept[state] < best)
+			best = table->accept[state];
+	}
+	for (size_t i = 0; i < table->pattern_count && table->patterns[i].arm < best; ++i)
+		if (table->patterns[i].pattern != NULL && patternMatch(table->patterns[i].pattern, word, len))
+			best = table->patterns[i].arm;
+	return best;
+}
@@ -1,31 +1,130 @@
-#define _POSIX_C_SOURCE 200809L // getline, strndup, strdup
+#define _POSIX_C_SOURCE 200809L // getline
 #include "command.h"
 #include "compatibility.h"
+#include "mash.h"
+#include <ctype.h>
+#include <errno.h>
 #include <readline/readline.h>
 #include <string.h>
+#include <unistd.h>
 
 #define dupSpecialCommand(cmd) { \
-	Command *new_loc = commandInit(); \
+	Command *new_loc = commandInit(cmd->c_arena); \
 	*new_loc = *cmd; \
 \
 	*cmd = (Command){}; /* Zero out everything */ \
 	cmd->c_len = new_loc->c_len; \
 	cmd->c_size = new_loc->c_size; \
 	cmd->c_buf = new_loc->c_buf; \
+	cmd->c_arena = new_loc->c_arena; \
 	cmd->c_next = new_loc; \
 }
 
 size_t shiftArg(Command *cmd) {
-	freeArg(cmd->c_argv[0]);
 	for (size_t i = 1; i < cmd->c_argc; ++i)
 		cmd->c_argv[i - 1] = cmd->c_argv[i];
 	return --cmd->c_argc;
 }
 
-int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream, AliasMap *aliases, char *PROMPT) {
+/*
+ * Get the name from a function definition (name(), name (), or function name), or NULL if cmd isn't one.
+ * args is set to the number of arguments the definition used.
+ */
+static char *functionName(Command *cmd, size_t *args) {
+	CmdArg *argv = cmd->c_argv;
+	size_t first = !strcmp(argv[0].str, "function") && cmd->c_argc > 1;
+	if (argv[first].type != ARG_BASIC_STRING)
+		return NULL;
+	char *word = argv[first].str;
+	size_t len = strlen(word);
+	if (len > 2 && !strcmp(&word[len - 2], "()")) {
+		*args = first + 1;
+		return arenaStrndup(cmd->c_arena, word, len - 2);
+	}
+	if (first + 1 < cmd->c_argc && argv[first + 1].type == ARG_BASIC_STRING && !strcmp(argv[first + 1].str, "()")) {
+		*args = first + 2;
+		return word;
+	}
+	if (first) {
+		*args = 2;
+		return word;
+	}
+	return NULL;
+}
+
+int parseMultiline(Command*, CmdInput*restrict, FILE*restrict, AliasMap*, Variables*, char*);
+
+/*
+ * Parse a function definition, the body is a { ... } group which may start on the next line.
+ * It is parsed once, and shared with the function table when the definition is executed.
+ */
+static int parseFunction(Command *cmd, char *name, size_t name_args, CmdInput *restrict istream, FILE *restrict ostream, AliasMap *aliases, Variables *vars, char *PROMPT) {
+	if (cmd->c_io.out_pipe || cmd->c_io.in_count > 0 || cmd->c_io.out_count > 0) {
+		cmd->c_buf[0] = cmd->c_io.out_pipe ? '|' : cmd->c_io.in_count > 0 ? '<' : '>';
+		return 1;
+	}
+	for (size_t i = 0; i < name_args; ++i)
+		shiftArg(cmd);
+
+	Command *group;
+	if (cmd->c_argc > 0) {
+		// Group starts on the same line
+		dupSpecialCommand(cmd);
+		group = cmd->c_next;
+		int ret = parseMultiline(group, istream, ostream, aliases, vars, PROMPT);
+		if (ret == 0 && group->c_type != CMD_GROUP) {
+			cmd->c_buf[0] = '{'; // Expected {
+			ret = 1;
+		}
+		if (ret != 0)
+			return ret;
+		cmd->c_next = NULL;
+	}
+	else {
+		// Read commands until "{" (only blank lines are allowed before it)
+		for (;;) {
+			group = commandInit(cmd->c_arena);
+			group->c_len = cmd->c_len;
+			group->c_size = cmd->c_size;
+			group->c_buf = cmd->c_buf;
+
+			const int parse_result = commandParse(group, istream, ostream, aliases, vars, PROMPT);
+			if (group->c_buf != cmd->c_buf) {
+				cmd->c_size = group->c_size;
+				cmd->c_buf = group->c_buf;
+			}
+			if (parse_result == 0 && group->c_type == CMD_GROUP)
+				break;
+			if (parse_result == 0 && group->c_type == CMD_EMPTY)
+				continue;
+			if (parse_result == 0)
+				cmd->c_buf[0] = '{'; // Expected {
+			else
+				cmd->c_len = group->c_len;
+			return parse_result == -1 ? -1 : 1;
+		}
+	}
+	cmd->c_len = group->c_len;
+	cmd->c_size = group->c_size;
+	cmd->c_buf = group->c_buf;
+
+	cmd->c_type = CMD_FUNCTION;
+	cmd->c_function = arenaAlloc(cmd->c_arena, sizeof (ShellFunction));
+	*cmd->c_function = (ShellFunction){ .name = name, .body = group, .arena = cmd->c_arena };
+	return 0;
+}
+
+int parseLoopBody(Command*, CmdInput*restrict, FILE*restrict, AliasMap*, Variables*, char*);
+
+int parseMultiline(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, AliasMap *aliases, Variables *vars, char *PROMPT) {
 	if (cmd->c_argc < 1 || cmd->c_argv[0].type != ARG_BASIC_STRING)
 		return 0;
 
+	size_t name_args;
+	char *name = functionName(cmd, &name_args);
+	if (name != NULL)
+		return parseFunction(cmd, name, name_args, istream, ostream, aliases, vars, PROMPT);
+
 	if (!strcmp(cmd->c_argv[0].str, "do")) {
 		if (cmd->c_argc == 1)
 			cmd->c_type = CMD_DO;
@@ -34,7 +133,7 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 			dupSpecialCommand(cmd);
 			cmd->c_type = CMD_DO;
 
-			int ret = parseMultiline(cmd->c_next, istream, ostream, aliases, PROMPT);
+			int ret = parseMultiline(cmd->c_next, istream, ostream, aliases, vars, PROMPT);
 			if (ret == 0) {
 				switch (cmd->c_next->c_type) {
 					case CMD_DO:
@@ -61,7 +160,7 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 			dupSpecialCommand(cmd);
 			cmd->c_type = CMD_THEN;
 
-			int ret = parseMultiline(cmd->c_next, istream, ostream, aliases, PROMPT);
+			int ret = parseMultiline(cmd->c_next, istream, ostream, aliases, vars, PROMPT);
 			if (ret == 0) {
 				switch (cmd->c_next->c_type) {
 					case CMD_DO:
@@ -87,7 +186,7 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 			dupSpecialCommand(cmd);
 			cmd->c_type = CMD_ELSE;
 
-			int ret = parseMultiline(cmd->c_next, istream, ostream, aliases, PROMPT);
+			int ret = parseMultiline(cmd->c_next, istream, ostream, aliases, vars, PROMPT);
 			if (ret == 0) {
 				switch (cmd->c_next->c_type) {
 					case CMD_DO:
@@ -120,6 +219,38 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 		}
 		cmd->c_type = CMD_FI;
 	}
+	else if (!strcmp(cmd->c_argv[0].str, "for")) {
+		// for name [in words]
+		if (cmd->c_argc < 2 || cmd->c_argv[1].type != ARG_BASIC_STRING || cmd->c_argv[1].str[varNameLength(cmd->c_argv[1].str)] != '\0' ||
+				(cmd->c_argc > 2 && (cmd->c_argv[2].type != ARG_BASIC_STRING || strcmp(cmd->c_argv[2].str, "in"))))
+			return 1;
+		// Redirections go after "done"
+		if (cmd->c_io.out_pipe) {
+			cmd->c_buf[0] = '|';
+			return 1;
+		}
+		if (cmd->c_io.in_count > 0) {
+			cmd->c_buf[0] = '<';
+			return 1;
+		}
+		if (cmd->c_io.out_count > 0) {
+			cmd->c_buf[0] = '>';
+			return 1;
+		}
+
+		// The variable takes the place of "for", followed by the words (without "in")
+		char *name = cmd->c_argv[1].str;
+		cmd->c_in_list = cmd->c_argc > 2;
+		shiftArg(cmd);
+		if (cmd->c_argc > 1) {
+			for (size_t i = 2; i < cmd->c_argc; ++i)
+				cmd->c_argv[i - 1] = cmd->c_argv[i];
+			--cmd->c_argc;
+		}
+		cmd->c_argv[0] = (CmdArg){ .type = ARG_VARIABLE, .name = name, .var = vars == NULL ? NULL : variableIntern(vars, name) };
+		cmd->c_type = CMD_FOR_IN;
+		return parseLoopBody(cmd, istream, ostream, aliases, vars, PROMPT);
+	}
 	else if (!strcmp(cmd->c_argv[0].str, "while")) {
 		// Shift out "while" arg if it is not alone
 		if (cmd->c_argc > 1) {
@@ -148,7 +279,7 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 		Command *const while_cmd = cmd, *test_cmd = cmd->c_next;
 		// Parse anything that came after "while"
 		if (test_cmd != NULL) {
-			int res = parseMultiline(test_cmd, istream, ostream, aliases, PROMPT);
+			int res = parseMultiline(test_cmd, istream, ostream, aliases, vars, PROMPT);
 			if (res != 0)
 				return res;
 			test_cmd->c_parent = while_cmd;
@@ -165,21 +296,16 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 
 		// Read commands until "do"
 		for (;;) {
-			cmd = commandInit();
+			cmd = commandInit(test_cmd->c_arena);
 			cmd->c_len = test_cmd->c_len;
 			cmd->c_size = test_cmd->c_size;
 			cmd->c_buf = test_cmd->c_buf;
 
-			const int parse_result = commandParse(cmd, istream, ostream, aliases, PROMPT);
-			if (parse_result == -1) {
-				commandFree(cmd);
-				free(cmd);
+			const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+			if (parse_result == -1)
 				return -1;
-			}
 			if (parse_result) {
 				while_cmd->c_len = cmd->c_len;
-				commandFree(cmd);
-				free(cmd);
 				return 1;
 			}
 			if (cmd->c_buf != while_cmd->c_buf) {
@@ -208,21 +334,16 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 		// Read commands until "done"
 		Command *body_cmd = cmd;
 		for (;;) {
-			cmd = commandInit();
+			cmd = commandInit(body_cmd->c_arena);
 			cmd->c_len = body_cmd->c_len;
 			cmd->c_size = body_cmd->c_size;
 			cmd->c_buf = body_cmd->c_buf;
 
-			const int parse_result = commandParse(cmd, istream, ostream, aliases, PROMPT);
-			if (parse_result == -1) {
-				commandFree(cmd);
-				free(cmd);
+			const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+			if (parse_result == -1)
 				return -1;
-			}
 			if (parse_result) {
 				while_cmd->c_len = cmd->c_len;
-				commandFree(cmd);
-				free(cmd);
 				return 1;
 			}
 			if (cmd->c_buf != while_cmd->c_buf) {
@@ -268,7 +389,7 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 		Command *const if_cmd = cmd, *test_cmd = cmd->c_next;
 		// Parse anything that came after "if"
 		if (test_cmd != NULL) {
-			int res = parseMultiline(test_cmd, istream, ostream, aliases, PROMPT);
+			int res = parseMultiline(test_cmd, istream, ostream, aliases, vars, PROMPT);
 			if (res != 0)
 				return res;
 			// Attempt to parse aliases
@@ -285,21 +406,16 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 
 		// Read commands until "then"
 		for (;;) {
-			cmd = commandInit();
+			cmd = commandInit(test_cmd->c_arena);
 			cmd->c_len = test_cmd->c_len;
 			cmd->c_size = test_cmd->c_size;
 			cmd->c_buf = test_cmd->c_buf;
 
-			const int parse_result = commandParse(cmd, istream, ostream, aliases, PROMPT);
-			if (parse_result == -1) {
-				commandFree(cmd);
-				free(cmd);
+			const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+			if (parse_result == -1)
 				return -1;
-			}
 			if (parse_result) {
 				if_cmd->c_len = cmd->c_len;
-				commandFree(cmd);
-				free(cmd);
 				return 1;
 			}
 			if (cmd->c_buf != if_cmd->c_buf) {
@@ -328,21 +444,16 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 		// Read commands until "fi"
 		Command *body_cmd = cmd;
 		for (;;) {
-			cmd = commandInit();
+			cmd = commandInit(body_cmd->c_arena);
 			cmd->c_len = body_cmd->c_len;
 			cmd->c_size = body_cmd->c_size;
 			cmd->c_buf = body_cmd->c_buf;
 
-			const int parse_result = commandParse(cmd, istream, ostream, aliases, PROMPT);
-			if (parse_result == -1) {
-				commandFree(cmd);
-				free(cmd);
+			const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+			if (parse_result == -1)
 				return -1;
-			}
 			if (parse_result) {
 				if_cmd->c_len = cmd->c_len;
-				commandFree(cmd);
-				free(cmd);
 				return 1;
 			}
 			if (cmd->c_buf != if_cmd->c_buf) {
@@ -372,24 +483,430 @@ int parseMultiline(Command *cmd, FILE *restrict istream, FILE *restrict ostream,
 		if_cmd->c_io = cmd->c_io;
 		cmd->c_io = (CmdIO){};
 	}
+	else if (!strcmp(cmd->c_argv[0].str, "{")) {
+		Command *const group_cmd = cmd;
+		// Shift out "{" if it is not alone, the rest is the first command of the group
+		if (cmd->c_argc > 1) {
+			shiftArg(cmd);
+			dupSpecialCommand(cmd);
+
+			int ret = parseMultiline(cmd->c_next, istream, ostream, aliases, vars, PROMPT);
+			if (ret != 0)
+				return ret;
+			switch (cmd->c_next->c_type) {
+				case CMD_DO:
+				case CMD_DONE:
+				case CMD_THEN:
+				case CMD_ELSE:
+				case CMD_FI:
+				case CMD_GROUP_END:
+					return 1;
+				default:
+					// Attempt to parse aliases
+					if (aliases != NULL)
+						aliasResolve(aliases, cmd->c_next);
+					break;
+			}
+			cmd->c_next->c_parent = group_cmd;
+		}
+		else if (cmd->c_io.out_pipe || cmd->c_io.in_count > 0 || cmd->c_io.out_count > 0) {
+			// Error if { had no extra arguments yet contained a pipe or redirection
+			cmd->c_buf[0] = cmd->c_io.out_pipe ? '|' : cmd->c_io.in_count > 0 ? '<' : '>';
+			return 1;
+		}
+		cmd->c_type = CMD_GROUP;
+
+		// Read commands until "}"
+		Command *body_cmd = group_cmd;
+		while (body_cmd->c_next != NULL)
+			body_cmd = body_cmd->c_next;
+		for (;;) {
+			cmd = commandInit(body_cmd->c_arena);
+			cmd->c_len = body_cmd->c_len;
+			cmd->c_size = body_cmd->c_size;
+			cmd->c_buf = body_cmd->c_buf;
+
+			const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+			if (parse_result == -1)
+				return -1;
+			if (parse_result) {
+				group_cmd->c_len = cmd->c_len;
+				return 1;
+			}
+			if (cmd->c_buf != group_cmd->c_buf) {
+				group_cmd->c_size = cmd->c_size;
+				group_cmd->c_buf = cmd->c_buf;
+			}
+			group_cmd->c_len = cmd->c_len;
+			if (cmd->c_type == CMD_GROUP_END)
+				break;
+			cmd->c_parent = group_cmd;
+			body_cmd->c_next = cmd;
+			while (body_cmd->c_next != NULL)
+				body_cmd = body_cmd->c_next;
+		}
+		// Groups can't be piped (yet)
+		if (cmd->c_io.out_pipe) {
+			group_cmd->c_buf[0] = '|';
+			return 1;
+		}
+		group_cmd->c_if_true = group_cmd->c_next;
+		group_cmd->c_next = NULL;
+		// Redirections after "}" apply to the whole group
+		group_cmd->c_io = cmd->c_io;
+		cmd->c_io = (CmdIO){};
+	}
+	else if (!strcmp(cmd->c_argv[0].str, "esac")) {
+		if (cmd->c_argc > 1) {
+			// TODO error length
+			return 1;
+		}
+		cmd->c_type = CMD_ESAC;
+	}
+	else if (!strcmp(cmd->c_argv[0].str, "}")) {
+		if (cmd->c_argc > 1) {
+			// TODO error length
+			return 1;
+		}
+		cmd->c_type = CMD_GROUP_END;
+	}
+	return 0;
+}
+
+/*
+ * Read the "do ... done" part of a loop.
+ * loop_cmd->c_if_true is set to the "do" command, and loop_cmd->c_next to "done".
+ */
+int parseLoopBody(Command *loop_cmd, CmdInput *restrict istream, FILE *restrict ostream, AliasMap *aliases, Variables *vars, char *PROMPT) {
+	// Read commands until "do" (only blank lines are allowed before it)
+	Command *cmd;
+	for (;;) {
+		cmd = commandInit(loop_cmd->c_arena);
+		cmd->c_len = loop_cmd->c_len;
+		cmd->c_size = loop_cmd->c_size;
+		cmd->c_buf = loop_cmd->c_buf;
+
+		const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+		if (cmd->c_buf != loop_cmd->c_buf) {
+			loop_cmd->c_size = cmd->c_size;
+			loop_cmd->c_buf = cmd->c_buf;
+		}
+		if (parse_result == 0 && cmd->c_type == CMD_DO)
+			break;
+		if (parse_result == 0 && cmd->c_type == CMD_EMPTY)
+			continue;
+		if (parse_result == 0)
+			loop_cmd->c_buf[0] = 'd'; // Expected do
+		else
+			loop_cmd->c_len = cmd->c_len;
+		return parse_result == -1 ? -1 : 1;
+	}
+	loop_cmd->c_if_true = cmd; // CMD_DO
+	// Jump over do's command chain (if it has one)
+	cmd->c_parent = loop_cmd;
+	while (cmd->c_next != NULL) {
+		cmd = cmd->c_next;
+		cmd->c_parent = loop_cmd;
+	}
+
+	// Read commands until "done"
+	Command *body_cmd = cmd;
+	for (;;) {
+		cmd = commandInit(body_cmd->c_arena);
+		cmd->c_len = body_cmd->c_len;
+		cmd->c_size = body_cmd->c_size;
+		cmd->c_buf = body_cmd->c_buf;
+
+		const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+		if (parse_result == -1)
+			return -1;
+		if (parse_result) {
+			loop_cmd->c_len = cmd->c_len;
+			return 1;
+		}
+		if (cmd->c_buf != loop_cmd->c_buf) {
+			loop_cmd->c_size = cmd->c_size;
+			loop_cmd->c_buf = cmd->c_buf;
+		}
+		if (cmd->c_type == CMD_DONE)
+			break;
+		cmd->c_parent = loop_cmd;
+		body_cmd->c_next = cmd;
+		while (body_cmd->c_next != NULL)
+			body_cmd = body_cmd->c_next;
+	}
+	loop_cmd->c_next = cmd; // CMD_DONE
+	loop_cmd->c_io = cmd->c_io;
+	cmd->c_io = (CmdIO){};
+	return 0;
+}
+
+ssize_t lengthMath(char*);
+
+/*
+ * Remove a compound command that was parsed directly from the buffer (end is the index after it).
+ * It may only be followed by a semicolon (and another command), ;; (left for the case arm it ends), or a comment.
+ */
+int removeCompound(Command *cmd, size_t end) {
+	char *buf = cmd->c_buf;
+	end += strspn(&buf[end], " \t");
+	if (buf[end] == ';' && buf[end + 1] != ';')
+		end += 1 + strspn(&buf[end + 1], " \t");
+	else if (buf[end] != ';' && buf[end] != '\0' && buf[end] != '#') {
+		cmd->c_len = end;
+		buf[0] = buf[end];
+		return 1;
+	}
+	memmove(buf, &buf[end], cmd->c_len - end + 1);
+	cmd->c_len -= end;
+	return 0;
+}
+
+int parseWord(Arena*, CmdArg*, char*, size_t, Variables*);
+size_t wordLength(char*, size_t, char);
+
+/*
+ * Length of NAME=, NAME+=, NAME[subscript]= or NAME[subscript]+= at the start of a word (0 if it doesn't start with one).
+ * *name_len is set to the length of the name.
+ */
+static size_t lengthAssignment(char *word, size_t *name_len) {
+	size_t l = *name_len = varNameLength(word);
+	if (l == 0)
+		return 0;
+	if (word[l] == '[') {
+		size_t len = strlen(&word[l + 1]), sub_len = wordLength(&word[l + 1], len, ']');
+		if (sub_len == 0 || sub_len == len)
+			return 0;
+		l += sub_len + 2;
+	}
+	if (word[l] == '+')
+		++l;
+	return word[l] == '=' ? l + 1 : 0;
+}
+
+// Whether a word starts with NAME=, making it a variable assignment (if nothing but assignments came before it)
+static _Bool isAssignment(char *word) {
+	size_t name_len;
+	return lengthAssignment(word, &name_len) > 0;
+}
+
+/*
+ * Parse an array subscript (the text between the brackets).
+ * Returns 1 if it isn't valid.
+ */
+static int parseSubscript(Arena *arena, Subscript *sub, char *str, size_t len, Variables *vars) {
+	*sub = (Subscript){ .type = '[', .key = { .type = ARG_NULL }, .index = NULL };
+	if (len == 1 && (str[0] == '@' || str[0] == '*')) {
+		sub->type = str[0];
+		return 0;
+	}
+	if (len == 0 || parseWord(arena, &sub->key, str, len, vars))
+		return 1;
+	// Indexes that aren't plain arithmetic (like $(...)) are expanded and evaluated when they are used
+	sub->index = mathCompile(arena, str, len, vars);
+	return 0;
+}
+
+// Length of a function definition's header and the blanks after it (where "{" should be), 0 if buf doesn't start with one
+/*
+ * Turn a word that can match path names into ARG_GLOB.
+ * Words that are all literal text are compiled now (or left alone if they have no pattern characters after all),
+ * words with unquoted expansions are compiled each time they are expanded. "${name[@]}" goes through here too, since it
+ * expands to several words.
+ */
+static void globWord(Arena *arena, CmdArg *arg) {
+	CmdArg *parts = arg->type == ARG_COMPLEX_STRING ? arg->sub : arg;
+	size_t count = arg->type == ARG_COMPLEX_STRING ? 0 : 1;
+	if (arg->type == ARG_COMPLEX_STRING)
+		while (parts[count].type != ARG_NULL)
+			++count;
+
+	_Bool special = 0, literal = 1;
+	size_t len = 0;
+	for (size_t i = 0; i < count; ++i) {
+		switch (parts[i].type) {
+			case ARG_BASIC_STRING:
+				special |= strpbrk(parts[i].str, "*?[") != NULL;
+			case ARG_QUOTED_STRING:
+				len += strlen(parts[i].str) * 2;
+				break;
+			case ARG_MATH: // Only ever digits
+			case ARG_MATH_WORD:
+				literal = 0;
+				break;
+			default:
+				literal = 0;
+				special |= !parts[i].quoted && parts[i].type != ARG_QUOTED_SUBSHELL;
+				// "${name[@]}" is a word for each element
+				special |= parts[i].type == ARG_PARAM_EXP && parts[i].pexp->sub.type == '@' && parts[i].pexp->op != PEXP_LENGTH;
+		}
+	}
+	if (!special)
+		return;
+
+	Glob *glob;
+	if (literal) {
+		// Quoted text is escaped, so that it only matches itself
+		char text[len + 1];
+		len = 0;
+		for (size_t i = 0; i < count; ++i) {
+			for (char *c = parts[i].str; *c != '\0'; ++c) {
+				if (parts[i].type == ARG_QUOTED_STRING && strchr("*?[]\\", *c) != NULL)
+					text[len++] = '\\';
+				text[len++] = *c;
+			}
+		}
+		if ((glob = globCompile(arena, text, len)) == NULL)
+			return;
+	}
+	else {
+		glob = arenaAlloc(arena, sizeof (Glob));
+		*glob = (Glob){ .count = 0, .parts = NULL };
+	}
+	glob->word = *arg;
+	*arg = (CmdArg){ .type = ARG_GLOB, .glob = glob };
+}
+
+static size_t lengthFunctionHeader(char *buf) {
+	size_t l = 0;
+	_Bool keyword = !strncmp(buf, "function", 8) && (buf[8] == ' ' || buf[8] == '\t');
+	if (keyword)
+		l = 8 + strspn(&buf[8], " \t");
+	size_t name = strcspn(&buf[l], " \t;|<>()'\"$");
+	if (name == 0)
+		return 0;
+	l += name;
+	size_t paren = l + strspn(&buf[l], " \t");
+	if (buf[paren] == '(' && buf[paren + 1] == ')')
+		l = paren + 2;
+	else if (!keyword)
+		return 0;
+	return l + strspn(&buf[l], " \t");
+}
+
+// Length of a keyword that can have a command after it on the same line (while, if, do, then, else, {), 0 if buf doesn't start with one
+static size_t lengthKeyword(char *buf) {
+	static char *const keywords[] = { "while", "if", "do", "then", "else", "{" };
+	for (size_t i = 0; i < sizeof (keywords) / sizeof (*keywords); ++i) {
+		size_t len = strlen(keywords[i]);
+		if (!strncmp(buf, keywords[i], len) && (buf[len] == ' ' || buf[len] == '\t'))
+			return len;
+	}
 	return 0;
 }
 
-void freeCmdIO(CmdIO *io) {
-	if (io->in != NULL) {
-		for (size_t i = 0; i < io->in_count; ++i)
-			freeArg(io->in[i].arg);
-		free(io->in);
-		io->in = NULL;
-	}
-	io->in_count = 0;
-	if (io->out != NULL) {
-		for (size_t i = 0; i < io->out_count; ++i)
-			freeArg(io->out[i].arg);
-		free(io->out);
-		io->out = NULL;
-	}
-	io->out_count = 0;
+// Whether buf starts with a command that is parsed straight from the buffer: ((...)), for ((...)), [[ ... ]], case, or an assignment
+static _Bool startsParsed(char *buf) {
+	if (!strncmp(buf, "for", 3)) {
+		size_t paren = 3 + strspn(&buf[3], " \t");
+		return buf[paren] == '(' && buf[paren + 1] == '(';
+	}
+	return (buf[0] == '(' && buf[1] == '(') || (buf[0] == '[' && buf[1] == '[') || isAssignment(buf) ||
+			(!strncmp(buf, "case", 4) && (buf[4] == ' ' || buf[4] == '\t'));
+}
+
+/*
+ * Parse ((expr)) and for ((init; cond; step)) commands, which can't be tokenized like regular commands.
+ * Returns 2 if the buffer doesn't start with one of them, otherwise the same as commandParse.
+ */
+int parseArithmetic(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, AliasMap *aliases, Variables *vars, char *PROMPT) {
+	char *buf = cmd->c_buf;
+	size_t start = strspn(buf, " \t");
+	_Bool is_for = 0;
+
+	if (!strncmp(&buf[start], "for", 3)) {
+		size_t paren = start + 3 + strspn(&buf[start + 3], " \t");
+		if (buf[paren] != '(' || buf[paren + 1] != '(')
+			return 2;
+		is_for = 1;
+		start = paren;
+	}
+	else if (buf[start] != '(' || buf[start + 1] != '(') {
+		/*
+		 * A keyword followed by a command that startsParsed finds, even after more keywords (do if ((...)); then), is split from it,
+		 * so that parseMultiline sees the keyword alone. The rest is checked again when it is parsed.
+		 */
+		start += lengthFunctionHeader(&buf[start]); // name() { ...
+		size_t len = lengthKeyword(&buf[start]);
+		if (len > 0) {
+			size_t next = start + len + strspn(&buf[start + len], " \t");
+			for (size_t l; (l = lengthKeyword(&buf[next])) > 0;)
+				next += l + strspn(&buf[next + l], " \t");
+			if (startsParsed(&buf[next]))
+				buf[start + len] = ';';
+		}
+		return 2;
+	}
+
+	// Find the end of the expression
+	char *expr = &buf[start + 2];
+	ssize_t length = lengthMath(expr);
+	if (length < 0 || expr[length + 1] != ')') {
+		cmd->c_len = start;
+		buf[0] = buf[start];
+		return 1;
+	}
+
+	if (is_for) {
+		// Split at the top level semicolons
+		size_t parts[3] = { 0 }, lengths[3], part = 0, depth = 0;
+		for (size_t i = 0; i < length; ++i) {
+			if (expr[i] == '(')
+				++depth;
+			else if (expr[i] == ')')
+				--depth;
+			else if (expr[i] == ';' && depth == 0) {
+				if (part == 2)
+					break;
+				lengths[part] = i - parts[part];
+				parts[++part] = i + 1;
+			}
+		}
+		if (part != 2) {
+			cmd->c_len = start;
+			buf[0] = buf[start];
+			return 1;
+		}
+		lengths[2] = length - parts[2];
+
+		// Compile each part, an empty part is left as ARG_NULL
+		cmd->c_argc = 3;
+		cmd->c_argv = arenaAlloc(cmd->c_arena, 3 * sizeof (CmdArg));
+		for (size_t i = 0; i < 3; ++i) {
+			cmd->c_argv[i] = (CmdArg){ .type = ARG_NULL };
+			if (strspn(&expr[parts[i]], " \t") >= lengths[i])
+				continue;
+			MathProg *math = mathCompile(cmd->c_arena, &expr[parts[i]], lengths[i], vars);
+			if (math == NULL) {
+				fprintf(stderr, "arithmetic syntax error in expression `%.*s'\n", (int)lengths[i], &expr[parts[i]]);
+				cmd->c_len = start;
+				buf[0] = buf[start];
+				return 1;
+			}
+			cmd->c_argv[i] = (CmdArg){ .type = ARG_MATH, .math = math };
+		}
+		cmd->c_type = CMD_FOR_ARITH;
+	}
+	else {
+		MathProg *math = mathCompile(cmd->c_arena, expr, length, vars);
+		if (math == NULL) {
+			fprintf(stderr, "arithmetic syntax error in expression `%.*s'\n", (int)length, expr);
+			cmd->c_len = start;
+			buf[0] = buf[start];
+			return 1;
+		}
+		cmd->c_argc = 1;
+		cmd->c_argv = arenaAlloc(cmd->c_arena, sizeof (CmdArg));
+		cmd->c_argv[0] = (CmdArg){ .type = ARG_MATH, .math = math };
+		cmd->c_type = CMD_ARITH;
+	}
+
+	if (removeCompound(cmd, start + 2 + length + 2))
+		return 1;
+
+	if (is_for)
+		return parseLoopBody(cmd, istream, ostream, aliases, vars, PROMPT);
+	return 0;
 }
 
 ssize_t lengthRegular(char*);
@@ -397,10 +914,14 @@ ssize_t lengthSingleQuote(char*);
 ssize_t lengthDoubleQuote(char*);
 ssize_t lengthRegInDouble(char *);
 ssize_t lengthDollarExp(char*);
-int commandTokenize(Command*, FILE*restrict, FILE*restrict, AliasMap*, char*);
+int commandTokenize(Command*, CmdInput*restrict, FILE*restrict, AliasMap*, Variables*, char*);
+int parseConditional(Command*, Variables*);
+int parseCase(Command*, CmdInput*restrict, FILE*restrict, AliasMap*, Variables*, char*);
+int parseArrayAssign(Command*, CmdInput*restrict, FILE*restrict, Variables*, char*);
 
-Command *commandInit() {
-	Command *new_command = malloc(sizeof (Command));
+// New command, allocated from (and owned by) arena
+Command *commandInit(Arena *arena) {
+	Command *new_command = arenaAlloc(arena, sizeof (Command));
 	*new_command = (Command){
 		.c_len = 0,
 		.c_size = 0,
@@ -408,10 +929,15 @@ Command *commandInit() {
 		.c_type = CMD_EMPTY,
 		.c_argc = 0,
 		.c_argv = NULL,
+		.c_in_list = 0,
+		.c_assign_count = 0,
+		.c_assign = NULL,
 		.c_next = NULL,
 		.c_if_true = NULL,
 		.c_if_false = NULL,
 		.c_parent = NULL,
+		.c_function = NULL,
+		.c_case = NULL,
 		.c_io = (CmdIO){
 			.in_count = 0,
 			.out_count = 0,
@@ -419,13 +945,48 @@ Command *commandInit() {
 			.out = NULL,
 			.in_file = NULL,
 			.out_file = NULL
-		}
+		},
+		.c_arena = arena
 	};
 	return new_command;
 }
 
-int commandRead(Command *cmd, FILE *restrict istream, FILE *restrict ostream, char *PROMPT) {
-	if (istream == stdin) {
+int commandRead(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, char *PROMPT) {
+	if (istream->file == NULL) {
+		// Script text, the line is used where it is (c_size stays 0, nothing to free)
+		char *newline;
+		if (istream->pos > istream->len) // Last line had no newline
+			istream->pos = istream->len;
+		while (newline = memchr(&istream->text[istream->pos], '\n', istream->len - istream->pos), newline == NULL && istream->fd != -1) {
+			// Line continues past the block, keep the start of it and read another block
+			memmove(istream->text, &istream->text[istream->pos], istream->len - istream->pos);
+			istream->len -= istream->pos;
+			istream->pos = 0;
+			if (istream->len + 1 == istream->size) {
+				// Out of memory is -1 with errno set, like a failed getline
+				char *text = realloc(istream->text, istream->size * 2);
+				if (text == NULL)
+					return -1;
+				istream->text = text;
+				istream->size *= 2;
+			}
+			ssize_t bytes_read = read(istream->fd, &istream->text[istream->len], istream->size - istream->len - 1);
+			if (bytes_read == -1 && errno == EINTR)
+				continue;
+			if (bytes_read <= 0)
+				break;
+			istream->len += bytes_read;
+		}
+		if (istream->pos >= istream->len)
+			return -1;
+		cmd->c_buf = &istream->text[istream->pos];
+		cmd->c_len = newline == NULL ? istream->len - istream->pos : (size_t)(newline - cmd->c_buf);
+		cmd->c_size = 0;
+		cmd->c_buf[cmd->c_len] = '\0';
+		istream->pos += cmd->c_len + 1;
+		return 0;
+	}
+	if (istream->file == stdin) {
 		if (cmd->c_buf != NULL)
 			free(cmd->c_buf);
 		cmd->c_buf = readline(PROMPT);
@@ -443,7 +1004,7 @@ int commandRead(Command *cmd, FILE *restrict istream, FILE *restrict ostream, ch
 	else {
 		if (cmd->c_size == 0 && cmd->c_buf != NULL)
 			free(cmd->c_buf);
-		cmd->c_len = getline(&cmd->c_buf, &cmd->c_size, istream);
+		cmd->c_len = getline(&cmd->c_buf, &cmd->c_size, istream->file);
 		if (cmd->c_len == -1)
 			return -1;
 
@@ -459,7 +1020,7 @@ int commandRead(Command *cmd, FILE *restrict istream, FILE *restrict ostream, ch
 	return 0;
 }
 
-int commandParse(Command *cmd, FILE *restrict istream, FILE *restrict ostream, AliasMap *aliases, char *PROMPT) {
+int commandParse(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, AliasMap *aliases, Variables *vars, char *PROMPT) {
 	Command *original = cmd;
 
 	// Read line if buffer isn't empty
@@ -472,9 +1033,20 @@ int commandParse(Command *cmd, FILE *restrict istream, FILE *restrict ostream, A
 		return 0;
 	}
 
+	// Arithmetic, conditional and case commands, and array assignments
+	int compound_result = parseArithmetic(cmd, istream, ostream, aliases, vars, PROMPT);
+	if (compound_result == 2)
+		compound_result = parseConditional(cmd, vars);
+	if (compound_result == 2)
+		compound_result = parseCase(cmd, istream, ostream, aliases, vars, PROMPT);
+	if (compound_result == 2)
+		compound_result = parseArrayAssign(cmd, istream, ostream, vars, PROMPT);
+	if (compound_result != 2)
+		return compound_result;
+
 	size_t error_length = 0;
 	// Parse Input (into tokens)
-	if (commandTokenize(cmd, istream, ostream, aliases, PROMPT)) { // Determine tokens and save them into cmd->c_argv
+	if (commandTokenize(cmd, istream, ostream, aliases, vars, PROMPT)) { // Determine tokens and save them into cmd->c_argv
 		// Error parsing command.
 		original->c_len = error_length + cmd->c_len;
 		cmd->c_buf[0] = cmd->c_buf[cmd->c_len];
@@ -482,7 +1054,7 @@ int commandParse(Command *cmd, FILE *restrict istream, FILE *restrict ostream, A
 	}
 	error_length += cmd->c_len + 1;
 
-	int parse_result = parseMultiline(cmd, istream, ostream, aliases, PROMPT);
+	int parse_result = parseMultiline(cmd, istream, ostream, aliases, vars, PROMPT);
 	if (parse_result == -1)
 		return -1;
 	if (parse_result) {
@@ -501,8 +1073,6 @@ ssize_t lengthRegular(char *buf) {
 	ssize_t l = 0;
 	for (char c; c = buf[l], c != '\0'; ++l) {
 		switch (c) {
-			case '=':
-				++l;
 			case '\'':
 			case '"':
 			case '$':
@@ -604,47 +1174,20 @@ ssize_t lengthVariable(char *buf) {
 	return l;
 }
 
+// Find the parenthesis closing a math expression, the expression itself is validated by mathCompile.
 ssize_t lengthMath(char *buf) {
 	ssize_t l = 0;
-	int operator = 0;
-	char c;
-	while (c = buf[l], c != ')') {
-		if (c == '\0')
-			return 0;
-		if (c == ' ') {
-			++l;
-			continue;
-		}
-		if (operator) {
-			switch (c) {
-				case '+':
-				case '-':
-				case '*':
-				case '/':
-				case '%':
-					operator = 0;
-					break;
-				default:
-					return 0;
-			}
-			++l;
-		}
-		else {
-			ssize_t temp;
-			if (c == '(') {
-				++l;
-				temp = lengthMath(&buf[l]);
-				++l;
-			}
-			else
-				temp = lengthVariable(&buf[l]);
-			if (temp == 0)
-				return 0;
-			l += temp;
-			operator = 1;
+	size_t depth = 0;
+	for (char c; c = buf[l], c != '\0'; ++l) {
+		if (c == '(')
+			++depth;
+		else if (c == ')') {
+			if (depth == 0)
+				return l;
+			--depth;
 		}
 	}
-	return operator ? l : 0; // If expecting an operand, the expression is incomplete
+	return -1;
 }
 
 ssize_t lengthDollarExp(char *buf) {
@@ -681,9 +1224,9 @@ ssize_t lengthDollarExp(char *buf) {
 							if (l == 2) {
 								++l;
 								temp = lengthMath(&buf[l]);
-								if (buf[l + temp] != ')')
+								if (temp < 0 || buf[l + temp + 1] != ')')
 									return 0;
-								++l;
+								return l + temp + 2;
 							}
 							break;
 					}
@@ -692,6 +1235,40 @@ ssize_t lengthDollarExp(char *buf) {
 					l += temp;
 				}
 				return l + 1;
+			case '{': {
+				// ${...} ends at the matching brace
+				size_t depth = 0;
+				while (c = buf[++l], c != '}' || depth > 0) {
+					ssize_t temp = 1;
+					switch (c) {
+						case '\0':
+							return 0;
+						case '\\':
+							if (buf[l + 1] != '\0')
+								++l;
+							break;
+						case '\'':
+							temp = lengthSingleQuote(&buf[l]);
+							break;
+						case '"':
+							temp = lengthDoubleQuote(&buf[l]);
+							break;
+						case '$':
+							temp = lengthDollarExp(&buf[l]);
+							break;
+						case '{':
+							++depth;
+							break;
+						case '}':
+							--depth;
+							break;
+					}
+					if (temp < 1)
+						return 0;
+					l += temp - 1;
+				}
+				return l + 1;
+			}
 			default:
 				return lengthVariable(&buf[l]) + 1;
 		}
@@ -699,91 +1276,1041 @@ ssize_t lengthDollarExp(char *buf) {
 	return l;
 }
 
-CmdArg *parseMath(char *buf, size_t *length) {
-	// go until ) found
-
-	// find number of operands/operators in top expression, by finding (operators * 2 + 1)
-	size_t operators = 0;
-	for (size_t i = 0; buf[i] != ')'; ++i) {
-		switch (buf[i]) {
-			case '+':
-			case '-':
-			case '*':
-			case '/':
-			case '%':
-				++operators;
-				break;
-			case '(':
-				++i;
-				ssize_t temp = lengthMath(&buf[i]);
-				// Assume greater than 0, since validation should have already occured.
-#ifdef DEBUG
-				fprintf(stderr, "lengthMath returned <= 0 from parseMath...\n");
-#endif
-				i += temp;
-				break;
+/*
+ * Create a variable argument from name (which it takes ownership of).
+ * Special parameters are classified here, and regular names are interned so
+ * that expansion never has to hash or compare strings.
+ */
+CmdArg variableArg(char *name, Variables *vars) {
+	if (name[0] >= '0' && name[0] <= '9')
+		return (CmdArg){ .type = ARG_PARAMETER, .name = name, .param = PARAM_POSITIONAL, .position = strtoul(name, NULL, 10) };
+	if (name[1] == '\0') {
+		switch (name[0]) {
+			case '?':
+				return (CmdArg){ .type = ARG_PARAMETER, .name = name, .param = PARAM_STATUS };
+			case '$':
+				return (CmdArg){ .type = ARG_PARAMETER, .name = name, .param = PARAM_PID };
+			case '#':
+				return (CmdArg){ .type = ARG_PARAMETER, .name = name, .param = PARAM_COUNT };
 		}
 	}
-#ifdef DEBUG
-	fprintf(stderr, "Math expression has %lu operators\n", operators);
-#endif
+	if (!strcmp(name, "RANDOM"))
+		return (CmdArg){ .type = ARG_PARAMETER, .name = name, .param = PARAM_RANDOM };
+	return (CmdArg){ .type = ARG_VARIABLE, .name = name, .var = vars == NULL ? NULL : variableIntern(vars, name) };
+}
 
-	CmdArg *args = calloc(operators * 2 + 2, sizeof (CmdArg));
-	args[operators * 2 + 1].type = ARG_NULL;
-	// once again, we are assuming everything has already been validated, if validation failed this WILL make mistakes
-	*length = 0;
-	while (buf[*length] == ' ') // skip whitespace
-		++*length;
-	size_t temp = lengthVariable(&buf[*length]);
-	args[0] = (CmdArg){
-		.type = isdigit(buf[*length]) ? ARG_MATH_OPERAND_NUMERIC : ARG_MATH_OPERAND_VARIABLE,
-		.str = strndup(&buf[*length], temp)
-	};
-	*length += temp;
-	for (size_t pair = 0; pair < operators; ++pair) {
-		// construct operator
-		while (buf[*length] == ' ') // skip whitespace
-			++*length;
-		size_t operator_index = pair * 2 + 1; // 1, 3, 5, 7, ...
-		args[operator_index] = (CmdArg) { .type = ARG_MATH_OPERATOR, .str = malloc(sizeof (char)) };
-		args[operator_index].str[0] = buf[(*length)++];
-
-		// construct operand
-		while (buf[*length] == ' ') // skip whitespace
-			++*length;
-		size_t operand_index = operator_index + 1; // 2, 4, 6, 8, ...
-		if (buf[*length] == '(') {
-			args[operand_index] = (CmdArg){ .type = ARG_MATH, .sub = parseMath(&buf[++*length], &temp) };
-			*length += temp + 1;
+// Add new_arg to the end of arg, turning it into a complex string if needed
+void appendArg(Arena *arena, CmdArg *arg, CmdArg new_arg) {
+	switch (arg->type) {
+		case ARG_NULL:
+			*arg = new_arg;
+			break;
+		case ARG_COMPLEX_STRING: {
+			size_t arr_len = 0;
+			while (arg->sub[arr_len].type != ARG_NULL)
+				++arr_len;
+			arg->sub = arenaGrow(arena, arg->sub, (arr_len + 1) * sizeof (CmdArg), (arr_len + 2) * sizeof (CmdArg));
+			arg->sub[arr_len + 1] = arg->sub[arr_len];
+			arg->sub[arr_len] = new_arg;
+			break;
 		}
-		else {
-			temp = lengthVariable(&buf[*length]);
-			args[operand_index] = (CmdArg){
-				.type = isdigit(buf[*length]) ? ARG_MATH_OPERAND_NUMERIC : ARG_MATH_OPERAND_VARIABLE,
-				.str = strndup(&buf[*length], temp)
-			};
-			*length += temp;
+		default: {
+			CmdArg new_complex = { .type = ARG_COMPLEX_STRING, .sub = arenaAlloc(arena, 3 * sizeof (CmdArg)) };
+			new_complex.sub[0] = *arg;
+			new_complex.sub[1] = new_arg;
+			new_complex.sub[2] = (CmdArg){ .type = ARG_NULL };
+			*arg = new_complex;
 		}
 	}
-	while (buf[*length] == ' ') // skip whitespace
-		++*length;
-
-	return args;
 }
 
-int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream, AliasMap *aliases, char *PROMPT) {
-	char *buf = cmd->c_buf;
-	/*
-	 * end: current parse index - when finished it will point one char past the end of the command
-	 * argc: how many args this command has
-	 * input_count: number of input files (<)
-	 * output_count: number of output files (>)
-	 * done: indicates we've finished parsing this command (there may be more after it)
-	 * whitespace: whether or not the last character was whitespace
+int dollarArg(Arena*, CmdArg*, char*, size_t, _Bool, Variables*);
+
+/*
+ * Recognise $(< file) and $(cat file) from the text inside the parentheses, they are read without forking.
+ * The file has to be a single word (quotes and expansions other than command substitutions are fine), anything else
+ * is left to a subshell. Returns 0 if text isn't one of them.
+ */
+static _Bool fileReadArg(Arena *arena, CmdArg *arg, char *text, size_t len, Variables *vars) {
+	size_t i = 0, text_len = len;
+	while (i < len && strchr(" \t\n", text[i]) != NULL)
+		++i;
+	_Bool cat = 0;
+	if (i < len && text[i] == '<')
+		++i;
+	else if (len - i > 4 && !strncmp(&text[i], "cat", 3) && strchr(" \t", text[i + 3]) != NULL) {
+		cat = 1;
+		i += 3;
+	}
+	else
+		return 0;
+	while (i < len && strchr(" \t\n", text[i]) != NULL)
+		++i;
+	while (len > i && strchr(" \t\n", text[len - 1]) != NULL)
+		--len;
+	// Options are left to cat itself
+	if (i == len || (cat && text[i] == '-'))
+		return 0;
+
+	char quote = 0;
+	_Bool split = 0;
+	for (size_t c = i; c < len; ++c) {
+		if (quote == '\'') {
+			if (text[c] == '\'')
+				quote = 0;
+			continue;
+		}
+		switch (text[c]) {
+			case '\\':
+				++c;
+				continue;
+			case '`':
+				return 0;
+			case '$':
+				if (c + 1 < len && text[c + 1] == '(')
+					return 0;
+				split |= quote == 0;
+				// Parameter expansions are taken whole, as long as they don't run anything
+				if (c + 1 < len && text[c + 1] == '{') {
+					size_t end = c + 2;
+					while (end < len && strchr("}$`", text[end]) == NULL)
+						++end;
+					if (end == len || text[end] != '}')
+						return 0;
+					c = end;
+				}
+				continue;
+			case '"':
+				quote = quote == '"' ? 0 : '"';
+				continue;
+			case '\'':
+				if (quote == 0)
+					quote = '\'';
+				continue;
+		}
+		if (quote == 0 && strchr(" \t\n;&|<>()*?[~", text[c]) != NULL)
+			return 0;
+	}
+	CmdArg file;
+	if (quote != 0 || parseWord(arena, &file, &text[i], len - i, vars))
+		return 0;
+	FileRead *read = arenaAlloc(arena, sizeof (FileRead));
+	*read = (FileRead){ .file = file, .command = arenaStrndup(arena, text, text_len), .cat = cat, .split = split };
+	*arg = (CmdArg){ .type = ARG_READ_FILE, .read = read };
+	return 1;
+}
+
+/*
+ * Parse the word part of a parameter expansion (default value, pattern, etc).
+ * Quoted and escaped text becomes ARG_QUOTED_STRING, so patterns can tell it
+ * apart from text that should be matched as a glob.
+ */
+int parseWord(Arena *arena, CmdArg *arg, char *str, size_t len, Variables *vars) {
+	*arg = (CmdArg){ .type = ARG_NULL };
+	_Bool inDoubleQuote = 0;
+	for (size_t i = 0; i < len;) {
+		ssize_t temp;
+		switch (str[i]) {
+			case '\'':
+				if (inDoubleQuote)
+					break;
+				temp = lengthSingleQuote(&str[i]);
+				if (temp < 2 || temp > len - i)
+					return 1;
+				appendArg(arena, arg, (CmdArg){ .type = ARG_QUOTED_STRING, .str = arenaStrndup(arena, &str[i + 1], temp - 2) });
+				i += temp;
+				continue;
+			case '"':
+				inDoubleQuote = !inDoubleQuote;
+				++i;
+				continue;
+			case '\\':
+				if (i + 1 < len) {
+					appendArg(arena, arg, (CmdArg){ .type = ARG_QUOTED_STRING, .str = arenaStrndup(arena, &str[i + 1], 1) });
+					i += 2;
+					continue;
+				}
+				break;
+			case '$': {
+				temp = lengthDollarExp(&str[i]);
+				if (temp < 1 || temp > len - i)
+					return 1;
+				CmdArg new_arg;
+				if (dollarArg(arena, &new_arg, &str[i], temp, inDoubleQuote, vars))
+					return 1;
+				appendArg(arena, arg, new_arg);
+				i += temp;
+				continue;
+			}
+		}
+		// Run of regular text
+		size_t run = i + 1;
+		while (run < len && strchr(inDoubleQuote ? "\"\\$" : "'\"\\$", str[run]) == NULL)
+			++run;
+		appendArg(arena, arg, (CmdArg){ .type = inDoubleQuote ? ARG_QUOTED_STRING : ARG_BASIC_STRING, .str = arenaStrndup(arena, &str[i], run - i) });
+		i = run;
+	}
+	// Only quotes (""), which is still a word
+	if (arg->type == ARG_NULL && len > 0)
+		*arg = (CmdArg){ .type = ARG_QUOTED_STRING, .str = arenaStrndup(arena, "", 0) };
+	return inDoubleQuote;
+}
+
+// Compile a pattern made up only of literal text, NULL if it contains expansions
+Pattern *literalPattern(Arena *arena, CmdArg arg) {
+	size_t count = arg.type == ARG_COMPLEX_STRING ? 0 : 1;
+	CmdArg *parts = arg.type == ARG_COMPLEX_STRING ? arg.sub : &arg;
+	if (arg.type == ARG_COMPLEX_STRING)
+		while (parts[count].type != ARG_NULL)
+			++count;
+
+	// Quoted text is escaped like patternQuote does, which at most doubles its length
+	size_t size = 1;
+	for (size_t i = 0; i < count; ++i) {
+		if (parts[i].type == ARG_NULL)
+			continue;
+		if (parts[i].type != ARG_BASIC_STRING && parts[i].type != ARG_QUOTED_STRING)
+			return NULL;
+		size += strlen(parts[i].str) * (parts[i].type == ARG_QUOTED_STRING ? 2 : 1);
+	}
+	char *source = malloc(size);
+	size_t length = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (parts[i].type == ARG_NULL)
+			continue;
+		for (char *c = parts[i].str; *c != '\0'; ++c) {
+			if (parts[i].type == ARG_QUOTED_STRING && strchr("*?[]\\", *c) != NULL)
+				source[length++] = '\\';
+			source[length++] = *c;
+		}
+	}
+	Pattern *pat = patternCompile(arena, source, length);
+	free(source);
+	return pat;
+}
+
+/*
+ * Compile a regex made up only of literal text (quoted text matches itself), NULL if it contains expansions or
+ * isn't valid.
+ */
+regex_t *literalRegex(Arena *arena, CmdArg arg) {
+	size_t count = arg.type == ARG_COMPLEX_STRING ? 0 : 1;
+	CmdArg *parts = arg.type == ARG_COMPLEX_STRING ? arg.sub : &arg;
+	if (arg.type == ARG_COMPLEX_STRING)
+		while (parts[count].type != ARG_NULL)
+			++count;
+
+	size_t size = 1;
+	for (size_t i = 0; i < count; ++i) {
+		if (parts[i].type != ARG_BASIC_STRING && parts[i].type != ARG_QUOTED_STRING)
+			return NULL;
+		size += strlen(parts[i].str) * (parts[i].type == ARG_QUOTED_STRING ? 2 : 1);
+	}
+	char source[size], *end = source;
+	for (size_t i = 0; i < count; ++i) {
+		for (char *c = parts[i].str; *c != '\0'; ++c) {
+			if (parts[i].type == ARG_QUOTED_STRING && strchr("\\.[]()*+?{}|^$", *c) != NULL)
+				*end++ = '\\';
+			*end++ = *c;
+		}
+	}
+	*end = '\0';
+	return regexCompile(arena, source);
+}
+
+// Length of the text before the first unquoted occurence of c (or len)
+size_t wordLength(char *str, size_t len, char c) {
+	size_t i = 0;
+	_Bool inDoubleQuote = 0;
+	for (; i < len && (str[i] != c || inDoubleQuote); ++i) {
+		ssize_t temp = 0;
+		switch (str[i]) {
+			case '\\':
+				++i;
+				break;
+			case '"':
+				inDoubleQuote = !inDoubleQuote;
+				break;
+			case '\'':
+				if (!inDoubleQuote)
+					temp = lengthSingleQuote(&str[i]);
+				break;
+			case '$':
+				temp = lengthDollarExp(&str[i]);
+				break;
+		}
+		if (temp > 1)
+			i += temp - 1;
+	}
+	return i > len ? len : i;
+}
+
+/*
+ * Parse the inside of ${...}.
+ * Returns 1 if it isn't a valid substitution.
+ */
+int paramExpArg(Arena *arena, CmdArg *arg, char *str, size_t len, Variables *vars) {
+	ParamExp *exp = arenaAlloc(arena, sizeof (ParamExp));
+	*exp = (ParamExp){
+		.op = PEXP_NONE,
+		.colon = 0,
+		.param = { .type = ARG_NULL },
+		.word = { .type = ARG_NULL },
+		.replacement = { .type = ARG_NULL },
+		.offset = NULL,
+		.length = NULL,
+		.sub = { .type = 0 },
+		.pattern = NULL
+	};
+	*arg = (CmdArg){ .type = ARG_PARAM_EXP, .pexp = exp };
+
+	size_t i = 0;
+	if (len > 1 && str[0] == '#') {
+		exp->op = PEXP_LENGTH;
+		i = 1;
+	}
+	else if (len > 1 && str[0] == '!') {
+		exp->op = PEXP_KEYS;
+		i = 1;
+	}
+
+	// Parameter name
+	size_t name_len;
+	if (str[i] >= '0' && str[i] <= '9')
+		for (name_len = 1; i + name_len < len && str[i + name_len] >= '0' && str[i + name_len] <= '9'; ++name_len);
+	else if (i < len && strchr("?$#", str[i]) != NULL)
+		name_len = 1;
+	else
+		name_len = varNameLength(&str[i]);
+	if (name_len == 0 || i + name_len > len)
+		return 1;
+	exp->param = variableArg(arenaStrndup(arena, &str[i], name_len), vars);
+	i += name_len;
+
+	// Array subscript
+	if (i < len && str[i] == '[') {
+		if (exp->param.type != ARG_VARIABLE)
+			return 1;
+		size_t sub_len = wordLength(&str[i + 1], len - i - 1, ']');
+		if (i + 1 + sub_len >= len || parseSubscript(arena, &exp->sub, &str[i + 1], sub_len, vars))
+			return 1;
+		i += sub_len + 2;
+	}
+
+	// Only ${!name[@]} lists keys (there are no indirect expansions)
+	if (exp->op == PEXP_KEYS && (i != len || exp->sub.type == '[' || exp->sub.type == 0))
+		return 1;
+	if (i == len)
+		return 0;
+	if (exp->op == PEXP_LENGTH)
+		return 1;
+
+	char *rest;
+	size_t rest_len;
+	switch (str[i]) {
+		case ':':
+			if (i + 1 < len && strchr("-=+?", str[i + 1]) != NULL) {
+				exp->colon = 1;
+				++i;
+				break;
+			}
+			// Substring, both parts are arithmetic
+			exp->op = PEXP_SUBSTRING;
+			rest = &str[i + 1];
+			rest_len = len - i - 1;
+			size_t offset_len = wordLength(rest, rest_len, ':');
+			if (strspn(rest, " \t") < offset_len) {
+				exp->offset = mathCompile(arena, rest, offset_len, vars);
+				if (exp->offset == NULL)
+					return 1;
+			}
+			if (offset_len < rest_len) {
+				exp->length = mathCompile(arena, &rest[offset_len + 1], rest_len - offset_len - 1, vars);
+				if (exp->length == NULL)
+					return 1;
+			}
+			return 0;
+		case '#':
+		case '%': {
+			_Bool longest = i + 1 < len && str[i + 1] == str[i];
+			exp->op = str[i] == '#'
+				? (longest ? PEXP_PREFIX_LONG : PEXP_PREFIX_SHORT)
+				: (longest ? PEXP_SUFFIX_LONG : PEXP_SUFFIX_SHORT);
+			i += 1 + longest;
+			if (parseWord(arena, &exp->word, &str[i], len - i, vars))
+				return 1;
+			exp->pattern = literalPattern(arena, exp->word);
+			return 0;
+		}
+		case '/': {
+			exp->op = PEXP_REPLACE;
+			if (++i < len) {
+				switch (str[i]) {
+					case '/':
+						exp->op = PEXP_REPLACE_ALL;
+						++i;
+						break;
+					case '#':
+						exp->op = PEXP_REPLACE_PREFIX;
+						++i;
+						break;
+					case '%':
+						exp->op = PEXP_REPLACE_SUFFIX;
+						++i;
+						break;
+				}
+			}
+			size_t pattern_len = wordLength(&str[i], len - i, '/');
+			if (parseWord(arena, &exp->word, &str[i], pattern_len, vars))
+				return 1;
+			exp->pattern = literalPattern(arena, exp->word);
+			i += pattern_len + 1;
+			if (i < len && parseWord(arena, &exp->replacement, &str[i], len - i, vars))
+				return 1;
+			return 0;
+		}
+	}
+
+	switch (str[i]) {
+		case '-':
+			exp->op = PEXP_DEFAULT;
+			break;
+		case '=':
+			exp->op = PEXP_ASSIGN;
+			if (exp->param.type != ARG_VARIABLE || (exp->sub.type != 0 && exp->sub.type != '['))
+				return 1;
+			break;
+		case '+':
+			exp->op = PEXP_ALTERNATE;
+			break;
+		case '?':
+			exp->op = PEXP_ERROR;
+			if (exp->sub.type != 0 && exp->sub.type != '[')
+				return 1;
+			break;
+		default:
+			return 1;
+	}
+	++i;
+	return parseWord(arena, &exp->word, &str[i], len - i, vars);
+}
+
+/*
+ * Create the argument for a $ expansion of length dollar_len.
+ * Returns 1 on a syntax error.
+ */
+int dollarArg(Arena *arena, CmdArg *arg, char *buf, size_t dollar_len, _Bool quoted, Variables *vars) {
+	if (dollar_len == 1) {
+		*arg = (CmdArg){ .type = ARG_BASIC_STRING, .str = arenaStrndup(arena, "$", 1) };
+		return 0;
+	}
+	switch (buf[1]) {
+		case '(':
+			if (buf[2] == '(') {
+				char *expr = &buf[3];
+				size_t expr_len = dollar_len - 5;
+				// Expansions are substituted as text, so what the expression is only becomes known when they are expanded
+				if (memchr(expr, '$', expr_len) != NULL || memchr(expr, '`', expr_len) != NULL) {
+					CmdArg *word = arenaAlloc(arena, sizeof (CmdArg));
+					if (parseWord(arena, word, expr, expr_len, vars))
+						return 1;
+					*arg = (CmdArg){ .type = ARG_MATH_WORD, .sub = word };
+					break;
+				}
+				MathProg *math = mathCompile(arena, expr, expr_len, vars);
+				if (math == NULL) {
+					fprintf(stderr, "arithmetic syntax error in expression `%.*s'\n", (int)expr_len, expr);
+					return 1;
+				}
+				*arg = (CmdArg){ .type = ARG_MATH, .math = math };
+			}
+			else if (!fileReadArg(arena, arg, &buf[2], dollar_len - 3, vars))
+				*arg = (CmdArg){ .type = quoted ? ARG_QUOTED_SUBSHELL : ARG_SUBSHELL, .str = arenaStrndup(arena, &buf[2], dollar_len - 3) };
+			break;
+		case '{':
+			if (paramExpArg(arena, arg, &buf[2], dollar_len - 3, vars)) {
+				fprintf(stderr, "%.*s: bad substitution\n", (int)dollar_len, buf);
+				return 1;
+			}
+			// Plain ${name} is just a variable
+			if (arg->pexp->op == PEXP_NONE && arg->pexp->sub.type == 0)
+				*arg = arg->pexp->param;
+			break;
+		default:
+			*arg = variableArg(arenaStrndup(arena, &buf[1], dollar_len - 1), vars);
+	}
+	arg->quoted = quoted;
+	return 0;
+}
+
+/*
+ * Length of a word inside [[ ... ]], -1 if it has an unterminated quote or expansion.
+ * With parens, unquoted ( and ) are words of their own (for grouping), otherwise balanced ones are part of the word (a regex).
+ */
+ssize_t lengthCondWord(char *buf, _Bool parens) {
+	if (parens && (buf[0] == '(' || buf[0] == ')'))
+		return 1;
+	ssize_t l = 0;
+	size_t depth = 0;
+	for (char c; c = buf[l], c != '\0' && c != ' ' && c != '\t' && c != ';'; ++l) {
+		ssize_t temp = 1;
+		if (c == '(' || c == ')') {
+			if (parens || (c == ')' && depth == 0))
+				break;
+			if (c == '(')
+				++depth;
+			else
+				--depth;
+		}
+		switch (c) {
+			case '\\':
+				if (buf[l + 1] != '\0')
+					++l;
+				break;
+			case '\'':
+				temp = lengthSingleQuote(&buf[l]);
+				break;
+			case '"':
+				temp = lengthDoubleQuote(&buf[l]);
+				break;
+			case '$':
+				temp = lengthDollarExp(&buf[l]);
+				break;
+		}
+		if (temp < 1)
+			return -1;
+		l += temp - 1;
+	}
+	return l;
+}
+
+// Words of a [[ ... ]] expression, as offsets into the command buffer
+typedef struct _cond_parser CondParser;
+struct _cond_parser {
+	char *buf;
+	size_t count, pos;
+	size_t *starts, *lengths;
+	Arena *arena;
+	Variables *vars;
+};
+
+// Check if the current word is exactly str (an unquoted operator)
+static _Bool condIs(CondParser *p, char *str) {
+	return p->pos < p->count && p->lengths[p->pos] == strlen(str) && !strncmp(&p->buf[p->starts[p->pos]], str, p->lengths[p->pos]);
+}
+
+static CondExpr *condNode(Arena *arena, enum _test_op op) {
+	CondExpr *expr = arenaAlloc(arena, sizeof (CondExpr));
+	*expr = (CondExpr){ .op = op, .left = { .type = ARG_NULL }, .right = { .type = ARG_NULL }, .a = NULL, .b = NULL, .pattern = NULL, .regex = NULL };
+	return expr;
+}
+
+CondExpr *condDup(Arena *arena, CondExpr *expr) {
+	if (expr == NULL)
+		return NULL;
+	CondExpr *new_expr = condNode(arena, expr->op);
+	new_expr->left = argdup(arena, expr->left);
+	new_expr->right = argdup(arena, expr->right);
+	new_expr->a = condDup(arena, expr->a);
+	new_expr->b = condDup(arena, expr->b);
+	if (expr->pattern != NULL)
+		new_expr->pattern = patternDup(arena, expr->pattern);
+	if (expr->regex != NULL)
+		new_expr->regex = literalRegex(arena, expr->right);
+	return new_expr;
+}
+
+// Parse the current word as an operand
+static int condOperand(CondParser *p, CmdArg *arg) {
+	if (p->pos >= p->count || condIs(p, "&&") || condIs(p, "||") || condIs(p, ")"))
+		return 1;
+	int ret = parseWord(p->arena, arg, &p->buf[p->starts[p->pos]], p->lengths[p->pos], p->vars);
+	++p->pos;
+	return ret;
+}
+
+// Integer operands are compiled now, if they are a literal or a plain variable
+static void condMath(Arena *arena, CmdArg *arg, Variables *vars) {
+	char *text = arg->type == ARG_BASIC_STRING ? arg->str : arg->type == ARG_VARIABLE ? arg->name : NULL;
+	if (text == NULL)
+		return;
+	MathProg *math = mathCompile(arena, text, strlen(text), vars);
+	if (math == NULL)
+		return; // Reported when it is evaluated
+	*arg = (CmdArg){ .type = ARG_MATH, .math = math };
+}
+
+static CondExpr *condOr(CondParser*);
+
+static CondExpr *condPrimary(CondParser *p) {
+	if (p->pos >= p->count)
+		return NULL;
+
+	if (condIs(p, "!")) {
+		++p->pos;
+		CondExpr *operand = condPrimary(p);
+		if (operand == NULL)
+			return NULL;
+		CondExpr *expr = condNode(p->arena, TEST_NOT);
+		expr->a = operand;
+		return expr;
+	}
+	if (condIs(p, "(")) {
+		++p->pos;
+		CondExpr *expr = condOr(p);
+		if (expr == NULL || !condIs(p, ")"))
+			return NULL;
+		++p->pos;
+		return expr;
+	}
+
+	// Unary operator (if something follows it)
+	char word[4] = "";
+	if (p->lengths[p->pos] < sizeof (word))
+		strncat(word, &p->buf[p->starts[p->pos]], p->lengths[p->pos]);
+	enum _test_op op = testUnaryOp(word);
+	if (op != TEST_NONE && p->pos + 1 < p->count) {
+		++p->pos;
+		CondExpr *expr = condNode(p->arena, op);
+		if (condOperand(p, &expr->left))
+			return NULL;
+		return expr;
+	}
+
+	CondExpr *expr = condNode(p->arena, TEST_STRING);
+	if (condOperand(p, &expr->left))
+		return NULL;
+
+	// Binary operator
+	word[0] = '\0';
+	if (p->pos < p->count && p->lengths[p->pos] < sizeof (word))
+		strncat(word, &p->buf[p->starts[p->pos]], p->lengths[p->pos]);
+	op = word[0] == '\0' ? TEST_NONE : !strcmp(word, "=~") ? TEST_REGEX : testBinaryOp(word);
+	if (op == TEST_NONE)
+		return expr;
+	++p->pos;
+	expr->op = op;
+	if (condOperand(p, &expr->right))
+		return NULL;
+	switch (op) {
+		case TEST_STR_EQ:
+		case TEST_STR_NE:
+			// The right side is a pattern
+			expr->pattern = literalPattern(p->arena, expr->right);
+			break;
+		case TEST_REGEX:
+			expr->regex = literalRegex(p->arena, expr->right);
+			break;
+		case TEST_INT_EQ: case TEST_INT_NE:
+		case TEST_INT_LT: case TEST_INT_LE:
+		case TEST_INT_GT: case TEST_INT_GE:
+			condMath(p->arena, &expr->left, p->vars);
+			condMath(p->arena, &expr->right, p->vars);
+			break;
+		default:
+			break;
+	}
+	return expr;
+}
+
+static CondExpr *condAnd(CondParser *p) {
+	CondExpr *expr = condPrimary(p);
+	while (expr != NULL && condIs(p, "&&")) {
+		++p->pos;
+		CondExpr *right = condPrimary(p), *and = condNode(p->arena, TEST_AND);
+		and->a = expr;
+		and->b = right;
+		expr = and;
+		if (right == NULL)
+			return NULL;
+	}
+	return expr;
+}
+
+static CondExpr *condOr(CondParser *p) {
+	CondExpr *expr = condAnd(p);
+	while (expr != NULL && condIs(p, "||")) {
+		++p->pos;
+		CondExpr *right = condAnd(p), *or = condNode(p->arena, TEST_OR);
+		or->a = expr;
+		or->b = right;
+		expr = or;
+		if (right == NULL)
+			return NULL;
+	}
+	return expr;
+}
+
+/*
+ * Parse [[ expr ]], with every operator resolved and every operand tokenized now, so
+ * that running it only has to expand the operands.
+ * Returns 2 if the buffer doesn't start with [[, otherwise the same as commandParse.
+ */
+int parseConditional(Command *cmd, Variables *vars) {
+	char *buf = cmd->c_buf;
+	size_t start = strspn(buf, " \t");
+	if (buf[start] != '[' || buf[start + 1] != '[' || (buf[start + 2] != ' ' && buf[start + 2] != '\t'))
+		return 2;
+
+	// Split into words, up to the closing ]]
+	CondParser p = { .buf = buf, .count = 0, .pos = 0, .starts = NULL, .lengths = NULL, .arena = cmd->c_arena, .vars = vars };
+	size_t i = start + 2, capacity = 0;
+	for (;;) {
+		i += strspn(&buf[i], " \t");
+		// The right side of =~ is a regex, which has parentheses of its own
+		_Bool regex = p.count > 0 && p.lengths[p.count - 1] == 2 && !strncmp(&buf[p.starts[p.count - 1]], "=~", 2);
+		ssize_t len = lengthCondWord(&buf[i], !regex);
+		if (len < 1) {
+			free(p.starts);
+			free(p.lengths);
+			cmd->c_len = i;
+			buf[0] = buf[start];
+			return 1;
+		}
+		if (len == 2 && buf[i] == ']' && buf[i + 1] == ']') {
+			i += 2;
+			break;
+		}
+		if (p.count == capacity) {
+			capacity = capacity == 0 ? 8 : capacity * 2;
+			p.starts = reallocarray(p.starts, capacity, sizeof (size_t));
+			p.lengths = reallocarray(p.lengths, capacity, sizeof (size_t));
+		}
+		p.starts[p.count] = i;
+		p.lengths[p.count++] = len;
+		i += len;
+	}
+
+	CondExpr *expr = condOr(&p);
+	if (expr == NULL || p.pos < p.count) {
+		size_t error = p.pos < p.count ? p.starts[p.pos] : i - 2;
+		free(p.starts);
+		free(p.lengths);
+		cmd->c_len = error;
+		buf[0] = buf[error];
+		return 1;
+	}
+	free(p.starts);
+	free(p.lengths);
+
+	cmd->c_argc = 1;
+	cmd->c_argv = arenaAlloc(cmd->c_arena, sizeof (CmdArg));
+	cmd->c_argv[0] = (CmdArg){ .type = ARG_COND, .cond = expr };
+	cmd->c_type = CMD_COND;
+	return removeCompound(cmd, i);
+}
+
+// Length of a case pattern, which ends at an unquoted |, ) or blank (-1 if it has an unterminated quote or expansion)
+static ssize_t lengthCasePattern(char *buf) {
+	ssize_t l = 0;
+	for (char c; c = buf[l], c != '\0' && strchr(" \t|();<>", c) == NULL; ++l) {
+		ssize_t temp = 1;
+		switch (c) {
+			case '\\':
+				if (buf[l + 1] != '\0')
+					++l;
+				break;
+			case '\'':
+				temp = lengthSingleQuote(&buf[l]);
+				break;
+			case '"':
+				temp = lengthDoubleQuote(&buf[l]);
+				break;
+			case '$':
+				temp = lengthDollarExp(&buf[l]);
+				break;
+		}
+		if (temp < 1)
+			return -1;
+		l += temp - 1;
+	}
+	return l;
+}
+
+// Whether buf starts with the word esac
+static _Bool isEsac(char *buf) {
+	return !strncmp(buf, "esac", 4) && (buf[4] == '\0' || strchr(" \t;|<>", buf[4]) != NULL);
+}
+
+/*
+ * Skip blanks, reading the next line when this one has nothing left (or only a comment).
+ * Returns the offset of what comes next, or -1 at the end of the input.
+ */
+static ssize_t caseNext(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, char *PROMPT) {
+	for (;;) {
+		size_t skip = strspn(cmd->c_buf, " \t");
+		if (cmd->c_buf[skip] != '\0' && cmd->c_buf[skip] != '#')
+			return skip;
+		cmd->c_buf[0] = '\0';
+		if (istream == NULL || commandRead(cmd, istream, ostream, PROMPT) == -1)
+			return -1;
+	}
+}
+
+// Remove the first len characters of the command buffer
+static void caseConsume(Command *cmd, size_t len) {
+	memmove(cmd->c_buf, &cmd->c_buf[len], cmd->c_len - len + 1);
+	cmd->c_len -= len;
+}
+
+/*
+ * Parse case word in pattern) commands ;; ... esac.
+ * Each arm is a CMD_CASE_ARM command (its arguments are the patterns, c_if_true its commands), linked from c_cmds, and
+ * c_next is the esac. The patterns are compiled into the command's dispatch table once they are all read.
+ * Returns 2 if the buffer doesn't start with case, otherwise the same as commandParse.
+ */
+int parseCase(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, AliasMap *aliases, Variables *vars, char *PROMPT) {
+	char *buf = cmd->c_buf;
+	size_t start = strspn(buf, " \t");
+	if (strncmp(&buf[start], "case", 4) || (buf[start + 4] != ' ' && buf[start + 4] != '\t'))
+		return 2;
+
+	// case word in
+	size_t i = start + 4 + strspn(&buf[start + 4], " \t");
+	ssize_t len = lengthCondWord(&buf[i], 0);
+	CmdArg word;
+	if (len < 1 || parseWord(cmd->c_arena, &word, &buf[i], len, vars)) {
+		cmd->c_len = i;
+		buf[0] = buf[i];
+		return 1;
+	}
+	i += len;
+	i += strspn(&buf[i], " \t");
+	if (strncmp(&buf[i], "in", 2) || (buf[i + 2] != '\0' && buf[i + 2] != ' ' && buf[i + 2] != '\t')) {
+		cmd->c_len = i;
+		buf[0] = buf[i];
+		return 1;
+	}
+	caseConsume(cmd, i + 2);
+	cmd->c_type = CMD_CASE;
+	cmd->c_argc = 1;
+	cmd->c_argv = arenaAlloc(cmd->c_arena, sizeof (CmdArg));
+	cmd->c_argv[0] = word;
+
+	Command *const case_cmd = cmd, *last_arm = NULL;
+	size_t capacity = 0;
+	CmdArg *patterns = NULL;
+	for (;;) {
+		ssize_t next = caseNext(case_cmd, istream, ostream, PROMPT);
+		if (next == -1) {
+			free(patterns);
+			return -1;
+		}
+		buf = case_cmd->c_buf;
+		if (isEsac(&buf[next]))
+			break;
+
+		// Patterns, separated by | and ending with )
+		size_t pos = next + (buf[next] == '(');
+		int count = 0;
+		for (;;) {
+			pos += strspn(&buf[pos], " \t");
+			len = lengthCasePattern(&buf[pos]);
+			if (count == capacity) {
+				capacity = capacity == 0 ? 4 : capacity * 2;
+				patterns = reallocarray(patterns, capacity, sizeof (CmdArg));
+			}
+			if (len < 1 || parseWord(case_cmd->c_arena, &patterns[count++], &buf[pos], len, vars))
+				break;
+			pos += len;
+			pos += strspn(&buf[pos], " \t");
+			if (buf[pos] != '|')
+				break;
+			++pos;
+		}
+		if (len < 1 || buf[pos] != ')') {
+			free(patterns);
+			case_cmd->c_len = pos;
+			buf[0] = buf[pos];
+			return 1;
+		}
+		caseConsume(case_cmd, pos + 1);
+
+		Command *arm = commandInit(case_cmd->c_arena);
+		arm->c_type = CMD_CASE_ARM;
+		arm->c_argc = count;
+		arm->c_argv = arenaAlloc(case_cmd->c_arena, count * sizeof (CmdArg));
+		memcpy(arm->c_argv, patterns, count * sizeof (CmdArg));
+		arm->c_parent = case_cmd;
+		if (last_arm == NULL)
+			case_cmd->c_cmds = arm;
+		else
+			last_arm->c_next = arm;
+		last_arm = arm;
+
+		// Commands until ;; (or esac)
+		Command *body_cmd = NULL;
+		for (;;) {
+			next = caseNext(case_cmd, istream, ostream, PROMPT);
+			if (next == -1) {
+				free(patterns);
+				return -1;
+			}
+			buf = case_cmd->c_buf;
+			if (buf[next] == ';' && buf[next + 1] == ';') {
+				caseConsume(case_cmd, next + 2);
+				break;
+			}
+			if (isEsac(&buf[next]))
+				break;
+
+			cmd = commandInit(case_cmd->c_arena);
+			cmd->c_len = case_cmd->c_len;
+			cmd->c_size = case_cmd->c_size;
+			cmd->c_buf = case_cmd->c_buf;
+
+			const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+			if (cmd->c_buf != case_cmd->c_buf) {
+				case_cmd->c_size = cmd->c_size;
+				case_cmd->c_buf = cmd->c_buf;
+			}
+			case_cmd->c_len = cmd->c_len;
+			if (parse_result != 0) {
+				free(patterns);
+				return parse_result;
+			}
+			switch (cmd->c_type) {
+				case CMD_EMPTY:
+					continue;
+				case CMD_DO: case CMD_DONE:
+				case CMD_THEN: case CMD_ELSE: case CMD_FI:
+				case CMD_GROUP_END: case CMD_ESAC:
+					free(patterns);
+					case_cmd->c_buf[0] = 'e'; // Expected esac
+					return 1;
+				default:
+					break;
+			}
+			if (body_cmd == NULL)
+				arm->c_if_true = cmd;
+			else
+				body_cmd->c_next = cmd;
+			for (body_cmd = cmd; body_cmd->c_next != NULL; body_cmd = body_cmd->c_next)
+				body_cmd->c_parent = case_cmd;
+			body_cmd->c_parent = case_cmd;
+		}
+		if (isEsac(&buf[next]))
+			break;
+	}
+	free(patterns);
+
+	// esac, which can have redirections for the whole case
+	cmd = commandInit(case_cmd->c_arena);
+	cmd->c_len = case_cmd->c_len;
+	cmd->c_size = case_cmd->c_size;
+	cmd->c_buf = case_cmd->c_buf;
+	const int parse_result = commandParse(cmd, istream, ostream, aliases, vars, PROMPT);
+	if (cmd->c_buf != case_cmd->c_buf) {
+		case_cmd->c_size = cmd->c_size;
+		case_cmd->c_buf = cmd->c_buf;
+	}
+	case_cmd->c_len = cmd->c_len;
+	if (parse_result != 0)
+		return parse_result;
+	if (cmd->c_type != CMD_ESAC || cmd->c_io.out_pipe) {
+		case_cmd->c_buf[0] = cmd->c_io.out_pipe ? '|' : 'e';
+		return 1;
+	}
+	case_cmd->c_next = cmd; // CMD_ESAC
+	case_cmd->c_io = cmd->c_io;
+	cmd->c_io = (CmdIO){};
+	case_cmd->c_case = caseCompile(case_cmd->c_arena, case_cmd);
+	return 0;
+}
+
+/*
+ * Parse a compound array assignment, NAME=(words) or NAME+=(words), which may continue over several lines.
+ * Each word is an element, or [subscript]=value to set one element. It becomes a command with no arguments and one
+ * assignment, whose elements are the words.
+ * Returns 2 if the buffer doesn't start with one, otherwise the same as commandParse.
+ */
+int parseArrayAssign(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, Variables *vars, char *PROMPT) {
+	char *buf = cmd->c_buf;
+	size_t start = strspn(buf, " \t"), name_len, assign_len = lengthAssignment(&buf[start], &name_len);
+	if (assign_len == 0 || buf[start + name_len] == '[' || buf[start + assign_len] != '(')
+		return 2;
+
+	CmdAssign *assign = arenaAlloc(cmd->c_arena, sizeof (CmdAssign));
+	*assign = (CmdAssign){
+		.name = arenaStrndup(cmd->c_arena, &buf[start], name_len),
+		.value = { .type = ARG_NULL },
+		.sub = { .type = 0 },
+		.append = buf[start + assign_len - 2] == '+',
+		.count = 0,
+		.elements = NULL
+	};
+	assign->var = vars == NULL ? NULL : variableIntern(vars, assign->name);
+	caseConsume(cmd, start + assign_len + 1);
+
+	size_t capacity = 0;
+	ArrayElement *elements = NULL;
+	for (;;) {
+		ssize_t pos = caseNext(cmd, istream, ostream, PROMPT);
+		if (pos == -1) {
+			free(elements);
+			return -1;
+		}
+		buf = cmd->c_buf;
+		if (buf[pos] == ')') {
+			caseConsume(cmd, pos + 1);
+			break;
+		}
+		if (assign->count == capacity) {
+			capacity = capacity == 0 ? 8 : capacity * 2;
+			elements = reallocarray(elements, capacity, sizeof (ArrayElement));
+		}
+		ArrayElement *element = &elements[assign->count++];
+		*element = (ArrayElement){ .sub = { .type = 0 }, .value = { .type = ARG_NULL } };
+
+		// [subscript]=value sets one element, the value isn't split or globbed
+		size_t value = pos;
+		if (buf[pos] == '[') {
+			size_t len = strlen(&buf[pos + 1]), sub_len = wordLength(&buf[pos + 1], len, ']');
+			if (sub_len < len && buf[pos + sub_len + 2] == '=') {
+				if (parseSubscript(cmd->c_arena, &element->sub, &buf[pos + 1], sub_len, vars) || element->sub.type != '[') {
+					free(elements);
+					cmd->c_len = pos;
+					buf[0] = buf[pos];
+					return 1;
+				}
+				value = pos + sub_len + 3;
+			}
+		}
+		ssize_t len = lengthCasePattern(&buf[value]);
+		if (len < 0 || (len == 0 && element->sub.type == 0) || (len > 0 && parseWord(cmd->c_arena, &element->value, &buf[value], len, vars))) {
+			free(elements);
+			cmd->c_len = value;
+			buf[0] = buf[value];
+			return 1;
+		}
+		if (element->sub.type == 0)
+			globWord(cmd->c_arena, &element->value);
+		caseConsume(cmd, value + len);
+	}
+
+	assign->elements = arenaAlloc(cmd->c_arena, assign->count * sizeof (ArrayElement));
+	if (assign->count > 0)
+		memcpy(assign->elements, elements, assign->count * sizeof (ArrayElement));
+	free(elements);
+	cmd->c_type = CMD_REGULAR;
+	cmd->c_assign_count = 1;
+	cmd->c_assign = assign;
+	return removeCompound(cmd, 0);
+}
+
+int commandTokenize(Command *cmd, CmdInput *restrict istream, FILE *restrict ostream, AliasMap *aliases, Variables *vars, char *PROMPT) {
+	char *buf = cmd->c_buf;
+	/*
+	 * end: current parse index - when finished it will point one char past the end of the command
+	 * argc: how many args this command has
+	 * input_count: number of input files (<)
+	 * output_count: number of output files (>)
+	 * done: indicates we've finished parsing this command (there may be more after it)
+	 * whitespace: whether or not the last character was whitespace
 	 * need_file: whether we are waiting for a filename argument (for < or >)
 	 * has_pipe: command ends with a pipe, so we need to create the next command and parse it
 	 */
-	size_t end = 0, argc = 0, input_count = 0, output_count = 0;
+	size_t end = 0, argc = 0, assign_count = 0, input_count = 0, output_count = 0;
 	_Bool done = 0, whitespace = 1, need_file = 0, has_pipe = 0;
 	while (end <= cmd->c_len && !done) {
 		_Bool parse_run = 1;
@@ -795,7 +2322,9 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 					cmd->c_len = end;
 					return -1;
 				}
-				++end;
+				// ;; ends a case arm, it is left for the case to find
+				if (buf[end] != ';' || buf[end + 1] != ';')
+					++end;
 			case '\0':
 				if (need_file) {
 					cmd->c_len = --end;
@@ -907,6 +2436,9 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 					need_file = 0;
 					--argc;
 				}
+				// Words before the command name that look like NAME=value are assignments
+				else if (whitespace && argc == assign_count && isAssignment(&buf[end]))
+					++assign_count;
 				whitespace = 0;
 		}
 		if (parse_run) {
@@ -923,8 +2455,6 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 					break;
 				default:
 					len = lengthRegular(&buf[end]);
-					if (argc == 0 && !need_file && buf[end + len - 1] == '=')
-						++argc;
 			}
 			if (len < 1) {
 				cmd->c_len = end - len;
@@ -938,39 +2468,66 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 #ifdef DEBUG
 	fprintf(stderr, "Argc: %zu\n", argc);
 #endif
-	cmd->c_argc = argc;
-	if (cmd->c_argc == 0) {
+	if (argc == 0) {
 		memmove(buf, &buf[end], cmd->c_len - end + 1);
 		return 0;
 	}
+	cmd->c_argc = argc - assign_count;
+	cmd->c_assign_count = assign_count;
 	argc = 0;
 	cmd->c_io = (CmdIO){ .in_count = input_count, .out_count = output_count };
 	input_count = 0;
 	output_count = 0;
 
 	// Allocate space for arguments
-	cmd->c_argv = calloc(cmd->c_argc, sizeof (CmdArg));
+	cmd->c_argv = arenaAlloc(cmd->c_arena, cmd->c_argc * sizeof (CmdArg));
 	for (size_t i = 0; i < cmd->c_argc; ++i)
 		cmd->c_argv[i].type = ARG_NULL;
+	if (cmd->c_assign_count)
+		cmd->c_assign = arenaAlloc(cmd->c_arena, cmd->c_assign_count * sizeof (CmdAssign));
 	if (cmd->c_io.in_count) {
-		cmd->c_io.in = calloc(cmd->c_io.in_count, sizeof (CmdIOFile));
+		cmd->c_io.in = arenaAlloc(cmd->c_arena, cmd->c_io.in_count * sizeof (CmdIOFile));
 		for (size_t i = 0; i < cmd->c_io.in_count; ++i)
 			cmd->c_io.in[i] = (CmdIOFile){ .arg = { .type = ARG_NULL }, .alternate = 0 };
 	}
 	if (cmd->c_io.out_count) {
-		cmd->c_io.out = calloc(cmd->c_io.out_count, sizeof (CmdIOFile));
+		cmd->c_io.out = arenaAlloc(cmd->c_arena, cmd->c_io.out_count * sizeof (CmdIOFile));
 		for (size_t i = 0; i < cmd->c_io.out_count; ++i)
 			cmd->c_io.out[i] = (CmdIOFile){ .arg = { .type = ARG_NULL }, .alternate = 0 };
 	}
 
 	// Parse and set each argument structure
 	need_file = 0;
-	_Bool inDoubleQuote = 0, need_input;
-	for (size_t current = 0; current < end; ++current) {
+	_Bool inDoubleQuote = 0, need_input, assigning = 0;
+	for (size_t current = 0, assigned = 0; current < end; ++current) {
+		// Assignments come first, the name is stored separately and the rest of the word is the value
+		if (assigned < cmd->c_assign_count && !assigning && !need_file && !inDoubleQuote && (current == 0 || strchr(" \t\n", buf[current - 1]) != NULL) && isAssignment(&buf[current])) {
+			size_t name_len, assign_len = lengthAssignment(&buf[current], &name_len);
+			CmdAssign *assign = &cmd->c_assign[assigned];
+			*assign = (CmdAssign){
+				.name = arenaStrndup(cmd->c_arena, &buf[current], name_len),
+				.value = { .type = ARG_NULL },
+				.sub = { .type = 0 },
+				.append = buf[current + assign_len - 2] == '+',
+				.count = 0,
+				.elements = NULL
+			};
+			assign->var = vars == NULL ? NULL : variableIntern(vars, assign->name);
+			if (buf[current + name_len] == '[') {
+				size_t sub_len = assign_len - name_len - 3 - assign->append;
+				if (parseSubscript(cmd->c_arena, &assign->sub, &buf[current + name_len + 1], sub_len, vars) || assign->sub.type != '[') {
+					cmd->c_len = current + name_len;
+					return 1;
+				}
+			}
+			assigning = 1;
+			current += assign_len - 1; // =
+			continue;
+		}
 		_Bool parse_regular = 0;
 		CmdArg *cur_arg = need_file
 			? (need_input ? &cmd->c_io.in[input_count].arg : &cmd->c_io.out[output_count].arg)
-			: &cmd->c_argv[argc], new_arg = { .type = ARG_NULL };
+			: assigning ? &cmd->c_assign[assigned].value : &cmd->c_argv[argc], new_arg = { .type = ARG_NULL };
 		switch (buf[current]) {
 			case '\'': {
 				// Treat as normal character
@@ -985,12 +2542,15 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 					return 1;
 				}
 
-				new_arg = (CmdArg){ .type = ARG_QUOTED_STRING, .str = strndup(&buf[current + 1], quote_len - 2) };
+				new_arg = (CmdArg){ .type = ARG_QUOTED_STRING, .str = arenaStrndup(cmd->c_arena, &buf[current + 1], quote_len - 2) };
 				current += quote_len - 1;
 				break;
 			}
 			case '"':
 				inDoubleQuote = inDoubleQuote ? 0 : 1;
+				// "" is still an (empty) argument
+				if (!inDoubleQuote && cur_arg->type == ARG_NULL && buf[current - 1] == '"')
+					*cur_arg = (CmdArg){ .type = ARG_QUOTED_STRING, .str = arenaStrndup(cmd->c_arena, "", 0) };
 				break;
 			case '$': {
 				size_t dollar_len = lengthDollarExp(&buf[current]);
@@ -999,34 +2559,25 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 					return 1;
 				}
 
-				if (dollar_len == 1) {
-					new_arg = (CmdArg){ .type = ARG_BASIC_STRING, .str = strdup("$") };
-				}
-				else {
-					if (buf[current + 1] == '(') {
-						if (buf[current + 2] == '(') {
-							size_t dummy;
-							new_arg = (CmdArg){ .type = ARG_MATH, .sub = parseMath(&buf[current + 3], &dummy) };
-						}
-						else
-							new_arg = (CmdArg){ .type = inDoubleQuote ? ARG_QUOTED_SUBSHELL : ARG_SUBSHELL, .str = strndup(&buf[current + 2], dollar_len - 3) };
-					}
-					else
-						new_arg = (CmdArg){ .type = ARG_VARIABLE, .str = strndup(&buf[current + 1], dollar_len - 1) };
-				}
+				if (dollarArg(cmd->c_arena, &new_arg, &buf[current], dollar_len, inDoubleQuote, vars))
+					return 1;
 				current += dollar_len - 1;
 				break;
 			}
 			case '~': // TODO: ARG_HOME, for an easy way to do ~username
 				if (!inDoubleQuote && cur_arg->type == ARG_NULL)
-					*cur_arg = (CmdArg){ .type = ARG_VARIABLE, .str = strdup("HOME") };
+					*cur_arg = variableArg(arenaStrndup(cmd->c_arena, "HOME", 4), vars);
 				else
 					parse_regular = 1;
 				break;
 			case '<':
 				// Boy, I sure wish I had left a comment when I wrote this :)
 				if (!inDoubleQuote) {
-					if ((argc < cmd->c_argc || need_file) && cur_arg->type != ARG_NULL) {
+					if (assigning) {
+						assigning = 0;
+						++assigned;
+					}
+					else if ((argc < cmd->c_argc || need_file) && cur_arg->type != ARG_NULL) {
 						if (need_file)
 							need_input ? ++input_count : ++output_count;
 						else
@@ -1045,7 +2596,11 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 				break;
 			case '>':
 				if (!inDoubleQuote) {
-					if ((argc < cmd->c_argc || need_file) && cur_arg->type != ARG_NULL) {
+					if (assigning) {
+						assigning = 0;
+						++assigned;
+					}
+					else if ((argc < cmd->c_argc || need_file) && cur_arg->type != ARG_NULL) {
 						if (need_file)
 							need_input ? ++input_count : ++output_count;
 						else
@@ -1072,7 +2627,11 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 			case '\t':
 			case '\n':
 				if (!inDoubleQuote) {
-					if (cur_arg->type != ARG_NULL) {
+					if (assigning) {
+						assigning = 0;
+						++assigned;
+					}
+					else if (cur_arg->type != ARG_NULL) {
 						if (need_file) {
 							need_input ? ++input_count : ++output_count;
 							need_file = 0;
@@ -1091,37 +2650,16 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 				fprintf(stderr, "len%s returned %zd!\nParsed from %zu, with buffer contents: \e[1;31m<\e[0m%s\e[1;31m>\e[0m", inDoubleQuote ? "RnD" : "R", reg_len, current, buf);
 				return 1;
 			}
-			if (argc == 0 && !need_file && !inDoubleQuote && buf[current + reg_len - 1] == '=')
-				++argc;
-
-			new_arg = (CmdArg){ .type = ARG_BASIC_STRING, .str = strndup(&buf[current], reg_len) };
+			new_arg = (CmdArg){ .type = inDoubleQuote ? ARG_QUOTED_STRING : ARG_BASIC_STRING, .str = arenaStrndup(cmd->c_arena, &buf[current], reg_len) };
 			current += reg_len - 1;
 		}
-		if (new_arg.type != ARG_NULL) {
-			switch (cur_arg->type) {
-				case ARG_NULL:
-					*cur_arg = new_arg;
-					break;
-				case ARG_COMPLEX_STRING: {
-					size_t arr_len = 0;
-					while (cur_arg->sub[arr_len].type != ARG_NULL)
-						++arr_len;
-					cur_arg->sub = reallocarray(cur_arg->sub, arr_len + 2, sizeof (CmdArg));
-					cur_arg->sub[arr_len + 1] = cur_arg->sub[arr_len];
-					cur_arg->sub[arr_len] = new_arg;
-					break;
-				}
-				default: {
-					CmdArg new_complex = { .type = ARG_COMPLEX_STRING, .sub = calloc(3, sizeof (CmdArg)) };
-					new_complex.sub[0] = *cur_arg;
-					new_complex.sub[1] = new_arg;
-					new_complex.sub[2] = (CmdArg){ .type = ARG_NULL };
-					*cur_arg = new_complex;
-				}
-			}
-		}
+		if (new_arg.type != ARG_NULL)
+			appendArg(cmd->c_arena, cur_arg, new_arg);
 	}
 
+	for (int i = 0; i < cmd->c_argc; ++i)
+		globWord(cmd->c_arena, &cmd->c_argv[i]);
+
 	// Finish up with command, and initialize next if applicable
 	memmove(buf, &buf[end], cmd->c_len - end + 1); // Remove command from buffer
 	cmd->c_len -= end;
@@ -1129,11 +2667,11 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 
 	// Read next command if applicable (pipe, &&, ||)
 	if (has_pipe) {
-		Command *next = cmd->c_next = commandInit();
+		Command *next = cmd->c_next = commandInit(cmd->c_arena);
 		next->c_len = cmd->c_len;
 		next->c_size = cmd->c_size;
 		next->c_buf = cmd->c_buf;
-		const int parse_result = commandParse(next, istream, ostream, aliases, PROMPT);
+		const int parse_result = commandParse(next, istream, ostream, aliases, vars, PROMPT);
 		if (next->c_buf != cmd->c_buf) {
 			cmd->c_size = next->c_size;
 			cmd->c_buf = next->c_buf;
@@ -1161,91 +2699,78 @@ int commandTokenize(Command *cmd, FILE *restrict istream, FILE *restrict ostream
 	return 0;
 }
 
-CmdArg argdup(CmdArg a) {
+// Copy an argument into arena
+CmdArg argdup(Arena *arena, CmdArg a) {
 	switch (a.type) {
 		case ARG_BASIC_STRING:
 		case ARG_QUOTED_STRING:
-		case ARG_VARIABLE:
 		case ARG_SUBSHELL:
 		case ARG_QUOTED_SUBSHELL:
-		case ARG_MATH_OPERAND_NUMERIC:
-		case ARG_MATH_OPERAND_VARIABLE:
-			return (CmdArg){ .type = a.type, .str = strdup(a.str) };
-		case ARG_COMPLEX_STRING:
-		case ARG_MATH: {
+			return (CmdArg){ .type = a.type, .str = arenaStrndup(arena, a.str, strlen(a.str)) };
+		case ARG_VARIABLE:
+		case ARG_PARAMETER: {
+			CmdArg new_arg = a;
+			new_arg.name = arenaStrndup(arena, a.name, strlen(a.name));
+			return new_arg;
+		}
+		case ARG_MATH:
+			return (CmdArg){ .type = ARG_MATH, .quoted = a.quoted, .math = mathDup(arena, a.math) };
+		case ARG_MATH_WORD: {
+			CmdArg *word = arenaAlloc(arena, sizeof (CmdArg));
+			*word = argdup(arena, *a.sub);
+			return (CmdArg){ .type = ARG_MATH_WORD, .quoted = a.quoted, .sub = word };
+		}
+		case ARG_PARAM_EXP: {
+			ParamExp *exp = arenaAlloc(arena, sizeof (ParamExp));
+			*exp = *a.pexp;
+			exp->param = argdup(arena, a.pexp->param);
+			exp->word = argdup(arena, a.pexp->word);
+			exp->replacement = argdup(arena, a.pexp->replacement);
+			if (exp->offset != NULL)
+				exp->offset = mathDup(arena, exp->offset);
+			if (exp->length != NULL)
+				exp->length = mathDup(arena, exp->length);
+			exp->sub.key = argdup(arena, a.pexp->sub.key);
+			if (exp->sub.index != NULL)
+				exp->sub.index = mathDup(arena, exp->sub.index);
+			if (exp->pattern != NULL)
+				exp->pattern = patternDup(arena, exp->pattern);
+			return (CmdArg){ .type = ARG_PARAM_EXP, .quoted = a.quoted, .pexp = exp };
+		}
+		case ARG_COND:
+			return (CmdArg){ .type = ARG_COND, .cond = condDup(arena, a.cond) };
+		case ARG_GLOB: {
+			Glob *glob = arenaAlloc(arena, sizeof (Glob));
+			*glob = *a.glob;
+			glob->word = argdup(arena, a.glob->word);
+			glob->parts = arenaAlloc(arena, glob->count * sizeof (GlobPart));
+			for (size_t i = 0; i < glob->count; ++i) {
+				GlobPart part = a.glob->parts[i];
+				if (part.name != NULL)
+					part.name = arenaStrndup(arena, part.name, part.length);
+				else if (part.pattern != NULL)
+					part.pattern = patternDup(arena, part.pattern);
+				glob->parts[i] = part;
+			}
+			return (CmdArg){ .type = ARG_GLOB, .glob = glob };
+		}
+		case ARG_READ_FILE: {
+			FileRead *read = arenaAlloc(arena, sizeof (FileRead));
+			*read = *a.read;
+			read->file = argdup(arena, a.read->file);
+			read->command = arenaStrndup(arena, a.read->command, strlen(a.read->command));
+			return (CmdArg){ .type = ARG_READ_FILE, .quoted = a.quoted, .read = read };
+		}
+		case ARG_COMPLEX_STRING: {
 			size_t sub_len = 0;
 			while (a.sub[sub_len++].type != ARG_NULL);
-			CmdArg new_arg = { .type = a.type, .sub = calloc(sub_len, sizeof (CmdArg)) };
+			CmdArg new_arg = { .type = a.type, .sub = arenaAlloc(arena, sub_len * sizeof (CmdArg)) };
 			for (size_t i = 0; i < sub_len; ++i)
-				new_arg.sub[i] = argdup(a.sub[i]);
+				new_arg.sub[i] = argdup(arena, a.sub[i]);
 			return new_arg;
 		}
-		case ARG_MATH_OPERATOR: {
-			char *c = malloc(sizeof (char));
-			*c = *a.str;
-			return (CmdArg){ .type = ARG_MATH_OPERATOR, .str = c };
-		}
 		case ARG_NULL:
 			return (CmdArg){ .type = ARG_NULL };
 	}
 	return (CmdArg){};
 }
-
-void commandFree(Command *cmd) {
-	if (cmd->c_argv != NULL) {
-		for (size_t i = 0; i < cmd->c_argc; ++i)
-			freeArg(cmd->c_argv[i]);
-		free(cmd->c_argv);
-		cmd->c_argv = NULL;
-		cmd->c_argc = 0;
-	}
-
-	if (cmd->c_next != NULL) {
-		commandFree(cmd->c_next);
-		free(cmd->c_next);
-		cmd->c_next = NULL;
-	}
-	if (cmd->c_if_true != NULL) {
-		commandFree(cmd->c_if_true);
-		free(cmd->c_if_true);
-		cmd->c_if_true = NULL;
-	}
-	if (cmd->c_if_false != NULL) {
-		commandFree(cmd->c_if_false);
-		free(cmd->c_if_false);
-		cmd->c_if_false = NULL;
-	}
-	if (cmd->c_cmds != NULL) {
-		commandFree(cmd->c_cmds);
-		free(cmd->c_cmds);
-		cmd->c_cmds = NULL;
-	}
-
-	cmd->c_parent = NULL;
-
-	freeCmdIO(&cmd->c_io);
-}
-
-void freeArg(CmdArg a) {
-	switch (a.type) {
-		case ARG_BASIC_STRING:
-		case ARG_QUOTED_STRING:
-		case ARG_VARIABLE:
-		case ARG_SUBSHELL:
-		case ARG_QUOTED_SUBSHELL:
-		case ARG_MATH_OPERATOR:
-		case ARG_MATH_OPERAND_NUMERIC:
-		case ARG_MATH_OPERAND_VARIABLE:
-			free(a.str);
-			break;
-		case ARG_COMPLEX_STRING:
-		case ARG_MATH:
-			for (size_t i = 0; a.sub[i].type != ARG_NULL; ++i)
-				freeArg(a.sub[i]);
-			free(a.sub);
-			break;
-		case ARG_NULL:
-		default:
-			break;
-	}
-}
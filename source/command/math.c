@@ -0,0 +1,598 @@
+#define _DEFAULT_SOURCE // random
+#include "command.h"
+#include "compatibility.h" // For reallocarray
+#include "mash.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Arithmetic compiler.
+ * Expressions are compiled once (at parse time) by a precedence climbing
+ * parser into a small stack machine program. Literals are decoded here,
+ * and operations on constants are folded, so evaluation only has to walk
+ * the instruction array.
+ */
+
+// Binary operator precedence (higher binds tighter), 0 if not a binary operator
+enum _math_prec {
+	PREC_NONE,
+	PREC_COMMA,
+	PREC_ASSIGN,
+	PREC_TERNARY,
+	PREC_LOR,
+	PREC_LAND,
+	PREC_BOR,
+	PREC_BXOR,
+	PREC_BAND,
+	PREC_EQUALITY,
+	PREC_RELATIONAL,
+	PREC_SHIFT,
+	PREC_ADDITIVE,
+	PREC_MULTIPLICATIVE,
+	PREC_POWER
+};
+
+typedef struct _math_compiler MathCompiler;
+struct _math_compiler {
+	char *buf;
+	size_t pos, length;
+	MathProg *prog; // Built in the scratch space, and copied out when it is done
+	size_t depth;   // Current stack depth
+	_Bool error;
+};
+
+// Scratch space for the program being compiled, kept for the next one
+static MathInstr *code_scratch = NULL;
+static char **names_scratch = NULL; // Point into the expression, with their lengths in name_lengths
+static size_t *name_lengths = NULL;
+static size_t code_capacity = 0, names_capacity = 0;
+
+// Binary operators, longest first so that prefixes don't match early
+static const struct {
+	char *str;
+	enum _math_op op;
+	enum _math_prec prec;
+} binary_ops[] = {
+	{ "**", MOP_POW, PREC_POWER },
+	{ "<<", MOP_SHL, PREC_SHIFT },
+	{ ">>", MOP_SHR, PREC_SHIFT },
+	{ "<=", MOP_LE, PREC_RELATIONAL },
+	{ ">=", MOP_GE, PREC_RELATIONAL },
+	{ "==", MOP_EQ, PREC_EQUALITY },
+	{ "!=", MOP_NE, PREC_EQUALITY },
+	{ "&&", MOP_LAND, PREC_LAND },
+	{ "||", MOP_LOR, PREC_LOR },
+	{ "*", MOP_MUL, PREC_MULTIPLICATIVE },
+	{ "/", MOP_DIV, PREC_MULTIPLICATIVE },
+	{ "%", MOP_MOD, PREC_MULTIPLICATIVE },
+	{ "+", MOP_ADD, PREC_ADDITIVE },
+	{ "-", MOP_SUB, PREC_ADDITIVE },
+	{ "<", MOP_LT, PREC_RELATIONAL },
+	{ ">", MOP_GT, PREC_RELATIONAL },
+	{ "&", MOP_BAND, PREC_BAND },
+	{ "^", MOP_BXOR, PREC_BXOR },
+	{ "|", MOP_BOR, PREC_BOR },
+	{ "?", MOP_JZ, PREC_TERNARY },
+	{ ",", MOP_POP, PREC_COMMA },
+};
+
+// Assignment operators, and the operation they apply before storing
+static const struct {
+	char *str;
+	enum _math_op op;
+} assign_ops[] = {
+	{ "<<=", MOP_SHL },
+	{ ">>=", MOP_SHR },
+	{ "*=", MOP_MUL },
+	{ "/=", MOP_DIV },
+	{ "%=", MOP_MOD },
+	{ "+=", MOP_ADD },
+	{ "-=", MOP_SUB },
+	{ "&=", MOP_BAND },
+	{ "^=", MOP_BXOR },
+	{ "|=", MOP_BOR },
+	{ "=", MOP_STORE },
+};
+
+static void compileExpression(MathCompiler*, enum _math_prec);
+
+static void skipSpace(MathCompiler *c) {
+	while (c->pos < c->length && isspace(c->buf[c->pos]))
+		++c->pos;
+}
+
+static _Bool match(MathCompiler *c, char *str) {
+	size_t len = strlen(str);
+	return c->pos + len <= c->length && !strncmp(&c->buf[c->pos], str, len);
+}
+
+static size_t emit(MathCompiler *c, MathInstr instr) {
+	MathProg *prog = c->prog;
+	if (prog->length == code_capacity) {
+		code_capacity = code_capacity == 0 ? 32 : code_capacity * 2;
+		prog->code = code_scratch = reallocarray(code_scratch, code_capacity, sizeof (MathInstr));
+	}
+	prog->code[prog->length] = instr;
+	return prog->length++;
+}
+
+static void push(MathCompiler *c, size_t amount) {
+	c->depth += amount;
+	if (c->depth > c->prog->depth)
+		c->prog->depth = c->depth;
+}
+
+// Get (or add) the index of a variable used by the program
+static size_t slotIndex(MathCompiler *c, char *name, size_t length) {
+	MathProg *prog = c->prog;
+	for (size_t i = 0; i < prog->var_count; ++i)
+		if (name_lengths[i] == length && !strncmp(prog->names[i], name, length))
+			return i;
+	if (prog->var_count == names_capacity) {
+		names_capacity = names_capacity == 0 ? 8 : names_capacity * 2;
+		prog->names = names_scratch = reallocarray(names_scratch, names_capacity, sizeof (char*));
+		name_lengths = reallocarray(name_lengths, names_capacity, sizeof (size_t));
+	}
+	prog->names[prog->var_count] = name;
+	name_lengths[prog->var_count] = length;
+	return prog->var_count++;
+}
+
+// Fold an operation on constants, returns 0 if it can't be done at compile time
+static _Bool foldBinary(enum _math_op op, long long left, long long right, long long *result) {
+	switch (op) {
+		case MOP_DIV:
+		case MOP_MOD:
+			if (right == 0) // Leave this for runtime to report
+				return 0;
+			// LLONG_MIN / -1 traps, the quotient wraps around instead (and there is never a remainder)
+			if (right == -1)
+				*result = op == MOP_DIV ? (long long)(0ULL - (unsigned long long)left) : 0;
+			else
+				*result = op == MOP_DIV ? left / right : left % right;
+			return 1;
+		case MOP_POW: {
+			if (right < 0)
+				return 0;
+			// Squaring, with the products wrapping around like bash
+			unsigned long long base = left, power = 1;
+			for (; right > 0; right >>= 1) {
+				if (right & 1)
+					power *= base;
+				base *= base;
+			}
+			*result = power;
+			return 1;
+		}
+		// Overflow wraps around like bash, which signed arithmetic doesn't do in C, and shift counts are taken mod 64
+		case MOP_MUL: *result = (unsigned long long)left * (unsigned long long)right; return 1;
+		case MOP_ADD: *result = (unsigned long long)left + (unsigned long long)right; return 1;
+		case MOP_SUB: *result = (unsigned long long)left - (unsigned long long)right; return 1;
+		case MOP_SHL: *result = (unsigned long long)left << (right & 63); return 1;
+		case MOP_SHR: *result = left >> (right & 63); return 1;
+		case MOP_LT: *result = left < right; return 1;
+		case MOP_LE: *result = left <= right; return 1;
+		case MOP_GT: *result = left > right; return 1;
+		case MOP_GE: *result = left >= right; return 1;
+		case MOP_EQ: *result = left == right; return 1;
+		case MOP_NE: *result = left != right; return 1;
+		case MOP_BAND: *result = left & right; return 1;
+		case MOP_BXOR: *result = left ^ right; return 1;
+		case MOP_BOR: *result = left | right; return 1;
+		default:
+			return 0;
+	}
+}
+
+/*
+ * Read a variable name (optionally written as $name or ${name}), returns its length.
+ * *brace is set if ${name is followed by a subscript, which the caller has to read (and the } after it).
+ */
+static size_t readName(MathCompiler *c, char **name, _Bool *brace) {
+	_Bool braced = 0;
+	size_t start = c->pos;
+	if (c->buf[start] == '$') {
+		++start;
+		if (start < c->length && c->buf[start] == '{') {
+			braced = 1;
+			++start;
+		}
+	}
+	size_t end = start;
+	if (end < c->length && (isalpha(c->buf[end]) || c->buf[end] == '_'))
+		while (end < c->length && (isalnum(c->buf[end]) || c->buf[end] == '_'))
+			++end;
+	if (end == start)
+		return 0;
+	*brace = braced && end < c->length && c->buf[end] == '[';
+	if (braced && !*brace) {
+		if (end >= c->length || c->buf[end] != '}')
+			return 0;
+		c->pos = end + 1;
+	}
+	else
+		c->pos = end;
+	*name = &c->buf[start];
+	return end - start;
+}
+
+static void compileOperand(MathCompiler *c) {
+	skipSpace(c);
+	if (c->pos >= c->length) {
+		c->error = 1;
+		return;
+	}
+	char ch = c->buf[c->pos];
+
+	// Parenthesized sub-expression
+	if (ch == '(') {
+		++c->pos;
+		compileExpression(c, PREC_COMMA);
+		skipSpace(c);
+		if (c->pos >= c->length || c->buf[c->pos] != ')') {
+			c->error = 1;
+			return;
+		}
+		++c->pos;
+		return;
+	}
+
+	// Prefix increment/decrement
+	if (match(c, "++") || match(c, "--")) {
+		_Bool inc = ch == '+';
+		c->pos += 2;
+		skipSpace(c);
+		char *name;
+		_Bool brace;
+		size_t length = readName(c, &name, &brace);
+		if (length == 0 || brace) {
+			c->error = 1;
+			return;
+		}
+		emit(c, (MathInstr){ .op = inc ? MOP_PREINC : MOP_PREDEC, .slot = slotIndex(c, name, length) });
+		push(c, 1);
+		return;
+	}
+
+	// Unary operators
+	if (ch == '-' || ch == '+' || ch == '!' || ch == '~') {
+		++c->pos;
+		size_t start = c->prog->length;
+		compileOperand(c);
+		if (c->error || ch == '+')
+			return;
+		enum _math_op op = ch == '-' ? MOP_NEG : ch == '!' ? MOP_NOT : MOP_BNOT;
+		// Fold constants
+		MathInstr *last = &c->prog->code[start];
+		if (c->prog->length == start + 1 && last->op == MOP_PUSH) {
+			last->value = op == MOP_NEG ? (long long)(0ULL - (unsigned long long)last->value) : op == MOP_NOT ? !last->value : ~last->value;
+			return;
+		}
+		emit(c, (MathInstr){ .op = op });
+		return;
+	}
+
+	// Numeric literal
+	if (isdigit(ch)) {
+		char *end;
+		long long value = strtoll(&c->buf[c->pos], &end, 0);
+		if (isalnum(*end) || *end == '_') {
+			c->error = 1;
+			return;
+		}
+		c->pos = end - c->buf;
+		emit(c, (MathInstr){ .op = MOP_PUSH, .value = value });
+		push(c, 1);
+		return;
+	}
+
+	// Variable
+	char *name;
+	_Bool brace;
+	size_t length = readName(c, &name, &brace);
+	if (length == 0) {
+		c->error = 1;
+		return;
+	}
+	if (length == 6 && !strncmp(name, "RANDOM", 6)) {
+		emit(c, (MathInstr){ .op = MOP_RANDOM });
+		push(c, 1);
+		return;
+	}
+	size_t slot = slotIndex(c, name, length);
+
+	// Array element, which can only be read
+	if (c->pos < c->length && c->buf[c->pos] == '[') {
+		++c->pos;
+		compileExpression(c, PREC_COMMA);
+		skipSpace(c);
+		if (c->error || c->pos >= c->length || c->buf[c->pos] != ']' || (brace && (c->pos + 1 >= c->length || c->buf[c->pos + 1] != '}'))) {
+			c->error = 1;
+			return;
+		}
+		c->pos += 1 + brace;
+		emit(c, (MathInstr){ .op = MOP_ELEMENT, .slot = slot });
+		return;
+	}
+	skipSpace(c);
+
+	// Assignment
+	for (size_t i = 0; i < sizeof (assign_ops) / sizeof (*assign_ops); ++i) {
+		if (!match(c, assign_ops[i].str) || (assign_ops[i].op == MOP_STORE && match(c, "==")))
+			continue;
+		c->pos += strlen(assign_ops[i].str);
+		if (assign_ops[i].op != MOP_STORE) {
+			emit(c, (MathInstr){ .op = MOP_LOAD, .slot = slot });
+			push(c, 1);
+		}
+		compileExpression(c, PREC_ASSIGN); // Right associative
+		if (assign_ops[i].op != MOP_STORE) {
+			emit(c, (MathInstr){ .op = assign_ops[i].op });
+			--c->depth;
+		}
+		emit(c, (MathInstr){ .op = MOP_STORE, .slot = slot });
+		return;
+	}
+
+	// Postfix increment/decrement
+	if (match(c, "++") || match(c, "--")) {
+		emit(c, (MathInstr){ .op = c->buf[c->pos] == '+' ? MOP_POSTINC : MOP_POSTDEC, .slot = slot });
+		c->pos += 2;
+		push(c, 1);
+		return;
+	}
+
+	emit(c, (MathInstr){ .op = MOP_LOAD, .slot = slot });
+	push(c, 1);
+}
+
+static void compileExpression(MathCompiler *c, enum _math_prec min_prec) {
+	size_t start = c->prog->length;
+	compileOperand(c);
+	while (!c->error) {
+		skipSpace(c);
+		if (c->pos >= c->length)
+			return;
+
+		// Find operator
+		size_t i;
+		for (i = 0; i < sizeof (binary_ops) / sizeof (*binary_ops); ++i)
+			if (match(c, binary_ops[i].str))
+				break;
+		if (i == sizeof (binary_ops) / sizeof (*binary_ops) || binary_ops[i].prec < min_prec)
+			return;
+		enum _math_op op = binary_ops[i].op;
+		enum _math_prec prec = binary_ops[i].prec;
+		c->pos += strlen(binary_ops[i].str);
+
+		switch (op) {
+			// Ternary: cond JZ else; true JMP end; else: false; end:
+			case MOP_JZ: {
+				size_t jz = emit(c, (MathInstr){ .op = MOP_JZ });
+				--c->depth;
+				compileExpression(c, PREC_COMMA);
+				skipSpace(c);
+				if (c->error || c->pos >= c->length || c->buf[c->pos] != ':') {
+					c->error = 1;
+					return;
+				}
+				++c->pos;
+				size_t jmp = emit(c, (MathInstr){ .op = MOP_JMP });
+				--c->depth;
+				c->prog->code[jz].jump = c->prog->length;
+				compileExpression(c, PREC_TERNARY); // Right associative
+				c->prog->code[jmp].jump = c->prog->length;
+				break;
+			}
+			// Short circuit: left LAND/LOR end; right BOOL; end:
+			case MOP_LAND:
+			case MOP_LOR: {
+				size_t jump = emit(c, (MathInstr){ .op = op });
+				--c->depth;
+				compileExpression(c, prec + 1);
+				emit(c, (MathInstr){ .op = MOP_BOOL });
+				c->prog->code[jump].jump = c->prog->length;
+				break;
+			}
+			// Comma: discard left value
+			case MOP_POP:
+				emit(c, (MathInstr){ .op = MOP_POP });
+				--c->depth;
+				compileExpression(c, PREC_ASSIGN);
+				break;
+			default: {
+				size_t right = c->prog->length;
+				compileExpression(c, op == MOP_POW ? prec : prec + 1); // ** is right associative
+				if (c->error)
+					return;
+				// Fold constants
+				MathInstr *code = c->prog->code;
+				long long result;
+				if (right == start + 1 && c->prog->length == right + 1 &&
+						code[start].op == MOP_PUSH && code[right].op == MOP_PUSH &&
+						foldBinary(op, code[start].value, code[right].value, &result)) {
+					code[start].value = result;
+					c->prog->length = start + 1;
+				}
+				else
+					emit(c, (MathInstr){ .op = op });
+				--c->depth;
+			}
+		}
+	}
+}
+
+// Allocate a program as one block (from arena, or malloc if it is NULL), with room for the names after everything else
+static MathProg *mathBlock(Arena *arena, size_t length, size_t var_count, size_t name_bytes) {
+	size_t size = sizeof (MathProg) + length * sizeof (MathInstr) + var_count * (sizeof (char*) + sizeof (Variable*)) + name_bytes;
+	MathProg *prog = arena == NULL ? malloc(size) : arenaAlloc(arena, size);
+	prog->length = length;
+	prog->var_count = var_count;
+	prog->code = (MathInstr*)(prog + 1);
+	prog->names = (char**)(prog->code + length);
+	prog->vars = (Variable**)(prog->names + var_count);
+	return prog;
+}
+
+/*
+ * Compile an arithmetic expression of the given length.
+ * The program is allocated from arena, or as a single block that can be freed if arena is NULL.
+ * Variables are bound to their slots if vars is not NULL (otherwise on first run).
+ * Returns NULL if the expression is not valid.
+ */
+MathProg *mathCompile(Arena *arena, char *buf, size_t length, Variables *vars) {
+	MathProg scratch = { .length = 0, .depth = 0, .code = code_scratch, .var_count = 0, .names = names_scratch, .vars = NULL };
+	MathCompiler c = { .buf = buf, .pos = 0, .length = length, .prog = &scratch, .depth = 0, .error = 0 };
+
+	skipSpace(&c);
+	// Empty expression evaluates to 0
+	if (c.pos == length) {
+		emit(&c, (MathInstr){ .op = MOP_PUSH, .value = 0 });
+		push(&c, 1);
+	}
+	else
+		compileExpression(&c, PREC_COMMA);
+	skipSpace(&c);
+	if (c.error || c.pos != length)
+		return NULL;
+
+	size_t name_bytes = 0;
+	for (size_t i = 0; i < scratch.var_count; ++i)
+		name_bytes += name_lengths[i] + 1;
+	MathProg *prog = mathBlock(arena, scratch.length, scratch.var_count, name_bytes);
+	prog->depth = scratch.depth;
+	memcpy(prog->code, scratch.code, scratch.length * sizeof (MathInstr));
+	char *name = (char*)(prog->vars + prog->var_count);
+	for (size_t i = 0; i < prog->var_count; ++i) {
+		memcpy(name, scratch.names[i], name_lengths[i]);
+		name[name_lengths[i]] = '\0';
+		prog->names[i] = name;
+		prog->vars[i] = vars == NULL ? NULL : variableIntern(vars, name);
+		name += name_lengths[i] + 1;
+	}
+	return prog;
+}
+
+MathProg *mathDup(Arena *arena, MathProg *prog) {
+	size_t name_bytes = 0;
+	for (size_t i = 0; i < prog->var_count; ++i)
+		name_bytes += strlen(prog->names[i]) + 1;
+	MathProg *new_prog = mathBlock(arena, prog->length, prog->var_count, name_bytes);
+	new_prog->depth = prog->depth;
+	memcpy(new_prog->code, prog->code, prog->length * sizeof (MathInstr));
+	char *name = (char*)(new_prog->vars + new_prog->var_count);
+	for (size_t i = 0; i < prog->var_count; ++i) {
+		new_prog->names[i] = strcpy(name, prog->names[i]);
+		new_prog->vars[i] = prog->vars[i];
+		name += strlen(name) + 1;
+	}
+	return new_prog;
+}
+
+/*
+ * Run a compiled program.
+ * The stack lives on the C stack (its maximum depth is known at compile time),
+ * so nothing is allocated. Returns -1 on a runtime error (division by zero).
+ */
+int mathRun(MathProg *prog, Variables *vars, long long *result) {
+	long long stack[prog->depth + 1];
+	size_t top = 0; // Number of values on the stack
+
+	// Bind variables of programs compiled without a symbol table
+	for (size_t i = 0; i < prog->var_count; ++i)
+		if (prog->vars[i] == NULL)
+			prog->vars[i] = variableIntern(vars, prog->names[i]);
+
+	for (size_t pc = 0; pc < prog->length; ++pc) {
+		MathInstr *instr = &prog->code[pc];
+		switch (instr->op) {
+			case MOP_PUSH:
+				stack[top++] = instr->value;
+				break;
+			case MOP_LOAD:
+				stack[top++] = variableNumber(vars, prog->vars[instr->slot]);
+				break;
+			case MOP_RANDOM:
+				stack[top++] = random();
+				break;
+			case MOP_ELEMENT: {
+				_Bool bad;
+				char *value = variableElement(prog->vars[instr->slot], stack[top - 1], &bad);
+				if (bad) {
+					fprintf(stderr, "mash: %s[%lld]: bad array subscript\n", prog->vars[instr->slot]->name, stack[top - 1]);
+					return -1;
+				}
+				stack[top - 1] = value == NULL ? 0 : numberValue(vars, value);
+				break;
+			}
+			case MOP_STORE:
+				variableSetNumber(prog->vars[instr->slot], stack[top - 1]);
+				break;
+			case MOP_PREINC:
+			case MOP_PREDEC:
+			case MOP_POSTINC:
+			case MOP_POSTDEC: {
+				Variable *var = prog->vars[instr->slot];
+				long long value = variableNumber(vars, var);
+				long long new_value = (unsigned long long)value + (instr->op == MOP_PREINC || instr->op == MOP_POSTINC ? 1 : -1ULL);
+				variableSetNumber(var, new_value);
+				stack[top++] = instr->op == MOP_PREINC || instr->op == MOP_PREDEC ? new_value : value;
+				break;
+			}
+			case MOP_NEG:
+				stack[top - 1] = 0ULL - (unsigned long long)stack[top - 1];
+				break;
+			case MOP_NOT:
+				stack[top - 1] = !stack[top - 1];
+				break;
+			case MOP_BNOT:
+				stack[top - 1] = ~stack[top - 1];
+				break;
+			case MOP_BOOL:
+				stack[top - 1] = stack[top - 1] != 0;
+				break;
+			case MOP_POP:
+				--top;
+				break;
+			case MOP_JMP:
+				pc = instr->jump - 1;
+				break;
+			case MOP_JZ:
+				if (stack[--top] == 0)
+					pc = instr->jump - 1;
+				break;
+			case MOP_LAND:
+				if (stack[top - 1] == 0)
+					pc = instr->jump - 1; // Leave 0 as the result
+				else
+					--top;
+				break;
+			case MOP_LOR:
+				if (stack[top - 1] != 0) {
+					stack[top - 1] = 1;
+					pc = instr->jump - 1;
+				}
+				else
+					--top;
+				break;
+			case MOP_DIV:
+			case MOP_MOD:
+				if (stack[top - 1] == 0) {
+					fputs("mash: division by 0\n", stderr);
+					return -1;
+				}
+			default: {
+				long long right = stack[--top];
+				if (instr->op == MOP_POW && right < 0) {
+					fputs("mash: exponent less than 0\n", stderr);
+					return -1;
+				}
+				foldBinary(instr->op, stack[top - 1], right, &stack[top - 1]);
+			}
+		}
+	}
+	*result = stack[top - 1];
+	return 0;
+}
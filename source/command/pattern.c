@@ -0,0 +1,296 @@
+#include "command.h"
+#include "compatibility.h" // For reallocarray
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Glob patterns.
+ * A pattern is compiled once into a list of nodes (literal runs, ?, *, and
+ * bracket expressions as 256 bit sets), so matching never has to look at the
+ * pattern syntax again.
+ */
+
+#define classSet(class, c) ((class)[(unsigned char)(c) >> 3] |= 1 << ((unsigned char)(c) & 7))
+#define classHas(class, c) ((class)[(unsigned char)(c) >> 3] & 1 << ((unsigned char)(c) & 7))
+
+// Scratch space for the pattern being compiled (kept for the next one), copied out when it is done
+static PatternNode *node_scratch = NULL;
+static char *literal_scratch = NULL;
+static size_t node_capacity = 0, literal_capacity = 0;
+
+static PatternNode *addNode(Pattern *pat, enum _pattern_type type) {
+	if (pat->count == node_capacity) {
+		node_capacity = node_capacity == 0 ? 16 : node_capacity * 2;
+		pat->nodes = node_scratch = reallocarray(node_scratch, node_capacity, sizeof (PatternNode));
+	}
+	PatternNode *node = &pat->nodes[pat->count++];
+	*node = (PatternNode){ .type = type, .length = 0, .literal = NULL };
+	return node;
+}
+
+// Allocate a pattern as one block (from arena, or malloc if it is NULL), classes and literal text go after the nodes
+static Pattern *patternBlock(Arena *arena, size_t count, size_t classes, size_t literal_bytes) {
+	size_t size = sizeof (Pattern) + count * sizeof (PatternNode) + classes * 32 + literal_bytes;
+	Pattern *pat = arena == NULL ? malloc(size) : arenaAlloc(arena, size);
+	pat->count = count;
+	pat->nodes = (PatternNode*)(pat + 1);
+	return pat;
+}
+
+// Copy nodes into a pattern from patternBlock, along with their classes and text
+static void patternFill(Pattern *pat, PatternNode *nodes) {
+	unsigned char *class = (unsigned char*)&pat->nodes[pat->count];
+	size_t classes = 0;
+	for (size_t i = 0; i < pat->count; ++i)
+		classes += nodes[i].type == PAT_CLASS;
+	char *literal = (char*)&class[classes * 32];
+	for (size_t i = 0; i < pat->count; ++i) {
+		pat->nodes[i] = nodes[i];
+		if (nodes[i].type == PAT_CLASS) {
+			pat->nodes[i].class = memcpy(class, nodes[i].class, 32);
+			class += 32;
+		}
+		else if (nodes[i].type == PAT_LITERAL) {
+			pat->nodes[i].literal = memcpy(literal, nodes[i].literal, nodes[i].length);
+			literal += nodes[i].length;
+		}
+	}
+}
+
+// Parse a bracket expression starting after the [, returns its length (0 if it isn't one)
+static size_t compileClass(unsigned char *class, char *str, size_t len) {
+	size_t i = 0;
+	_Bool negate = 0;
+	if (i < len && (str[i] == '!' || str[i] == '^')) {
+		negate = 1;
+		++i;
+	}
+	memset(class, 0, 32);
+	for (size_t first = i; i < len; ++i) {
+		char c = str[i];
+		if (c == ']' && i > first)
+			break;
+		// Character classes ([:alpha:] etc)
+		if (c == '[' && i + 1 < len && str[i + 1] == ':') {
+			char *end = strstr(&str[i + 2], ":]");
+			if (end != NULL && end < &str[len]) {
+				static const struct {
+					char *name;
+					int (*test)(int);
+				} classes[] = {
+					{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+					{ "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+					{ "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit }
+				};
+				size_t name_len = end - &str[i + 2];
+				for (size_t n = 0; n < sizeof (classes) / sizeof (*classes); ++n)
+					if (strlen(classes[n].name) == name_len && !strncmp(classes[n].name, &str[i + 2], name_len))
+						for (int ch = 1; ch < 256; ++ch)
+							if (classes[n].test(ch))
+								classSet(class, ch);
+				i = end - str + 1;
+				continue;
+			}
+		}
+		if (c == '\\' && i + 1 < len)
+			c = str[++i];
+		// Range
+		if (i + 2 < len && str[i + 1] == '-' && str[i + 2] != ']') {
+			char last = str[i + 2];
+			i += 2;
+			if (last == '\\' && i + 1 < len)
+				last = str[++i];
+			for (int ch = (unsigned char)c; ch <= (unsigned char)last; ++ch)
+				classSet(class, ch);
+			continue;
+		}
+		classSet(class, c);
+	}
+	// No closing bracket, so it is a literal [
+	if (i >= len)
+		return 0;
+	if (negate)
+		for (size_t b = 0; b < 32; ++b)
+			class[b] = ~class[b];
+	return i + 1;
+}
+
+/*
+ * Compile a pattern of the given length.
+ * It is allocated from arena, or as a single block that can be freed if arena is NULL.
+ */
+Pattern *patternCompile(Arena *arena, char *str, size_t len) {
+	Pattern scratch = { .count = 0, .nodes = node_scratch, .min_length = 0, .fixed = 1 };
+	Pattern *pat = &scratch;
+	// Literal text is collected in the scratch space, and classes after it (there is room for as many as str could hold)
+	if (literal_capacity < len + len / 2 * 32) {
+		literal_capacity = len + len / 2 * 32;
+		literal_scratch = realloc(literal_scratch, literal_capacity);
+	}
+	size_t literal_bytes = 0, classes = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		char c = str[i];
+		switch (c) {
+			case '*':
+				// Consecutive stars are the same as one
+				if (pat->count == 0 || pat->nodes[pat->count - 1].type != PAT_STAR)
+					addNode(pat, PAT_STAR);
+				pat->fixed = 0;
+				continue;
+			case '?':
+				addNode(pat, PAT_ANY);
+				++pat->min_length;
+				continue;
+			case '[': {
+				unsigned char class[32];
+				size_t class_len = compileClass(class, &str[i + 1], len - i - 1);
+				if (class_len == 0)
+					break;
+				PatternNode *node = addNode(pat, PAT_CLASS);
+				node->class = memcpy(&literal_scratch[len + classes++ * 32], class, 32);
+				++pat->min_length;
+				i += class_len;
+				continue;
+			}
+			case '\\':
+				if (i + 1 < len)
+					c = str[++i];
+				break;
+		}
+		// Literal character, which is added to the previous run if possible
+		PatternNode *node = pat->count > 0 && pat->nodes[pat->count - 1].type == PAT_LITERAL
+			? &pat->nodes[pat->count - 1]
+			: addNode(pat, PAT_LITERAL);
+		if (node->length++ == 0)
+			node->literal = &literal_scratch[literal_bytes];
+		literal_scratch[literal_bytes++] = c;
+		++pat->min_length;
+	}
+
+	Pattern *compiled = patternBlock(arena, pat->count, classes, literal_bytes);
+	compiled->min_length = pat->min_length;
+	compiled->fixed = pat->fixed;
+	patternFill(compiled, pat->nodes);
+	return compiled;
+}
+
+// Match an entire string
+_Bool patternMatch(Pattern *pat, char *str, size_t len) {
+	if (len < pat->min_length || (pat->fixed && len != pat->min_length))
+		return 0;
+	// Literal text at the end has to be there (*.c), which rules out most strings without trying any stars
+	PatternNode *last = pat->count > 0 ? &pat->nodes[pat->count - 1] : NULL;
+	if (last != NULL && last->type == PAT_LITERAL && memcmp(&str[len - last->length], last->literal, last->length))
+		return 0;
+
+	// Only the last star ever needs to be retried, since a star matches anything the later ones could
+	size_t n = 0, s = 0, star_n = 0, star_s = 0;
+	_Bool star = 0;
+	for (;;) {
+		if (n < pat->count) {
+			PatternNode *node = &pat->nodes[n];
+			switch (node->type) {
+				case PAT_STAR:
+					star = 1;
+					star_n = n++;
+					star_s = s;
+					continue;
+				case PAT_ANY:
+					if (s < len) {
+						++s;
+						++n;
+						continue;
+					}
+					break;
+				case PAT_CLASS:
+					if (s < len && classHas(node->class, str[s])) {
+						++s;
+						++n;
+						continue;
+					}
+					break;
+				case PAT_LITERAL:
+					if (len - s >= node->length && !memcmp(&str[s], node->literal, node->length)) {
+						s += node->length;
+						++n;
+						continue;
+					}
+					break;
+			}
+		}
+		else if (s == len)
+			return 1;
+		// Mismatch, let the last star consume one more character
+		if (!star || star_s >= len)
+			return 0;
+		n = star_n + 1;
+		s = ++star_s;
+	}
+}
+
+// Length of the shortest (or longest) prefix of str that matches, -1 if none do
+ssize_t patternPrefix(Pattern *pat, char *str, size_t len, _Bool longest) {
+	if (len < pat->min_length)
+		return -1;
+	if (pat->fixed)
+		return patternMatch(pat, str, pat->min_length) ? (ssize_t)pat->min_length : -1;
+	if (longest) {
+		for (size_t l = len + 1; l-- > pat->min_length;)
+			if (patternMatch(pat, str, l))
+				return l;
+	}
+	else {
+		for (size_t l = pat->min_length; l <= len; ++l)
+			if (patternMatch(pat, str, l))
+				return l;
+	}
+	return -1;
+}
+
+// Start of the shortest (or longest) suffix of str that matches, -1 if none do
+ssize_t patternSuffix(Pattern *pat, char *str, size_t len, _Bool longest) {
+	if (len < pat->min_length)
+		return -1;
+	if (pat->fixed)
+		return patternMatch(pat, &str[len - pat->min_length], pat->min_length) ? (ssize_t)(len - pat->min_length) : -1;
+	if (longest) {
+		for (size_t s = 0; s <= len - pat->min_length; ++s)
+			if (patternMatch(pat, &str[s], len - s))
+				return s;
+	}
+	else {
+		for (size_t s = len - pat->min_length + 1; s-- > 0;)
+			if (patternMatch(pat, &str[s], len - s))
+				return s;
+	}
+	return -1;
+}
+
+// Escape every special character in str, so that it only matches itself
+char *patternQuote(char *str) {
+	char *quoted = malloc(strlen(str) * 2 + 1), *end = quoted;
+	for (; *str != '\0'; ++str) {
+		if (strchr("*?[]\\", *str) != NULL)
+			*end++ = '\\';
+		*end++ = *str;
+	}
+	*end = '\0';
+	return quoted;
+}
+
+Pattern *patternDup(Arena *arena, Pattern *pat) {
+	size_t classes = 0, literal_bytes = 0;
+	for (size_t i = 0; i < pat->count; ++i) {
+		if (pat->nodes[i].type == PAT_CLASS)
+			++classes;
+		else if (pat->nodes[i].type == PAT_LITERAL)
+			literal_bytes += pat->nodes[i].length;
+	}
+	Pattern *new_pat = patternBlock(arena, pat->count, classes, literal_bytes);
+	new_pat->min_length = pat->min_length;
+	new_pat->fixed = pat->fixed;
+	patternFill(new_pat, pat->nodes);
+	return new_pat;
+}
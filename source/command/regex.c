@@ -0,0 +1,151 @@
+#include "command.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Regular expressions for [[ string =~ regex ]].
+ * A regex that is literal text is compiled once, when the command is parsed.
+ * Ones built from expansions are compiled when they run, and kept in a small
+ * cache of the most recently used patterns, so a loop matching the same
+ * pattern against every line only compiles it once.
+ */
+
+#define REGEX_BUCKETS (REGEX_CACHE_SIZE * 2)
+
+typedef struct _cached_regex CachedRegex;
+struct _cached_regex {
+	char *text;
+	size_t length;
+	uint64_t hash;
+	regex_t regex;
+	_Bool valid;               // It compiled, invalid patterns are cached too
+	CachedRegex *prev, *next;  // Most recently used first
+	CachedRegex *chain;        // Next in the same bucket
+};
+
+static CachedRegex *buckets[REGEX_BUCKETS];
+static CachedRegex *newest = NULL, *oldest = NULL;
+static size_t hits = 0, misses = 0, entries = 0;
+
+// FNV-1a
+static uint64_t regexHash(const char *str, size_t len) {
+	uint64_t hash = 0xCBF29CE484222325;
+	for (size_t i = 0; i < len; ++i)
+		hash = (hash ^ (unsigned char)str[i]) * 0x100000001B3;
+	return hash;
+}
+
+static void regexFree(void *regex) {
+	regfree(regex);
+}
+
+/*
+ * Compile text as an extended regex owned by arena.
+ * Returns NULL if it isn't valid.
+ */
+regex_t *regexCompile(Arena *arena, char *text) {
+	regex_t *regex = arenaAlloc(arena, sizeof (regex_t));
+	if (regcomp(regex, text, REG_EXTENDED) != 0)
+		return NULL;
+	arenaCleanup(arena, regexFree, regex);
+	return regex;
+}
+
+static void lruUnlink(CachedRegex *entry) {
+	if (entry->prev != NULL)
+		entry->prev->next = entry->next;
+	else
+		newest = entry->next;
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+	else
+		oldest = entry->prev;
+}
+
+static void lruPush(CachedRegex *entry) {
+	entry->prev = NULL;
+	entry->next = newest;
+	if (newest != NULL)
+		newest->prev = entry;
+	else
+		oldest = entry;
+	newest = entry;
+}
+
+/*
+ * Get text (null terminated at len) compiled as an extended regex, from the cache if it was used recently.
+ * Returns NULL if it isn't valid. The regex stays valid until the next call.
+ */
+regex_t *regexCached(char *text, size_t len) {
+	uint64_t hash = regexHash(text, len);
+	CachedRegex **bucket = &buckets[hash % REGEX_BUCKETS];
+	for (CachedRegex *entry = *bucket; entry != NULL; entry = entry->chain) {
+		if (entry->hash == hash && entry->length == len && !memcmp(entry->text, text, len)) {
+			++hits;
+			if (entry != newest) {
+				lruUnlink(entry);
+				lruPush(entry);
+			}
+			return entry->valid ? &entry->regex : NULL;
+		}
+	}
+	++misses;
+
+	// Reuse the least recently used entry once the cache is full
+	CachedRegex *entry;
+	if (entries == REGEX_CACHE_SIZE) {
+		entry = oldest;
+		lruUnlink(entry);
+		CachedRegex **link = &buckets[entry->hash % REGEX_BUCKETS];
+		while (*link != entry)
+			link = &(*link)->chain;
+		*link = entry->chain;
+		if (entry->valid)
+			regfree(&entry->regex);
+		free(entry->text);
+	}
+	else {
+		entry = malloc(sizeof (CachedRegex));
+		++entries;
+	}
+	entry->text = malloc(len + 1);
+	memcpy(entry->text, text, len + 1);
+	entry->length = len;
+	entry->hash = hash;
+	entry->valid = regcomp(&entry->regex, text, REG_EXTENDED) == 0;
+	entry->chain = *bucket;
+	*bucket = entry;
+	lruPush(entry);
+	return entry->valid ? &entry->regex : NULL;
+}
+
+// Escape every special character in str, so that it only matches itself (freed with free)
+char *regexQuote(char *str) {
+	char *quoted = malloc(strlen(str) * 2 + 1), *end = quoted;
+	for (; *str != '\0'; ++str) {
+		if (strchr("\\.[]()*+?{}|^$", *str) != NULL)
+			*end++ = '\\';
+		*end++ = *str;
+	}
+	*end = '\0';
+	return quoted;
+}
+
+void regexCacheStats(size_t *cache_hits, size_t *cache_misses, size_t *cache_entries) {
+	*cache_hits = hits;
+	*cache_misses = misses;
+	*cache_entries = entries;
+}
+
+void regexCacheFree() {
+	for (CachedRegex *entry = newest, *next; entry != NULL; entry = next) {
+		next = entry->next;
+		if (entry->valid)
+			regfree(&entry->regex);
+		free(entry->text);
+		free(entry);
+	}
+	memset(buckets, 0, sizeof (buckets));
+	newest = oldest = NULL;
+	entries = 0;
+}
@@ -1,11 +1,15 @@
 #define _DEFAULT_SOURCE // random
 #define _POSIX_C_SOURCE 200809L // fileno
 #include "command.h"
+#include "compatibility.h" // strchrnul
 #include "mash.h"
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 #include <string.h>
 #include <unistd.h>
@@ -16,6 +20,17 @@ int fds[2];
 
 pid_t cmd_pid = 1; // Don't default to 0 - will cause memory leak
 _Bool killed = 0;
+_Bool interactive_shell = 0; // Set by main, errors that end a script only end the command when interactive
+
+extern char **environ;
+
+// Words expanded by the commands being run, each command releases its own when it finishes
+static Arena *expansion = NULL;
+
+// Copy of str that lasts until the command being run is done
+static char *expansionCopy(const char *str, size_t len) {
+	return arenaStrndup(expansion, str, len);
+}
 
 typedef struct _thread_data ThreadData;
 struct _thread_data {
@@ -69,7 +84,683 @@ void kill_child(int sig) {
 struct sigaction sigint_action = { .sa_handler = kill_child };
 struct sigaction previous_action;
 
-CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+// Execute a list of commands (a loop or if body, or a group)
+static CmdSignal executeList(Command *cmd, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	for (Command *cur = cmd; cur != NULL; cur = cur->c_next) {
+		CmdSignal res = commandExecute(cur, aliases, _source, vars, history_pool, cmd_exit);
+		// Redirections are opened every time the body runs, so they have to be closed every time
+		closeIOFiles(&cur->c_io);
+		switch (res) {
+			case CSIG_DONE:
+				break;
+			case CSIG_EXEC:
+				// TODO handle exec fail
+				res = CSIG_EXIT;
+			case CSIG_EXIT:
+			case CSIG_CONTINUE:
+			case CSIG_BREAK:
+			case CSIG_INT:
+			case CSIG_RETURN:
+				return res;
+		}
+		while (cur->c_io.out_pipe)
+			cur = cur->c_next;
+	}
+	return CSIG_DONE;
+}
+
+/*
+ * Call a shell function.
+ * The arguments are swapped in as a new source ($0 stays the same), and local variables get a new scope.
+ */
+static CmdSignal functionCall(ShellFunction *func, char **e_argv, int argc, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	char *args[argc];
+	args[0] = (*_source)->argv[0];
+	for (int i = 1; i < argc; ++i)
+		args[i] = e_argv[i];
+	Source *frame = sourceAdd(*_source, NULL, argc, args);
+	*_source = frame;
+	variablePushScope(vars);
+	arenaRetain(func->arena); // In case it is redefined or unset while running
+
+	CmdSignal res = commandExecute(func->body, aliases, _source, vars, history_pool, cmd_exit);
+
+	arenaRelease(func->arena);
+	variablePopScope(vars);
+	*_source = sourceClose(frame);
+	return res == CSIG_RETURN ? CSIG_DONE : res;
+}
+
+// Point stdin at fd, giving back what was read ahead first. Returns the old stdin for stdinRestore (-1 if it was closed)
+static int stdinRedirect(int fd) {
+	inputSync();
+	int saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+	dup2(fd, STDIN_FILENO);
+	inputDiscard(STDIN_FILENO);
+	return saved_in;
+}
+
+static void stdinRestore(int saved_in) {
+	inputSync();
+	inputDiscard(STDIN_FILENO);
+	if (saved_in == -1) // stdin was closed
+		close(STDIN_FILENO);
+	else {
+		dup2(saved_in, STDIN_FILENO);
+		close(saved_in);
+	}
+}
+
+// Handle what a line of a file returned, true if the rest of the file is skipped (res is then the file's result)
+static _Bool scriptLineDone(CmdSignal *res, Source *source, uint8_t *cmd_exit) {
+	switch (*res) {
+		case CSIG_DONE:
+			return 0;
+		case CSIG_CONTINUE:
+		case CSIG_BREAK:
+			*cmd_exit = 1;
+			fprintf(stderr, "%s: %s: not in a loop\n", source->argv[0], *res == CSIG_BREAK ? "break" : "continue");
+			*res = CSIG_DONE;
+			return 0;
+		case CSIG_RETURN:
+			*res = CSIG_DONE;
+			return 1;
+		default: // CSIG_EXEC, CSIG_EXIT and CSIG_INT stop everything
+			return 1;
+	}
+}
+
+/*
+ * Execute a parsed file, line by line like the main loop would.
+ * return stops it early, exit and SIGINT stop everything.
+ */
+CmdSignal scriptExecute(Script *script, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	for (size_t i = 0; i < script->count; ++i) {
+		outputFlush(); // Line boundary, like in the main loop
+		CmdSignal res = executeList(script->cmds[i], aliases, _source, vars, history_pool, cmd_exit);
+		if (scriptLineDone(&res, *_source, cmd_exit))
+			return res;
+	}
+	return CSIG_DONE;
+}
+
+/*
+ * Execute a file by parsing each line just before it runs, like the main loop does.
+ * Used for files whose parse depends on what earlier lines did (alias).
+ */
+CmdSignal scriptExecuteLines(int fd, char *name, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	CmdInput input = { .file = NULL, .fd = fd, .text = malloc(SCRIPT_BLOCK_SIZE), .len = 0, .pos = 0, .size = SCRIPT_BLOCK_SIZE };
+	if (input.text == NULL) {
+		fprintf(stderr, "%s: %s: %m\n", (*_source)->argv[0], name);
+		*cmd_exit = 1;
+		return CSIG_DONE;
+	}
+	Command cmd = { .c_len = 0, .c_size = 0, .c_buf = NULL };
+	CmdSignal res = CSIG_DONE;
+	for (;;) {
+		cmd = (Command){ .c_len = cmd.c_len, .c_size = cmd.c_size, .c_buf = cmd.c_buf, .c_type = CMD_EMPTY, .c_arena = arenaInit() };
+		outputFlush(); // Line boundary, like in the main loop
+		errno = 0;
+		int parse_result = commandParse(&cmd, &input, NULL, aliases, vars, NULL);
+		if (parse_result == -1 && errno == ENOMEM) {
+			fprintf(stderr, "%s: %s: %m\n", (*_source)->argv[0], name);
+			*cmd_exit = 1;
+		}
+		else if (parse_result == 1) {
+			fprintf(stderr, "   %*s\n", (int)cmd.c_len, "^");
+			fprintf(stderr, "%s: parse error near `%c'\n", name, cmd.c_buf[0]);
+			cmd.c_buf[0] = '\0';
+		}
+		else if (parse_result == 0 && cmd.c_type != CMD_EMPTY)
+			res = executeList(&cmd, aliases, _source, vars, history_pool, cmd_exit);
+		arenaRelease(cmd.c_arena);
+		if (parse_result == -1 || scriptLineDone(&res, *_source, cmd_exit))
+			break;
+	}
+	free(input.text);
+	return res;
+}
+
+static const char *const builtins[] = {
+	".", "[", "alias", "break", "cd", "continue", "declare", "echo", "exit", "export",
+	"help", "let", "local", "mapfile", "printf", "read", "readarray", "return", "shift", "source", "stats", "test",
+	"unalias", "unset"
+};
+
+// Built-in or function, anything that runs in the shell itself
+static _Bool isBuiltin(char *name) {
+	if (functionGet(name) != NULL)
+		return 1;
+	for (size_t i = 0; i < sizeof (builtins) / sizeof (*builtins); ++i)
+		if (!strcmp(builtins[i], name))
+			return 1;
+	return 0;
+}
+
+// What a built-in needs to run commands of its own (the mapfile callback)
+typedef struct _builtin_context BuiltinContext;
+struct _builtin_context {
+	AliasMap *aliases;
+	Source **source;
+	Variables *vars;
+	FILE **history_pool;
+};
+
+static CmdSignal builtinExecute(Command*, char**, int, FILE*, AliasMap*, Source**, Variables*, FILE**, uint8_t*);
+
+// Run argv for a built-in, it has to be a function or another built-in (which run without forking)
+static CmdSignal builtinCallback(char **argv, void *data) {
+	BuiltinContext *context = data;
+	if (!isBuiltin(argv[0])) {
+		fprintf(stderr, "%s: %s: callback must be a function or built-in\n", (*context->source)->argv[0], argv[0]);
+		return CSIG_DONE;
+	}
+	int argc = 0;
+	while (argv[argc] != NULL)
+		++argc;
+	uint8_t status;
+	return builtinExecute(NULL, argv, argc, NULL, context->aliases, context->source, context->vars, context->history_pool, &status);
+}
+
+/*
+ * Run a built-in, with its input (if any) coming from filein, or stdin if NULL.
+ * Output goes to stdout, which the caller has already pointed in the right direction.
+ */
+static CmdSignal builtinExecute(Command *cmd, char **e_argv, int argc, FILE *filein, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	Source *source = *_source;
+
+	// Functions come first, they can replace built-ins
+	ShellFunction *func = functionGet(e_argv[0]);
+	if (func != NULL)
+		return functionCall(func, e_argv, argc, aliases, _source, vars, history_pool, cmd_exit);
+
+	// Continue
+	if (!strcmp(e_argv[0], "continue")) {
+		*cmd_exit = 0;
+		return CSIG_CONTINUE;
+	}
+
+	// Break
+	else if (!strcmp(e_argv[0], "break")) {
+		*cmd_exit = 0;
+		return CSIG_BREAK;
+	}
+
+	// Output, written through the shell's buffer
+	else if (!strcmp(e_argv[0], "echo"))
+		b_echo(cmd_exit, e_argv);
+	else if (!strcmp(e_argv[0], "printf"))
+		b_printf(cmd_exit, e_argv, source, vars);
+
+	// Check for alias
+	else if (!strcmp(e_argv[0], "alias")) {
+		outputFlush(); // Printed with stdio
+		b_alias(cmd_exit, e_argv, source, aliases);
+	}
+
+	// Check for unalias
+	else if (!strcmp(e_argv[0], "unalias"))
+		b_unalias(cmd_exit, e_argv, argc, aliases);
+
+	// Exit shell
+	else if (!strcmp(e_argv[0], "exit"))
+		return b_exit(cmd_exit, e_argv, argc, source);
+
+	// Show help
+	else if (!strcmp(e_argv[0], "help"))
+		b_help(cmd_exit);
+
+	// Declare variable attributes
+	else if (!strcmp(e_argv[0], "declare"))
+		b_declare(cmd_exit, e_argv, source, vars);
+
+	// Arithmetic
+	else if (!strcmp(e_argv[0], "let"))
+		b_let(cmd_exit, e_argv, source, vars);
+
+	// Function local variables
+	else if (!strcmp(e_argv[0], "local"))
+		b_local(cmd_exit, e_argv, source, vars);
+
+	// Return from function
+	else if (!strcmp(e_argv[0], "return"))
+		return b_return(cmd_exit, e_argv, argc, source);
+
+	// Change directory
+	else if (!strcmp(e_argv[0], "cd"))
+		b_cd(cmd_exit, e_argv, argc, vars);
+
+	// Export variable
+	else if (!strcmp(e_argv[0], "export"))
+		b_export(cmd_exit, e_argv, argc, source, vars);
+
+	// Check for unset
+	else if (!strcmp(e_argv[0], "unset"))
+		b_unset(cmd_exit, e_argv, source, vars);
+
+	// Check for dot (source file)
+	else if (!strcmp(e_argv[0], ".") || !strcmp(e_argv[0], "source"))
+		return b_dot(cmd_exit, e_argv, argc, aliases, _source, vars, history_pool);
+
+	// Check for read
+	else if (!strcmp(e_argv[0], "read")) {
+		outputFlush(); // Anything before read is likely a prompt
+		b_read(cmd_exit, filein, e_argv, source, vars);
+	}
+
+	// Load lines into an array
+	else if (!strcmp(e_argv[0], "mapfile") || !strcmp(e_argv[0], "readarray"))
+		return b_mapfile(cmd_exit, filein, e_argv, source, vars, builtinCallback, &(BuiltinContext){ .aliases = aliases, .source = _source, .vars = vars, .history_pool = history_pool });
+
+	// Shift args
+	else if (!strcmp(e_argv[0], "shift"))
+		b_shift(cmd_exit, e_argv, argc, source);
+
+	// Cache statistics
+	else if (!strcmp(e_argv[0], "stats"))
+		b_stats(cmd_exit);
+
+	// Conditional expression
+	else if (!strcmp(e_argv[0], "[") || !strcmp(e_argv[0], "test"))
+		b_test(cmd_exit, e_argv, argc, source, vars);
+
+	return CSIG_DONE;
+}
+
+static int expandWords(WordList*, CmdArg, Source*, Variables*, uint8_t*);
+static int expandWord(char**, CmdArg, Source*, Variables*, uint8_t*);
+static int subscriptEvaluate(char**, long long*, Subscript*, Variable*, Source*, Variables*, uint8_t*);
+
+// Text of old followed by value, for += (in the expansion arena)
+static char *appendValue(char *old, char *value) {
+	if (old == NULL || old[0] == '\0')
+		return value;
+	size_t old_len = strlen(old), len = strlen(value);
+	char *text = arenaAlloc(expansion, old_len + len + 1);
+	memcpy(text, old, old_len);
+	memcpy(&text[old_len], value, len + 1);
+	return text;
+}
+
+/*
+ * Set the element of var that a subscript refers to, or append to it. *end is set to the index after it (in an
+ * indexed array), where the next element of a compound assignment goes.
+ * Returns -1 if the shell should exit.
+ */
+static int elementAssign(Variable *var, Subscript *sub, char *value, _Bool append, size_t *end, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	char *key;
+	long long index;
+	int ret = subscriptEvaluate(&key, &index, sub, var, source, vars, cmd_exit);
+	if (ret != 0)
+		return ret == -1 ? -1 : 0;
+	if (key != NULL) {
+		if (append)
+			value = appendValue(variableKey(var, key), value);
+		variableKeySet(var, key, value, strlen(value));
+		return 0;
+	}
+	_Bool bad;
+	char *old = variableElement(var, index, &bad);
+	if (bad) {
+		fprintf(stderr, "%s: %s[%lld]: bad array subscript\n", source->argv[0], var->name, index);
+		*cmd_exit = 1;
+		return 0;
+	}
+	if (index < 0)
+		index += variableArrayEnd(var);
+	if (append)
+		value = appendValue(old, value);
+	variableArraySet(var, index, value, strlen(value));
+	*end = index + 1;
+	return 0;
+}
+
+/*
+ * Assign NAME=(...), the elements replace the array's (or go after them, for +=).
+ * Every element is expanded before anything is set, so the array can be used in its own assignment. Words without a
+ * subscript are elements in order, or key value pairs for an associative array.
+ * Returns -1 if the shell should exit.
+ */
+static int assignElements(Variable *var, CmdAssign *assign, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	WordList words = { .words = NULL, .count = 0, .size = 0 };
+	size_t *ends = arenaAlloc(expansion, (assign->count + 1) * sizeof (size_t));
+	for (size_t e = 0; e < assign->count; ++e) {
+		ArrayElement *element = &assign->elements[e];
+		int ret;
+		if (element->sub.type == 0)
+			ret = expandWords(&words, element->value, source, vars, cmd_exit);
+		else {
+			char *value;
+			ret = expandWord(&value, element->value, source, vars, cmd_exit);
+			if (ret == 0 && value == NULL)
+				ret = 1;
+			if (ret == 0)
+				wordAppend(expansion, &words, value);
+		}
+		if (ret != 0)
+			return ret == -1 ? -1 : 0;
+		ends[e] = words.count;
+	}
+
+	if (!assign->append) {
+		if (var->assoc != NULL)
+			variableAssocClear(var);
+		else
+			variableArrayClear(var);
+	}
+	size_t next = variableArrayEnd(var), word = 0;
+	char *key = NULL; // Associative array key waiting for its value
+	for (size_t e = 0; e < assign->count; ++e) {
+		if (assign->elements[e].sub.type != 0) {
+			if (elementAssign(var, &assign->elements[e].sub, words.words[word++], 0, &next, source, vars, cmd_exit) == -1)
+				return -1;
+			continue;
+		}
+		for (; word < ends[e]; ++word) {
+			char *value = words.words[word];
+			if (var->assoc == NULL)
+				variableArraySet(var, next++, value, strlen(value));
+			else if (key == NULL)
+				key = value;
+			else {
+				variableKeySet(var, key, value, strlen(value));
+				key = NULL;
+			}
+		}
+	}
+	if (key != NULL)
+		variableKeySet(var, key, "", 0);
+	// NAME=() is still an array
+	if (var->array == NULL && var->assoc == NULL)
+		variableArrayClear(var);
+	return 0;
+}
+
+/*
+ * Set variables from a command that is only assignments, in order.
+ * Returns -1 if the shell should exit.
+ */
+static int assignVariables(CmdAssign *assign, size_t count, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	for (size_t i = 0; i < count; ++i) {
+		// Slot was bound by the tokenizer, unless it was parsed without a symbol table (aliases)
+		Variable *var = assign[i].var != NULL ? assign[i].var : variableIntern(vars, assign[i].name);
+
+		if (assign[i].elements != NULL) {
+			if (assignElements(var, &assign[i], source, vars, cmd_exit) == -1)
+				return -1;
+			continue;
+		}
+
+		// Arithmetic results are stored as numbers, and only formatted if used as text
+		if (assign[i].value.type == ARG_MATH && assign[i].sub.type == 0 && !assign[i].append) {
+			long long number;
+			if (mathRun(assign[i].value.math, vars, &number) == -1)
+				*cmd_exit = 1;
+			else if (variableSetNumber(var, number) == -1) {
+				fprintf(stderr, "%s: set variable: %m\n", source->argv[0]);
+				*cmd_exit = 1;
+			}
+			continue;
+		}
+
+		char *value = "";
+		if (assign[i].value.type != ARG_NULL) {
+			if (expandArgument(&value, assign[i].value, source, vars, cmd_exit) == -1)
+				return -1;
+			if (value == NULL)
+				return 0;
+		}
+		if (assign[i].sub.type == '[') {
+			size_t end;
+			if (elementAssign(var, &assign[i].sub, value, assign[i].append, &end, source, vars, cmd_exit) == -1)
+				return -1;
+			continue;
+		}
+		// += adds to integer variables, and appends to anything else (the first element of an array)
+		if (assign[i].append && var->integer && var->array == NULL && var->assoc == NULL) {
+			long long number;
+			if (evaluateMathString(&number, value, vars) == -1) {
+				fprintf(stderr, "%s: %s: syntax error in expression\n", source->argv[0], value);
+				*cmd_exit = 1;
+			}
+			else
+				variableSetNumber(var, (unsigned long long)variableNumber(vars, var) + (unsigned long long)number);
+			continue;
+		}
+		if (assign[i].append)
+			value = appendValue(variableValue(var), value);
+		if (variableAssign(vars, var, value) == -1) {
+			fprintf(stderr, "%s: set variable: %m\n", source->argv[0]);
+			*cmd_exit = 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Give a built-in or function its assignments, as exported variables in a new scope.
+ * The caller pops the scope when it is done, which puts everything back.
+ */
+static void assignTemporary(CmdAssign *assign, char **values, size_t count, Variables *vars) {
+	variablePushScope(vars);
+	for (size_t i = 0; i < count; ++i) {
+		Variable *var = assign[i].var != NULL ? assign[i].var : variableIntern(vars, assign[i].name);
+		variableLocal(vars, var);
+		var->exported = 1;
+		variableAssign(vars, var, values[i]);
+	}
+}
+
+/*
+ * Environment for a command run with assignments: the shell's environment, with them added or replacing what was there.
+ * Everything is allocated from the expansion arena.
+ */
+static char **commandEnvironment(CmdAssign *assign, char **values, size_t count) {
+	size_t env_count = 0;
+	while (environ[env_count] != NULL)
+		++env_count;
+	char **envp = arenaAlloc(expansion, (env_count + count + 1) * sizeof (char*));
+
+	size_t used = 0;
+	for (size_t i = 0; i < env_count; ++i) {
+		_Bool replaced = 0;
+		for (size_t a = 0; a < count && !replaced; ++a) {
+			size_t name_len = strlen(assign[a].name);
+			replaced = !strncmp(environ[i], assign[a].name, name_len) && environ[i][name_len] == '=';
+		}
+		if (!replaced)
+			envp[used++] = environ[i];
+	}
+	for (size_t a = 0; a < count; ++a) {
+		// The last assignment to a name wins
+		_Bool repeated = 0;
+		for (size_t later = a + 1; later < count && !repeated; ++later)
+			repeated = !strcmp(assign[a].name, assign[later].name);
+		if (repeated)
+			continue;
+		size_t name_len = strlen(assign[a].name), value_len = strlen(values[a]);
+		char *entry = envp[used++] = arenaAlloc(expansion, name_len + value_len + 2);
+		memcpy(entry, assign[a].name, name_len);
+		entry[name_len] = '=';
+		memcpy(&entry[name_len + 1], values[a], value_len + 1);
+	}
+	envp[used] = NULL;
+	return envp;
+}
+
+/*
+ * Run a for loop's body once, with its variable set to value (or to number if value is NULL).
+ * Returns CSIG_DONE to keep going, CSIG_BREAK to stop, or a signal the loop has to return.
+ */
+static CmdSignal forIteration(Command *cmd, Variable *var, char *value, long long number, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	if ((value == NULL ? variableSetNumber(var, number) : variableAssign(vars, var, value)) == -1) {
+		fprintf(stderr, "%s: %s: %m\n", (*_source)->argv[0], var->name);
+		*cmd_exit = 1;
+		return CSIG_BREAK;
+	}
+	CmdSignal res = commandExecute(cmd->c_if_true, aliases, _source, vars, history_pool, cmd_exit);
+	switch (res) {
+		case CSIG_CONTINUE:
+			return CSIG_DONE;
+		case CSIG_EXEC:
+			// TODO handle EXEC fail
+			return CSIG_EXIT;
+		default:
+			return res;
+	}
+}
+
+/*
+ * Parse a {first..last} or {first..last..step} range, of numbers or single letters.
+ * width is how wide numbers are zero padded to (0 if they aren't).
+ */
+static _Bool forRange(char *str, long long *first, long long *last, unsigned long long *step, int *width, _Bool *letters) {
+	size_t len = strlen(str);
+	if (len < 6 || str[0] != '{' || str[len - 1] != '}')
+		return 0;
+	char *end = &str[len - 1], *pos = &str[1];
+	long long values[3] = { 0, 0, 1 };
+	*width = 0;
+	*letters = isalpha((unsigned char)str[1]) && str[2] == '.';
+	for (size_t i = 0; i < 3; ++i) {
+		char *start = pos;
+		if (*letters && i < 2) {
+			if (!isalpha((unsigned char)*pos))
+				return 0;
+			values[i] = (unsigned char)*pos++;
+		}
+		else {
+			values[i] = strtoll(pos, &pos, 10);
+			if (pos == start || !isdigit((unsigned char)pos[-1]))
+				return 0;
+			// Leading zeros pad every number to the widest end
+			char *digits = *start == '-' || *start == '+' ? start + 1 : start;
+			if (i < 2 && digits[0] == '0' && pos - digits > 1 && pos - start > *width)
+				*width = pos - start;
+		}
+		if (pos == end)
+			break;
+		if (i == 2 || strncmp(pos, "..", 2))
+			return 0;
+		pos += 2;
+	}
+	if (pos != end)
+		return 0;
+	// Zero padding is as wide as the longer end
+	if (*width > 0) {
+		char number[24];
+		int widths[2] = { sprintf(number, "%lld", values[0]), sprintf(number, "%lld", values[1]) };
+		for (size_t i = 0; i < 2; ++i)
+			if (widths[i] > *width)
+				*width = widths[i];
+	}
+	*first = values[0];
+	*last = values[1];
+	*step = values[2] < 0 ? 0ULL - (unsigned long long)values[2] : values[2] == 0 ? 1 : (unsigned long long)values[2];
+	return 1;
+}
+
+/*
+ * Run a for loop's body for each value one word of its list makes.
+ * Nothing is collected up front: ranges are counted through, unquoted $(...) output is split (by IFS) where it is, and other words
+ * (globs) are expanded once and walked. Everything the word expanded to is released before the next word.
+ */
+static CmdSignal forWord(Command *cmd, Variable *var, CmdArg word, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	long long first, last;
+	unsigned long long step;
+	int width;
+	_Bool letters;
+	if (word.type == ARG_BASIC_STRING && forRange(word.str, &first, &last, &step, &width, &letters)) {
+		CmdSignal res = CSIG_DONE;
+		for (long long n = first; res == CSIG_DONE; ) {
+			char text[24];
+			if (letters)
+				sprintf(text, "%c", (char)n);
+			else if (width > 0)
+				sprintf(text, "%0*lld", width, n);
+			res = forIteration(cmd, var, letters || width > 0 ? text : NULL, n, aliases, _source, vars, history_pool, cmd_exit);
+			// Stop when the next step would go past the end, before it can overflow (the distance is taken unsigned for the same reason)
+			unsigned long long left = first <= last ? (unsigned long long)last - (unsigned long long)n : (unsigned long long)n - (unsigned long long)last;
+			if (left < step)
+				break;
+			n = first <= last ? (long long)((unsigned long long)n + step) : (long long)((unsigned long long)n - step);
+		}
+		return res;
+	}
+
+	ArenaMark mark = arenaMark(expansion);
+	CmdSignal res = CSIG_DONE;
+	if (word.type == ARG_GLOB && word.glob->word.type == ARG_SUBSHELL) {
+		char *output;
+		if (expandArgument(&output, word.glob->word, *_source, vars, cmd_exit) == -1) {
+			*history_pool = NULL;
+			res = CSIG_EXIT;
+		}
+		else if (output != NULL) {
+			Ifs ifs;
+			ifsInit(&ifs, getvar(vars, "IFS"));
+			size_t len = strlen(output), pos = 0, start, field_len;
+			while (res == CSIG_DONE && ifsField(&ifs, output, len, &pos, &start, &field_len)) {
+				char *field = &output[start];
+				field[field_len] = '\0';
+				// Fields that are patterns go through the path names they match
+				Glob *glob = strpbrk(field, "*?[") != NULL ? globCompile(expansion, field, field_len) : NULL;
+				WordList matches = { .words = NULL, .count = 0, .size = 0 };
+				if (glob == NULL || globExpand(glob, expansion, &matches, vars) == 0)
+					res = forIteration(cmd, var, field, 0, aliases, _source, vars, history_pool, cmd_exit);
+				for (size_t i = 0; res == CSIG_DONE && i < matches.count; ++i)
+					res = forIteration(cmd, var, matches.words[i], 0, aliases, _source, vars, history_pool, cmd_exit);
+			}
+		}
+	}
+	else {
+		WordList words = { .words = NULL, .count = 0, .size = 0 };
+		int ret = expandWords(&words, word, *_source, vars, cmd_exit);
+		if (ret == -1) {
+			*history_pool = NULL;
+			res = CSIG_EXIT;
+		}
+		for (size_t i = 0; ret == 0 && res == CSIG_DONE && i < words.count; ++i)
+			res = forIteration(cmd, var, words.words[i], 0, aliases, _source, vars, history_pool, cmd_exit);
+	}
+	arenaReset(expansion, mark);
+	return res;
+}
+
+static int expandPattern(Pattern**, CmdArg, Source*, Variables*, uint8_t*);
+
+/*
+ * Find the arm of a case command that its word matches (NULL if none do).
+ * Literal patterns and globs are all checked at once, patterns with expansions are then only expanded if they are in
+ * an earlier arm than the match. Returns -1 if the shell should exit.
+ */
+static int caseArm(Command **arm, Command *cmd, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	*arm = NULL;
+	char *word;
+	if (expandArgument(&word, cmd->c_argv[0], source, vars, cmd_exit) == -1)
+		return -1;
+	if (word == NULL)
+		return 0;
+	size_t len = strlen(word);
+
+	CaseTable *table = cmd->c_case;
+	size_t best = caseMatch(table, word, len);
+	for (size_t i = 0; i < table->pattern_count && table->patterns[i].arm < best; ++i) {
+		if (table->patterns[i].pattern != NULL)
+			continue;
+		Pattern *pat;
+		if (expandPattern(&pat, table->patterns[i].word, source, vars, cmd_exit) == -1)
+			return -1;
+		if (pat != NULL && patternMatch(pat, word, len))
+			best = table->patterns[i].arm;
+		free(pat);
+	}
+	if (best != CASE_NO_ARM)
+		*arm = table->arms[best];
+	return 0;
+}
+
+static CmdSignal commandRun(Command *cmd, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
 	// Empty/blank command, or skippable command (then, else, do)
 	switch (cmd->c_type) {
 		case CMD_WHILE:
@@ -103,6 +794,9 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 							return CSIG_EXIT;
 						case CSIG_INT:
 							return CSIG_INT;
+						case CSIG_RETURN:
+							closeIOFiles(&cmd->c_io);
+							return CSIG_RETURN;
 					}
 				}
 				if (cont) {
@@ -129,8 +823,9 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 						closeIOFiles(&cmd->c_io);
 						return CSIG_EXIT;
 					case CSIG_INT:
+					case CSIG_RETURN:
 						closeIOFiles(&cmd->c_io);
-						return CSIG_INT;
+						return res;
 				}
 				if (brk) {
 					*cmd_exit = 0;
@@ -168,6 +863,7 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 						case CSIG_CONTINUE:
 						case CSIG_BREAK:
 						case CSIG_INT:
+						case CSIG_RETURN:
 							closeIOFiles(&cmd->c_io);
 							return res;
 					}
@@ -187,43 +883,192 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 					case CSIG_CONTINUE:
 					case CSIG_BREAK:
 					case CSIG_INT:
+					case CSIG_RETURN:
 						closeIOFiles(&cmd->c_io);
 						return res;
 				}
 			}
 			closeIOFiles(&cmd->c_io);
 			return CSIG_DONE;
-		case CMD_DO:
-		case CMD_THEN:
-		case CMD_ELSE:
+		case CMD_ARITH: {
+			// Exit status is 0 if the expression was non-zero
+			long long value;
+			*cmd_exit = mathRun(cmd->c_argv[0].math, vars, &value) == -1 || value == 0;
+			return CSIG_DONE;
+		}
+		case CMD_COND: {
+			// Evaluated in place, exit status is 0 if true, 1 if false, and 2 on error
+			uint8_t status = *cmd_exit;
+			int ret = evaluateCondition(cmd->c_argv[0].cond, *_source, vars, &status);
+			if (ret == -1) {
+				*history_pool = NULL;
+				return CSIG_EXIT;
+			}
+			*cmd_exit = ret;
+			return CSIG_DONE;
+		}
+		case CMD_FOR_ARITH: {
 			killed = 0;
-			for (Command *cur = cmd->c_next; cur != NULL; cur = cur->c_next) {
-				CmdSignal res = commandExecute(cur, aliases, _source, vars, history_pool, cmd_exit);
+			// Open IO files
+			switch (openIOFiles(&cmd->c_io, *_source, vars, cmd_exit)) {
+				case -1:
+					return CSIG_EXIT;
+				case 0:
+					break;
+				default:
+					*cmd_exit = 1;
+					return CSIG_DONE;
+			}
+			long long value;
+			// Initialize
+			if (cmd->c_argv[0].type == ARG_MATH && mathRun(cmd->c_argv[0].math, vars, &value) == -1) {
+				closeIOFiles(&cmd->c_io);
+				*cmd_exit = 1;
+				return CSIG_DONE;
+			}
+			*cmd_exit = 0;
+			for (;;) {
+				// Test condition (an empty condition is always true)
+				if (cmd->c_argv[1].type == ARG_MATH) {
+					if (mathRun(cmd->c_argv[1].math, vars, &value) == -1) {
+						*cmd_exit = 1;
+						break;
+					}
+					if (value == 0)
+						break;
+				}
+				// Run body commands
+				_Bool brk = 0;
+				CmdSignal res = commandExecute(cmd->c_if_true, aliases, _source, vars, history_pool, cmd_exit);
 				switch (res) {
+					case CSIG_BREAK:
+						brk = 1;
+					case CSIG_CONTINUE:
 					case CSIG_DONE:
 						break;
 					case CSIG_EXEC:
-						// TODO handle exec fail
-						res = CSIG_EXIT;
+						// TODO handle EXEC fail
 					case CSIG_EXIT:
-					case CSIG_CONTINUE:
-					case CSIG_BREAK:
+						closeIOFiles(&cmd->c_io);
+						return CSIG_EXIT;
 					case CSIG_INT:
-						closeIOFiles(&cur->c_io);
+					case CSIG_RETURN:
+						closeIOFiles(&cmd->c_io);
 						return res;
 				}
-				while (cur->c_io.out_pipe)
-					cur = cur->c_next;
+				if (brk) {
+					*cmd_exit = 0;
+					break;
+				}
+				// Step
+				if (cmd->c_argv[2].type == ARG_MATH && mathRun(cmd->c_argv[2].math, vars, &value) == -1) {
+					*cmd_exit = 1;
+					break;
+				}
 			}
+			closeIOFiles(&cmd->c_io);
 			return CSIG_DONE;
-		case CMD_DONE:
-		case CMD_FI:
-			*cmd_exit = 0;
-		case CMD_EMPTY:
-			return killed ? CSIG_INT : CSIG_DONE;
-		default:
-			if (cmd->c_argc == 0) // TODO: do we need to check argc...?
-				return CSIG_DONE;
+		}
+		case CMD_FOR_IN: {
+			killed = 0;
+			// Open IO files
+			switch (openIOFiles(&cmd->c_io, *_source, vars, cmd_exit)) {
+				case -1:
+					return CSIG_EXIT;
+				case 0:
+					break;
+				default:
+					*cmd_exit = 1;
+					return CSIG_DONE;
+			}
+			Variable *var = cmd->c_argv[0].var != NULL ? cmd->c_argv[0].var : variableIntern(vars, cmd->c_argv[0].name);
+			*cmd_exit = 0;
+			CmdSignal res = CSIG_DONE;
+			// Without a list it goes through the positional parameters (as they were when it started)
+			if (!cmd->c_in_list) {
+				Source *source = *_source;
+				size_t count = source->argc;
+				char **params = arenaAlloc(expansion, count * sizeof (char*));
+				for (size_t i = 1; i < count; ++i)
+					params[i] = expansionCopy(source->argv[i], strlen(source->argv[i]));
+				for (size_t i = 1; res == CSIG_DONE && i < count; ++i)
+					res = forIteration(cmd, var, params[i], 0, aliases, _source, vars, history_pool, cmd_exit);
+			}
+			for (size_t i = 1; res == CSIG_DONE && i < cmd->c_argc; ++i)
+				res = forWord(cmd, var, cmd->c_argv[i], aliases, _source, vars, history_pool, cmd_exit);
+			closeIOFiles(&cmd->c_io);
+			if (res == CSIG_BREAK) {
+				*cmd_exit = 0;
+				res = CSIG_DONE;
+			}
+			return res;
+		}
+		case CMD_CASE: {
+			killed = 0;
+			// Open IO files
+			switch (openIOFiles(&cmd->c_io, *_source, vars, cmd_exit)) {
+				case -1:
+					return CSIG_EXIT;
+				case 0:
+					break;
+				default:
+					*cmd_exit = 1;
+					return CSIG_DONE;
+			}
+			Command *arm;
+			if (caseArm(&arm, cmd, *_source, vars, cmd_exit) == -1) {
+				closeIOFiles(&cmd->c_io);
+				*history_pool = NULL;
+				return CSIG_EXIT;
+			}
+			// Nothing matching (or an empty arm) is still a success
+			*cmd_exit = 0;
+			CmdSignal res = arm == NULL ? CSIG_DONE : executeList(arm->c_if_true, aliases, _source, vars, history_pool, cmd_exit);
+			closeIOFiles(&cmd->c_io);
+			return res;
+		}
+		case CMD_DO:
+		case CMD_THEN:
+		case CMD_ELSE:
+			killed = 0;
+			return executeList(cmd->c_next, aliases, _source, vars, history_pool, cmd_exit);
+		case CMD_GROUP: {
+			killed = 0;
+			// Open IO files
+			switch (openIOFiles(&cmd->c_io, *_source, vars, cmd_exit)) {
+				case -1:
+					return CSIG_EXIT;
+				case 0:
+					break;
+				default:
+					*cmd_exit = 1;
+					return CSIG_DONE;
+			}
+			// A pipe into the group is the stdin of the commands in it
+			int saved_in = -1;
+			if (cmd->c_io.in_pipe)
+				saved_in = stdinRedirect(fds[0]);
+			CmdSignal res = executeList(cmd->c_if_true, aliases, _source, vars, history_pool, cmd_exit);
+			if (cmd->c_io.in_pipe)
+				stdinRestore(saved_in);
+			closeIOFiles(&cmd->c_io);
+			return res;
+		}
+		case CMD_FUNCTION:
+			// The body was parsed with the definition, the table just needs a reference to it
+			functionDefine(cmd->c_function);
+			*cmd_exit = 0;
+			return CSIG_DONE;
+		case CMD_DONE:
+		case CMD_FI:
+			*cmd_exit = 0;
+		case CMD_EMPTY:
+		case CMD_CASE_ARM:
+		case CMD_ESAC:
+			return killed ? CSIG_INT : CSIG_DONE;
+		default:
+			if (cmd->c_argc == 0 && cmd->c_assign_count == 0)
+				return CSIG_DONE;
 	}
 
 	// Set (or create) input and output files
@@ -256,132 +1101,115 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 
 	Source *source = *_source;
 
-	// Check if user is setting shell variable
-	if (cmd->c_argv[0].type == ARG_BASIC_STRING) {
-		size_t len = strlen(cmd->c_argv[0].str);
-		if (cmd->c_argv[0].str[len - 1] == '=' &&
-				len - varNameLength(cmd->c_argv[0].str) == 1) {
-			cmd->c_argv[0].str[len - 1] = '\0';
-			char *full_arg = "";
-			if (cmd->c_argv[1].type != ARG_NULL) {
-				if (expandArgument(&full_arg, cmd->c_argv[1], source, vars, cmd_exit) == -1) {
-					*history_pool = NULL;
-					return CSIG_EXIT;
-				}
-				if (full_arg == NULL)
-					return CSIG_DONE;
-			}
-
-			int ret = setvar(vars, cmd->c_argv[0].str, full_arg, 0);
-			if (ret == -1) {
-				fprintf(stderr, "%s: set variable: %m\n", source->argv[0]);
-				*cmd_exit = 1;
-			}
-			if (cmd->c_argv[1].type != ARG_NULL)
-				free(full_arg);
-			return CSIG_DONE;
+	// Only assignments, they set shell variables
+	if (cmd->c_argc == 0) {
+		if (assignVariables(cmd->c_assign, cmd->c_assign_count, source, vars, cmd_exit) == -1) {
+			*history_pool = NULL;
+			return CSIG_EXIT;
 		}
+		return CSIG_DONE;
 	}
 
-	// Expand command into string array
-	char *e_argv[cmd->c_argc + 1];
+	// Expand command into its words (literal words are used straight from the command, nothing here is freed)
+	WordList words = { .words = arenaAlloc(expansion, (cmd->c_argc + 1) * sizeof (char*)), .count = 0, .size = cmd->c_argc + 1 };
 	for (size_t i = 0; i < cmd->c_argc; ++i) {
-		char *full_arg;
-		if (expandArgument(&full_arg, cmd->c_argv[i], source, vars, cmd_exit) == -1) {
-			for (size_t e = 0; e < i; ++e)
-				free(e_argv[e]);
+		int ret = expandWords(&words, cmd->c_argv[i], source, vars, cmd_exit);
+		if (ret == -1) {
 			*history_pool = NULL;
 			return CSIG_EXIT;
 		}
-		if (full_arg == NULL) {
-			for (size_t e = 0; e < i; ++e)
-				free(e_argv[e]);
+		if (ret == 1)
 			return CSIG_DONE;
+	}
+	char **e_argv = words.words;
+	int e_argc = words.count;
+
+	// Assignments before a command only apply to it
+	char *values[cmd->c_assign_count + 1];
+	for (size_t i = 0; i < cmd->c_assign_count; ++i) {
+		values[i] = "";
+		if (cmd->c_assign[i].value.type == ARG_NULL)
+			continue;
+		if (expandArgument(&values[i], cmd->c_assign[i].value, source, vars, cmd_exit) == -1) {
+			*history_pool = NULL;
+			return CSIG_EXIT;
 		}
-		e_argv[i] = full_arg;
+		if (values[i] == NULL)
+			return CSIG_DONE;
 	}
-	e_argv[cmd->c_argc] = NULL;
 
 #ifdef DEBUG
 	fputs("Execing:\n", stderr);
-	for (size_t i = 0; i < cmd->c_argc; ++i)
+	for (size_t i = 0; i < e_argc; ++i)
 		fprintf(stderr, "%s ", e_argv[i]);
 	fputc('\n', stderr);
 #endif
 
-	// Continue
-	if (!strcmp(e_argv[0], "continue")) {
-		for (size_t i = 0; i < cmd->c_argc; ++i)
-			free(e_argv[i]);
-		*cmd_exit = 0;
-		return CSIG_CONTINUE;
-	}
-
-	// Break
-	else if (!strcmp(e_argv[0], "break")) {
-		for (size_t i = 0; i < cmd->c_argc; ++i)
-			free(e_argv[i]);
-		*cmd_exit = 0;
-		return CSIG_BREAK;
-	}
-
-	// Check for alias
-	else if (!strcmp(e_argv[0], "alias"))
-		b_alias(cmd_exit, e_argv, source, aliases);
-
-	// Check for unalias
-	else if (!strcmp(e_argv[0], "unalias"))
-		b_unalias(cmd_exit, e_argv, cmd->c_argc, aliases);
-
-	// Exit shell
-	else if (!strcmp(e_argv[0], "exit"))
-		return b_exit(cmd_exit, e_argv, cmd->c_argc, source);
-
-	// Show help
-	else if (!strcmp(e_argv[0], "help"))
-		b_help(cmd_exit);
-
-	// Change directory
-	else if (!strcmp(e_argv[0], "cd"))
-		b_cd(cmd_exit, e_argv, cmd->c_argc);
-
-	// Export variable
-	else if (!strcmp(e_argv[0], "export"))
-		b_export(cmd_exit, e_argv, cmd->c_argc, source, vars);
-
-	// Check for unset
-	else if (!strcmp(e_argv[0], "unset"))
-		b_unset(cmd_exit, e_argv, source, vars);
+	// Built-ins run in the shell, unless they are piped into another command (then they get a process like anything else)
+	if (!cmd->c_io.out_pipe && isBuiltin(e_argv[0])) {
+		// Read from the pipe if this is the end of a pipeline (an input redirection takes priority)
+		FILE *pipein = NULL;
+		if (cmd->c_io.in_pipe && filein == NULL) {
+			int fd = dup(fds[0]);
+			if (fd != -1)
+				filein = pipein = fdopen(fd, "r");
+		}
+		// Point stdout at the output file, everything buffered so far belongs to the old one
+		int saved_out = -1;
+		if (fileout != NULL) {
+			outputFlush();
+			saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+			dup2(fileno(fileout), STDOUT_FILENO);
+		}
+		// Functions run whole commands, which read stdin: point it at the input file (what was read ahead is given back first)
+		int saved_in = -1;
+		_Bool redirect_in = filein != NULL && functionGet(e_argv[0]) != NULL;
+		if (redirect_in)
+			saved_in = stdinRedirect(fileno(filein));
 
-	// Check for dot (source file)
-	else if (!strcmp(e_argv[0], "."))
-		b_dot(cmd_exit, e_argv, cmd->c_argc, _source);
+		if (cmd->c_assign_count > 0)
+			assignTemporary(cmd->c_assign, values, cmd->c_assign_count, vars);
+		CmdSignal res = builtinExecute(cmd, e_argv, e_argc, filein, aliases, _source, vars, history_pool, cmd_exit);
+		if (cmd->c_assign_count > 0)
+			variablePopScope(vars);
 
-	// Check for read
-	else if (!strcmp(e_argv[0], "read"))
-		b_read(cmd_exit, filein, e_argv, source, vars);
+		if (redirect_in)
+			stdinRestore(saved_in);
 
-	// Shift args
-	else if (!strcmp(e_argv[0], "shift"))
-		b_shift(cmd_exit, e_argv, cmd->c_argc, source);
+		if (fileout != NULL) {
+			outputFlush();
+			if (saved_out == -1) // stdout was closed
+				close(STDOUT_FILENO);
+			else {
+				dup2(saved_out, STDOUT_FILENO);
+				close(saved_out);
+			}
+		}
+		if (pipein != NULL) {
+			inputDiscard(fileno(pipein));
+			fclose(pipein);
+		}
+		return res == CSIG_DONE && killed ? CSIG_INT : res;
+	}
 
 	// Regular command
 	else {
 		// Check for exec
 		if (!strcmp(e_argv[0], "exec")) { // TODO: don't exit if exec failed
-			if (cmd->c_argc == 1) {
+			if (e_argc == 1) {
 				fprintf(stderr, "%s: exec: requires at least one argument\n", source->argv[0]);
-				for (size_t v = 0; v < cmd->c_argc; ++v)
-					free(e_argv[v]);
 				*cmd_exit = 1;
 				return CSIG_DONE;
 			}
 			char *exec = e_argv[0];
-			for (size_t i = 0; i < cmd->c_argc; ++i)
+			for (size_t i = 0; i < e_argc; ++i)
 				e_argv[i] = e_argv[i + 1];
-			e_argv[cmd->c_argc] = exec;
+			e_argv[e_argc] = exec;
 		}
 
+		// The child's environment, if the command has assignments (the shell's own is left alone)
+		char **envp = cmd->c_assign_count > 0 && !isBuiltin(e_argv[0]) ? commandEnvironment(cmd->c_assign, values, cmd->c_assign_count) : NULL;
+
 		// Setup pipe
 		int pin[2] = { fds[0], -1 }, pout[2] = { -1, -1 };
 		if (cmd->c_io.out_pipe) {
@@ -406,7 +1234,9 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 			}
 		}
 
-		// Execute regular command
+		// Execute regular command (the child must not inherit buffered output, or miss input the shell read ahead)
+		outputFlush();
+		inputSync();
 		cmd_pid = fork();
 		// Forked process will execute the command
 		if (cmd_pid == 0) {
@@ -426,13 +1256,21 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 			else if (fileout != NULL)
 				dup2(fileno(fileout), STDOUT_FILENO);
 
+			// Built-in at the start or middle of a pipeline
+			if (isBuiltin(e_argv[0])) {
+				if (cmd->c_assign_count > 0)
+					assignTemporary(cmd->c_assign, values, cmd->c_assign_count, vars);
+				builtinExecute(cmd, e_argv, e_argc, cmd->c_io.in_pipe ? NULL : filein, aliases, _source, vars, history_pool, cmd_exit);
+				outputFlush();
+				*history_pool = NULL;
+				return CSIG_EXIT;
+			}
+
 			// TODO consider manual search of the path
+			if (envp != NULL)
+				environ = envp;
 			execvp(e_argv[0], e_argv);
 			fprintf(stderr, "%s: %s: %m\n", source->argv[0], e_argv[0]);
-
-			// Free memory (I wish this wasn't all duplicated in the child to begin with...)
-			for (size_t i = 0; i < cmd->c_argc; ++i)
-				free(e_argv[i]);
 			*history_pool = NULL;
 
 			*cmd_exit = 1;
@@ -488,6 +1326,7 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 				case CSIG_CONTINUE:
 				case CSIG_BREAK:
 				case CSIG_INT:
+				case CSIG_RETURN:
 					if (killed) {
 						sigaction(SIGINT, &previous_action, NULL);
 						fputc('\n', stderr);
@@ -509,13 +1348,6 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 			}
 			close(pin[0]);
 		}
-		if (filein != NULL) { // Cursed code to keep FILE position and fd offset in sync...
-			ssize_t offset = lseek(fileno(filein), 0, SEEK_CUR);
-			//fprintf(stderr, "FILE fd offset is now %zi (stream %ld)\n", offset, ftell(filein));
-			fseek(filein, offset, SEEK_SET);
-			fflush(filein);
-			//fprintf(stderr, "FILE fd offset is now %zi (stream %ld)\n", offset, ftell(filein));
-		}
 		// Set exit status (unless we piped, as the next programs exit status is used)
 		if (!cmd->c_io.out_pipe)
 			*cmd_exit = WEXITSTATUS(cmd_stat);
@@ -526,196 +1358,161 @@ CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Vari
 			previous_action.sa_handler(SIGINT);
 		}
 		// Return -1 if command was exec
-		if (e_argv[cmd->c_argc] != NULL) {
-			for (size_t i = 0; i < cmd->c_argc - 1; ++i)
-				free(e_argv[i]);
-			free(e_argv[cmd->c_argc]);
+		if (e_argv[e_argc] != NULL)
 			return killed ? CSIG_INT : CSIG_EXIT;
-		}
 	}
-	for (size_t i = 0; i < cmd->c_argc; ++i)
-		free(e_argv[i]);
 	return killed ? CSIG_INT : CSIG_DONE;
 }
 
-// Math formula
-typedef struct _math_operand MathOprnd;
-typedef struct _math_operator MathOprtr;
-struct _math_operand {
-	int variable; // false == literal
-	union {
-		long long value;
-		char *name;
-	};
-	struct _math_operator *operator_left;
-	struct _math_operator *operator_right;
-};
-struct _math_operator {
-	char type;
-	struct _math_operand *operand_left;
-	struct _math_operand *operand_right;
-};
+/*
+ * Run a command.
+ * Everything its words expand to is released in one go when it is done.
+ */
+CmdSignal commandExecute(Command *cmd, AliasMap *aliases, Source **_source, Variables *vars, FILE **history_pool, uint8_t *cmd_exit) {
+	if (expansion == NULL)
+		expansion = arenaInit();
+	ArenaMark mark = arenaMark(expansion);
+	CmdSignal res = commandRun(cmd, aliases, _source, vars, history_pool, cmd_exit);
+	arenaReset(expansion, mark);
+	return res;
+}
+
+// Evaluate a math expression given as a string, returns -1 if it could not be parsed.
+int evaluateMathString(long long *result, char *str, Variables *vars) {
+	MathProg *math = mathCompile(NULL, str, strlen(str), vars);
+	if (math == NULL)
+		return -1;
+	int ret = mathRun(math, vars, result);
+	free(math);
+	return ret;
+}
 
-long long evaluateMath(CmdArg arg, Variables *vars) {
-	// Allocate space and construct linked list
-	MathOprnd root;
-	if (arg.sub[0].type == ARG_MATH_OPERAND_VARIABLE) {
-		root = (MathOprnd){ .variable = 1, .name = arg.sub[0].str };
+int expandParamExp(char**, ParamExp*, Source*, Variables*, uint8_t*);
+
+#define FILE_READ_BLOCK 65536 // Growth of the buffer for $(< file) when the size isn't known up front
+
+// Whether cat runs the system's binary: it isn't a function, and the first one on $PATH is in /bin or /usr/bin
+static _Bool systemCat(Variables *vars) {
+	char *path = getvar(vars, "PATH");
+	if (functionGet("cat") != NULL || path == NULL)
+		return 0;
+	for (;;) {
+		size_t dir_len = strcspn(path, ":");
+		char file[dir_len + 5];
+		if (dir_len == 0)
+			strcpy(file, "cat");
+		else
+			sprintf(file, "%.*s/cat", (int)dir_len, path);
+		if (access(file, X_OK) == 0)
+			return (dir_len == 4 && !strncmp(path, "/bin", 4)) || (dir_len == 8 && !strncmp(path, "/usr/bin", 8));
+		if (path[dir_len] == '\0')
+			return 0;
+		path += dir_len + 1;
 	}
-	else {
-		root = (MathOprnd){ .variable = 0, .operator_left = NULL, .operator_right = NULL };
-		int scanned;
-		if (sscanf(arg.sub[0].str, "%Ld%n", &root.value, &scanned))
-			if (arg.sub[0].str[scanned] != '\0')
-				fprintf(stderr, "asdf: truncated number to %d digits\n", scanned - (arg.sub[0].str[0] == '-' ? 1 : 0));
-	}
-	for (size_t i = 1; arg.sub[i].type != ARG_NULL; i += 2) {
-		MathOprtr *operator = malloc(sizeof (MathOprtr));
-		MathOprnd *operand = malloc(sizeof (MathOprnd));
-		*operator = (MathOprtr){ .type = arg.sub[i].str[0], .operand_left = NULL, .operand_right = operand };
-		if (arg.sub[i + 1].type == ARG_MATH_OPERAND_VARIABLE)
-			*operand = (MathOprnd){ .variable = 1, .name = arg.sub[i + 1].str };
-		else {
-			*operand = (MathOprnd){ .variable = 0, .operator_left = operator, .operator_right = NULL };
-			int scanned;
-			if (sscanf(arg.sub[i + 1].str, "%Ld%n", &operand->value, &scanned))
-				if (arg.sub[i + 1].str[scanned] != '\0')
-					fprintf(stderr, "asdf: truncated number to %d digits\n", scanned - (arg.sub[i + 1].str[0] == '-' ? 1 : 0));
-		}
-		if (i > 1) {
-			operator->operand_left = root.operator_left->operand_right;
-			root.operator_left = operator;
-		}
-		else {
-			operator->operand_left = &root;
-			root.operator_left = root.operator_right = operator;
-		}
-	}
-	MathOprnd *operand = &root;
-	for (;; operand = operand->operator_right->operand_right) {
-		if (operand->variable) {
-			operand->variable = 0;
-			/*if (isdigit(arg.sub[i * 2].str[0])) {
-				unsigned position;
-				sscanf(arg.sub[i * 2].str)
-			}*/
-			if (!strcmp(operand->name, "RANDOM"))
-				operand->value = random();
-			else {
-				long long number = 0;
-				char *value = getvar(vars, operand->name);
-				if (value != NULL) {
-					int scanned;
-					if (sscanf(value, "%Ld%n", &number, &scanned))
-						if (value[scanned] != '\0')
-							number = 0;
-					operand->value = number;
-				}
-			}
-		}
-		if (operand->operator_right == NULL)
-			break;
+}
+
+/*
+ * Expand $(< file) or $(cat file) by reading the file straight into the expansion arena, with the trailing newlines
+ * removed like the output of any other subshell. It is run in a subshell after all when that could give a different
+ * result (cat isn't the system's, or the name could be split into several words).
+ */
+static int expandFileRead(char **str, CmdArg arg, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	FileRead *file_read = arg.read;
+	CmdArg subshell = { .type = arg.quoted ? ARG_QUOTED_SUBSHELL : ARG_SUBSHELL, .quoted = arg.quoted, .str = file_read->command };
+	if (file_read->cat && !systemCat(vars))
+		return expandArgument(str, subshell, source, vars, cmd_exit);
+	char *path;
+	if (expandArgument(&path, file_read->file, source, vars, cmd_exit) == -1)
+		return -1;
+	if (path == NULL) {
+		*str = NULL;
+		return 0;
 	}
+	char *ifs = getvar(vars, "IFS");
+	if (file_read->split && (strpbrk(path, ifs == NULL ? " \t\n" : ifs) != NULL || strpbrk(path, "*?[") != NULL))
+		return expandArgument(str, subshell, source, vars, cmd_exit);
 
-	// pe(mdas)
-	MathOprtr *operator = root.operator_right;
-	while (operator != NULL) {
-		switch (operator->type) {
-			case '*':
-				operator->operand_left->value *= operator->operand_right->value;
-				break;
-			case '/':
-				if (operator->operand_right->value == 0) {
-					// divide by zero
-					fputs("divide by zero error\n", stderr);
-					operator = root.operator_right;
-					while (operator != NULL) {
-						MathOprtr *next = operator->operand_right->operator_right;
-						free(operator->operand_right);
-						free(operator);
-						operator = next;
-					}
-					return 0;
-				}
-				operator->operand_left->value /= operator->operand_right->value;
-				break;
-			case '%':
-				operator->operand_left->value %= operator->operand_right->value;
-				break;
-			default:
-				operator = operator->operand_right->operator_right;
-				continue;
+	*cmd_exit = 0;
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		fprintf(stderr, "%s: %s: %m\n", file_read->cat ? "cat" : source->argv[0], path);
+		if (fd != -1)
+			close(fd);
+		*cmd_exit = 1;
+		*str = "";
+		return 0;
+	}
+	// Room for the terminator, and for the read that finds the end of a regular file without growing
+	size_t size = S_ISREG(st.st_mode) && st.st_size > 0 ? (size_t)st.st_size + 2 : FILE_READ_BLOCK, len = 0;
+	char *text = arenaAlloc(expansion, size);
+	for (;;) {
+		if (len + 1 == size) {
+			text = arenaGrow(expansion, text, size, size + FILE_READ_BLOCK);
+			size += FILE_READ_BLOCK;
 		}
-		MathOprnd *previous = operator->operand_left;
-		previous->operator_right = operator->operand_right->operator_right;
-		free(operator->operand_right);
-		free(operator);
-		operator = previous->operator_right;
-	}
-	operator = root.operator_right;
-	while (operator != NULL) {
-		switch (operator->type) {
-			case '+':
-				operator->operand_left->value += operator->operand_right->value;
-				break;
-			case '-':
-				operator->operand_left->value -= operator->operand_right->value;
-				break;
-			default:
-				operator = operator->operand_right->operator_right;
-				continue;
+		ssize_t bytes_read = read(fd, &text[len], size - len - 1);
+		if (bytes_read == -1 && errno == EINTR)
+			continue;
+		// Only cat complains about what can't be read (like a directory)
+		if (bytes_read == -1 && file_read->cat) {
+			fprintf(stderr, "cat: %s: %m\n", path);
+			*cmd_exit = 1;
 		}
-		MathOprnd *previous = operator->operand_left;
-		previous->operator_right = operator->operand_right->operator_right;
-		free(operator->operand_right);
-		free(operator);
-		operator = previous->operator_right;
+		if (bytes_read < 1)
+			break;
+		len += bytes_read;
 	}
-
-	return root.value;
+	close(fd);
+	// Trailing newlines are removed
+	while (len > 0 && text[len - 1] == '\n')
+		--len;
+	text[len] = '\0';
+	*str = text;
+	return 0;
 }
 
+/*
+ * Expand an argument into *str (NULL if it couldn't be expanded).
+ * Nothing is freed by the caller: literal words point into the parsed command, and everything
+ * else is allocated from the expansion arena, so it is valid until the current command is done.
+ */
 int expandArgument(char **str, CmdArg arg, Source *source, Variables *vars, uint8_t *cmd_exit) {
 	switch (arg.type) {
 		case ARG_BASIC_STRING:
 		case ARG_QUOTED_STRING:
-			*str = strdup(arg.str);
+			*str = arg.str;
 			return 0;
-		case ARG_VARIABLE:
-			if (arg.str[0] >= '0' && arg.str[0] <= '9') {
-				unsigned position;
-				sscanf(arg.str, "%u", &position);
-				*str = strdup(position >= source->argc ? "" : source->argv[position]);
-				return 0;
-			}
-			if (!strcmp(arg.str, "RANDOM")) {
-				char number[12];
-				sprintf(number, "%ld", random());
-				*str = strdup(number);
-				return 0;
-			}
-			if (!strcmp(arg.str, "?")) {
-				char number[4];
-				sprintf(number, "%"PRIu8, *cmd_exit);
-				*str = strdup(number);
-				return 0;
-			}
-			if (!strcmp(arg.str, "$")) {
-				char number[21];
-				sprintf(number, "%ld", (long)getpid());
-				*str = strdup(number);
-				return 0;
-			}
-			if (!strcmp(arg.str, "#")) {
-				char number[8];
-				sprintf(number, "%u", (unsigned)source->argc - 1);
-				*str = strdup(number);
-				return 0;
+		case ARG_VARIABLE: {
+			// Slot was bound by the tokenizer, unless it was parsed without a symbol table (aliases)
+			Variable *var = arg.var != NULL ? arg.var : variableIntern(vars, arg.name);
+			char *value = variableValue(var);
+			// Copied, the command may change the variable while it still needs the word
+			*str = value == NULL ? "" : expansionCopy(value, strlen(value));
+			return 0;
+		}
+		case ARG_PARAMETER: {
+			char number[21];
+			switch (arg.param) {
+				case PARAM_POSITIONAL:
+					*str = arg.position >= source->argc ? "" : expansionCopy(source->argv[arg.position], strlen(source->argv[arg.position]));
+					return 0;
+				case PARAM_RANDOM:
+					*str = expansionCopy(number, sprintf(number, "%ld", random()));
+					return 0;
+				case PARAM_STATUS:
+					*str = expansionCopy(number, sprintf(number, "%"PRIu8, *cmd_exit));
+					return 0;
+				case PARAM_PID:
+					*str = expansionCopy(number, sprintf(number, "%ld", (long)getpid()));
+					return 0;
+				case PARAM_COUNT:
+					*str = expansionCopy(number, sprintf(number, "%u", (unsigned)source->argc - 1));
+					return 0;
 			}
-
-			char *value = getvar(vars, arg.str);
-			*str = strdup(value == NULL ? "" : value);
+			*str = NULL;
 			return 0;
+		}
 		case ARG_SUBSHELL:
 		case ARG_QUOTED_SUBSHELL: {
 			char *filepath;
@@ -725,6 +1522,8 @@ int expandArgument(char **str, CmdArg arg, Source *source, Variables *vars, uint
 				return 0;
 			}
 
+			outputFlush();
+			inputSync();
 			pid_t sub_pid = fork();
 			// Run subshell
 			if (sub_pid == 0) {
@@ -740,6 +1539,8 @@ int expandArgument(char **str, CmdArg arg, Source *source, Variables *vars, uint
 				close(sub_stdout);
 				free(filepath);
 
+				// The shell this child was forked from exits with the subshell's status
+				*cmd_exit = err;
 				errno = err;
 				return -1;
 			}
@@ -748,42 +1549,19 @@ int expandArgument(char **str, CmdArg arg, Source *source, Variables *vars, uint
 			waitpid(sub_pid, &cmd_stat, 0);
 			*cmd_exit = WEXITSTATUS(cmd_stat);
 
-			// Allocate memory for the file
+			// Read the whole output straight into the word, unquoted output is split into fields by whoever expands it
 			off_t size = lseek(sub_stdout, 0, SEEK_END);
 			lseek(sub_stdout, 0, SEEK_SET);
-			char *sub_output = *str = calloc(size + 1, sizeof (char));
+			char *sub_output = *str = arenaAlloc(expansion, size + 1);
 			size_t out_end = 0;
-			char buffer[TMP_RW_BUFSIZE];
-			memset(buffer, 0, TMP_RW_BUFSIZE);
-			int read_return;
-			// TODO: if a word is caught on the TMP_RW_BUFSIZE byte boundary it will be split into 2 arguments - need to fix this (and already know how...)
-			while ((read_return = read(sub_stdout, buffer, TMP_RW_BUFSIZE)) > 0 ) {
-				// Regular subshells replace newlines and tabs with spaces, and truncate all spaces longer than 1.
-				if (arg.type == ARG_SUBSHELL) {
-					for (size_t i = 0; i < read_return; ++i) {
-						int whitespace = 0;
-						while (buffer[i] == '\n' || buffer[i] == '\t' || buffer[i] == ' ') {
-							whitespace = 1;
-							++i;
-						}
-						if (whitespace && out_end > 0) {
-							if (i >= read_return)
-								continue;
-							sub_output[out_end++] = ' ';
-						}
-						sub_output[out_end++] = buffer[i];
-					}
-				}
-				// But quoted subshells allow you to get the exact output from the command, unchanged
-				else {
-					strncpy(&sub_output[out_end], buffer, read_return);
-					out_end += read_return;
-				}
-			}
+			ssize_t read_return;
+			while (out_end < (size_t)size && (read_return = read(sub_stdout, &sub_output[out_end], size - out_end)) > 0)
+				out_end += read_return;
 			close(sub_stdout);
 			unlink(filepath); // TODO: consider stdio's tmpfile?
 			free(filepath);
-			if (out_end > 0 && (sub_output[out_end - 1] == ' ' || sub_output[out_end - 1] == '\n'))
+			// Trailing newlines are removed
+			while (out_end > 0 && sub_output[out_end - 1] == '\n')
 				--out_end;
 			sub_output[out_end] = '\0';
 			return 0;
@@ -792,55 +1570,831 @@ int expandArgument(char **str, CmdArg arg, Source *source, Variables *vars, uint
 			size_t sub_count = 0;
 			while (arg.sub[sub_count].type != ARG_NULL)
 				++sub_count;
+			// Expand every part first, so the result can be allocated once at its final size
 			char *sub_argv[sub_count];
+			size_t lengths[sub_count], length = 0;
 			for (size_t i = 0; i < sub_count; ++i) {
-				char *e;
-				if (expandArgument(&e, arg.sub[i], source, vars, cmd_exit) == -1) {
-					for (size_t f = 0; f < i; ++f)
-						free(sub_argv[f]);
+				if (expandArgument(&sub_argv[i], arg.sub[i], source, vars, cmd_exit) == -1)
 					return -1;
-				}
-				if (e == NULL) {
-					for (size_t f = 0; f < i; ++f)
-						free(sub_argv[f]);
+				if (sub_argv[i] == NULL) {
 					*str = NULL;
 					return 0;
 				}
-				sub_argv[i] = e;
+				lengths[i] = strlen(sub_argv[i]);
+				length += lengths[i];
 			}
 
-			// Find length of strings together
-			size_t length = 0;
-			for (size_t i = 0; i < sub_count; ++i)
-				length += strlen(sub_argv[i]);
-			char *expanded_string = calloc(length + 1, sizeof (char));
-			expanded_string[0] = '\0';
+			char *expanded_string = *str = arenaAlloc(expansion, length + 1);
 			for (size_t i = 0; i < sub_count; ++i) {
-				strcat(expanded_string, sub_argv[i]);
-				free(sub_argv[i]);
+				memcpy(expanded_string, sub_argv[i], lengths[i]);
+				expanded_string += lengths[i];
 			}
-			*str = expanded_string;
+			*expanded_string = '\0';
 			return 0;
 		}
-		case ARG_MATH: {
-			char number[21];
-			sprintf(number, "%Ld", evaluateMath(arg, vars));
-			*str = strdup(number);
+		case ARG_MATH:
+		case ARG_MATH_WORD: {
+			MathProg *math = arg.math;
+			if (arg.type == ARG_MATH_WORD) {
+				char *expr;
+				int ret = expandArgument(&expr, *arg.sub, source, vars, cmd_exit);
+				if (ret == -1 || expr == NULL) {
+					*str = NULL;
+					return ret;
+				}
+				math = mathCompile(NULL, expr, strlen(expr), vars);
+				if (math == NULL) {
+					fprintf(stderr, "%s: %s: arithmetic syntax error in expression\n", source->argv[0], expr);
+					*cmd_exit = 1;
+					*str = NULL;
+					return 0;
+				}
+			}
+			long long number;
+			int ret = mathRun(math, vars, &number);
+			if (arg.type == ARG_MATH_WORD)
+				free(math);
+			if (ret == -1) {
+				*cmd_exit = 1;
+				*str = NULL;
+				return 0;
+			}
+			char text[21];
+			*str = expansionCopy(text, sprintf(text, "%lld", number));
 			return 0;
-			/*size_t sub_count = 1; // operand count
-			while (arg.sub[sub_count].type != ARG_NULL)
-				if (arg.sub[sub_count].type == ARG_OPERATOR)
-					++sub_count;
-			char *sub_argv[sub_count];
-			for (size_t i = 0)
-			return 0;*/
 		}
+		case ARG_PARAM_EXP:
+			return expandParamExp(str, arg.pexp, source, vars, cmd_exit);
+		case ARG_READ_FILE:
+			return expandFileRead(str, arg, source, vars, cmd_exit);
+		// Path names are only expanded into a command's words, anywhere else it is just the word
+		case ARG_GLOB:
+			return expandArgument(str, arg.glob->word, source, vars, cmd_exit);
 		case ARG_NULL:
-		case ARG_MATH_OPERAND_NUMERIC:
-		case ARG_MATH_OPERAND_VARIABLE:
-		case ARG_MATH_OPERATOR:
 		default:
 			*str = NULL;
 			return 0;
 	}
 }
+
+// Expand a word from a parameter expansion, an empty word expands to ""
+static int expandWord(char **str, CmdArg word, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	if (word.type == ARG_NULL) {
+		*str = "";
+		return 0;
+	}
+	return expandArgument(str, word, source, vars, cmd_exit);
+}
+
+// Build the text of a pattern (in the expansion arena), quoted parts are escaped with quote so they only match themselves
+static int expandPatternText(char **pattern, size_t *length, CmdArg word, char *(*quote)(char*), Source *source, Variables *vars, uint8_t *cmd_exit) {
+	size_t count = word.type == ARG_COMPLEX_STRING ? 0 : 1;
+	CmdArg *parts = word.type == ARG_COMPLEX_STRING ? word.sub : &word;
+	if (word.type == ARG_COMPLEX_STRING)
+		while (parts[count].type != ARG_NULL)
+			++count;
+
+	char *texts[count];
+	for (size_t i = 0; i < count; ++i) {
+		int ret = expandWord(&texts[i], parts[i], source, vars, cmd_exit);
+		if (ret == -1 || texts[i] == NULL) {
+			*pattern = NULL;
+			return ret;
+		}
+	}
+
+	*pattern = "";
+	*length = 0;
+	for (size_t i = 0; i < count; ++i) {
+		char *text = texts[i], *quoted = NULL;
+		if (parts[i].type == ARG_QUOTED_STRING || parts[i].type == ARG_QUOTED_SUBSHELL || parts[i].quoted)
+			text = quoted = quote(text);
+		size_t text_len = strlen(text);
+		*pattern = arenaGrow(expansion, *length == 0 ? NULL : *pattern, *length, *length + text_len + 1);
+		memcpy(&(*pattern)[*length], text, text_len + 1);
+		*length += text_len;
+		free(quoted);
+	}
+	return 0;
+}
+
+// Build the pattern for a parameter expansion (freed with free)
+static int expandPattern(Pattern **pat, CmdArg word, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	char *pattern;
+	size_t length;
+	int ret = expandPatternText(&pattern, &length, word, patternQuote, source, vars, cmd_exit);
+	if (ret == -1 || pattern == NULL) {
+		*pat = NULL;
+		return ret;
+	}
+	*pat = patternCompile(NULL, pattern, length);
+	return 0;
+}
+
+// Apply a pattern operator (${name#pattern} ... ${name/pattern/string}) to len bytes of value, the result is in the expansion arena
+static char *patternOperate(enum _pexp_op op, Pattern *pat, char *replacement, char *value, size_t len) {
+	ssize_t match;
+	switch (op) {
+		case PEXP_PREFIX_SHORT:
+		case PEXP_PREFIX_LONG:
+			match = patternPrefix(pat, value, len, op == PEXP_PREFIX_LONG);
+			return match == -1 ? expansionCopy(value, len) : expansionCopy(&value[match], len - match);
+		case PEXP_SUFFIX_SHORT:
+		case PEXP_SUFFIX_LONG:
+			match = patternSuffix(pat, value, len, op == PEXP_SUFFIX_LONG);
+			return expansionCopy(value, match == -1 ? len : match);
+		default:
+			break;
+	}
+
+	// Replacements
+	size_t rep_len = strlen(replacement), out_len = 0, start = 0, end = 0;
+	char *result = arenaAlloc(expansion, len + 1);
+	switch (op) {
+		case PEXP_REPLACE_PREFIX:
+			match = patternPrefix(pat, value, len, 1);
+			if (match != -1)
+				end = match;
+			break;
+		case PEXP_REPLACE_SUFFIX:
+			match = patternSuffix(pat, value, len, 1);
+			if (match != -1)
+				start = match;
+			end = len;
+			break;
+		default:
+			match = -1;
+	}
+	// Anchored replacements match at most once
+	if (op == PEXP_REPLACE_PREFIX || op == PEXP_REPLACE_SUFFIX) {
+		if (match != -1) {
+			result = arenaGrow(expansion, result, 0, len - (end - start) + rep_len + 1);
+			memcpy(result, value, start);
+			memcpy(&result[start], replacement, rep_len);
+			memcpy(&result[start + rep_len], &value[end], len - end);
+			out_len = len - (end - start) + rep_len;
+		}
+		else {
+			memcpy(result, value, len);
+			out_len = len;
+		}
+	}
+	else {
+		size_t size = len + 1;
+		for (size_t i = 0; i <= len; ++i) {
+			// Longest non-empty match starting here
+			match = i < len ? patternPrefix(pat, &value[i], len - i, 1) : -1;
+			if (match < 1) {
+				if (i < len)
+					result[out_len++] = value[i];
+				continue;
+			}
+			if (out_len + rep_len + (len - i - match) + 1 > size) {
+				size = out_len + rep_len + (len - i - match) + 1;
+				result = arenaGrow(expansion, result, out_len, size);
+			}
+			memcpy(&result[out_len], replacement, rep_len);
+			out_len += rep_len;
+			i += match - 1;
+			if (op == PEXP_REPLACE) {
+				memcpy(&result[out_len], &value[i + 1], len - i - 1);
+				out_len += len - i - 1;
+				break;
+			}
+		}
+	}
+	result[out_len] = '\0';
+	return result;
+}
+
+/*
+ * Get the pattern of a pattern operator (compiled now unless it was literal, free it if it isn't exp->pattern) and its
+ * replacement. *pat is NULL if they couldn't be expanded.
+ */
+static int patternOperands(Pattern **pat, char **replacement, ParamExp *exp, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	*pat = exp->pattern;
+	if (*pat == NULL) {
+		int ret = expandPattern(pat, exp->word, source, vars, cmd_exit);
+		if (ret == -1 || *pat == NULL)
+			return ret;
+	}
+	if (exp->op < PEXP_REPLACE || exp->op > PEXP_REPLACE_SUFFIX)
+		return 0;
+	int ret = expandWord(replacement, exp->replacement, source, vars, cmd_exit);
+	if (ret == -1 || *replacement == NULL) {
+		if (*pat != exp->pattern)
+			free(*pat);
+		*pat = NULL;
+	}
+	return ret;
+}
+
+/*
+ * Find the element a subscript refers to: *key for an associative array (which stays NULL otherwise), or *index.
+ * Returns -1 if the shell should exit, or 1 if it couldn't be evaluated.
+ */
+static int subscriptEvaluate(char **key, long long *index, Subscript *sub, Variable *var, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	*key = NULL;
+	if (var->assoc != NULL || sub->index == NULL) {
+		char *text;
+		int ret = expandWord(&text, sub->key, source, vars, cmd_exit);
+		if (ret == -1)
+			return -1;
+		if (text == NULL)
+			return 1;
+		if (var->assoc != NULL) {
+			*key = text;
+			return 0;
+		}
+		// Subscripts that needed expanding first, like a[$(...)]
+		if (evaluateMathString(index, text, vars) == -1) {
+			fprintf(stderr, "%s: %s: syntax error in expression\n", source->argv[0], text);
+			*cmd_exit = 1;
+			return 1;
+		}
+		return 0;
+	}
+	if (mathRun(sub->index, vars, index) == -1) {
+		*cmd_exit = 1;
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * Expand ${name[@]} or ${name[*]} into a word for each element (after its operator), appended to list.
+ * The words are copies in the expansion arena, so the variable can change while they are used.
+ * Returns -1 if the shell should exit, or 1 if it couldn't be expanded.
+ */
+static int expandElements(WordList *list, ParamExp *exp, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	Variable *var = exp->param.var != NULL ? exp->param.var : variableIntern(vars, exp->param.name);
+	size_t count = variableCount(var);
+	char **values = arenaAlloc(expansion, (count + 1) * sizeof (char*)), **keys = NULL;
+	size_t *indexes = NULL;
+	if (var->assoc != NULL)
+		keys = arenaAlloc(expansion, (count + 1) * sizeof (char*));
+	else
+		indexes = arenaAlloc(expansion, (count + 1) * sizeof (size_t));
+	variableList(var, values, indexes, keys);
+	if (list->size < list->count + count + 1) {
+		list->words = arenaGrow(expansion, list->words, list->size * sizeof (char*), (list->count + count + 1) * sizeof (char*));
+		list->size = list->count + count + 1;
+	}
+
+	size_t first = 0, last = count;
+	switch (exp->op) {
+		case PEXP_NONE:
+			break;
+		case PEXP_KEYS:
+			for (size_t i = 0; i < count; ++i) {
+				char number[21];
+				wordAppend(expansion, list, keys != NULL ? expansionCopy(keys[i], strlen(keys[i])) : expansionCopy(number, sprintf(number, "%zu", indexes[i])));
+			}
+			return 0;
+		case PEXP_SUBSTRING: {
+			// Indexed arrays are sliced by index, associative ones by position
+			long long offset = 0, length = count;
+			if ((exp->offset != NULL && mathRun(exp->offset, vars, &offset) == -1) || (exp->length != NULL && mathRun(exp->length, vars, &length) == -1)) {
+				*cmd_exit = 1;
+				return 1;
+			}
+			if (length < 0) {
+				fprintf(stderr, "%s: %s: substring expression < 0\n", source->argv[0], exp->param.name);
+				*cmd_exit = 1;
+				return 1;
+			}
+			if (offset < 0)
+				offset += keys != NULL ? (long long)count : (long long)variableArrayEnd(var);
+			if (offset < 0)
+				return 0;
+			if (keys != NULL)
+				first = (size_t)offset < count ? offset : count;
+			else
+				while (first < count && indexes[first] < (size_t)offset)
+					++first;
+			if ((size_t)length < count - first)
+				last = first + length;
+			break;
+		}
+		case PEXP_DEFAULT:
+		case PEXP_ALTERNATE: {
+			_Bool unset = count == 0 || (exp->colon && count == 1 && values[0][0] == '\0');
+			if (exp->op == PEXP_DEFAULT && !unset)
+				break;
+			if (exp->op == PEXP_ALTERNATE && unset)
+				return 0;
+			char *word;
+			int ret = expandWord(&word, exp->word, source, vars, cmd_exit);
+			if (ret != 0 || word == NULL)
+				return ret == -1 ? -1 : 1;
+			wordAppend(expansion, list, expansionCopy(word, strlen(word)));
+			return 0;
+		}
+		default: {
+			Pattern *pat;
+			char *replacement = "";
+			int ret = patternOperands(&pat, &replacement, exp, source, vars, cmd_exit);
+			if (ret == -1 || pat == NULL)
+				return ret == -1 ? -1 : 1;
+			for (size_t i = 0; i < count; ++i)
+				wordAppend(expansion, list, patternOperate(exp->op, pat, replacement, values[i], strlen(values[i])));
+			if (pat != exp->pattern)
+				free(pat);
+			return 0;
+		}
+	}
+	for (size_t i = first; i < last; ++i)
+		wordAppend(expansion, list, expansionCopy(values[i], strlen(values[i])));
+	return 0;
+}
+
+// A field being built from the parts of a word
+typedef struct _field Field;
+struct _field {
+	char *text;       // What the field expands to, a slice of an expansion until more is added to it
+	size_t length;
+	char *pattern;    // Its text as a pattern if any quoted part had pattern characters (NULL if it is the same)
+	size_t pattern_length;
+	_Bool started;    // Field exists, even if it is empty
+	_Bool owned;      // Text was copied into its own buffer
+};
+
+// Add text to a field, quoted text is escaped in its pattern
+static void fieldAppend(Field *field, char *str, size_t len, _Bool quoted) {
+	_Bool escape = 0;
+	for (size_t i = 0; quoted && !escape && i < len; ++i)
+		escape = strchr("*?[]\\", str[i]) != NULL;
+	if (!field->started && !escape) {
+		*field = (Field){ .text = str, .length = len, .started = 1 };
+		return;
+	}
+	field->started = 1;
+
+	if (field->pattern == NULL && escape) {
+		field->pattern = arenaAlloc(expansion, field->length + 1);
+		if (field->length > 0) // A field that hasn't started (or that an empty "${name[@]}" ended) has no text
+			memcpy(field->pattern, field->text, field->length);
+		field->pattern_length = field->length;
+	}
+	if (field->pattern != NULL) {
+		field->pattern = arenaGrow(expansion, field->pattern, field->pattern_length + 1, field->pattern_length + len * 2 + 1);
+		for (size_t i = 0; i < len; ++i) {
+			if (escape && strchr("*?[]\\", str[i]) != NULL)
+				field->pattern[field->pattern_length++] = '\\';
+			field->pattern[field->pattern_length++] = str[i];
+		}
+		field->pattern[field->pattern_length] = '\0';
+	}
+
+	if (field->owned)
+		field->text = arenaGrow(expansion, field->text, field->length + 1, field->length + len + 1);
+	else {
+		char *text = arenaAlloc(expansion, field->length + len + 1);
+		if (field->length > 0)
+			memcpy(text, field->text, field->length);
+		field->text = text;
+		field->owned = 1;
+	}
+	memcpy(&field->text[field->length], str, len);
+	field->text[field->length += len] = '\0';
+}
+
+// Append a finished field to words, or the path names it matches
+static void fieldEnd(Field *field, WordList *words, Variables *vars) {
+	if (!field->started)
+		return;
+	// Slices end where their delimiter was (or already at the end of their expansion)
+	if (!field->owned && field->text[field->length] != '\0')
+		field->text[field->length] = '\0';
+	char *pattern = field->pattern != NULL ? field->pattern : field->text;
+	size_t length = field->pattern != NULL ? field->pattern_length : field->length;
+	Glob *glob = strpbrk(pattern, "*?[") != NULL ? globCompile(expansion, pattern, length) : NULL;
+	if (glob == NULL || globExpand(glob, expansion, words, vars) == 0)
+		wordAppend(expansion, words, field->text);
+	*field = (Field){ .started = 0 };
+}
+
+// Split len bytes of text (which is ended in place) into fields with ifs, the first one joins field
+static void fieldSplit(Field *field, WordList *words, Ifs *ifs, char *text, size_t len, Variables *vars) {
+	// A leading delimiter of only whitespace ends the field before, others give an empty first field that joins it
+	if (ifsLeadingSpace(ifs, text, len))
+		fieldEnd(field, words, vars);
+	size_t pos = 0, start, field_len;
+	for (_Bool first = 1; ifsField(ifs, text, len, &pos, &start, &field_len); first = 0) {
+		if (!first)
+			fieldEnd(field, words, vars);
+		fieldAppend(field, &text[start], field_len, 0);
+	}
+	if (len > 0 && ifsDelimiter(ifs, text[len - 1]))
+		fieldEnd(field, words, vars);
+}
+
+/*
+ * Expand a word with unquoted expansions into fields, appended to words.
+ * The expansions are split with IFS, the first and last fields join the text around them, and every field is matched
+ * against path names. A word that leaves no fields (only unquoted expansions, which were empty) adds nothing.
+ */
+static int expandFields(WordList *words, CmdArg word, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	size_t count = word.type == ARG_COMPLEX_STRING ? 0 : 1;
+	CmdArg *parts = word.type == ARG_COMPLEX_STRING ? word.sub : &word;
+	if (word.type == ARG_COMPLEX_STRING)
+		while (parts[count].type != ARG_NULL)
+			++count;
+
+	Ifs ifs;
+	_Bool ifs_ready = 0;
+	Field field = { .started = 0 };
+	for (size_t i = 0; i < count; ++i) {
+		// "${name[@]}" is a field for each element, unquoted elements are each split
+		if (parts[i].type == ARG_PARAM_EXP && (parts[i].pexp->sub.type == '@' || (parts[i].pexp->sub.type == '*' && !parts[i].quoted)) && parts[i].pexp->op != PEXP_LENGTH) {
+			// The whole word, the elements go straight into the command's words
+			if (count == 1 && parts[i].quoted)
+				return expandElements(words, parts[i].pexp, source, vars, cmd_exit);
+			WordList elements = { .words = NULL, .count = 0, .size = 0 };
+			int ret = expandElements(&elements, parts[i].pexp, source, vars, cmd_exit);
+			if (ret != 0)
+				return ret;
+			if (!parts[i].quoted && !ifs_ready) {
+				ifsInit(&ifs, getvar(vars, "IFS"));
+				ifs_ready = 1;
+			}
+			for (size_t e = 0; e < elements.count; ++e) {
+				if (e > 0)
+					fieldEnd(&field, words, vars);
+				if (parts[i].quoted)
+					fieldAppend(&field, elements.words[e], strlen(elements.words[e]), 1);
+				else
+					fieldSplit(&field, words, &ifs, elements.words[e], strlen(elements.words[e]), vars);
+			}
+			continue;
+		}
+
+		char *text;
+		int ret = expandWord(&text, parts[i], source, vars, cmd_exit);
+		if (ret == -1 || text == NULL)
+			return ret == -1 ? -1 : 1;
+		size_t len = strlen(text);
+
+		switch (parts[i].type) {
+			case ARG_BASIC_STRING:
+			case ARG_MATH:
+			case ARG_MATH_WORD:
+				fieldAppend(&field, text, len, 0);
+				continue;
+			case ARG_QUOTED_STRING:
+			case ARG_QUOTED_SUBSHELL:
+				fieldAppend(&field, text, len, 1);
+				continue;
+			default:
+				if (parts[i].quoted) {
+					fieldAppend(&field, text, len, 1);
+					continue;
+				}
+		}
+
+		if (!ifs_ready) {
+			ifsInit(&ifs, getvar(vars, "IFS"));
+			ifs_ready = 1;
+		}
+		// Fields are ended in place, which parameter expansions may not own (${x:-word} can be the word itself)
+		if (parts[i].type == ARG_PARAM_EXP)
+			text = expansionCopy(text, len);
+		fieldSplit(&field, words, &ifs, text, len, vars);
+	}
+	fieldEnd(&field, words, vars);
+	return 0;
+}
+
+/*
+ * Expand a word that can match path names, appending what it matches to words (or the word itself if nothing does).
+ * Words with unquoted expansions are split into fields here, which are each compiled if they have pattern characters.
+ */
+static int expandGlob(WordList *words, Glob *glob, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	if (glob->count == 0)
+		return expandFields(words, glob->word, source, vars, cmd_exit);
+	if (globExpand(glob, expansion, words, vars) > 0)
+		return 0;
+	char *plain;
+	if (expandArgument(&plain, glob->word, source, vars, cmd_exit) == -1)
+		return -1;
+	if (plain == NULL)
+		return 1;
+	wordAppend(expansion, words, plain);
+	return 0;
+}
+
+/*
+ * Expand an argument into the command words it makes, appended to words.
+ * Returns -1 if the shell should exit, or 1 if it couldn't be expanded.
+ */
+static int expandWords(WordList *words, CmdArg arg, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	if (arg.type == ARG_GLOB)
+		return expandGlob(words, arg.glob, source, vars, cmd_exit);
+	char *str;
+	if (expandArgument(&str, arg, source, vars, cmd_exit) == -1)
+		return -1;
+	if (str == NULL)
+		return 1;
+	wordAppend(expansion, words, str);
+	return 0;
+}
+
+/*
+ * Expand ${...} with an operator.
+ * Everything operates on the variable's stored string, which is only copied
+ * (into the expansion arena) for the final result.
+ */
+int expandParamExp(char **str, ParamExp *exp, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	// Every element, joined into one string
+	if (exp->sub.type == '@' || exp->sub.type == '*') {
+		Variable *var = exp->param.var != NULL ? exp->param.var : variableIntern(vars, exp->param.name);
+		char number[21];
+		if (exp->op == PEXP_LENGTH) {
+			*str = expansionCopy(number, sprintf(number, "%zu", variableCount(var)));
+			return 0;
+		}
+		WordList elements = { .words = NULL, .count = 0, .size = 0 };
+		int ret = expandElements(&elements, exp, source, vars, cmd_exit);
+		if (ret != 0) {
+			*str = NULL;
+			return ret == -1 ? -1 : 0;
+		}
+		// ${name[*]} is joined with the first character of IFS, ${name[@]} with a space
+		char *ifs = exp->sub.type == '*' ? getvar(vars, "IFS") : NULL;
+		char separator = ifs == NULL ? ' ' : ifs[0];
+		size_t length = 0;
+		for (size_t i = 0; i < elements.count; ++i)
+			length += strlen(elements.words[i]) + (separator != '\0');
+		*str = arenaAlloc(expansion, length + 1);
+		length = 0;
+		for (size_t i = 0; i < elements.count; ++i) {
+			if (i > 0 && separator != '\0')
+				(*str)[length++] = separator;
+			size_t len = strlen(elements.words[i]);
+			memcpy(&(*str)[length], elements.words[i], len);
+			length += len;
+		}
+		(*str)[length] = '\0';
+		return 0;
+	}
+
+	// Get the value, NULL if the parameter is unset
+	char *value;
+	Variable *var = NULL;
+	char *key = NULL;
+	long long index = 0;
+	switch (exp->param.type) {
+		case ARG_VARIABLE:
+			var = exp->param.var != NULL ? exp->param.var : variableIntern(vars, exp->param.name);
+			if (exp->sub.type == 0) {
+				value = variableValue(var);
+				break;
+			}
+			int ret = subscriptEvaluate(&key, &index, &exp->sub, var, source, vars, cmd_exit);
+			if (ret != 0) {
+				*str = NULL;
+				return ret == -1 ? -1 : 0;
+			}
+			if (key != NULL) {
+				value = variableKey(var, key);
+				break;
+			}
+			_Bool bad;
+			value = variableElement(var, index, &bad);
+			if (bad) {
+				fprintf(stderr, "%s: %s[%lld]: bad array subscript\n", source->argv[0], exp->param.name, index);
+				*cmd_exit = 1;
+				*str = NULL;
+				return 0;
+			}
+			if (index < 0)
+				index += variableArrayEnd(var);
+			break;
+		case ARG_PARAMETER:
+			if (exp->param.param == PARAM_POSITIONAL) {
+				value = exp->param.position < source->argc ? source->argv[exp->param.position] : NULL;
+				break;
+			}
+			if (expandArgument(&value, exp->param, source, vars, cmd_exit) == -1)
+				return -1;
+			break;
+		default:
+			value = NULL;
+	}
+	_Bool unset = value == NULL || (exp->colon && value[0] == '\0');
+	if (value == NULL)
+		value = "";
+	size_t len = strlen(value);
+	int ret = 0;
+
+	switch (exp->op) {
+		case PEXP_NONE:
+			*str = expansionCopy(value, len);
+			break;
+		case PEXP_LENGTH: {
+			char number[21];
+			*str = expansionCopy(number, sprintf(number, "%zu", len));
+			break;
+		}
+		case PEXP_SUBSTRING: {
+			long long offset = 0, length = len;
+			if ((exp->offset != NULL && mathRun(exp->offset, vars, &offset) == -1) || (exp->length != NULL && mathRun(exp->length, vars, &length) == -1)) {
+				*cmd_exit = 1;
+				*str = NULL;
+				break;
+			}
+			// Negative offsets count from the end, and a negative length is an offset from the end
+			if (offset < 0)
+				offset = offset + (long long)len < 0 ? 0 : offset + len;
+			if (offset > len)
+				offset = len;
+			if (length < 0) {
+				length += len - offset;
+				if (length < 0) {
+					fprintf(stderr, "%s: %s: substring expression < 0\n", source->argv[0], exp->param.name);
+					*cmd_exit = 1;
+					*str = NULL;
+					break;
+				}
+			}
+			if (length > len - offset)
+				length = len - offset;
+			*str = expansionCopy(&value[offset], length);
+			break;
+		}
+		case PEXP_DEFAULT:
+		case PEXP_ASSIGN:
+			if (!unset) {
+				*str = expansionCopy(value, len);
+				break;
+			}
+			ret = expandWord(str, exp->word, source, vars, cmd_exit);
+			if (ret == -1 || *str == NULL || exp->op == PEXP_DEFAULT)
+				break;
+			if (key != NULL) {
+				variableKeySet(var, key, *str, strlen(*str));
+				break;
+			}
+			if (exp->sub.type == '[') {
+				variableArraySet(var, index, *str, strlen(*str));
+				break;
+			}
+			if (setvar(vars, exp->param.name, *str, 0) == -1) {
+				fprintf(stderr, "%s: set variable: %m\n", source->argv[0]);
+				*cmd_exit = 1;
+				*str = NULL;
+				break;
+			}
+			// Integer variables may have changed what was assigned
+			value = variableValue(var);
+			*str = expansionCopy(value, strlen(value));
+			break;
+		case PEXP_ALTERNATE:
+			if (unset)
+				*str = "";
+			else
+				ret = expandWord(str, exp->word, source, vars, cmd_exit);
+			break;
+		case PEXP_ERROR: {
+			if (!unset) {
+				*str = expansionCopy(value, len);
+				break;
+			}
+			char *message;
+			ret = expandWord(&message, exp->word, source, vars, cmd_exit);
+			if (ret == -1 || message == NULL) {
+				*str = NULL;
+				break;
+			}
+			fprintf(stderr, "%s: %s: %s\n", source->argv[0], exp->param.name, message[0] == '\0' ? "parameter null or not set" : message);
+			*cmd_exit = 1;
+			*str = NULL;
+			// A script stops here (so guards like "${DIR:?}" protect what comes after)
+			if (!interactive_shell)
+				ret = -1;
+			break;
+		}
+		default: {
+			// Pattern operators
+			Pattern *pat;
+			char *replacement = "";
+			ret = patternOperands(&pat, &replacement, exp, source, vars, cmd_exit);
+			if (ret == -1 || pat == NULL) {
+				*str = NULL;
+				break;
+			}
+			*str = patternOperate(exp->op, pat, replacement, value, len);
+			if (pat != exp->pattern)
+				free(pat);
+		}
+	}
+	return ret;
+}
+
+// Get the integer value of a [[ operand
+static int conditionNumber(long long *number, CmdArg arg, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	if (arg.type == ARG_MATH)
+		return mathRun(arg.math, vars, number) == -1 ? 2 : 0;
+	char *str;
+	if (expandArgument(&str, arg, source, vars, cmd_exit) == -1)
+		return -1;
+	if (str == NULL)
+		return 2;
+	int ret = 0;
+	if (evaluateMathString(number, str, vars) == -1) {
+		fprintf(stderr, "%s: [[: %s: syntax error in expression\n", source->argv[0], str);
+		ret = 2;
+	}
+	return ret;
+}
+
+/*
+ * Evaluate a [[ ... ]] expression.
+ * Returns 0 if true, 1 if false, 2 on error, and -1 if the shell should exit.
+ */
+int evaluateCondition(CondExpr *cond, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	int ret;
+	switch (cond->op) {
+		case TEST_NOT:
+			ret = evaluateCondition(cond->a, source, vars, cmd_exit);
+			return ret == 0 || ret == 1 ? !ret : ret;
+		case TEST_AND:
+			ret = evaluateCondition(cond->a, source, vars, cmd_exit);
+			return ret != 0 ? ret : evaluateCondition(cond->b, source, vars, cmd_exit);
+		case TEST_OR:
+			ret = evaluateCondition(cond->a, source, vars, cmd_exit);
+			return ret != 1 ? ret : evaluateCondition(cond->b, source, vars, cmd_exit);
+		case TEST_INT_EQ: case TEST_INT_NE:
+		case TEST_INT_LT: case TEST_INT_LE:
+		case TEST_INT_GT: case TEST_INT_GE: {
+			// Operands are arithmetic expressions
+			long long left, right;
+			ret = conditionNumber(&left, cond->left, source, vars, cmd_exit);
+			if (ret == 0)
+				ret = conditionNumber(&right, cond->right, source, vars, cmd_exit);
+			return ret != 0 ? ret : testCompare(cond->op, left, right);
+		}
+		default:
+			break;
+	}
+
+	char *left;
+	if (expandArgument(&left, cond->left, source, vars, cmd_exit) == -1)
+		return -1;
+	if (left == NULL)
+		return 2;
+	if (cond->right.type == ARG_NULL)
+		return testUnary(cond->op, left, vars);
+
+	// == and != match a pattern
+	if (cond->op == TEST_STR_EQ || cond->op == TEST_STR_NE) {
+		Pattern *pat = cond->pattern;
+		if (pat == NULL) {
+			if (expandPattern(&pat, cond->right, source, vars, cmd_exit) == -1)
+				return -1;
+			if (pat == NULL)
+				return 2;
+		}
+		ret = patternMatch(pat, left, strlen(left)) == (cond->op == TEST_STR_NE);
+		if (pat != cond->pattern)
+			free(pat);
+		return ret;
+	}
+
+	// =~ matches an extended regex, and puts the match and its groups in BASH_REMATCH
+	if (cond->op == TEST_REGEX) {
+		regex_t *regex = cond->regex;
+		if (regex == NULL) {
+			char *text;
+			size_t length;
+			if (expandPatternText(&text, &length, cond->right, regexQuote, source, vars, cmd_exit) == -1)
+				return -1;
+			if (text == NULL)
+				return 2;
+			regex = regexCached(text, length);
+			if (regex == NULL) {
+				fprintf(stderr, "%s: [[: %s: invalid regular expression\n", source->argv[0], text);
+				return 2;
+			}
+		}
+		regmatch_t groups[regex->re_nsub + 1];
+		Variable *rematch = variableIntern(vars, "BASH_REMATCH");
+		variableArrayClear(rematch);
+		if (regexec(regex, left, regex->re_nsub + 1, groups, 0) != 0)
+			return 1;
+		for (size_t i = 0; i <= regex->re_nsub; ++i) {
+			if (groups[i].rm_so == -1)
+				variableArraySet(rematch, i, "", 0);
+			else
+				variableArraySet(rematch, i, &left[groups[i].rm_so], groups[i].rm_eo - groups[i].rm_so);
+		}
+		return 0;
+	}
+
+	char *right;
+	if (expandArgument(&right, cond->right, source, vars, cmd_exit) == -1)
+		return -1;
+	if (right == NULL)
+		return 2;
+	return testBinary(cond->op, left, right);
+}
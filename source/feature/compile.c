@@ -0,0 +1,994 @@
+#define _POSIX_C_SOURCE 200809L // fileno
+#include "command.h"
+#include "mash.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Compiled script cache.
+ * A script run as `mash script.sh` is parsed once and its commands are saved
+ * in the user's cache directory, in a file named after a hash of the script.
+ * The file has no pointers in it (commands refer to each other by index, and
+ * everything else is written in order), so it is read straight from a
+ * read-only mapping. It also holds a copy of the script, which has to match
+ * what is being run byte for byte, and the version of mash that wrote it;
+ * anything that doesn't match or doesn't make sense makes the script get
+ * parsed again.
+ */
+
+#define COMPILED_MAGIC "mashs10"
+#define COMPILED_BUILD "mash " __DATE__ " " __TIME__
+#define NO_COMMAND UINT64_MAX
+
+regex_t *literalRegex(Arena*, CmdArg);
+
+// FNV-1a over 8 byte words, names cache files and checks that they are intact
+static uint64_t hashBytes(const char *data, size_t len) {
+	uint64_t hash = 0xcbf29ce484222325 ^ len;
+	size_t i = 0;
+	for (; i + sizeof (uint64_t) <= len; i += sizeof (uint64_t)) {
+		uint64_t word;
+		memcpy(&word, &data[i], sizeof (word));
+		hash = (hash ^ word) * 0x100000001b3;
+		hash ^= hash >> 29;
+	}
+	for (; i < len; ++i)
+		hash = (hash ^ (unsigned char)data[i]) * 0x100000001b3;
+	return hash;
+}
+
+/*
+ * Writing
+ */
+
+typedef struct _script_writer ScriptWriter;
+struct _script_writer {
+	char *buf;
+	size_t len, size;
+	_Bool failed; // Something in the script can't be saved
+	size_t count;
+	Command **cmds;   // Every command, the index is what gets written
+	size_t slots;     // Size of the table below (a power of 2)
+	size_t *table;    // Open addressed: address -> index + 1 (0 is empty)
+};
+
+static void writeReserve(ScriptWriter *w, size_t len) {
+	if (w->len + len > w->size) {
+		w->size = (w->len + len) * 2;
+		w->buf = realloc(w->buf, w->size);
+	}
+}
+
+static void writeBytes(ScriptWriter *w, const void *data, size_t len) {
+	writeReserve(w, len);
+	memcpy(&w->buf[w->len], data, len);
+	w->len += len;
+}
+
+// Numbers are written 7 bits at a time, most are a single byte
+static void writeNumber(ScriptWriter *w, uint64_t number) {
+	writeReserve(w, 10);
+	for (; number >= 0x80; number >>= 7)
+		w->buf[w->len++] = (number & 0x7F) | 0x80;
+	w->buf[w->len++] = number;
+}
+
+// Strings are written with their length + 1, NULL as 0
+static void writeString(ScriptWriter *w, char *str) {
+	if (str == NULL) {
+		writeNumber(w, 0);
+		return;
+	}
+	size_t len = strlen(str);
+	writeNumber(w, len + 1);
+	writeBytes(w, str, len);
+}
+
+// Command index + 1, or 0 for no command
+static void writeIndex(ScriptWriter *w, uint64_t index) {
+	writeNumber(w, index == NO_COMMAND ? 0 : index + 1);
+}
+
+static void writeMath(ScriptWriter *w, MathProg *prog) {
+	writeNumber(w, prog != NULL);
+	if (prog == NULL)
+		return;
+	writeNumber(w, prog->length);
+	writeNumber(w, prog->depth);
+	for (size_t i = 0; i < prog->length; ++i) {
+		writeNumber(w, prog->code[i].op);
+		writeNumber(w, prog->code[i].value);
+	}
+	writeNumber(w, prog->var_count);
+	for (size_t i = 0; i < prog->var_count; ++i)
+		writeString(w, prog->names[i]);
+}
+
+static void writePattern(ScriptWriter *w, Pattern *pat) {
+	writeNumber(w, pat != NULL);
+	if (pat == NULL)
+		return;
+	writeNumber(w, pat->count);
+	for (size_t i = 0; i < pat->count; ++i) {
+		PatternNode *node = &pat->nodes[i];
+		writeNumber(w, node->type);
+		writeNumber(w, node->length);
+		if (node->type == PAT_LITERAL)
+			writeBytes(w, node->literal, node->length);
+		else if (node->type == PAT_CLASS)
+			writeBytes(w, node->class, 32);
+	}
+	writeNumber(w, pat->min_length);
+	writeNumber(w, pat->fixed);
+}
+
+static void writeCond(ScriptWriter*, CondExpr*);
+static void writeSubscript(ScriptWriter*, Subscript*);
+
+static void writeArg(ScriptWriter *w, CmdArg arg) {
+	writeNumber(w, arg.type);
+	writeNumber(w, arg.quoted);
+	switch (arg.type) {
+		case ARG_NULL:
+			break;
+		case ARG_BASIC_STRING:
+		case ARG_QUOTED_STRING:
+		case ARG_SUBSHELL:
+		case ARG_QUOTED_SUBSHELL:
+		case ARG_VARIABLE:
+			writeString(w, arg.str);
+			break;
+		case ARG_PARAMETER:
+			writeString(w, arg.name);
+			writeNumber(w, arg.param);
+			writeNumber(w, arg.position);
+			break;
+		case ARG_COMPLEX_STRING: {
+			size_t count = 0;
+			while (arg.sub[count].type != ARG_NULL)
+				++count;
+			writeNumber(w, count);
+			for (size_t i = 0; i < count; ++i)
+				writeArg(w, arg.sub[i]);
+			break;
+		}
+		case ARG_MATH:
+			writeMath(w, arg.math);
+			break;
+		case ARG_MATH_WORD:
+			writeArg(w, *arg.sub);
+			break;
+		case ARG_PARAM_EXP:
+			writeNumber(w, arg.pexp->op);
+			writeNumber(w, arg.pexp->colon);
+			writeArg(w, arg.pexp->param);
+			writeArg(w, arg.pexp->word);
+			writeArg(w, arg.pexp->replacement);
+			writeMath(w, arg.pexp->offset);
+			writeMath(w, arg.pexp->length);
+			writeSubscript(w, &arg.pexp->sub);
+			writePattern(w, arg.pexp->pattern);
+			break;
+		case ARG_COND:
+			writeCond(w, arg.cond);
+			break;
+		case ARG_GLOB:
+			writeArg(w, arg.glob->word);
+			writeNumber(w, arg.glob->count);
+			for (size_t i = 0; i < arg.glob->count; ++i) {
+				writeString(w, arg.glob->parts[i].name);
+				writePattern(w, arg.glob->parts[i].pattern);
+				writeNumber(w, arg.glob->parts[i].hidden);
+				writeNumber(w, arg.glob->parts[i].recursive);
+			}
+			writeNumber(w, arg.glob->absolute);
+			writeNumber(w, arg.glob->directory);
+			break;
+		case ARG_READ_FILE:
+			writeArg(w, arg.read->file);
+			writeString(w, arg.read->command);
+			writeNumber(w, arg.read->cat);
+			writeNumber(w, arg.read->split);
+			break;
+		default:
+			w->failed = 1;
+	}
+}
+
+static void writeCond(ScriptWriter *w, CondExpr *expr) {
+	writeNumber(w, expr != NULL);
+	if (expr == NULL)
+		return;
+	writeNumber(w, expr->op);
+	writeArg(w, expr->left);
+	writeArg(w, expr->right);
+	writeCond(w, expr->a);
+	writeCond(w, expr->b);
+	writePattern(w, expr->pattern);
+}
+
+static void writeSubscript(ScriptWriter *w, Subscript *sub) {
+	writeNumber(w, sub->type);
+	if (sub->type != '[')
+		return;
+	writeArg(w, sub->key);
+	writeMath(w, sub->index);
+}
+
+// Number every command reachable from cmd (everything commandFree would free)
+static void collectCommands(ScriptWriter *w, Command *cmd) {
+	if (cmd == NULL)
+		return;
+	if ((w->count & (w->count - 1)) == 0) // Doubled at powers of 2
+		w->cmds = realloc(w->cmds, (w->count == 0 ? 1 : w->count * 2) * sizeof (Command*));
+	w->cmds[w->count++] = cmd;
+	collectCommands(w, cmd->c_next);
+	collectCommands(w, cmd->c_if_true);
+	collectCommands(w, cmd->c_if_false);
+	collectCommands(w, cmd->c_cmds);
+	if (cmd->c_function != NULL)
+		collectCommands(w, cmd->c_function->body);
+}
+
+static size_t commandSlot(ScriptWriter *w, Command *cmd) {
+	size_t slot = ((uintptr_t)cmd >> 4) * 0x9E3779B97F4A7C15 & (w->slots - 1);
+	while (w->table[slot] != 0 && w->cmds[w->table[slot] - 1] != cmd)
+		slot = (slot + 1) & (w->slots - 1);
+	return slot;
+}
+
+static uint64_t commandIndex(ScriptWriter *w, Command *cmd) {
+	if (cmd == NULL)
+		return NO_COMMAND;
+	size_t slot = commandSlot(w, cmd);
+	if (w->table[slot] == 0) { // Not part of this script
+		w->failed = 1;
+		return NO_COMMAND;
+	}
+	return w->table[slot] - 1;
+}
+
+static void writeCommand(ScriptWriter *w, Command *cmd) {
+	writeNumber(w, cmd->c_type);
+	writeNumber(w, cmd->c_argc);
+	for (int i = 0; i < cmd->c_argc; ++i)
+		writeArg(w, cmd->c_argv[i]);
+	writeNumber(w, cmd->c_in_list);
+	writeNumber(w, cmd->c_assign_count);
+	for (size_t i = 0; i < cmd->c_assign_count; ++i) {
+		CmdAssign *assign = &cmd->c_assign[i];
+		writeString(w, assign->name);
+		writeArg(w, assign->value);
+		writeSubscript(w, &assign->sub);
+		writeNumber(w, assign->append);
+		writeNumber(w, assign->elements != NULL);
+		if (assign->elements == NULL)
+			continue;
+		writeNumber(w, assign->count);
+		for (size_t e = 0; e < assign->count; ++e) {
+			writeSubscript(w, &assign->elements[e].sub);
+			writeArg(w, assign->elements[e].value);
+		}
+	}
+	// alias changes how the lines after it are parsed, so scripts using it have to be read line by line
+	if (cmd->c_type == CMD_REGULAR && cmd->c_argc > 0 && cmd->c_argv[0].type == ARG_BASIC_STRING &&
+			(!strcmp(cmd->c_argv[0].str, "alias") || !strcmp(cmd->c_argv[0].str, "unalias")))
+		w->failed = 1;
+
+	Command *links[] = { cmd->c_next, cmd->c_if_true, cmd->c_if_false, cmd->c_cmds, cmd->c_parent };
+	for (size_t i = 0; i < sizeof (links) / sizeof (*links); ++i) {
+		writeIndex(w, commandIndex(w, links[i]));
+	}
+	writeNumber(w, cmd->c_function != NULL);
+	if (cmd->c_function != NULL) {
+		writeString(w, cmd->c_function->name);
+		writeIndex(w, commandIndex(w, cmd->c_function->body));
+	}
+
+	writeNumber(w, cmd->c_io.in_count);
+	for (size_t i = 0; i < cmd->c_io.in_count; ++i) {
+		writeArg(w, cmd->c_io.in[i].arg);
+		writeNumber(w, cmd->c_io.in[i].alternate);
+	}
+	writeNumber(w, cmd->c_io.out_count);
+	for (size_t i = 0; i < cmd->c_io.out_count; ++i) {
+		writeArg(w, cmd->c_io.out[i].arg);
+		writeNumber(w, cmd->c_io.out[i].alternate);
+	}
+	writeNumber(w, cmd->c_io.in_pipe);
+	writeNumber(w, cmd->c_io.out_pipe);
+}
+
+/*
+ * Serialize a parsed script (and its source, which is checked when it is loaded).
+ * Returns NULL if the script has something that can't be saved.
+ */
+static char *scriptSerialize(Script *script, char *source, size_t source_len, size_t *len) {
+	ScriptWriter w = { .buf = NULL, .len = 0, .size = 0, .failed = 0, .count = 0, .cmds = NULL, .slots = 1, .table = NULL };
+	for (size_t i = 0; i < script->count; ++i)
+		collectCommands(&w, script->cmds[i]);
+	while (w.slots < w.count * 2)
+		w.slots *= 2;
+	w.table = calloc(w.slots, sizeof (size_t));
+	for (size_t i = 0; i < w.count; ++i)
+		w.table[commandSlot(&w, w.cmds[i])] = i + 1;
+
+	writeBytes(&w, COMPILED_MAGIC, sizeof (COMPILED_MAGIC));
+	writeString(&w, COMPILED_BUILD);
+	writeNumber(&w, source_len);
+	writeBytes(&w, source, source_len);
+	writeNumber(&w, w.count);
+	for (size_t i = 0; i < w.count; ++i)
+		writeCommand(&w, w.cmds[i]);
+	writeNumber(&w, script->count);
+	for (size_t i = 0; i < script->count; ++i)
+		writeNumber(&w, commandIndex(&w, script->cmds[i]));
+
+	uint64_t checksum = hashBytes(w.buf, w.len);
+	writeBytes(&w, &checksum, sizeof (checksum));
+
+	free(w.table);
+	free(w.cmds);
+	if (w.failed) {
+		free(w.buf);
+		return NULL;
+	}
+	*len = w.len;
+	return w.buf;
+}
+
+/*
+ * Reading
+ * Every read is bounds checked, and failing one makes every read after it
+ * return 0 or an empty string. Everything is allocated from the script's arena,
+ * so whatever was built before a failure is freed with it.
+ */
+
+typedef struct _script_reader ScriptReader;
+struct _script_reader {
+	const char *data;
+	size_t len, pos;
+	_Bool failed;
+	Arena *arena;
+	Variables *vars;
+};
+
+static uint64_t readNumber(ScriptReader *r) {
+	uint64_t number = 0;
+	for (unsigned shift = 0; !r->failed; shift += 7) {
+		if (r->pos == r->len || shift > 63) {
+			r->failed = 1;
+			break;
+		}
+		unsigned char byte = r->data[r->pos++];
+		number |= (uint64_t)(byte & 0x7F) << shift;
+		if (!(byte & 0x80))
+			return number;
+	}
+	return 0;
+}
+
+// Read a number which has to be less than limit
+static uint64_t readBounded(ScriptReader *r, uint64_t limit) {
+	uint64_t number = readNumber(r);
+	if (number >= limit) {
+		r->failed = 1;
+		return 0;
+	}
+	return number;
+}
+
+// Read a count of things that each take at least one more byte
+static size_t readCount(ScriptReader *r) {
+	return readBounded(r, r->len - r->pos + 1);
+}
+
+static const char *readBytes(ScriptReader *r, size_t len) {
+	if (r->failed || r->len - r->pos < len) {
+		r->failed = 1;
+		return NULL;
+	}
+	const char *bytes = &r->data[r->pos];
+	r->pos += len;
+	return bytes;
+}
+
+static char *readString(ScriptReader *r) {
+	uint64_t len = readNumber(r);
+	if (len == 0 && !r->failed)
+		return NULL;
+	const char *bytes = readBytes(r, len - 1);
+	return bytes == NULL ? arenaStrndup(r->arena, "", 0) : arenaStrndup(r->arena, bytes, len - 1);
+}
+
+// Command index (less than count), or NO_COMMAND
+static uint64_t readIndex(ScriptReader *r, size_t count) {
+	uint64_t index = readBounded(r, (uint64_t)count + 1);
+	return index == 0 ? NO_COMMAND : index - 1;
+}
+
+static MathProg *readMath(ScriptReader *r) {
+	if (!readBounded(r, 2))
+		return NULL;
+	MathProg *prog = arenaAlloc(r->arena, sizeof (MathProg));
+	prog->length = readCount(r);
+	prog->depth = readBounded(r, prog->length + 1);
+	prog->code = arenaAlloc(r->arena, prog->length * sizeof (MathInstr));
+	for (size_t i = 0; i < prog->length; ++i) {
+		prog->code[i].op = readBounded(r, MOP_POP + 1);
+		prog->code[i].value = readNumber(r);
+	}
+	prog->var_count = readCount(r);
+	prog->names = arenaAlloc(r->arena, prog->var_count * sizeof (char*));
+	prog->vars = arenaAlloc(r->arena, prog->var_count * sizeof (Variable*));
+	for (size_t i = 0; i < prog->var_count; ++i) {
+		prog->names[i] = readString(r);
+		if (prog->names[i] == NULL)
+			prog->names[i] = arenaStrndup(r->arena, "", 0);
+		prog->vars[i] = NULL; // Bound on first run
+	}
+	// Slots and jumps have to stay inside the program
+	for (size_t i = 0; i < prog->length; ++i) {
+		switch (prog->code[i].op) {
+			case MOP_LOAD:
+			case MOP_ELEMENT:
+			case MOP_STORE:
+			case MOP_PREINC: case MOP_PREDEC:
+			case MOP_POSTINC: case MOP_POSTDEC:
+				if (prog->code[i].slot >= prog->var_count)
+					r->failed = 1;
+				break;
+			case MOP_LAND:
+			case MOP_LOR:
+			case MOP_JZ:
+			case MOP_JMP:
+				if (prog->code[i].jump == 0 || prog->code[i].jump > prog->length)
+					r->failed = 1;
+				break;
+			default:
+				break;
+		}
+	}
+	return prog;
+}
+
+static Pattern *readPattern(ScriptReader *r) {
+	if (!readBounded(r, 2))
+		return NULL;
+	Pattern *pat = arenaAlloc(r->arena, sizeof (Pattern));
+	size_t count = readCount(r);
+	pat->count = 0;
+	pat->nodes = arenaAlloc(r->arena, count * sizeof (PatternNode));
+	for (; pat->count < count; ++pat->count) {
+		PatternNode *node = &pat->nodes[pat->count];
+		node->type = readBounded(r, PAT_CLASS + 1);
+		node->length = readNumber(r);
+		const char *bytes;
+		switch (node->type) {
+			case PAT_LITERAL:
+				bytes = readBytes(r, node->length);
+				if (bytes == NULL)
+					node->length = 0;
+				node->literal = arenaStrndup(r->arena, bytes == NULL ? "" : bytes, node->length);
+				break;
+			case PAT_CLASS:
+				bytes = readBytes(r, 32);
+				node->class = memset(arenaAlloc(r->arena, 32), 0, 32);
+				if (bytes != NULL)
+					memcpy(node->class, bytes, 32);
+				break;
+			default:
+				break;
+		}
+	}
+	pat->min_length = readNumber(r);
+	pat->fixed = readBounded(r, 2);
+	return pat;
+}
+
+static CondExpr *readCond(ScriptReader*);
+static void readSubscript(ScriptReader*, Subscript*);
+
+static CmdArg readArg(ScriptReader *r) {
+	CmdArg arg = { .type = readBounded(r, ARG_READ_FILE + 1) };
+	arg.quoted = readBounded(r, 2);
+	switch (arg.type) {
+		case ARG_NULL:
+			break;
+		case ARG_BASIC_STRING:
+		case ARG_QUOTED_STRING:
+		case ARG_SUBSHELL:
+		case ARG_QUOTED_SUBSHELL:
+			arg.str = readString(r);
+			if (arg.str == NULL)
+				arg.str = arenaStrndup(r->arena, "", 0);
+			break;
+		case ARG_VARIABLE:
+			arg.name = readString(r);
+			if (arg.name == NULL)
+				arg.name = arenaStrndup(r->arena, "", 0);
+			arg.var = r->failed ? NULL : variableIntern(r->vars, arg.name);
+			break;
+		case ARG_PARAMETER:
+			arg.name = readString(r);
+			if (arg.name == NULL)
+				arg.name = arenaStrndup(r->arena, "", 0);
+			arg.param = readBounded(r, PARAM_COUNT + 1);
+			arg.position = readNumber(r);
+			break;
+		case ARG_COMPLEX_STRING: {
+			size_t count = readCount(r);
+			arg.sub = arenaAlloc(r->arena, (count + 1) * sizeof (CmdArg));
+			for (size_t i = 0; i <= count; ++i)
+				arg.sub[i].type = ARG_NULL;
+			for (size_t i = 0; i < count; ++i) {
+				arg.sub[i] = readArg(r);
+				// A null argument would end the list early
+				if (arg.sub[i].type == ARG_NULL) {
+					r->failed = 1;
+					break;
+				}
+			}
+			break;
+		}
+		case ARG_MATH:
+			arg.math = readMath(r);
+			if (arg.math == NULL) {
+				r->failed = 1;
+				arg.type = ARG_NULL;
+			}
+			break;
+		case ARG_MATH_WORD:
+			arg.sub = arenaAlloc(r->arena, sizeof (CmdArg));
+			*arg.sub = readArg(r);
+			if (arg.sub->type == ARG_NULL)
+				r->failed = 1;
+			break;
+		case ARG_PARAM_EXP:
+			arg.pexp = arenaAlloc(r->arena, sizeof (ParamExp));
+			arg.pexp->op = readBounded(r, PEXP_KEYS + 1);
+			arg.pexp->colon = readBounded(r, 2);
+			arg.pexp->param = readArg(r);
+			arg.pexp->word = readArg(r);
+			arg.pexp->replacement = readArg(r);
+			arg.pexp->offset = readMath(r);
+			arg.pexp->length = readMath(r);
+			readSubscript(r, &arg.pexp->sub);
+			arg.pexp->pattern = readPattern(r);
+			if (arg.pexp->param.type != ARG_VARIABLE && arg.pexp->param.type != ARG_PARAMETER)
+				r->failed = 1;
+			break;
+		case ARG_COND:
+			arg.cond = readCond(r);
+			if (arg.cond == NULL) {
+				r->failed = 1;
+				arg.type = ARG_NULL;
+			}
+			break;
+		case ARG_GLOB: {
+			Glob *glob = arg.glob = arenaAlloc(r->arena, sizeof (Glob));
+			glob->word = readArg(r);
+			glob->count = readCount(r);
+			glob->parts = arenaAlloc(r->arena, glob->count * sizeof (GlobPart));
+			for (size_t i = 0; i < glob->count; ++i) {
+				GlobPart *part = &glob->parts[i];
+				part->name = readString(r);
+				part->length = part->name == NULL ? 0 : strlen(part->name);
+				part->pattern = readPattern(r);
+				part->hidden = readBounded(r, 2);
+				part->recursive = readBounded(r, 2);
+				// Every component is exactly one of a name, a pattern, or **
+				if ((part->name != NULL) + (part->pattern != NULL) + part->recursive != 1)
+					r->failed = 1;
+			}
+			glob->absolute = readBounded(r, 2);
+			glob->directory = readBounded(r, 2);
+			if (glob->word.type == ARG_NULL)
+				r->failed = 1;
+			break;
+		}
+		case ARG_READ_FILE: {
+			FileRead *read = arg.read = arenaAlloc(r->arena, sizeof (FileRead));
+			read->file = readArg(r);
+			read->command = readString(r);
+			read->cat = readBounded(r, 2);
+			read->split = readBounded(r, 2);
+			if (read->file.type == ARG_NULL || read->command == NULL)
+				r->failed = 1;
+			break;
+		}
+	}
+	return arg;
+}
+
+static CondExpr *readCond(ScriptReader *r) {
+	if (!readBounded(r, 2))
+		return NULL;
+	CondExpr *expr = arenaAlloc(r->arena, sizeof (CondExpr));
+	expr->op = readBounded(r, TEST_OR + 1);
+	expr->left = readArg(r);
+	expr->right = readArg(r);
+	expr->a = readCond(r);
+	expr->b = readCond(r);
+	expr->pattern = readPattern(r);
+	// Compiled regexes can't be saved, literal ones are compiled again
+	expr->regex = expr->op == TEST_REGEX ? literalRegex(r->arena, expr->right) : NULL;
+	return expr;
+}
+
+static void readSubscript(ScriptReader *r, Subscript *sub) {
+	*sub = (Subscript){ .type = readBounded(r, '[' + 1), .key = { .type = ARG_NULL }, .index = NULL };
+	if (sub->type != 0 && sub->type != '[' && sub->type != '@' && sub->type != '*')
+		r->failed = 1;
+	if (sub->type != '[')
+		return;
+	sub->key = readArg(r);
+	sub->index = readMath(r);
+}
+
+// Links between commands, only made once everything has been read
+typedef struct _command_links CommandLinks;
+struct _command_links {
+	uint64_t next, if_true, if_false, cmds, parent, body;
+	char *function; // Function name, if it defines one
+};
+
+static Command *linkCommand(Command **cmds, uint64_t index) {
+	return index == NO_COMMAND ? NULL : cmds[index];
+}
+
+static Script *scriptDeserialize(const char *data, size_t len, char *source, size_t source_len, Variables *vars) {
+	// Checksum of everything else, at the end
+	uint64_t checksum;
+	if (len < sizeof (checksum))
+		return NULL;
+	len -= sizeof (checksum);
+	memcpy(&checksum, &data[len], sizeof (checksum));
+	if (checksum != hashBytes(data, len))
+		return NULL;
+	ScriptReader r = { .data = data, .len = len, .pos = 0, .failed = 0, .arena = NULL, .vars = vars };
+
+	// Header, and the script it was made from
+	const char *magic = readBytes(&r, sizeof (COMPILED_MAGIC));
+	if (magic == NULL || memcmp(magic, COMPILED_MAGIC, sizeof (COMPILED_MAGIC)))
+		return NULL;
+	uint64_t build_len = readNumber(&r) - 1; // Written as a string
+	const char *build = readBytes(&r, build_len);
+	if (build == NULL || build_len != strlen(COMPILED_BUILD) || memcmp(build, COMPILED_BUILD, build_len))
+		return NULL;
+	if (readNumber(&r) != source_len)
+		return NULL;
+	const char *saved = readBytes(&r, source_len);
+	if (saved == NULL || memcmp(saved, source, source_len))
+		return NULL;
+
+	size_t count = readCount(&r);
+	r.arena = arenaInit();
+	Command **cmds = calloc(count + 1, sizeof (Command*));
+	CommandLinks *links = calloc(count + 1, sizeof (CommandLinks));
+	size_t read = 0;
+	for (; read < count && !r.failed; ++read) {
+		Command *cmd = cmds[read] = commandInit(r.arena);
+		cmd->c_type = readBounded(&r, CMD_FUNCTION + 1);
+		cmd->c_argc = readCount(&r);
+		cmd->c_argv = arenaAlloc(r.arena, (cmd->c_argc + 1) * sizeof (CmdArg));
+		for (int i = 0; i < cmd->c_argc; ++i)
+			cmd->c_argv[i] = readArg(&r);
+		cmd->c_in_list = readBounded(&r, 2);
+		// A for loop's first argument is its variable
+		if (cmd->c_type == CMD_FOR_IN && (cmd->c_argc < 1 || cmd->c_argv[0].type != ARG_VARIABLE))
+			r.failed = 1;
+		cmd->c_assign_count = readCount(&r);
+		cmd->c_assign = cmd->c_assign_count == 0 ? NULL : arenaAlloc(r.arena, cmd->c_assign_count * sizeof (CmdAssign));
+		for (size_t i = 0; i < cmd->c_assign_count; ++i) {
+			CmdAssign *assign = &cmd->c_assign[i];
+			assign->name = readString(&r);
+			if (assign->name == NULL)
+				r.failed = 1;
+			assign->var = r.failed ? NULL : variableIntern(r.vars, assign->name);
+			assign->value = readArg(&r);
+			readSubscript(&r, &assign->sub);
+			assign->append = readBounded(&r, 2);
+			assign->count = 0;
+			assign->elements = NULL;
+			if (readBounded(&r, 2)) {
+				assign->count = readCount(&r);
+				assign->elements = arenaAlloc(r.arena, (assign->count + 1) * sizeof (ArrayElement));
+				for (size_t e = 0; e < assign->count; ++e) {
+					readSubscript(&r, &assign->elements[e].sub);
+					assign->elements[e].value = readArg(&r);
+				}
+			}
+		}
+
+		CommandLinks *link = &links[read];
+		uint64_t *indices[] = { &link->next, &link->if_true, &link->if_false, &link->cmds, &link->parent };
+		for (size_t i = 0; i < sizeof (indices) / sizeof (*indices); ++i)
+			*indices[i] = readIndex(&r, count);
+		if (readBounded(&r, 2)) {
+			link->function = readString(&r);
+			link->body = readIndex(&r, count);
+			if (link->function == NULL || link->body == NO_COMMAND)
+				r.failed = 1;
+		}
+
+		cmd->c_io.in_count = readCount(&r);
+		cmd->c_io.in = cmd->c_io.in_count == 0 ? NULL : arenaAlloc(r.arena, cmd->c_io.in_count * sizeof (CmdIOFile));
+		for (size_t i = 0; i < cmd->c_io.in_count; ++i) {
+			cmd->c_io.in[i].arg = readArg(&r);
+			cmd->c_io.in[i].alternate = readBounded(&r, 2);
+		}
+		cmd->c_io.out_count = readCount(&r);
+		cmd->c_io.out = cmd->c_io.out_count == 0 ? NULL : arenaAlloc(r.arena, cmd->c_io.out_count * sizeof (CmdIOFile));
+		for (size_t i = 0; i < cmd->c_io.out_count; ++i) {
+			cmd->c_io.out[i].arg = readArg(&r);
+			cmd->c_io.out[i].alternate = readBounded(&r, 2);
+		}
+		cmd->c_io.in_pipe = readBounded(&r, 2);
+		cmd->c_io.out_pipe = readBounded(&r, 2);
+	}
+
+	Script *script = malloc(sizeof (Script));
+	*script = (Script){ .count = readCount(&r), .cmds = NULL, .refs = 1, .arena = r.arena };
+	script->cmds = calloc(script->count + 1, sizeof (Command*));
+	uint64_t *roots = calloc(script->count + 1, sizeof (uint64_t));
+	for (size_t i = 0; i < script->count; ++i)
+		roots[i] = readBounded(&r, count);
+
+	/*
+	 * Every command has to be owned exactly once (by another command or the script), or walking the tree would go wrong.
+	 * Commands are numbered in the order they are reached, so a command only owns commands after it (no cycles).
+	 */
+	if (!r.failed) {
+		size_t *owners = calloc(count + 1, sizeof (size_t));
+		for (size_t i = 0; i < count; ++i) {
+			uint64_t owned[] = { links[i].next, links[i].if_true, links[i].if_false, links[i].cmds, links[i].function == NULL ? NO_COMMAND : links[i].body };
+			for (size_t j = 0; j < sizeof (owned) / sizeof (*owned); ++j) {
+				if (owned[j] == NO_COMMAND)
+					continue;
+				if (owned[j] <= i)
+					r.failed = 1;
+				else
+					++owners[owned[j]];
+			}
+		}
+		for (size_t i = 0; i < script->count; ++i)
+			++owners[roots[i]];
+		for (size_t i = 0; i < count; ++i)
+			if (owners[i] != 1)
+				r.failed = 1;
+		free(owners);
+		// A case has its word, and only arms (with at least one pattern) after c_cmds
+		for (size_t i = 0; !r.failed && i < count; ++i) {
+			if (cmds[i]->c_type != CMD_CASE)
+				continue;
+			if (cmds[i]->c_argc != 1)
+				r.failed = 1;
+			for (uint64_t arm = links[i].cmds; !r.failed && arm != NO_COMMAND; arm = links[arm].next)
+				if (cmds[arm]->c_type != CMD_CASE_ARM || cmds[arm]->c_argc < 1)
+					r.failed = 1;
+		}
+	}
+
+	if (r.failed || r.pos != r.len) {
+		free(roots);
+		arenaRelease(r.arena);
+		free(cmds);
+		free(links);
+		free(script->cmds);
+		free(script);
+		return NULL;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		Command *cmd = cmds[i];
+		cmd->c_next = linkCommand(cmds, links[i].next);
+		cmd->c_if_true = linkCommand(cmds, links[i].if_true);
+		cmd->c_if_false = linkCommand(cmds, links[i].if_false);
+		cmd->c_cmds = linkCommand(cmds, links[i].cmds);
+		cmd->c_parent = linkCommand(cmds, links[i].parent);
+		if (links[i].function != NULL) {
+			cmd->c_function = arenaAlloc(r.arena, sizeof (ShellFunction));
+			*cmd->c_function = (ShellFunction){ .name = links[i].function, .body = cmds[links[i].body], .arena = r.arena };
+		}
+	}
+	// case dispatch isn't saved, it is built again from the arms
+	for (size_t i = 0; i < count; ++i)
+		if (cmds[i]->c_type == CMD_CASE)
+			cmds[i]->c_case = caseCompile(r.arena, cmds[i]);
+	for (size_t i = 0; i < script->count; ++i)
+		script->cmds[i] = cmds[roots[i]];
+	free(roots);
+	free(cmds);
+	free(links);
+	return script;
+}
+
+/*
+ * Cache files
+ */
+
+#define CACHE_MAX_FILES 256 // More than this and the oldest are removed, whenever a file is written
+
+// Create a directory and any parents it is missing (like mkdir -p)
+static int makeDirs(char *path) {
+	for (char *slash = strchr(&path[1], '/');; slash = strchr(&slash[1], '/')) {
+		if (slash != NULL)
+			*slash = '\0';
+		int ret = mkdir(path, 0700) == -1 && errno != EEXIST ? -1 : 0;
+		if (slash == NULL)
+			return ret;
+		*slash = '/';
+		if (ret == -1)
+			return -1;
+	}
+}
+
+// Path of the cache file for a script, the directory is created if create is set
+static char *cachePath(uint64_t hash, _Bool create) {
+	char *env_xdg = getenv("XDG_CACHE_HOME"), *env_home = getenv("HOME");
+	if ((env_xdg == NULL || env_xdg[0] == '\0') && env_home == NULL)
+		return NULL;
+	char *base = env_xdg != NULL && env_xdg[0] != '\0' ? env_xdg : env_home;
+	char *path = malloc(strlen(base) + 40);
+	if (path == NULL)
+		return NULL;
+	sprintf(path, "%s%s/mash", base, base == env_home ? "/.cache" : "");
+	if (create && makeDirs(path) == -1) {
+		free(path);
+		return NULL;
+	}
+	sprintf(&path[strlen(path)], "/%016llx.msc", (unsigned long long)hash);
+	return path;
+}
+
+typedef struct _cache_file CacheFile;
+struct _cache_file {
+	struct timespec mtime;
+	char *name;
+};
+
+static int compareCacheFiles(const void *a, const void *b) {
+	struct timespec x = ((CacheFile*)a)->mtime, y = ((CacheFile*)b)->mtime;
+	if (x.tv_sec != y.tv_sec)
+		return x.tv_sec < y.tv_sec ? -1 : 1;
+	return (x.tv_nsec > y.tv_nsec) - (x.tv_nsec < y.tv_nsec);
+}
+
+// Remove the least recently written files from the directory path is in, if it has more than CACHE_MAX_FILES
+static void cachePrune(char *path) {
+	char *slash = strrchr(path, '/');
+	*slash = '\0';
+	DIR *dir = opendir(path);
+	*slash = '/';
+	if (dir == NULL)
+		return;
+
+	CacheFile *files = NULL;
+	size_t count = 0, size = 0;
+	struct stat st;
+	for (struct dirent *entry; (entry = readdir(dir)) != NULL;) {
+		if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(st.st_mode))
+			continue;
+		if (count == size) {
+			size = size == 0 ? CACHE_MAX_FILES * 2 : size * 2;
+			CacheFile *grown = realloc(files, size * sizeof (CacheFile));
+			if (grown == NULL)
+				break;
+			files = grown;
+		}
+		files[count].name = strdup(entry->d_name);
+		if (files[count].name != NULL)
+			files[count++].mtime = st.st_mtim;
+	}
+	if (count > CACHE_MAX_FILES) {
+		qsort(files, count, sizeof (CacheFile), compareCacheFiles);
+		for (size_t i = 0; i < count - CACHE_MAX_FILES; ++i)
+			unlinkat(dirfd(dir), files[i].name, 0);
+	}
+	for (size_t i = 0; i < count; ++i)
+		free(files[i].name);
+	free(files);
+	closedir(dir);
+}
+
+static Script *cacheRead(char *path, char *source, size_t source_len, Variables *vars) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	struct stat st;
+	// Only trust files this user wrote
+	if (fstat(fd, &st) == -1 || st.st_uid != getuid() || st.st_size == 0) {
+		close(fd);
+		return NULL;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+	Script *script = scriptDeserialize(data, st.st_size, source, source_len, vars);
+	munmap(data, st.st_size);
+	return script;
+}
+
+// Write to a temporary file first, so that nothing ever sees half a cache file, then make room for it
+static void cacheWrite(char *path, char *data, size_t len) {
+	char *tmp = malloc(strlen(path) + 8);
+	if (tmp == NULL)
+		return;
+	sprintf(tmp, "%s.XXXXXX", path);
+	int fd = mkstemp(tmp);
+	if (fd == -1) {
+		free(tmp);
+		return;
+	}
+	_Bool ok = 1;
+	for (size_t written = 0; ok && written < len;) {
+		ssize_t w = write(fd, &data[written], len - written);
+		if (w == -1 && errno != EINTR)
+			ok = 0;
+		else if (w > 0)
+			written += w;
+	}
+	if (close(fd) == -1 || !ok || rename(tmp, path) == -1)
+		unlink(tmp);
+	else
+		cachePrune(path);
+	free(tmp);
+}
+
+/*
+ * Get the parsed commands of a script being run, compiled from the cache if possible.
+ * On a miss, the script is parsed (reading all of file) and saved for next time.
+ * Returns NULL if the script has to be read line by line instead (file is rewound in that case).
+ */
+Script *scriptCompiled(FILE *file, AliasMap *aliases, Variables *vars) {
+	// The whole script is needed to check it against the cache
+	size_t len;
+	char *source = scriptRead(fileno(file), &len);
+	if (source == NULL || len == 0) {
+		free(source);
+		rewind(file);
+		return NULL;
+	}
+
+	uint64_t hash = hashBytes(source, len);
+	char *path = cachePath(hash, 0);
+	Script *script = path == NULL ? NULL : cacheRead(path, source, len, vars);
+	free(path);
+	if (script != NULL) {
+		free(source);
+		return script;
+	}
+
+	// Lines are terminated in place while parsing, and the original is needed to save it
+	CmdInput input = { .file = NULL, .fd = -1, .text = malloc(len + 1), .len = len, .pos = 0, .size = len + 1 };
+	memcpy(input.text, source, len + 1);
+	script = scriptParse(&input, aliases, vars);
+	free(input.text);
+	// Scripts with errors are read line by line, so the lines before the error run first
+	char *data = NULL;
+	size_t data_len;
+	if (script != NULL)
+		data = scriptSerialize(script, source, len, &data_len);
+	free(source);
+	if (data == NULL) {
+		if (script != NULL)
+			scriptRelease(script);
+		rewind(file);
+		return NULL;
+	}
+	path = cachePath(hash, 1);
+	if (path != NULL)
+		cacheWrite(path, data, data_len);
+	free(path);
+	free(data);
+	return script;
+}
@@ -120,6 +120,23 @@ int mktmpfile(_Bool hidden, char **path, Variables *vars) {
 }
 
 int openInputFiles(CmdIO *io, Source *source, Variables *vars, uint8_t *cmd_exit) {
+	// A single file is read where it is
+	if (io->in_count == 1 && !io->in[0].alternate) {
+		char *ipath;
+		if (expandArgument(&ipath, io->in[0].arg, source, vars, cmd_exit) == -1)
+			return -1; // Child process with error
+		if (ipath == NULL) {
+			fprintf(stderr, "%s: error expanding argument, possibly related error message: %m\n", source->argv[0]);
+			return 1;
+		}
+		io->in_file = fopen(ipath, "r");
+		if (io->in_file == NULL) {
+			fprintf(stderr, "%s: %m: %s\n", source->argv[0], ipath);
+			return 1;
+		}
+		return 0;
+	}
+
 	// File we will return (which will contain the concatenated contents of all requested files)
 	io->in_file = tmpfile();
 	_Bool error = 0;
@@ -130,7 +147,6 @@ int openInputFiles(CmdIO *io, Source *source, Variables *vars, uint8_t *cmd_exit
 			if (expandArgument(&string, io->in[i].arg, source, vars, cmd_exit) == -1)
 				return -1;
 			fwrite(string, sizeof (char), strlen(io->in[i].arg.str), io->in_file);
-			free(string);
 			fwrite("\n", sizeof (char), 1, io->in_file);
 		}
 		// Input is real file
@@ -149,11 +165,9 @@ int openInputFiles(CmdIO *io, Source *source, Variables *vars, uint8_t *cmd_exit
 			FILE *ifile = fopen(ipath, "r");
 			if (ifile == NULL) {
 				fprintf(stderr, "%s: %m: %s\n", source->argv[0], ipath);
-				free(ipath);
 				error = 1;
 				break;
 			}
-			free(ipath);
 
 			// Copy contents to temporary file
 			char buffer[TMP_RW_BUFSIZE];
@@ -192,11 +206,9 @@ int openOutputFiles(CmdIO *io, Source *source, Variables *vars, uint8_t *cmd_exi
 		FILE *ofile = fopen(opath, io->out[i].alternate ? "a" : "w");
 		if (ofile == NULL) {
 			fprintf(stderr, "%s: %m: %s\n", source->argv[0], opath);
-			free(opath);
 			error = 1;
 			break;
 		}
-		free(opath);
 
 		// Add to array
 		io->out_file[i] = ofile;
@@ -207,8 +219,8 @@ int openOutputFiles(CmdIO *io, Source *source, Variables *vars, uint8_t *cmd_exi
 		free(io->out_file);
 		io->out_file = NULL;
 	}
-	else
-		io->out_file[i] = tmpfile();
+	else // Output is collected in a temporary file when it has to be copied to several files
+		io->out_file[i] = i == 1 ? io->out_file[0] : tmpfile();
 
 	return error ? 1 : 0;
 }
@@ -237,21 +249,23 @@ int openIOFiles(CmdIO *io, Source *source, Variables *vars, uint8_t *cmd_exit) {
 
 void closeIOFiles(CmdIO *io) {
 	if (io->in_file != NULL) {
+		inputDiscard(fileno(io->in_file));
 		fclose(io->in_file);
 		io->in_file = NULL;
 	}
 	if (io->out_file != NULL) {
-		if (io->out_count > 0) {
+		if (io->out_count > 1) {
 			rewind(io->out_file[io->out_count]);
 			char buffer[TMP_RW_BUFSIZE];
 			size_t bytes_read;
 			while (bytes_read = fread(buffer, sizeof (char), TMP_RW_BUFSIZE, io->out_file[io->out_count]), bytes_read > 0)
 				for (size_t i = 0; i < io->out_count; ++i)
 					fwrite(buffer, sizeof (char), bytes_read, io->out_file[i]);
-			for (size_t i = 0; i < io->out_count; ++i)
-				fclose(io->out_file[i]);
 		}
-		fclose(io->out_file[io->out_count]);
+		for (size_t i = 0; i < io->out_count; ++i)
+			fclose(io->out_file[i]);
+		if (io->out_count != 1)
+			fclose(io->out_file[io->out_count]);
 		free(io->out_file);
 		io->out_file = NULL;
 	}
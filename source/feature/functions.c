@@ -0,0 +1,56 @@
+#include "command.h"
+#include "mash.h"
+#include <stdlib.h>
+
+/*
+ * Function table.
+ * Functions are parsed once, when they are defined, and the table only holds
+ * a reference to the arena they were parsed into (the command that defined
+ * them may still be running, and the rest of its parse is kept with them).
+ */
+
+static unsigned long long buckets = 0;
+static hashTable *functions = NULL;
+
+void functionDefine(ShellFunction *func) {
+	if (functions == NULL) {
+		buckets = 16;
+		functions = createTable(buckets);
+	}
+	TableEntry *entry;
+	functions = tableAdd(functions, &buckets, func->name, &entry);
+
+	arenaRetain(func->arena);
+	if (entry->data != NULL)
+		arenaRelease(((ShellFunction*)entry->data)->arena);
+	entry->data = func;
+}
+
+ShellFunction *functionGet(char *name) {
+	if (functions == NULL)
+		return NULL;
+	TableEntry *entry = tableSearch(functions, buckets, name);
+	return entry == NULL ? NULL : entry->data;
+}
+
+// Returns 1 if there was no such function
+int functionUnset(char *name) {
+	ShellFunction *func = functionGet(name);
+	if (func == NULL)
+		return 1;
+	functions = tableRemove(functions, &buckets, name);
+	arenaRelease(func->arena);
+	return 0;
+}
+
+void functionFreeAll() {
+	if (functions == NULL)
+		return;
+	for (unsigned long long bucket = 0; bucket < buckets; ++bucket) {
+		for (Node *node = functions[bucket].next; node != NULL; node = node->next)
+			arenaRelease(((ShellFunction*)node->entry.data)->arena);
+		free_nodes(functions[bucket].next);
+	}
+	free(functions);
+	functions = NULL;
+}
@@ -0,0 +1,510 @@
+#define _DEFAULT_SOURCE // d_type, syscall, fstatat
+#include "command.h"
+#include "mash.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <locale.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+/*
+ * Path name expansion.
+ * A word is split at its slashes into components, and each component is
+ * compiled into a pattern (literal components are just names). Matching walks
+ * the components one at a time: literal ones are appended to every path found
+ * so far, pattern ones read those directories (with getdents64 on Linux, a
+ * large buffer at a time) and only stat entries whose type isn't known.
+ *
+ * ** walks whole trees, which is done by a pool of threads (GLOBTHREADS of
+ * them) taking directories from each other's queues. Patterns are compiled
+ * before the threads start (the compiler isn't thread safe), the threads only
+ * match against them.
+ */
+
+#define GLOB_BUFFER_SIZE 262144 // Directory entries read per system call
+#define GLOB_MAX_THREADS 8      // Default thread count is the number of processors, up to this
+#define GLOB_THREAD_LIMIT 64    // Most GLOBTHREADS can ask for
+
+// Directory being read
+typedef struct _glob_dir GlobDir;
+struct _glob_dir {
+	int fd;
+#ifdef __linux__
+	char *buffer;
+	size_t pos, len; // Position in, and bytes in, buffer
+#else
+	DIR *dir;
+#endif
+};
+
+#ifdef __linux__
+// Records getdents64 fills the buffer with
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+#endif
+
+// Entry buffer of the shell's own thread
+static char *entry_buffer = NULL;
+
+// Open a directory, buffer (GLOB_BUFFER_SIZE bytes) is where its entries are read to
+static _Bool dirOpen(GlobDir *dir, const char *path, char *buffer) {
+#ifdef __linux__
+	dir->buffer = buffer;
+	dir->pos = dir->len = 0;
+	return (dir->fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1;
+#else
+	if ((dir->dir = opendir(path)) == NULL)
+		return 0;
+	dir->fd = dirfd(dir->dir);
+	return 1;
+#endif
+}
+
+// Name of the next entry (NULL at the end), and its DT_ type (DT_UNKNOWN if the file system doesn't say)
+static char *dirNext(GlobDir *dir, unsigned char *type) {
+#ifdef __linux__
+	if (dir->pos >= dir->len) {
+		long bytes = syscall(SYS_getdents64, dir->fd, dir->buffer, GLOB_BUFFER_SIZE);
+		if (bytes <= 0)
+			return NULL;
+		dir->len = bytes;
+		dir->pos = 0;
+	}
+	struct linux_dirent64 *entry = (struct linux_dirent64*)&dir->buffer[dir->pos];
+	dir->pos += entry->d_reclen;
+	*type = entry->d_type;
+	return entry->d_name;
+#else
+	struct dirent *entry = readdir(dir->dir);
+	if (entry == NULL)
+		return NULL;
+#ifdef _DIRENT_HAVE_D_TYPE
+	*type = entry->d_type;
+#else
+	*type = DT_UNKNOWN;
+#endif
+	return entry->d_name;
+#endif
+}
+
+static void dirClose(GlobDir *dir) {
+#ifdef __linux__
+	close(dir->fd);
+#else
+	closedir(dir->dir);
+#endif
+}
+
+/*
+ * Whether an entry is a directory, only asking the file system if d_type didn't say.
+ * Symbolic links are followed if follow is set, otherwise they are never directories.
+ */
+static _Bool isDirectory(GlobDir *dir, char *name, unsigned char type, _Bool follow) {
+	if (type == DT_DIR)
+		return 1;
+	if (type != DT_UNKNOWN && (type != DT_LNK || !follow))
+		return 0;
+	struct stat st;
+	return fstatat(dir->fd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Hidden files only match a pattern that starts with a dot, and . and .. never do
+static _Bool isHidden(char *name, _Bool hidden_ok) {
+	return name[0] == '.' && (!hidden_ok || name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/*
+ * Compile a path name pattern of the given length, allocated from arena.
+ * Returns NULL if no component has any pattern characters (so the word is never expanded).
+ */
+Glob *globCompile(Arena *arena, char *str, size_t len) {
+	// Components, ignoring repeated slashes
+	size_t count = 0;
+	for (size_t i = 0; i < len; ++i)
+		count += str[i] != '/' && (i == 0 || str[i - 1] == '/');
+	if (count == 0)
+		return NULL;
+
+	Glob *glob = arenaAlloc(arena, sizeof (Glob));
+	*glob = (Glob){
+		.word = { .type = ARG_NULL },
+		.count = 0,
+		.parts = arenaAlloc(arena, count * sizeof (GlobPart)),
+		.absolute = str[0] == '/',
+		.directory = str[len - 1] == '/'
+	};
+	_Bool special = 0;
+	for (size_t i = 0; i < len;) {
+		while (str[i] == '/')
+			++i;
+		size_t start = i;
+		while (i < len && str[i] != '/')
+			++i;
+		if (start == i)
+			break;
+		GlobPart *gp = &glob->parts[glob->count];
+		// Any number of directories, **/** is the same as **
+		if (i - start == 2 && !strncmp(&str[start], "**", 2)) {
+			if (glob->count == 0 || !glob->parts[glob->count - 1].recursive) {
+				*gp = (GlobPart){ .name = NULL, .length = 0, .pattern = NULL, .hidden = 0, .recursive = 1 };
+				++glob->count;
+			}
+			special = 1;
+			continue;
+		}
+		Pattern *pat = patternCompile(arena, &str[start], i - start);
+		_Bool literal = pat->count == 1 && pat->nodes[0].type == PAT_LITERAL;
+		*gp = (GlobPart){
+			.name = literal ? arenaStrndup(arena, pat->nodes[0].literal, pat->nodes[0].length) : NULL,
+			.length = literal ? pat->nodes[0].length : 0,
+			.pattern = literal ? NULL : pat,
+			.hidden = pat->nodes[0].type == PAT_LITERAL && pat->nodes[0].literal[0] == '.',
+			.recursive = 0
+		};
+		++glob->count;
+		special |= !literal;
+	}
+	return special ? glob : NULL;
+}
+
+static int compareBytes(const void *a, const void *b) {
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+static int compareCollated(const void *a, const void *b) {
+	return strcoll(*(char**)a, *(char**)b);
+}
+
+// Join a path so far (empty, or ending in /) and a name, with a slash after it if more components follow
+static char *pathJoin(Arena *arena, char *path, size_t path_len, char *name, size_t len, _Bool slash) {
+	char *joined = arenaAlloc(arena, path_len + len + 2);
+	memcpy(joined, path, path_len);
+	memcpy(&joined[path_len], name, len);
+	if (slash)
+		joined[path_len + len++] = '/';
+	joined[path_len + len] = '\0';
+	return joined;
+}
+
+/*
+ * Recursive walks (**)
+ */
+
+// What a walk collects from every directory under its roots
+enum _walk_mode {
+	WALK_DIRS,  // Each directory (** with more components after the next one)
+	WALK_ALL,   // Everything (** is the last component)
+	WALK_MATCH  // What matches the last component (**/name)
+};
+
+typedef struct _glob_walk GlobWalk;
+
+// Thread of a walk, with the queue of directories it has yet to read (others take from its front when they run out)
+typedef struct _glob_worker GlobWorker;
+struct _glob_worker {
+	GlobWalk *walk;
+	size_t index;
+	pthread_t thread;
+	pthread_mutex_t lock; // Protects the queue
+	char **queue;         // Paths ending with /, the worker takes from the back
+	size_t head, tail, size;
+	Arena *arena;         // Paths found, merged into the result when the walk is done
+	WordList found;
+	char *buffer;         // Directory entries
+};
+
+struct _glob_walk {
+	enum _walk_mode mode;
+	GlobPart *match;      // WALK_MATCH
+	_Bool directory;      // Only directories are collected (the word ends with /)
+	size_t count;
+	GlobWorker *workers;
+	pthread_mutex_t lock; // Protects the counters and goes with more
+	pthread_cond_t more;
+	size_t queued;        // Directories in queues
+	size_t pending;       // Directories in queues or being read, the walk is over when this is 0
+};
+
+static void walkPush(GlobWorker *w, char **dirs, size_t count) {
+	if (count == 0)
+		return;
+	// Counted before they can be taken, so the counters never go below what is really there
+	GlobWalk *walk = w->walk;
+	pthread_mutex_lock(&walk->lock);
+	walk->queued += count;
+	walk->pending += count;
+	pthread_mutex_unlock(&walk->lock);
+
+	pthread_mutex_lock(&w->lock);
+	if (w->tail + count > w->size) {
+		// Move what is left to the front before growing
+		if (w->head > 0) {
+			memmove(w->queue, &w->queue[w->head], (w->tail - w->head) * sizeof (char*));
+			w->tail -= w->head;
+			w->head = 0;
+		}
+		if (w->tail + count > w->size) {
+			w->size = (w->tail + count) * 2;
+			w->queue = realloc(w->queue, w->size * sizeof (char*));
+		}
+	}
+	memcpy(&w->queue[w->tail], dirs, count * sizeof (char*));
+	w->tail += count;
+	pthread_mutex_unlock(&w->lock);
+
+	pthread_mutex_lock(&walk->lock);
+	pthread_cond_broadcast(&walk->more);
+	pthread_mutex_unlock(&walk->lock);
+}
+
+// Take a directory from the back of the worker's own queue, or the front of another's
+static char *walkTake(GlobWorker *w) {
+	GlobWalk *walk = w->walk;
+	char *dir = NULL;
+	for (size_t i = 0; dir == NULL && i < walk->count; ++i) {
+		GlobWorker *victim = &walk->workers[(w->index + i) % walk->count];
+		pthread_mutex_lock(&victim->lock);
+		if (victim->head < victim->tail)
+			dir = victim == w ? victim->queue[--victim->tail] : victim->queue[victim->head++];
+		pthread_mutex_unlock(&victim->lock);
+	}
+	if (dir != NULL) {
+		pthread_mutex_lock(&walk->lock);
+		--walk->queued;
+		pthread_mutex_unlock(&walk->lock);
+	}
+	return dir;
+}
+
+// Read one directory, collecting what the walk wants from it and queueing its subdirectories
+static void walkDirectory(GlobWorker *w, char *path) {
+	GlobWalk *walk = w->walk;
+	size_t path_len = strlen(path);
+	GlobDir dir;
+	if (!dirOpen(&dir, path_len == 0 ? "." : path, w->buffer))
+		return;
+
+	char *subdirs[64];
+	size_t subdir_count = 0;
+	unsigned char type;
+	for (char *name; (name = dirNext(&dir, &type)) != NULL;) {
+		if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+			continue;
+		size_t len = strlen(name);
+		// Hidden directories aren't descended into, and symbolic links aren't followed
+		_Bool descend = name[0] != '.' && isDirectory(&dir, name, type, 0);
+		char *subdir = descend ? pathJoin(w->arena, path, path_len, name, len, 1) : NULL;
+
+		switch (walk->mode) {
+			case WALK_DIRS:
+				if (descend)
+					wordAppend(w->arena, &w->found, subdir);
+				break;
+			case WALK_ALL:
+				// Links to directories are listed by **/, they just aren't walked
+				if (name[0] == '.' || (walk->directory && !descend && !isDirectory(&dir, name, type, 1)))
+					break;
+				wordAppend(w->arena, &w->found, descend && walk->directory ? subdir : pathJoin(w->arena, path, path_len, name, len, walk->directory));
+				break;
+			case WALK_MATCH: {
+				GlobPart *gp = walk->match;
+				if (isHidden(name, gp->hidden))
+					break;
+				if (gp->name != NULL ? len != gp->length || memcmp(name, gp->name, len) : !patternMatch(gp->pattern, name, len))
+					break;
+				if (walk->directory && !isDirectory(&dir, name, type, 1))
+					break;
+				wordAppend(w->arena, &w->found, pathJoin(w->arena, path, path_len, name, len, walk->directory));
+				break;
+			}
+		}
+
+		if (descend) {
+			subdirs[subdir_count++] = subdir;
+			if (subdir_count == sizeof (subdirs) / sizeof (*subdirs)) {
+				walkPush(w, subdirs, subdir_count);
+				subdir_count = 0;
+			}
+		}
+	}
+	dirClose(&dir);
+	walkPush(w, subdirs, subdir_count);
+}
+
+static void *walkThread(void *ptr) {
+	GlobWorker *w = ptr;
+	GlobWalk *walk = w->walk;
+	for (;;) {
+		char *dir = walkTake(w);
+		if (dir != NULL) {
+			walkDirectory(w, dir);
+			pthread_mutex_lock(&walk->lock);
+			if (--walk->pending == 0)
+				pthread_cond_broadcast(&walk->more);
+			pthread_mutex_unlock(&walk->lock);
+			continue;
+		}
+		// Wait until someone queues another directory, or the last one is done
+		pthread_mutex_lock(&walk->lock);
+		while (walk->queued == 0 && walk->pending > 0)
+			pthread_cond_wait(&walk->more, &walk->lock);
+		_Bool done = walk->pending == 0;
+		pthread_mutex_unlock(&walk->lock);
+		if (done)
+			return NULL;
+	}
+}
+
+// How many threads a walk uses, GLOBTHREADS or the number of processors
+static size_t walkThreads(Variables *vars) {
+	char *value = getvar(vars, "GLOBTHREADS");
+	long threads = value != NULL && value[0] != '\0' ? strtol(value, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		return 1;
+	if (threads > (value == NULL ? GLOB_MAX_THREADS : GLOB_THREAD_LIMIT))
+		return value == NULL ? GLOB_MAX_THREADS : GLOB_THREAD_LIMIT;
+	return threads;
+}
+
+// Walk the trees under roots (paths ending with /, or empty) with a pool of threads, appending what is found to out
+static void globWalk(enum _walk_mode mode, GlobPart *match, _Bool directory, WordList *roots, Arena *arena, WordList *out, Variables *vars) {
+	GlobWalk walk = {
+		.mode = mode,
+		.match = match,
+		.directory = directory,
+		.count = walkThreads(vars),
+		.queued = 0,
+		.pending = 0
+	};
+	pthread_mutex_init(&walk.lock, NULL);
+	pthread_cond_init(&walk.more, NULL);
+	GlobWorker workers[walk.count];
+	walk.workers = workers;
+	for (size_t i = 0; i < walk.count; ++i) {
+		workers[i] = (GlobWorker){
+			.walk = &walk,
+			.index = i,
+			.queue = NULL,
+			.head = 0, .tail = 0, .size = 0,
+			.arena = arenaInit(),
+			.found = { .words = NULL, .count = 0, .size = 0 },
+			.buffer = malloc(GLOB_BUFFER_SIZE)
+		};
+		pthread_mutex_init(&workers[i].lock, NULL);
+	}
+	walkPush(&workers[0], roots->words, roots->count);
+
+	// This thread is the first worker (if a thread can't be started, the others do its share)
+	size_t started = 1;
+	while (started < walk.count && pthread_create(&workers[started].thread, NULL, walkThread, &workers[started]) == 0)
+		++started;
+	walkThread(&workers[0]);
+	for (size_t i = 1; i < started; ++i)
+		pthread_join(workers[i].thread, NULL);
+
+	for (size_t i = 0; i < walk.count; ++i) {
+		for (size_t n = 0; n < workers[i].found.count; ++n)
+			wordAppend(arena, out, arenaStrndup(arena, workers[i].found.words[n], strlen(workers[i].found.words[n])));
+		arenaRelease(workers[i].arena);
+		free(workers[i].queue);
+		free(workers[i].buffer);
+		pthread_mutex_destroy(&workers[i].lock);
+	}
+	pthread_cond_destroy(&walk.more);
+	pthread_mutex_destroy(&walk.lock);
+}
+
+/*
+ * Append the path names glob matches to out, sorted (strings are allocated from arena).
+ * Returns how many there were.
+ */
+size_t globExpand(Glob *glob, Arena *arena, WordList *out, Variables *vars) {
+	if (entry_buffer == NULL)
+		entry_buffer = malloc(GLOB_BUFFER_SIZE);
+	size_t first = out->count;
+	// Paths matched by the components so far, each ending with a slash (the first is empty, or /)
+	WordList paths = { .words = NULL, .count = 0, .size = 0 };
+	wordAppend(arena, &paths, glob->absolute ? "/" : "");
+
+	for (size_t part = 0; part < glob->count; ++part) {
+		GlobPart *gp = &glob->parts[part];
+		_Bool last = part + 1 == glob->count;
+		_Bool slash = !last || glob->directory;
+		WordList next = { .words = NULL, .count = 0, .size = 0 };
+		WordList *matched = last ? out : &next;
+
+		if (gp->recursive) {
+			// The directories ** starts from are part of what it matches (unless that is the current directory)
+			if (last) {
+				for (size_t p = 0; p < paths.count; ++p)
+					if (paths.words[p][0] != '\0')
+						wordAppend(arena, out, paths.words[p]);
+				globWalk(WALK_ALL, NULL, glob->directory, &paths, arena, out, vars);
+			}
+			// The component after ** is matched while the trees are read
+			else if (part + 2 == glob->count) {
+				globWalk(WALK_MATCH, &glob->parts[part + 1], glob->directory, &paths, arena, out, vars);
+				break;
+			}
+			// Otherwise the rest is matched against every directory (zero directories is the path itself)
+			else {
+				for (size_t p = 0; p < paths.count; ++p)
+					wordAppend(arena, &next, paths.words[p]);
+				globWalk(WALK_DIRS, NULL, 0, &paths, arena, &next, vars);
+			}
+			paths = next;
+			continue;
+		}
+
+		for (size_t p = 0; p < paths.count; ++p) {
+			char *path = paths.words[p];
+			size_t path_len = strlen(path);
+
+			// A literal name only needs to exist, and that only matters for the last one (a missing directory fails to open)
+			if (gp->name != NULL) {
+				char *joined = pathJoin(arena, path, path_len, gp->name, gp->length, slash);
+				struct stat st;
+				if (!last || (glob->directory ? stat(joined, &st) == 0 && S_ISDIR(st.st_mode) : lstat(joined, &st) == 0))
+					wordAppend(arena, matched, joined);
+				continue;
+			}
+
+			GlobDir dir;
+			if (!dirOpen(&dir, path_len == 0 ? "." : path, entry_buffer))
+				continue;
+			unsigned char type;
+			for (char *name; (name = dirNext(&dir, &type)) != NULL;) {
+				if (isHidden(name, gp->hidden))
+					continue;
+				size_t len = strlen(name);
+				if (!patternMatch(gp->pattern, name, len))
+					continue;
+				if (slash && !isDirectory(&dir, name, type, 1))
+					continue;
+				wordAppend(arena, matched, pathJoin(arena, path, path_len, name, len, slash));
+			}
+			dirClose(&dir);
+		}
+		paths = next;
+	}
+
+	// Threads find things in no particular order, sorting makes the result the same every time
+	// (byte order is the collation order of the C locale, which saves strcoll from having to work that out)
+	size_t count = out->count - first;
+	const char *collate = setlocale(LC_COLLATE, NULL);
+	_Bool bytes = collate == NULL || !strcmp(collate, "C") || !strcmp(collate, "POSIX");
+	qsort(&out->words[first], count, sizeof (char*), bytes ? compareBytes : compareCollated);
+	return count;
+}
@@ -0,0 +1,118 @@
+#include "mash.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/*
+ * Shell input buffer.
+ * read takes its input from here rather than stdio, so a loop reading a file
+ * line by line makes one system call per block instead of several per line.
+ * Only files that can seek are read ahead: whatever is left in the buffer is
+ * given back (by moving the offset back) before a child process inherits the
+ * fd. Anything else (pipes, terminals) is read a byte at a time, so nothing a
+ * child should see is ever taken.
+ */
+
+#define INPUT_BLOCK_SIZE 65536
+#define INPUT_FDS 4
+
+typedef struct _input_buffer InputBuffer;
+struct _input_buffer {
+	int fd;             // -1 if unused
+	_Bool seekable;     // Checked when the fd starts using the buffer
+	size_t start, end;  // Unread bytes
+	char *data;         // Allocated on first use, and kept
+};
+
+static InputBuffer buffers[INPUT_FDS] = {
+	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+};
+
+// Give back what is buffered, so the fd's offset is where the shell has read up to
+static void syncBuffer(InputBuffer *buf) {
+	if (buf->end > buf->start)
+		lseek(buf->fd, -(off_t)(buf->end - buf->start), SEEK_CUR);
+	buf->start = buf->end = 0;
+}
+
+static InputBuffer *findBuffer(int fd) {
+	for (size_t i = 0; i < INPUT_FDS; ++i)
+		if (buffers[i].fd == fd)
+			return &buffers[i];
+	InputBuffer *buf = NULL;
+	for (size_t i = 0; buf == NULL && i < INPUT_FDS; ++i)
+		if (buffers[i].start == buffers[i].end)
+			buf = &buffers[i];
+	// Every buffer is holding input for another fd
+	if (buf == NULL) {
+		buf = &buffers[0];
+		syncBuffer(buf);
+	}
+	buf->fd = fd;
+	buf->seekable = lseek(fd, 0, SEEK_CUR) != -1;
+	buf->start = buf->end = 0;
+	return buf;
+}
+
+/*
+ * Get the unread input of fd, reading more if there is none. *data points at it, and stays valid until the next call.
+ * to_end is set by callers that will consume everything up to the end of the input, so there is nothing to leave for
+ * a child process and pipes can be read a block at a time as well.
+ * Returns how many bytes there are, 0 at the end of the input, or -1 on errors.
+ */
+ssize_t inputPeek(int fd, char **data, _Bool to_end) {
+	InputBuffer *buf = findBuffer(fd);
+	if (buf->start == buf->end) {
+		if (buf->data == NULL)
+			buf->data = malloc(INPUT_BLOCK_SIZE);
+		ssize_t bytes_read;
+		do
+			bytes_read = read(fd, buf->data, buf->seekable || to_end ? INPUT_BLOCK_SIZE : 1);
+		while (bytes_read == -1 && errno == EINTR);
+		if (bytes_read < 1)
+			return bytes_read;
+		buf->start = 0;
+		buf->end = bytes_read;
+	}
+	*data = &buf->data[buf->start];
+	return buf->end - buf->start;
+}
+
+// Mark len bytes of what inputPeek returned as read
+void inputConsume(int fd, size_t len) {
+	InputBuffer *buf = findBuffer(fd);
+	buf->start += len;
+	if (buf->start == buf->end)
+		buf->start = buf->end = 0;
+}
+
+// Whether fd has input waiting, or gets some within timeout milliseconds (-1 waits forever)
+_Bool inputReady(int fd, int timeout) {
+	InputBuffer *buf = findBuffer(fd);
+	if (buf->start < buf->end)
+		return 1;
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int ret;
+	do
+		ret = poll(&pfd, 1, timeout);
+	while (ret == -1 && errno == EINTR);
+	return ret != 0;
+}
+
+// Give back everything that was read ahead, must be done before a child process can read from the same files
+void inputSync() {
+	for (size_t i = 0; i < INPUT_FDS; ++i)
+		if (buffers[i].fd != -1)
+			syncBuffer(&buffers[i]);
+}
+
+// Forget fd's buffer, before it is closed (its number may be used for something else next)
+void inputDiscard(int fd) {
+	for (size_t i = 0; i < INPUT_FDS; ++i) {
+		if (buffers[i].fd == fd) {
+			buffers[i].fd = -1;
+			buffers[i].start = buffers[i].end = 0;
+		}
+	}
+}
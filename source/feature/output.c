@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 200809L // writev
+#include "mash.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+/*
+ * Shell output buffer.
+ * Builtins write through this instead of making a system call per command.
+ * Each fd gets a list of fixed size blocks (so appending never moves data),
+ * which are all handed to the kernel in one writev when flushed.
+ */
+
+#define OUTPUT_BLOCK_SIZE 8192
+#define OUTPUT_BLOCKS 16
+#define OUTPUT_FDS 4
+
+typedef struct _output_buffer OutputBuffer;
+struct _output_buffer {
+	int fd;                      // -1 if unused
+	size_t count, used;          // Blocks in use, bytes used in the last one
+	char *blocks[OUTPUT_BLOCKS]; // Allocated on first use, and kept
+};
+
+static OutputBuffer buffers[OUTPUT_FDS] = {
+	{ .fd = -1 }, { .fd = -1 }, { .fd = -1 }, { .fd = -1 }
+};
+
+static void flushBuffer(OutputBuffer *buf) {
+	if (buf->count == 0)
+		return;
+
+	struct iovec iov[OUTPUT_BLOCKS];
+	for (size_t i = 0; i < buf->count; ++i)
+		iov[i] = (struct iovec){ .iov_base = buf->blocks[i], .iov_len = OUTPUT_BLOCK_SIZE };
+	iov[buf->count - 1].iov_len = buf->used;
+
+	// Keep going after partial writes, give up on errors (closed pipe, full disk, etc)
+	struct iovec *cur = iov;
+	int count = buf->count;
+	while (count > 0) {
+		ssize_t written = writev(buf->fd, cur, count);
+		if (written == -1) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		while (count > 0 && written >= cur->iov_len) {
+			written -= cur->iov_len;
+			++cur;
+			--count;
+		}
+		if (count > 0) {
+			cur->iov_base = (char*)cur->iov_base + written;
+			cur->iov_len -= written;
+		}
+	}
+	buf->count = buf->used = 0;
+}
+
+// Write everything that is buffered, must be done before anything else can write to the same files
+void outputFlush() {
+	// Anything written with stdio came first
+	fflush(stdout);
+	for (size_t i = 0; i < OUTPUT_FDS; ++i)
+		flushBuffer(&buffers[i]);
+}
+
+void outputWrite(int fd, char *str, size_t len) {
+	OutputBuffer *buf = NULL;
+	for (size_t i = 0; buf == NULL && i < OUTPUT_FDS; ++i)
+		if (buffers[i].fd == fd)
+			buf = &buffers[i];
+	for (size_t i = 0; buf == NULL && i < OUTPUT_FDS; ++i)
+		if (buffers[i].count == 0)
+			buf = &buffers[i];
+	// Every buffer is in use by another fd
+	if (buf == NULL) {
+		outputFlush();
+		buf = &buffers[0];
+	}
+	buf->fd = fd;
+
+	while (len > 0) {
+		if (buf->count == 0 || buf->used == OUTPUT_BLOCK_SIZE) {
+			if (buf->count == OUTPUT_BLOCKS)
+				flushBuffer(buf);
+			if (buf->blocks[buf->count] == NULL)
+				buf->blocks[buf->count] = malloc(OUTPUT_BLOCK_SIZE);
+			++buf->count;
+			buf->used = 0;
+		}
+		size_t space = OUTPUT_BLOCK_SIZE - buf->used, part = len < space ? len : space;
+		memcpy(&buf->blocks[buf->count - 1][buf->used], str, part);
+		buf->used += part;
+		str += part;
+		len -= part;
+	}
+}
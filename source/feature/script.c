@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L // st_mtim
+#include "command.h"
+#include "mash.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Parse cache for sourced files.
+ * A file is parsed once into the command chain of each line, which is replayed
+ * every time it is sourced, for as long as stat says it is the same file.
+ */
+
+typedef struct _cached_script CachedScript;
+struct _cached_script {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	off_t size;
+	Script *script;
+};
+
+static unsigned long long buckets = 0;
+static hashTable *scripts = NULL;
+static size_t hits = 0, misses = 0, entries = 0;
+
+/*
+ * Read everything from fd in as few reads as possible (one, for regular files).
+ * The result has room for a null terminator after len, NULL is returned on errors.
+ */
+char *scriptRead(int fd, size_t *len) {
+	struct stat st;
+	size_t size = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 ? (size_t)st.st_size + 1 : TMP_RW_BUFSIZE;
+	char *text = malloc(size);
+	*len = 0;
+	for (;;) {
+		if (*len + 1 >= size) {
+			size *= 2;
+			text = realloc(text, size);
+		}
+		ssize_t bytes_read = read(fd, &text[*len], size - *len - 1);
+		if (bytes_read == 0)
+			break;
+		if (bytes_read == -1) {
+			if (errno == EINTR)
+				continue;
+			free(text);
+			return NULL;
+		}
+		*len += bytes_read;
+	}
+	text[*len] = '\0';
+	return text;
+}
+
+/*
+ * Parse a whole file.
+ * Returns NULL if any line fails to parse, without reporting it: the caller runs the file
+ * line by line instead, so that the lines before the error run and the error is reported in order.
+ */
+Script *scriptParse(CmdInput *input, AliasMap *aliases, Variables *vars) {
+	Script *script = malloc(sizeof (Script));
+	*script = (Script){ .count = 0, .cmds = NULL, .refs = 1, .arena = arenaInit() };
+
+	// Line buffer, carried from one command to the next (like the main loop does with last_cmd), or the current line of text
+	char *buf = NULL;
+	size_t len = 0, size = 0, allocated = 0;
+	Command *cmd = NULL; // Reused until a line has something to keep
+	int parse_result;
+	for (;;) {
+		if (cmd == NULL)
+			cmd = commandInit(script->arena);
+		*cmd = (Command){ .c_len = len, .c_size = size, .c_buf = buf, .c_type = CMD_EMPTY, .c_arena = script->arena };
+
+		errno = 0;
+		parse_result = commandParse(cmd, input, NULL, aliases, vars, NULL);
+		len = cmd->c_len;
+		size = cmd->c_size;
+		buf = cmd->c_buf;
+		if (parse_result != 0)
+			break;
+		if (cmd->c_type == CMD_EMPTY)
+			continue;
+
+		if (script->count == allocated) {
+			allocated = allocated == 0 ? 16 : allocated * 2;
+			script->cmds = realloc(script->cmds, allocated * sizeof (Command*));
+		}
+		script->cmds[script->count++] = cmd;
+		cmd = NULL;
+	}
+	if (input->file != NULL)
+		free(buf);
+	// Reading can fail too (running out of memory), line by line reports it
+	if (parse_result != -1 || errno == ENOMEM) {
+		scriptRelease(script);
+		return NULL;
+	}
+	return script;
+}
+
+void scriptRelease(Script *script) {
+	if (--script->refs > 0)
+		return;
+	arenaRelease(script->arena);
+	free(script->cmds);
+	free(script);
+}
+
+// alias changes how the lines after it are parsed, so files using it can't be parsed ahead
+static _Bool usesAlias(Command *cmd) {
+	if (cmd == NULL)
+		return 0;
+	if (cmd->c_type == CMD_REGULAR && cmd->c_argc > 0 && cmd->c_argv[0].type == ARG_BASIC_STRING &&
+			(!strcmp(cmd->c_argv[0].str, "alias") || !strcmp(cmd->c_argv[0].str, "unalias")))
+		return 1;
+	return usesAlias(cmd->c_next) || usesAlias(cmd->c_if_true) || usesAlias(cmd->c_if_false) || usesAlias(cmd->c_cmds) ||
+		(cmd->c_function != NULL && usesAlias(cmd->c_function->body));
+}
+
+/*
+ * Get the parsed commands of a file, from the cache if it hasn't changed since it was parsed.
+ * Returns NULL (with errno set) if it can't be read. The caller must release the result.
+ * Files that use alias or expand one, or don't parse, aren't cached: NULL is returned
+ * with by_line set, and they have to be run with scriptExecuteLines instead.
+ */
+Script *scriptLoad(char *path, AliasMap *aliases, Variables *vars, _Bool *by_line) {
+	*by_line = 0;
+	if (scripts == NULL) {
+		buckets = 16;
+		scripts = createTable(buckets);
+	}
+
+	struct stat st;
+	if (stat(path, &st) == -1)
+		return NULL;
+	TableEntry *entry = tableSearch(scripts, buckets, path);
+	if (entry != NULL) {
+		CachedScript *cached = entry->data;
+		if (cached->dev == st.st_dev && cached->ino == st.st_ino && cached->size == st.st_size &&
+				cached->mtime.tv_sec == st.st_mtim.tv_sec && cached->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			++hits;
+			++cached->script->refs;
+			return cached->script;
+		}
+	}
+	++misses;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+	// The file may have changed since stat, what was actually read is what gets cached
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return NULL;
+	}
+	CmdInput input = { .file = NULL, .fd = fd, .text = malloc(SCRIPT_BLOCK_SIZE), .len = 0, .pos = 0, .size = SCRIPT_BLOCK_SIZE };
+	size_t resolved = aliases->resolved;
+	Script *script = scriptParse(&input, aliases, vars);
+	free(input.text);
+	close(fd);
+	// Files with errors aren't cached either, so that the errors are reported every time, in order
+	*by_line = script == NULL || aliases->resolved != resolved;
+	for (size_t i = 0; !*by_line && i < script->count; ++i)
+		*by_line = usesAlias(script->cmds[i]);
+	if (*by_line) {
+		if (script != NULL)
+			scriptRelease(script);
+		return NULL;
+	}
+
+	scripts = tableAdd(scripts, &buckets, path, &entry);
+	if (entry->data == NULL) {
+		entry->data = malloc(sizeof (CachedScript));
+		++entries;
+	}
+	else
+		scriptRelease(((CachedScript*)entry->data)->script);
+	++script->refs;
+	*(CachedScript*)entry->data = (CachedScript){
+		.dev = st.st_dev,
+		.ino = st.st_ino,
+		.mtime = st.st_mtim,
+		.size = st.st_size,
+		.script = script
+	};
+	return script;
+}
+
+void scriptCacheStats(size_t *cache_hits, size_t *cache_misses, size_t *cache_entries) {
+	*cache_hits = hits;
+	*cache_misses = misses;
+	*cache_entries = entries;
+}
+
+void scriptCacheFree() {
+	if (scripts == NULL)
+		return;
+	for (unsigned long long bucket = 0; bucket < buckets; ++bucket) {
+		for (Node *node = scripts[bucket].next; node != NULL; node = node->next) {
+			CachedScript *cached = node->entry.data;
+			scriptRelease(cached->script);
+			free(cached);
+		}
+		free_nodes(scripts[bucket].next);
+	}
+	free(scripts);
+	scripts = NULL;
+}
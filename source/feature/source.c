@@ -63,6 +63,8 @@ Source *sourceClose(Source *source) {
 	if (source->prev != NULL) {
 		Source *prev = source->prev;
 		prev->next = source->next;
+		if (source->next != NULL) // Not the last source (a function that sourced a file)
+			source->next->prev = prev;
 		free(source);
 		return prev;
 	}
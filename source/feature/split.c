@@ -0,0 +1,104 @@
+#include "mash.h"
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/*
+ * Field splitting.
+ * Unquoted expansions are split at the characters in IFS: runs of IFS
+ * whitespace separate fields (and are ignored at the ends), any other IFS
+ * character ends a field on its own. Fields are found where they are in the
+ * expanded text, nothing is copied. With few delimiters (the default IFS has
+ * three), the text is scanned 16 bytes at a time.
+ */
+
+// Default IFS, used when it is unset
+#define IFS_DEFAULT " \t\n"
+
+void ifsInit(Ifs *ifs, char *value) {
+	if (value == NULL)
+		value = IFS_DEFAULT;
+	memset(ifs->class, IFS_NONE, sizeof (ifs->class));
+	ifs->count = 0;
+	for (unsigned char *c = (unsigned char*)value; *c != '\0'; ++c) {
+		if (ifs->class[*c] != IFS_NONE)
+			continue;
+		ifs->class[*c] = *c == ' ' || *c == '\t' || *c == '\n' ? IFS_SPACE : IFS_OTHER;
+		if (ifs->count < IFS_VECTOR_CHARS)
+			ifs->chars[ifs->count] = *c;
+		++ifs->count;
+	}
+}
+
+// Offset of the first delimiter in str (len if there isn't one)
+static size_t ifsScan(Ifs *ifs, const char *str, size_t len) {
+	size_t i = 0;
+#if defined(__SSE2__) && defined(__GNUC__)
+	if (ifs->count <= IFS_VECTOR_CHARS) {
+		__m128i delims[IFS_VECTOR_CHARS];
+		for (size_t c = 0; c < ifs->count; ++c)
+			delims[c] = _mm_set1_epi8(ifs->chars[c]);
+		for (; i + 16 <= len; i += 16) {
+			__m128i block = _mm_loadu_si128((const __m128i*)&str[i]);
+			__m128i hits = _mm_cmpeq_epi8(block, delims[0]);
+			for (size_t c = 1; c < ifs->count; ++c)
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, delims[c]));
+			int mask = _mm_movemask_epi8(hits);
+			if (mask != 0)
+				return i + __builtin_ctz(mask);
+		}
+	}
+#endif
+	for (; i < len; ++i)
+		if (ifs->class[(unsigned char)str[i]] != IFS_NONE)
+			break;
+	return i;
+}
+
+/*
+ * Find the next field of text, starting from *pos (0 for the first), which is moved past it and its delimiter.
+ * Returns 0 when there are no more fields.
+ */
+_Bool ifsField(Ifs *ifs, char *text, size_t len, size_t *pos, size_t *start, size_t *field_len) {
+	size_t i = *pos;
+	if (ifs->count == 0) {
+		// Empty IFS, the whole text is one field
+		if (i > 0 || len == 0)
+			return 0;
+		*start = 0;
+		*field_len = *pos = len;
+		return 1;
+	}
+	if (i == 0)
+		while (i < len && ifs->class[(unsigned char)text[i]] == IFS_SPACE)
+			++i;
+	if (i >= len)
+		return 0;
+
+	*start = i;
+	*field_len = ifsScan(ifs, &text[i], len - i);
+	i += *field_len;
+	// The delimiter is whitespace around at most one other IFS character
+	while (i < len && ifs->class[(unsigned char)text[i]] == IFS_SPACE)
+		++i;
+	if (i < len && ifs->class[(unsigned char)text[i]] == IFS_OTHER)
+		++i;
+	while (i < len && ifs->class[(unsigned char)text[i]] == IFS_SPACE)
+		++i;
+	*pos = i;
+	return 1;
+}
+
+// Whether c is in IFS
+_Bool ifsDelimiter(Ifs *ifs, char c) {
+	return ifs->class[(unsigned char)c] != IFS_NONE;
+}
+
+// Whether text starts with a delimiter that is only whitespace
+_Bool ifsLeadingSpace(Ifs *ifs, char *text, size_t len) {
+	size_t i = 0;
+	while (i < len && ifs->class[(unsigned char)text[i]] == IFS_SPACE)
+		++i;
+	return i > 0 && (i == len || ifs->class[(unsigned char)text[i]] != IFS_OTHER);
+}
@@ -1,43 +1,188 @@
-#define _POSIX_C_SOURCE 200809L // strdup, setenv
+#define _POSIX_C_SOURCE 200809L // strdup, strndup, setenv
+#include "command.h"
+#include "compatibility.h" // For reallocarray
 #include "mash.h"
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+extern char **environ;
+
+#define ARRAY_MAX_GAP 64     // Setting an element further than this past the end of a dense array makes it sparse
+#define ARRAY_SHARED_MAX 256 // Longest value variableArrayLoad copies into an array's shared blocks
+
+// Free the value at position pos of an array, unless it is in the array's shared blocks
+static void elementFree(VarArray *array, size_t pos) {
+	if (array->shared == NULL || !array->shared[pos])
+		free(array->values[pos]);
+	else
+		array->shared[pos] = 0;
+}
+
+// Free the elements of an array variable, leaving it a scalar
+static void elementsFree(Variable *var) {
+	if (var->array != NULL) {
+		for (size_t i = 0; i < var->array->count; ++i)
+			elementFree(var->array, i);
+		free(var->array->values);
+		free(var->array->indexes);
+		free(var->array->shared);
+		if (var->array->arena != NULL)
+			arenaRelease(var->array->arena);
+		free(var->array);
+		var->array = NULL;
+	}
+	if (var->assoc != NULL) {
+		for (unsigned long long bucket = 0; bucket < var->assoc->buckets; ++bucket) {
+			for (Node *node = var->assoc->map[bucket].next; node != NULL; node = node->next)
+				free(node->entry.data);
+			free_nodes(var->assoc->map[bucket].next);
+		}
+		free(var->assoc->map);
+		free(var->assoc);
+		var->assoc = NULL;
+	}
+}
+
 Variables *variableInit() {
 	Variables *vars = malloc(sizeof (Variables));
 	vars->buckets = 16;
 	vars->map = createTable(vars->buckets);
+	vars->depth = vars->scope_count = 0;
+	vars->scopes = NULL;
+
+	// Import the environment, so that lookups never need to go through getenv
+	for (char **env = environ; *env != NULL; ++env) {
+		char *equal_addr = strchr(*env, '=');
+		if (equal_addr == NULL)
+			continue;
+		char *name = strndup(*env, equal_addr - *env);
+		variableSet(vars, name, &equal_addr[1]);
+		variableIntern(vars, name)->exported = 1;
+		free(name);
+	}
 	return vars;
 }
 
 void variableFree(Variables *vars) {
 	for (unsigned long long bucket = 0; bucket < vars->buckets; ++bucket) {
-		for (Node *node = vars->map[bucket].next; node != NULL; node = node->next)
-			free(node->entry.data);
+		for (Node *node = vars->map[bucket].next; node != NULL; node = node->next) {
+			Variable *var = node->entry.data;
+			free(var->value);
+			elementsFree(var);
+			free(var);
+		}
 		free_nodes(vars->map[bucket].next);
 	}
 	free(vars->map);
+	for (size_t i = 0; i < vars->scope_count; ++i) {
+		for (size_t s = 0; s < vars->scopes[i].count; ++s) {
+			free(vars->scopes[i].saved[s].old.value);
+			elementsFree(&vars->scopes[i].saved[s].old);
+		}
+		free(vars->scopes[i].saved);
+	}
+	free(vars->scopes);
 	free(vars);
 }
 
-void variableSet(Variables *vars, char *name, char *value) {
+/*
+ * Get the slot for a variable, creating an unset one if needed.
+ * Slots are never removed from the table (unset only clears the value), so
+ * the returned pointer stays valid for as long as vars exists.
+ */
+Variable *variableIntern(Variables *vars, char *name) {
 	TableEntry *entry;
 	vars->map = tableAdd(vars->map, &vars->buckets, name, &entry);
 
+	if (entry->data == NULL) {
+		Variable *var = malloc(sizeof (Variable));
+		*var = (Variable){ .name = entry->key, .value = NULL, .array = NULL, .assoc = NULL, .number = 0, .exported = 0, .integer = 0, .numeric = 0, .formatted = 0 };
+		entry->data = var;
+	}
+	return entry->data;
+}
+
+void variableSet(Variables *vars, char *name, char *value) {
+	Variable *var = variableIntern(vars, name);
+
 	char *const new_value = strdup(value);
 
-	// Variable already existed, so we must free some data
-	if (entry->data != NULL)
-		free(entry->data);
+	// Variable already had a value, so we must free it
+	if (var->value != NULL)
+		free(var->value);
 
-	// Populate table entry
-	entry->data = new_value;
+	var->value = new_value;
+	var->numeric = var->formatted = 0;
 }
 
 char *variableGet(Variables *vars, char *name) {
 	TableEntry *entry = tableSearch(vars->map, vars->buckets, name);
-	return entry == NULL ? NULL : entry->data;
+	return entry == NULL ? NULL : variableValue(entry->data);
+}
+
+/*
+ * Get the string value of a variable.
+ * Numeric values are only formatted when something actually needs the text.
+ */
+char *variableValue(Variable *var) {
+	if (var->array != NULL || var->assoc != NULL) {
+		_Bool bad;
+		return var->array != NULL ? variableElement(var, 0, &bad) : variableKey(var, "0");
+	}
+	if (var->numeric && !var->formatted) {
+		if (var->value == NULL) // Large enough for any long long
+			var->value = malloc(21);
+		sprintf(var->value, "%lld", var->number);
+		var->formatted = 1;
+	}
+	return var->value;
+}
+
+/*
+ * Get a string as an integer, like arithmetic does with the values of variables.
+ * Anything but a plain decimal number is evaluated as an expression (so 0x10, " 5 " and 3+4 work),
+ * values that aren't valid expressions are 0.
+ */
+long long numberValue(Variables *vars, char *value) {
+	static unsigned depth = 0; // Variables whose value names another variable are evaluated recursively
+	char *end, *digits = value + (*value == '-' || *value == '+');
+	long long number = strtoll(value, &end, 10);
+	if (*end == '\0' && (digits[0] != '0' || digits[1] == '\0')) // A leading 0 is octal
+		return number;
+	if (depth == NUMBER_MAX_DEPTH) {
+		fprintf(stderr, "mash: %s: expression recursion level exceeded\n", value);
+		return 0;
+	}
+	++depth;
+	if (evaluateMathString(&number, value, vars) == -1)
+		number = 0;
+	--depth;
+	return number;
+}
+
+// Get the value of a variable as an integer (0 if unset or not a number).
+long long variableNumber(Variables *vars, Variable *var) {
+	if (var->numeric)
+		return var->number;
+	char *value = variableValue(var);
+	return value == NULL ? 0 : numberValue(vars, value);
+}
+
+// Set a variable to an integer, without formatting it (unless exported).
+int variableSetNumber(Variable *var, long long number) {
+	if (!var->numeric) {
+		free(var->value);
+		var->value = NULL;
+		var->numeric = 1;
+	}
+	var->number = number;
+	var->formatted = 0;
+
+	if (var->exported)
+		return setenv(var->name, variableValue(var), 1);
+	return 0;
 }
 
 void variableUnset(Variables *vars, char *name) {
@@ -45,54 +190,79 @@ void variableUnset(Variables *vars, char *name) {
 	if (entry == NULL)
 		return;
 
-	// Free string, and remove from table
-	free(entry->data);
-	vars->map = tableRemove(vars->map, &vars->buckets, name);
+	// Free string, but keep the slot since parsed commands may point to it
+	Variable *var = entry->data;
+	free(var->value);
+	var->value = NULL;
+	elementsFree(var);
+	var->numeric = var->formatted = 0;
 }
 
 int setvar(Variables *vars, char *name, char *value, _Bool env) {
-	// User is setting local variable, but this variable is already in the environment
-	if (!env && getenv(name) != NULL)
-		env = 1;
-
-	// Environment variable
-	if (env) {
-		// User is exporting a local variable into the environment
-		if (value == NULL) {
-			char *local = variableGet(vars, name); // If this returns NULL the local var isn't actually set, so we'll use an empty string
-			int ret = setenv(name, local == NULL ? "" : local, 1);
-			int err = errno;
-			if (local != NULL)
-				variableUnset(vars, name);
-			errno = err;
-			return ret;
+	Variable *var = variableIntern(vars, name);
+
+	// User is exporting a local variable into the environment
+	if (env && value == NULL) {
+		char *current = variableValue(var);
+		if (current == NULL) // Local var isn't actually set, so we'll use an empty string
+			current = "";
+		var->exported = 1;
+		return setenv(name, current, 1);
+	}
+	if (env)
+		var->exported = 1;
+	return variableAssign(vars, var, value);
+}
+
+// Assign a string to a variable (integer variables evaluate it, arrays set their first element)
+int variableAssign(Variables *vars, Variable *var, char *value) {
+	if (var->array != NULL) {
+		variableArraySet(var, 0, value, strlen(value));
+		return 0;
+	}
+	if (var->assoc != NULL) {
+		variableKeySet(var, "0", value, strlen(value));
+		return 0;
+	}
+	if (var->integer) {
+		long long number;
+		if (evaluateMathString(&number, value, vars) == -1) {
+			errno = EINVAL;
+			return -1;
 		}
-		// User is setting an environment variable
-		if (variableGet(vars, name) != NULL) // Remove local variable if it is set
-			variableUnset(vars, name);
-		return setenv(name, value, 1);
+		return variableSetNumber(var, number);
 	}
 
-	// Shell variable
-	variableSet(vars, name, value);
+	char *const new_value = strdup(value);
+	free(var->value);
+	var->value = new_value;
+	var->numeric = var->formatted = 0;
+
+	// Keep the real environment in sync, child processes inherit it
+	if (var->exported)
+		return setenv(var->name, value, 1);
 	return 0;
 }
 
 char *getvar(Variables *vars, char *name) {
-	char *var = getenv(name);
-	if (var != NULL)
-		return var;
-
-	var = variableGet(vars, name);
-	return var;
+	return variableGet(vars, name);
 }
 
 int unsetvar(Variables *vars, char *name) {
-	if (getenv(name) == NULL) {
-		variableUnset(vars, name);
+	TableEntry *entry = tableSearch(vars->map, vars->buckets, name);
+	if (entry == NULL)
 		return 0;
+
+	Variable *var = entry->data;
+	free(var->value);
+	var->value = NULL;
+	elementsFree(var);
+	var->numeric = var->formatted = 0;
+	if (var->exported) {
+		var->exported = 0;
+		return unsetenv(name);
 	}
-	return unsetenv(name);
+	return 0;
 }
 
 size_t varNameLength(char *str) {
@@ -101,3 +271,367 @@ size_t varNameLength(char *str) {
 		return strspn(str, "_0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ");
 	return 0;
 }
+
+/*
+ * Function scopes use shallow binding: a local variable keeps its slot, and
+ * its previous state is saved in the scope and put back when the function
+ * returns. Nothing is copied for variables that aren't made local, and the
+ * scope arrays are kept around, so calls normally don't allocate.
+ */
+void variablePushScope(Variables *vars) {
+	if (vars->depth == vars->scope_count) {
+		vars->scopes = realloc(vars->scopes, ++vars->scope_count * sizeof (VarScope));
+		vars->scopes[vars->depth] = (VarScope){ .count = 0, .size = 0, .saved = NULL };
+	}
+	vars->scopes[vars->depth++].count = 0;
+}
+
+void variablePopScope(Variables *vars) {
+	VarScope *scope = &vars->scopes[--vars->depth];
+	// Restore in reverse, in case a variable was somehow saved twice
+	for (size_t i = scope->count; i-- > 0;) {
+		Variable *var = scope->saved[i].var;
+		_Bool was_exported = var->exported;
+		free(var->value);
+		elementsFree(var);
+		*var = scope->saved[i].old;
+		// Keep the real environment in sync
+		if (var->exported && variableValue(var) != NULL)
+			setenv(var->name, var->value, 1);
+		else if (was_exported)
+			unsetenv(var->name);
+	}
+	scope->count = 0;
+}
+
+// Make a variable local to the current function (it starts out unset, and only stays exported)
+void variableLocal(Variables *vars, Variable *var) {
+	if (vars->depth == 0)
+		return;
+	VarScope *scope = &vars->scopes[vars->depth - 1];
+	for (size_t i = 0; i < scope->count; ++i)
+		if (scope->saved[i].var == var)
+			return;
+
+	if (scope->count == scope->size) {
+		scope->size = scope->size == 0 ? 8 : scope->size * 2;
+		scope->saved = realloc(scope->saved, scope->size * sizeof (SavedVar));
+	}
+	scope->saved[scope->count++] = (SavedVar){ .var = var, .old = *var };
+	var->value = NULL;
+	var->array = NULL;
+	var->assoc = NULL;
+	var->integer = var->numeric = var->formatted = 0;
+}
+
+/*
+ * Indexed arrays.
+ * Elements are kept in a vector indexed by their subscript, with NULL for
+ * the ones that aren't set. Setting an element far past the end (a[1000000])
+ * switches the array to sparse storage instead: the elements that are set,
+ * in order of their indexes, which are found with a binary search.
+ * Small values loaded in bulk are packed into blocks of an arena owned by
+ * the array, and freed with it.
+ */
+
+// Make a variable an empty indexed array (dropping whatever value it had)
+void variableArrayClear(Variable *var) {
+	free(var->value);
+	var->value = NULL;
+	var->numeric = var->formatted = 0;
+	elementsFree(var);
+	var->array = malloc(sizeof (VarArray));
+	*var->array = (VarArray){ .count = 0, .size = 0, .values = NULL, .indexes = NULL, .set = 0, .arena = NULL, .shared = NULL };
+}
+
+// Resize the vectors of an array (its values, and which of them are shared)
+static void arrayResize(VarArray *array, size_t size) {
+	array->values = reallocarray(array->values, size, sizeof (char*));
+	if (array->shared != NULL) {
+		array->shared = reallocarray(array->shared, size, sizeof (_Bool));
+		if (size > array->size)
+			memset(&array->shared[array->size], 0, (size - array->size) * sizeof (_Bool));
+	}
+	array->size = size;
+}
+
+// Position of index in a sparse array, or where it would be inserted
+static size_t sparseFind(VarArray *array, size_t index) {
+	size_t low = 0, high = array->count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (array->indexes[mid] < index)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+// Switch a dense array to sparse storage
+static void arraySparse(VarArray *array) {
+	size_t *indexes = malloc((array->set > 0 ? array->set : 1) * sizeof (size_t)), count = 0;
+	for (size_t i = 0; i < array->count; ++i) {
+		if (array->values[i] == NULL)
+			continue;
+		array->values[count] = array->values[i];
+		if (array->shared != NULL)
+			array->shared[count] = array->shared[i];
+		indexes[count++] = i;
+	}
+	array->indexes = indexes;
+	array->count = count;
+	arrayResize(array, array->set > 0 ? array->set : 1);
+}
+
+/*
+ * Position of element index in the vectors of an array, with the slot emptied (its old value freed) for the caller
+ * to fill. The variable becomes an array if it wasn't one.
+ */
+static size_t arraySlot(Variable *var, size_t index) {
+	if (var->array == NULL) {
+		// The old value is element 0
+		char *old = var->assoc == NULL ? variableValue(var) : NULL;
+		var->value = NULL;
+		variableArrayClear(var);
+		if (old != NULL && index != 0)
+			variableArraySet(var, 0, old, strlen(old));
+		free(old);
+	}
+	VarArray *array = var->array;
+	if (array->indexes == NULL && index >= array->count + ARRAY_MAX_GAP && index / 2 >= array->set)
+		arraySparse(array);
+
+	if (array->indexes != NULL) {
+		size_t pos = sparseFind(array, index);
+		if (pos < array->count && array->indexes[pos] == index) {
+			elementFree(array, pos);
+			array->values[pos] = NULL;
+			return pos;
+		}
+		if (array->count == array->size) {
+			arrayResize(array, array->size * 2);
+			array->indexes = reallocarray(array->indexes, array->size, sizeof (size_t));
+		}
+		memmove(&array->values[pos + 1], &array->values[pos], (array->count - pos) * sizeof (char*));
+		memmove(&array->indexes[pos + 1], &array->indexes[pos], (array->count - pos) * sizeof (size_t));
+		if (array->shared != NULL) {
+			memmove(&array->shared[pos + 1], &array->shared[pos], (array->count - pos) * sizeof (_Bool));
+			array->shared[pos] = 0;
+		}
+		array->values[pos] = NULL;
+		array->indexes[pos] = index;
+		++array->count;
+		++array->set;
+		return pos;
+	}
+
+	if (index >= array->size) {
+		size_t size = array->size < 8 ? 8 : array->size;
+		while (size <= index)
+			size *= 2;
+		arrayResize(array, size);
+	}
+	for (; array->count <= index; ++array->count)
+		array->values[array->count] = NULL;
+	if (array->values[index] == NULL)
+		++array->set;
+	elementFree(array, index);
+	array->values[index] = NULL;
+	return index;
+}
+
+// Set element index of an array to len bytes of value, the variable becomes an array if it wasn't one
+void variableArraySet(Variable *var, size_t index, char *value, size_t len) {
+	size_t pos = arraySlot(var, index);
+	var->array->values[pos] = strndup(value, len);
+}
+
+/*
+ * Set an element like variableArraySet, except that a small value is copied into blocks shared by the array rather
+ * than allocated on its own, for loading many elements at once (mapfile).
+ */
+void variableArrayLoad(Variable *var, size_t index, char *value, size_t len) {
+	if (len > ARRAY_SHARED_MAX) {
+		variableArraySet(var, index, value, len);
+		return;
+	}
+	size_t pos = arraySlot(var, index);
+	VarArray *array = var->array;
+	if (array->arena == NULL) {
+		array->arena = arenaInit();
+		array->shared = calloc(array->size, sizeof (_Bool));
+	}
+	array->values[pos] = arenaStrndup(array->arena, value, len);
+	array->shared[pos] = 1;
+}
+
+// Highest index of an array plus one (0 if it is empty), where appending starts
+size_t variableArrayEnd(Variable *var) {
+	if (var->array == NULL)
+		return var->assoc == NULL && variableValue(var) != NULL;
+	VarArray *array = var->array;
+	if (array->indexes != NULL)
+		return array->count == 0 ? 0 : array->indexes[array->count - 1] + 1;
+	return array->count;
+}
+
+/*
+ * Resolve a negative index, which counts back from the end.
+ * Returns 0 if it is still before the start.
+ */
+static _Bool arrayIndex(Variable *var, long long *index) {
+	if (*index < 0)
+		*index += variableArrayEnd(var);
+	return *index >= 0;
+}
+
+/*
+ * Get an element of an array, NULL if it isn't set (a variable that isn't an array is element 0).
+ * Negative indexes count back from the end, *bad is set if that goes past the start.
+ */
+char *variableElement(Variable *var, long long index, _Bool *bad) {
+	*bad = !arrayIndex(var, &index);
+	if (*bad)
+		return NULL;
+	VarArray *array = var->array;
+	if (array == NULL)
+		return index == 0 && var->assoc == NULL ? variableValue(var) : NULL;
+	if (array->indexes != NULL) {
+		size_t pos = sparseFind(array, index);
+		return pos < array->count && array->indexes[pos] == index ? array->values[pos] : NULL;
+	}
+	return index < array->count ? array->values[index] : NULL;
+}
+
+// Unset an element of an array, returns 0 if the index is before the start
+_Bool variableElementUnset(Variable *var, long long index) {
+	if (!arrayIndex(var, &index))
+		return 0;
+	VarArray *array = var->array;
+	if (array == NULL) {
+		if (index == 0 && var->assoc == NULL) {
+			free(var->value);
+			var->value = NULL;
+			var->numeric = var->formatted = 0;
+		}
+		return 1;
+	}
+	if (array->indexes != NULL) {
+		size_t pos = sparseFind(array, index);
+		if (pos == array->count || array->indexes[pos] != index)
+			return 1;
+		elementFree(array, pos);
+		memmove(&array->values[pos], &array->values[pos + 1], (array->count - pos - 1) * sizeof (char*));
+		memmove(&array->indexes[pos], &array->indexes[pos + 1], (array->count - pos - 1) * sizeof (size_t));
+		if (array->shared != NULL) {
+			memmove(&array->shared[pos], &array->shared[pos + 1], (array->count - pos - 1) * sizeof (_Bool));
+			array->shared[array->count - 1] = 0;
+		}
+		--array->count;
+		--array->set;
+		return 1;
+	}
+	if (index >= array->count || array->values[index] == NULL)
+		return 1;
+	elementFree(array, index);
+	array->values[index] = NULL;
+	--array->set;
+	// Keep the end at the last element that is set
+	while (array->count > 0 && array->values[array->count - 1] == NULL)
+		--array->count;
+	return 1;
+}
+
+/*
+ * Associative arrays.
+ * Each one is a hash table of its own, mapping keys to the values.
+ */
+
+// Make a variable an empty associative array (dropping whatever value it had)
+void variableAssocClear(Variable *var) {
+	free(var->value);
+	var->value = NULL;
+	var->numeric = var->formatted = 0;
+	elementsFree(var);
+	var->assoc = malloc(sizeof (VarAssoc));
+	*var->assoc = (VarAssoc){ .buckets = 8, .map = createTable(8), .count = 0 };
+}
+
+// Set the element key of an associative array to len bytes of value
+void variableKeySet(Variable *var, char *key, char *value, size_t len) {
+	if (var->assoc == NULL)
+		variableAssocClear(var);
+	TableEntry *entry;
+	var->assoc->map = tableAdd(var->assoc->map, &var->assoc->buckets, key, &entry);
+	if (entry->data == NULL)
+		++var->assoc->count;
+	free(entry->data);
+	entry->data = strndup(value, len);
+}
+
+// Get the element key of an associative array, NULL if it isn't set
+char *variableKey(Variable *var, char *key) {
+	if (var->assoc == NULL)
+		return NULL;
+	TableEntry *entry = tableSearch(var->assoc->map, var->assoc->buckets, key);
+	return entry == NULL ? NULL : entry->data;
+}
+
+void variableKeyUnset(Variable *var, char *key) {
+	if (var->assoc == NULL)
+		return;
+	TableEntry *entry = tableSearch(var->assoc->map, var->assoc->buckets, key);
+	if (entry == NULL)
+		return;
+	free(entry->data);
+	var->assoc->map = tableRemove(var->assoc->map, &var->assoc->buckets, key);
+	--var->assoc->count;
+}
+
+// Number of elements of an array (a variable that isn't one has 1 if it is set)
+size_t variableCount(Variable *var) {
+	if (var->array != NULL)
+		return var->array->set;
+	if (var->assoc != NULL)
+		return var->assoc->count;
+	return variableValue(var) != NULL;
+}
+
+/*
+ * Get every element of an array, in order, into values (and their indexes or keys, either can be NULL).
+ * Each has to have room for variableCount elements.
+ */
+void variableList(Variable *var, char **values, size_t *indexes, char **keys) {
+	size_t n = 0;
+	if (var->assoc != NULL) {
+		for (unsigned long long bucket = 0; bucket < var->assoc->buckets; ++bucket) {
+			for (Node *node = var->assoc->map[bucket].next; node != NULL; node = node->next, ++n) {
+				if (values != NULL)
+					values[n] = node->entry.data;
+				if (keys != NULL)
+					keys[n] = node->entry.key;
+			}
+		}
+		return;
+	}
+	VarArray *array = var->array;
+	if (array == NULL) {
+		if (variableValue(var) == NULL)
+			return;
+		if (values != NULL)
+			values[0] = variableValue(var);
+		if (indexes != NULL)
+			indexes[0] = 0;
+		return;
+	}
+	for (size_t i = 0; i < array->count; ++i) {
+		if (array->values[i] == NULL)
+			continue;
+		if (values != NULL)
+			values[n] = array->values[i];
+		if (indexes != NULL)
+			indexes[n] = array->indexes != NULL ? array->indexes[i] : i;
+		++n;
+	}
+}
@@ -66,6 +66,7 @@ int removeNode(Node *ll, unsigned long long hash, char *str) {
 			p->next = n->next;
 			free(n->entry.key);
 			free(n);
+			--ll->size;
 			return 1;
 		}
 	}
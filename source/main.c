@@ -4,6 +4,7 @@
 #include "mash.h"
 #include <errno.h>
 #include <limits.h>
+#include <locale.h>
 #include <pwd.h>
 #include <signal.h>
 #include <stdio.h>
@@ -24,6 +25,8 @@ int main(int argc, char *argv[]) {
 
 	// Set stderr to be line buffered
 	setvbuf(stderr, NULL, _IOLBF, 0);
+	// Path names are sorted in the user's collation order
+	setlocale(LC_COLLATE, "");
 
 	// Determine shell type
 	int login = argv[0][0] == '-';
@@ -33,6 +36,7 @@ int main(int argc, char *argv[]) {
 	int interactive = argc == 1 && isatty(fileno(stdin)), subshell = 0;
 	if (interactive)
 		fputs("This mash is interactive.\n", stderr);
+	interactive_shell = interactive;
 
 	// Create shell environment
 	Source *source = sourceInit();
@@ -99,10 +103,22 @@ int main(int argc, char *argv[]) {
 	}
 
 	// Further initialization after successful setup and argument parsing
-	Command *cmd = NULL, *last_cmd = commandInit(); // TODO make a struct for a command - can have an array of command history to call back on!
+	Command *cmd = NULL, *last_cmd = malloc(sizeof (Command)); // TODO make a struct for a command - can have an array of command history to call back on!
+	*last_cmd = (Command){ .c_buf = NULL, .c_type = CMD_EMPTY, .c_arena = arenaInit() };
 	AliasMap *aliases = aliasInit();
 	Variables *vars = variableInit();
 
+	// Scripts are run from their compiled form if possible, which means everything is parsed already
+	Script *compiled = NULL;
+	size_t compiled_line = 0;
+	if (!interactive && !subshell && source->input != stdin) {
+		compiled = scriptCompiled(source->input, aliases, vars);
+		if (compiled != NULL) {
+			fclose(source->input);
+			source->input = NULL;
+		}
+	}
+
 	// If this is a subshell, we need to setup last_cmd in a special way
 	if (subshell) {
 		last_cmd->c_len = strlen(subshell_cmd);
@@ -114,18 +130,29 @@ int main(int argc, char *argv[]) {
 
 	// User prompt (main loop)
 	for (;;) {
-		// cmd == NULL tells us we need to free the current command chain, then read more
+		// Compiled script, the next line is already parsed
+		if (cmd == NULL && compiled != NULL) {
+			if (compiled_line > 0)
+				closeIOFiles(&compiled->cmds[compiled_line - 1]->c_io);
+			if (compiled_line == compiled->count)
+				break;
+			outputFlush();
+			cmd = compiled->cmds[compiled_line++];
+		}
+
+		// cmd == NULL tells us we need to free the current command chain (its whole arena), then read more
 		if (cmd == NULL) {
 			closeIOFiles(&last_cmd->c_io);
-			commandFree(last_cmd);
+			arenaRelease(last_cmd->c_arena);
+			*last_cmd = (Command){ .c_len = last_cmd->c_len, .c_size = last_cmd->c_size, .c_buf = last_cmd->c_buf, .c_type = CMD_EMPTY, .c_arena = arenaInit() };
 			cmd = last_cmd;
 
 			// Present prompt and read command
 			if (interactive && source->input == stdin && (last_cmd->c_size > 0 ? last_cmd->c_buf[0] == '\0' : 1)) {
 				char *PROMPTCMD = getvar(vars, "PROMPT_COMMAND");
 				if (PROMPTCMD != NULL) {
-					Command promptcmd = { .c_len = strlen(PROMPTCMD), .c_buf = strdup(PROMPTCMD) };
-					int parse_result = commandParse(&promptcmd, NULL, NULL, aliases, NULL);
+					Command promptcmd = { .c_len = strlen(PROMPTCMD), .c_buf = strdup(PROMPTCMD), .c_arena = arenaInit() };
+					int parse_result = commandParse(&promptcmd, NULL, NULL, aliases, vars, NULL);
 					_Bool isChild = 0;
 					switch (parse_result) {
 						case -1:
@@ -143,7 +170,7 @@ int main(int argc, char *argv[]) {
 							fprintf(stderr, "%s: PROMPT_COMMAND: parse error near `%c'\n", argv[0], promptcmd.c_buf[0]);
 							break;
 					}
-					commandFree(&promptcmd);
+					arenaRelease(promptcmd.c_arena);
 					free(promptcmd.c_buf);
 					if (isChild)
 						break;
@@ -151,7 +178,9 @@ int main(int argc, char *argv[]) {
 				PROMPT = createPrompt(vars, source, PASSWD, UID);
 			}
 
-			int parse_result = commandParse(cmd, source->input, source->output, aliases, PROMPT);
+			// Command boundary, buffered output has to be written before the next prompt
+			outputFlush();
+			int parse_result = commandParse(cmd, source->input == NULL ? NULL : &(CmdInput){ .file = source->input, .fd = -1 }, source->output, aliases, vars, PROMPT);
 			last_cmd = cmd;
 			if (parse_result == -1) {
 				if (subshell)
@@ -209,6 +238,17 @@ int main(int argc, char *argv[]) {
 			case CSIG_INT:
 				cmd_exit = 130; // SIGINT
 				break;
+			case CSIG_RETURN:
+				// Returning from a sourced file stops reading it
+				if (source->input != stdin && source->input != NULL && source->prev != NULL) {
+					last_cmd->c_buf[0] = '\0';
+					cmd = NULL;
+					source = sourceClose(source);
+					continue;
+				}
+				cmd_exit = 1;
+				fprintf(stderr, "%s: return: can only `return' from a function or sourced script\n", source->argv[0]);
+				break;
 		}
 		if (brk)
 			break;
@@ -226,10 +266,15 @@ int main(int argc, char *argv[]) {
 
 	if (!subshell && last_cmd->c_buf != NULL)
 		free(last_cmd->c_buf);
-	commandFree(last_cmd);
+	arenaRelease(last_cmd->c_arena);
 	free(last_cmd);
 
+	if (compiled != NULL)
+		scriptRelease(compiled);
 	aliasFree(aliases);
+	functionFreeAll();
+	scriptCacheFree();
+	regexCacheFree();
 
 	// Update history file
 	if (interactive && history_pool != NULL) {
@@ -244,6 +289,7 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	outputFlush();
 	variableFree(vars);
 	sourceFree(source); // This will close history_pool
 
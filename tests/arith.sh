@@ -0,0 +1,19 @@
+# (( )) and for (( ; ; )), and where they can start on a line
+for ((i = 0; i < 3; i++)); do if ((i == 2)); then echo two; fi; done
+f() { for ((j = 0; j < 2; j++)); do echo j$j; done; }
+f
+if true; then while ((0)); do echo no; done; echo after; fi
+{ if (( 1 < 2 )); then echo lt; fi; }
+if true; then if ((1)); then echo nested; fi; fi
+if true; then for ((k = 0; k < 2; k++)); do echo k$k; done; fi
+n=0
+while ((n < 2)); do n=$((n + 1)); echo n$n; done
+for ((i = 0; i < 3; i++))
+do
+	((i == 1)); echo "i=$i $?"
+done
+((0)); echo "status $?"
+((5)); echo "status $?"
+x=3; ((x += 4, y = x * 2)); echo $x $y
+i=0; for ((;;)); do i=$((i + 1)); if ((i == 3)); then break; fi; done; echo "i=$i"
+for ((j = 0; ; j++)); do if ((j == 2)); then break; fi; done; echo "j=$j"
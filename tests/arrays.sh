@@ -0,0 +1,61 @@
+# Indexed and associative arrays
+a=(one two "three four" five)
+echo "${#a[@]} ${a[0]} ${a[2]} ${a[-1]}"
+for x in "${a[@]}"; do echo "[$x]"; done
+for x in ${a[@]}; do echo "<$x>"; done
+echo "${!a[@]}"
+a+=(six seven)
+a[10]=ten
+echo "${!a[@]} / ${#a[@]}"
+a[2]+=XX
+echo "${a[2]}"
+b=("${a[@]:1:3}")
+echo "${#b[@]}: ${b[*]}"
+echo "${a[@]#t}"
+echo "${a[@]/e/E}"
+declare -A h
+h[foo]=1
+h[bar]="two words"
+h+=([baz]=3)
+echo "${h[foo]} ${h[bar]} ${#h[@]}"
+for k in "${!h[@]}"; do echo "key $k=${h[$k]}"; done > keys
+sort keys
+i=1
+c=([i+1]=x y [0]=z)
+echo "${!c[@]} ${c[*]}"
+IFS=,
+echo "${c[*]}"
+unset IFS
+e=()
+echo "e ${#e[@]} [${e[@]}]"
+cnt() { echo $#; }; cnt "${e[@]}"; cnt "${a[@]}"; cnt "x${a[@]}y"
+n=(
+  1 2
+  3   # comment
+)
+echo ${n[@]}
+big[1000000]=m
+big[5]=f
+echo "${!big[@]} ${#big[@]}"
+unset 'a[1]'
+echo "${!a[@]}"
+unset a
+echo "[${a[@]}]"
+y=scalar
+declare -A y
+echo "${!y[@]} ${y[0]}"
+s=abc
+declare -a s
+s[3]=d
+echo "${s[@]} ${!s[@]}"
+r=(1 2 3)
+echo $((${r[1]} + 1)) $((r[2] * 2 + r[-1])); ((t = r[0] + r[1])); echo $t
+f() { local m; m=(x y); echo "${m[1]}"; }
+f
+echo "[${m[@]}]"
+{ arr=(1 2 3); echo ${#arr[@]}; }
+if true; then x=5; echo x$x; fi
+if false; then echo no; else x=7; echo x$x; fi
+e=(1 2); export e; echo "${e[@]}"
+declare -A ea; ea[k]=v; export ea; echo "${ea[k]}"
+z=(); touch 'q*'; echo "${z[@]}"'q*' "${u[@]}"q* x"${z[@]}"'*'
@@ -0,0 +1,48 @@
+# case ... esac
+for w in -h --help -v foo.c bar.txt "" "a b" x "*" abc abd q1 Q2 zz; do
+	case $w in
+		-h|--help) echo "$w: help";;
+		-v)
+			echo "$w: verbose"
+			;;
+		*.c|*.h) echo "$w: source" ;;
+		"a b") echo "$w: spaced";;
+		"*") echo "$w: star literal";;
+		ab[cd]) echo "$w: abx";;
+		[a-z][0-9]|[[:upper:]]?) echo "$w: class";;
+		'') echo "empty";;
+		x) ;;
+		*) echo "$w: other";;
+	esac
+	echo "status $?"
+done
+case foo in bar) echo no;; foo) echo one line;; esac
+case foo in f*) echo first;; fo*) echo second;; esac
+case foo in fo*) echo glob first;; foo) echo literal second;; esac
+p="f*"
+case foo in $p) echo dynamic;; *) echo star;; esac
+case foo in "$p") echo quoted dynamic;; *) echo not quoted;; esac
+case foo in
+	(foo) echo paren
+esac
+case zzz in bar) echo no; esac
+echo "nomatch $?"
+case abc in a*) case abc in *c) echo nested;; esac;; esac
+for i in 1 2 3; do
+	case $i in 2) continue;; 3) break;; esac
+	echo loop $i
+done
+case xyz in x*) echo redirected;; esac > out
+cat out
+f() {
+	case $1 in
+		a) return 3;;
+	esac
+	echo after
+}
+f a; echo "ret $?"
+f b
+if true; then case yes in y*) echo in then;; esac; fi
+for w in a b; do case $w in a) echo A;; b) echo B;; esac; done
+i=0
+for w in 5 15 7; do case x$w in x*5) ((i++));; x7) [[ $w == 7 ]];; esac; done; echo "i=$i $?"
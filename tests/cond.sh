@@ -0,0 +1,48 @@
+# test, [ and [[ ]]
+t() { echo "$1 -> $?"; }
+[ ! ]; t '!'
+[ ]; t empty
+[ "" ]; t '""'
+[ -n ]; t '-n'
+[ -z ]; t '-z'
+[ ! -n ]; t '! -n'
+[ ! "" ]; t '! ""'
+[ ! x ]; t '! x'
+[ -z "" ]; t '-z ""'
+[ ! = x ]; t '! = x'
+[ ! = ! ]; t '! = !'
+[ x -a "" ]; t 'x -a ""'
+[ x -o "" ]; t 'x -o ""'
+[ ! -a x ]; t '! -a x'
+[ "(" x ")" ]; t '( x )'
+[ "(" "" ")" ]; t '( "" )'
+[ ! x = y ]; t '! x = y'
+[ ! ! x ]; t '! ! x'
+[ "(" -n x ")" ]; t '( -n x )'
+[ 1 -eq 1 -a 2 -eq 2 ]; t and5
+[ ! "(" x ")" ]; t '! ( x )'
+[ 10 -gt 9 ]; t '10 -gt 9'
+[ abc '<' abd ]; t 'abc < abd'
+mkdir dir; touch file
+test -d dir; t '-d dir'
+test -f dir; t '-f dir'
+[ -e file -a -f file ]; t '-e -a -f'
+[ file -nt nothing ]; t '-nt'
+
+[[ a == a ]]; t '[[ == ]]'
+[[ abc == a* ]]; t '[[ glob ]]'
+[[ abc == "a*" ]]; t '[[ quoted ]]'
+[[ -n x && ( b != c || 1 -eq 2 ) ]]; t '[[ && || ]]'
+[[ 3 -lt 10 ]]; t '[[ -lt ]]'
+[[ 3 < 10 ]]; t '[[ < ]]'
+{ if [[ a == a ]]; then echo eq; fi; }
+while true; do if [[ x ]]; then break; fi; done; echo broke
+i=0
+while [[ $i -lt 2 ]]; do i=$((i + 1)); echo i$i; done
+[[ (a == a) ]]; t '(a == a)'
+[[ ! (a == b) ]]; t '! (a == b)'
+[[ (a == b) || (c == c) ]]; t 'or groups'
+[[ ( -n x && ( 1 -lt 2 ) ) ]]; t nested
+[[ !(a == a) ]]; t '!(a == a)'
+[[ "(" == "(" ]]; t 'quoted ('
+[[ a\( == a\( ]]; t 'escaped ('
@@ -0,0 +1,8 @@
+# ${...} expansion
+v=abcdefghij
+echo ${v:2:3} ${v#abc} ${v%hij} ${v/c*/X} ${#v} ${U:-def} ${U:+alt} ${Z:=zz} $Z
+IFS=' ' ; w="a   b c"; printf '<%s>' $w; echo
+x=$(echo "${U:?in subshell}"; echo inner)
+echo "after $?"
+: ${DIR:?unset}
+echo "not reached"
@@ -0,0 +1,30 @@
+# for name in words
+for i in a b c; do echo "i=$i"; done
+for i in {1..5}; do echo -n "$i "; done; echo
+for i in {5..1..2}; do echo -n "$i "; done; echo
+for i in {08..11}; do echo -n "$i "; done; echo
+for i in {-2..2}; do echo -n "$i "; done; echo
+for c in {a..e}; do echo -n "$c"; done; echo
+for i in {a..e..2}; do echo -n "$i"; done; echo
+for i in {1..10..-3}; do echo -n "$i "; done; echo
+for i in {1..3} x {3..1}
+do
+	echo -n "$i "
+done
+echo
+for i in {9223372036854775805..9223372036854775807}; do echo $i; done
+for i in {-9223372036854775806..-9223372036854775808}; do echo $i; done
+for i in {9223372036854775800..9223372036854775807..5}; do echo $i; done
+touch a.c b.c; mkdir d1 d2
+for f in *.c d*/; do echo "f=$f"; done
+for w in $(echo one   two; echo three); do echo "w=$w"; done
+for w in "$(echo one   two)"; do echo "w=$w"; done
+for i in {1..10}; do if [ $i -eq 3 ]; then continue; fi; if [ $i -gt 5 ]; then break; fi; echo -n "$i "; done; echo "status $?"
+for i in {1..3}; do for j in {1..2}; do echo -n "$i$j "; done; done; echo
+x=9
+for x in; do echo never; done; echo "x=$x"
+f() { for a; do echo "arg $a"; done; for a in; do echo never; done; }
+f p "q r"
+for i in {1..3}; do echo $i; done > out
+cat out
+for w in 1; do arr=(a b); echo ${arr[1]}; done
@@ -0,0 +1,34 @@
+# Functions reading from pipes and redirections
+printf 'a\nb\nc\n' > lines
+f() { cat; }
+seq 2 | f
+f < lines
+f <<< str
+g() { read x; echo "got $x"; read y; echo "then $y"; }
+printf 'x\ny\n' | g
+g < lines
+while read l; do echo "line $l"; g; done < lines
+h() { mapfile -t arr; echo "${#arr[@]} ${arr[*]}"; }
+seq 5 | h
+h < lines
+k() { echo "out $1"; }
+k 1 > out; k 2 >> out; cat out
+T=temp sh -c 'echo child $T'
+m() { echo "in m: $T"; }
+T=temp m
+echo "after: [$T]"
+f() { echo in f $1; g() { echo g defined; }; f() { echo redefined; }; echo still old; }
+f 1
+f 2
+g
+function h2 { if ((1)); then echo h2; fi; }
+h2
+r() { return 3; echo no; }
+r; echo "ret $?"
+echo hi | { read x; echo "group x=$x"; }
+echo hi | { cat; }
+printf 'a\nb\nc\n' | { read l; echo "first $l"; cat; }
+seq 3 | { while read n; do echo "n$n"; done; }
+echo yo | { cat | tr a-z A-Z; }
+echo piped | { cat; } < lines
+{ read y; echo "y=$y"; } < lines
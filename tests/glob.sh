@@ -0,0 +1,20 @@
+# Path name expansion
+mkdir -p d1/x d2/x d3/.hidden d1/deep/er
+touch a.c b.c c.h .dot.c d1/x/y.c d1/k.c d2/x/z.c d3/.hidden/h.c d1/deep/er/z.c d2/k.c
+ln -s d1 lnk
+echo *.c
+echo "*.c"
+echo '*'.c
+echo *.zz
+echo .*
+echo */
+echo d*/*.c
+echo */x/*
+echo [ab].c
+x='*.h'
+echo $x "$x"
+y=d
+echo $y*
+echo ./*.c
+for f in *.c; do echo "f=$f"; done
+echo "a"*.c
@@ -0,0 +1,17 @@
+# ** walked by threads
+mkdir -p d1/x d2/x d3/.hidden d1/deep/er
+touch a.c b.c c.h .dot.c d1/x/y.c d1/k.c d2/x/z.c d3/.hidden/h.c d1/deep/er/z.c d2/k.c
+ln -s d1 lnk
+echo **
+echo **/
+echo **/*.c
+echo **/x/*
+echo d1/**/*.c
+echo **/y.c
+echo **/**/z.c
+echo **/nothing*
+echo d*/**/*.c
+for n in 1 2 8 64; do
+	GLOBTHREADS=$n
+	echo $n **/*.c
+done
@@ -0,0 +1,9 @@
+# declare -i and let
+declare -i k=5
+k+=3
+echo $k
+let "z = 5 ** 3" w=z/5; echo $z $w
+x=0x10; o=010; s=" 5 "; z=3+4; m=-010; w=abc; abc=6
+echo $((x)) $((o)) $((s)) $((z*2)) $((m)) $((w)) $((x + o))
+a=(0x10 " 7 " 2*3); echo $((a[0] + a[1] + a[2]))
+declare -i i; i=z; echo $i
@@ -0,0 +1,21 @@
+# mapfile and readarray
+seq 1 7 > seven
+cb() { echo "cb $1 [$2] n=${#a[@]}"; }
+mapfile -t -c 3 -C cb a < seven
+echo "${a[@]}"
+mapfile -s 2 -n 3 b < seven
+for x in "${b[@]}"; do echo "b=[$x]"; done
+printf "a\nb" > two
+mapfile d < two
+for x in "${d[@]}"; do echo "d=[$x]"; done
+mapfile < seven
+echo ${#MAPFILE[@]} ${MAPFILE[6]}
+mapfile -d , -t f <<< "x,y,z"
+for x in "${f[@]}"; do echo "f=[$x]"; done
+readarray -t g < seven
+echo "${g[@]:2:3}"
+{ mapfile -t -n 2 h; read r; cat; } < seven
+echo "h=${h[@]} r=$r"
+awk 'BEGIN { for (i = 0; i < 20000; i++) printf "line %d %s\n", i, (i % 1000 == 0 ? sprintf("%0400d", i) : "") }' > big
+mapfile -t big < big
+echo ${#big[@]} "${big[19999]}" ${#big[1000]}
@@ -0,0 +1,28 @@
+# $((...)): precedence, overflow and powers
+echo $((7 / 2)) $((-7 / 2)) $((-7 % 3)) $((1 << 62)) $((~0)) $((5 > 3 ? 10 : 20))
+echo $((-9223372036854775807 - 1))
+x=-9223372036854775807; x=$((x - 1)); y=-1
+echo $((x / y)) $((x % y)) $((x / -1)) $((x % -1))
+echo $((2**62)) $((3**5)) $((2**64)) $((7**0)) $((-2**3)) $((0**0))
+echo $((2**3000000000)) $((3**3000000001))
+n=40; echo $((3**n))
+
+# Wrapping around, and shift counts mod 64
+m=9223372036854775807; n=-9223372036854775808
+echo $((9223372036854775807 + 1)) $((m + 1)) $((n - 1)) $((m * 3)) $((-(-9223372036854775807 - 1))) $((-n))
+echo $((1 << 64)) $((1 << 65)) $((-1 << 3)) $((m << 1)) $((1 >> 64)) $((-16 >> 2)) $((8 >> 65))
+k=$m; ((k++)); echo $k; ((k--)); echo $k; ((++k)); echo $k
+declare -i d=$m; d+=1; echo $d
+((m += 1)); echo $m
+s=3; echo $((s << 66)) $((s * -m))
+
+# Expansions in $((...)) are substituted as text
+echo $(( $((1+1)) * 3 )) $(( $(echo 4) + 1 ))
+op=+; echo $((1 $op 2))
+n=1; x1=5; echo $(( x$n )) $(( x$n * 2 ))
+e="1+2"; echo $(( $e * 3 )) "$(( $e * 3 ))"
+i=0; echo $(( ${i} + 1 )) $(( $i ))
+a=(4 5); echo $(( ${a[1]} + ${#a[@]} ))
+z=$(( $((2**3)) + $(( 1 << 2 )) )); echo $z
+echo $(( $(echo 1 +) 2 ))
+for ((k = 0; k < 3; k++)); do echo $(( $k * $k )); done
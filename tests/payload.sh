@@ -0,0 +1,7 @@
+# A script with a payload after exit, which only parses line by line
+echo before
+f() { echo "in f"; }
+f
+exit 3
+;; ) fi done esac 
+}
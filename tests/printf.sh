@@ -0,0 +1,13 @@
+# printf
+for s in '' 'abc' 'a b' 'a,b' '#x' 'x#' '~a' 'a~' 'a=b' "it's" 'a"b' '$x' 'a*?[]' '{}' '!^' 'a%b@c+d-e.f/g:h' "$(printf 'tab\there')" "$(printf 'nl\nx')" "$(printf '\001\033')" 'x\y' ';&|<>()`'; do printf '%q|' "$s"; echo; done
+printf '[%10q] [%-6q]\n' 'a b' x
+printf '%s=%d;' a 1 b 2; echo
+printf '%5.2f|%-4s|%04d|%x|%o|%c\n' 3.14159 ab 42 255 8 xyz
+printf -v out '%s-%s' p q; echo $out
+printf '%b\n' 'a\tb'
+printf '%.*s|\n' -5 abc
+printf '%*s|%-*s|\n' -5 ab 4 cd
+printf '%*.*f|\n' -8 -1 3.14159
+printf '%.*d|\n' 3 7
+printf '%*d|\n' -3 42
+printf '%.*s|\n' 99999999999 abc
@@ -0,0 +1,34 @@
+# read
+printf 'l1 a b\nl2 c d\nl3\\ x y\\\nz\nlast' > r.txt
+while read a b; do
+	echo "[$a][$b]"
+done < r.txt
+echo "last=[$a][$b]"
+while read -r a b; do
+	echo "r[$a][$b]"
+done < r.txt
+while read -r line; do
+	echo "line=$line"
+	/bin/true
+done < r.txt
+IFS=, read a b <<< "1,2,"
+echo "[$a][$b]"
+IFS=, read a b <<< "1,,"
+echo "[$a][$b]"
+read a b <<< "  x  y  z  "
+echo "[$a][$b]"
+read <<< "  spaced  "
+echo "[$REPLY]"
+read -d : a b <<< "p q:r s"
+echo "[$a][$b] $?"
+read -n 3 a <<< "abcdef"
+echo "[$a]"
+read -rn 3 a <<< "a\bcdef"
+echo "[$a]"
+read a < /dev/null
+echo "eof $? [$a]"
+read -t 0 a <<< "x"
+echo "t0 $?"
+seq 1 5 > five
+{ read x; read y; cat; } < five
+echo "x=$x y=$y"
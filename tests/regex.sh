@@ -0,0 +1,11 @@
+# [[ =~ ]] and BASH_REMATCH
+t() { echo "$1 -> $?"; }
+[[ abc123 =~ ([a-z]+)([0-9]+) ]]; t '[[ =~ ]]'
+echo "${BASH_REMATCH[@]}"
+re='(x)(y)?'
+[[ x =~ $re ]]; echo "${BASH_REMATCH[2]}|${BASH_REMATCH[1]}"
+[[ x =~ "(" ]]; t 'quoted ('
+bad='('
+[[ x =~ $bad ]]; t 'bad regex'
+[[ abc =~ (b)(c) ]]; echo "${BASH_REMATCH[2]}"
+[[ (x =~ ^x$) ]]; t 'regex in group'
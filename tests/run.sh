@@ -0,0 +1,58 @@
+#!/bin/sh
+# Run every tests/*.sh with mash and with bash, and compare what they print.
+# Each script runs in a fresh scratch directory, and its exit status is compared too.
+# Only stdout is compared: error messages are worded differently by each shell.
+#
+#   tests/run.sh [mash binary] [test ...]
+
+cd "$(dirname "$0")/.." || exit 1
+MASH=${1:-./mash}
+[ $# -gt 0 ] && shift
+BASH=${BASH_BIN:-bash}
+if [ ! -x "$MASH" ]; then
+	echo "$MASH: not built (run make)" >&2
+	exit 1
+fi
+MASH=$(cd "$(dirname "$MASH")" && pwd)/$(basename "$MASH")
+# A test that hangs fails instead of stopping the run
+TIMEOUT=
+command -v timeout > /dev/null && TIMEOUT="timeout 30"
+
+scratch=$(mktemp -d) || exit 1
+trap 'rm -rf "$scratch"' EXIT
+# Compiled scripts are cached per user, keep them out of the way
+XDG_CACHE_HOME=$scratch/cache
+export XDG_CACHE_HOME
+
+[ $# -eq 0 ] && set -- tests/*.sh
+passed=0 failed=0
+for test; do
+	case $test in */run.sh) continue;; esac
+	name=$(basename "$test" .sh)
+	script=$(pwd)/$test
+	for shell in mash bash; do
+		rm -rf "$scratch/work"
+		mkdir "$scratch/work"
+		if [ $shell = mash ]; then
+			# Twice, the second run comes from the compiled script cache
+			(cd "$scratch/work" && $TIMEOUT "$MASH" "$script" < /dev/null > /dev/null 2>&1)
+			rm -rf "$scratch/work"
+			mkdir "$scratch/work"
+			(cd "$scratch/work" && $TIMEOUT "$MASH" "$script" < /dev/null > "$scratch/$shell.out" 2> "$scratch/$shell.err")
+		else
+			(cd "$scratch/work" && $TIMEOUT "$BASH" -O globstar "$script" < /dev/null > "$scratch/$shell.out" 2> "$scratch/$shell.err")
+		fi
+		echo "exit $?" >> "$scratch/$shell.out"
+	done
+	if cmp -s "$scratch/mash.out" "$scratch/bash.out"; then
+		echo "PASS $name"
+		passed=$((passed + 1))
+	else
+		echo "FAIL $name"
+		diff "$scratch/mash.out" "$scratch/bash.out" | sed 's/^/	/'
+		sed 's/^/	mash stderr: /' "$scratch/mash.err"
+		failed=$((failed + 1))
+	fi
+done
+echo "$passed passed, $failed failed"
+[ $failed -eq 0 ]
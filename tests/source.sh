@@ -0,0 +1,14 @@
+# . and source, replayed from the parse cache unless the file uses aliases
+shopt -s expand_aliases 2> /dev/null
+printf 'echo "lib $1"\nlf() { echo "lf $#"; }\nreturn 2\necho not reached\n' > lib.sh
+. ./lib.sh a; echo "ret $?"
+source ./lib.sh; lf x y
+for i in 1 2 3; do . ./lib.sh $i; done
+printf 'alias hi="echo hello"\nhi\nalias hi="echo bye"\nhi there\nif true; then return 4; fi\necho not reached\n' > al.sh
+. ./al.sh; echo "ret $?"
+. ./al.sh
+printf 'hi\n' > use.sh
+. ./use.sh
+alias hi="echo again"
+. ./use.sh
+. ./nonexistent; echo "missing $?"
@@ -0,0 +1,20 @@
+# $(< file) and $(cat file)
+printf 'one\ntwo words\n\n\n' > f.txt
+x=$(< f.txt)
+echo "[$x]"
+y="$(cat f.txt)"
+echo "[$y]"
+f=f.txt
+echo "[$(< $f)]" "[$(<"$f")]"
+for w in $(< f.txt); do echo "w=$w"; done
+z=$(< nonexistent)
+echo "missing $? [$z]"
+z=$(cat nonexistent)
+echo "cat missing $? [$z]"
+echo "[$(cat f.txt | tr a-z A-Z)]"
+cat() { echo "fn cat $1"; }
+echo "[$(cat f.txt)]"
+unset -f cat
+seq 1 100000 > s
+s=$(< s)
+echo ${#s}